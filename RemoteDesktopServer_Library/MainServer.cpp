@@ -4,11 +4,13 @@
 #include "ServiceInstaller.h"
 #include "ServerService.h"
 #include "Server.h"
+#include "Replay_Sink.h"
 #include "..\RemoteDesktop_Library\NetworkSetup.h"
 #include "..\RemoteDesktop_Library\EventLog.h"
 #include "..\RemoteDesktop_Library\UserInfo.h"
 #include "..\RemoteDesktop_Library\ProcessUtils.h"
 #include "..\RemoteDesktop_Library\Desktop_Background.h"
+#include "..\RemoteDesktop_Library\Session_Recorder.h"
 
 #if _DEBUG
 #include "Console.h"
@@ -41,6 +43,11 @@ void RemoteDesktop::Startup(LPWSTR* argv, int argc, bool reverseconnect_to_gatew
 			if (reverseconnect_to_gateway) _Server->ReverseConnect(DefaultPort(), DefaultGateway(), DefaultProxyGetSessionURL());
 			else _Server->Listen(DefaultPort());
 		}
+		else if (_wcsicmp(L"replay", argv[1] + 1) == 0 && argc > 2)
+		{//-replay file [realtime], nothing in the recording is acted on, see Replay_Sink
+			RemoteDesktop::Replay_Sink sink;
+			sink.Replay(argv[2], argc > 3 && _wcsicmp(L"realtime", argv[3]) == 0);
+		}
 		else if (_wcsicmp(L"delayed_run", argv[1] + 1) == 0)
 		{
 			Sleep(3000);
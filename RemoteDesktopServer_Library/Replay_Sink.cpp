@@ -0,0 +1,89 @@
+#include "stdafx.h"
+#include "Replay_Sink.h"
+#include "..\RemoteDesktop_Library\CommonNetwork.h"
+#include "..\RemoteDesktop_Library\SocketHandler.h"
+#include "..\RemoteDesktop_Library\Clipboard.h"
+#include "..\RemoteDesktop_Library\Session_Recorder.h"
+
+void RemoteDesktop::Replay_Sink::_Reject(Packet_Header* header){
+	DEBUG_MSG("Replay rejected a message of type % with % bytes", header->Packet_Type, header->PayloadLen);
+	_Rejected += 1;
+}
+void RemoteDesktop::Replay_Sink::OnReceive(Packet_Header* header, const char* data, std::shared_ptr<RemoteDesktop::SocketHandler>& sh){
+	auto len = header->PayloadLen;
+	switch (header->Packet_Type){
+	case NetworkMessages::CONNECT_REQUEST:{
+		User_Info_Header h;
+		if (len != (int)sizeof(h)) return _Reject(header);
+		memcpy(&h, data, sizeof(h));
+		break;
+	}
+	case NetworkMessages::KEYEVENT:{
+		KeyEvent_Header h;
+		if (len < (int)sizeof(h)) return _Reject(header);
+		memcpy(&h, data, sizeof(h));
+		break;
+	}
+	case NetworkMessages::MOUSEEVENT:{
+		MouseEvent_Header h;
+		if (len != (int)sizeof(h)) return _Reject(header);
+		memcpy(&h, data, sizeof(h));
+		break;
+	}
+	case NetworkMessages::CAD:
+		DEBUG_MSG("Replay skipped the secure attention sequence");
+		break;
+	case NetworkMessages::FILE:{
+		File_Header h;
+		if (len <= (int)sizeof(h)) return _Reject(header);
+		memcpy(&h, data, sizeof(h));
+		h.RelativePath[MAX_PATH - 1] = 0;
+		if (h.ChunkSize < 0 || h.ChunkSize > len - (int)sizeof(h)) return _Reject(header);
+		DEBUG_MSG("Replay skipped writing % bytes to %", h.ChunkSize, std::string(h.RelativePath));
+		break;
+	}
+	case NetworkMessages::FOLDER:{
+		if (len < 1 || 1 + (unsigned char)*data > len) return _Reject(header);
+		DEBUG_MSG("Replay skipped creating folder %", std::string(data + 1, (unsigned char)*data));
+		break;
+	}
+	case NetworkMessages::CLIPBOARDCHANGED:{
+		Clipboard_Data clip;
+		if (!Clipboard::Deserialize(data, len, clip)) return _Reject(header);
+		break;
+	}
+	case NetworkMessages::CLIPBOARD_FORMATS:
+		if (len < (int)sizeof(Clipboard_Announce_Header)) return _Reject(header);
+		break;
+	case NetworkMessages::CLIPBOARD_REQUEST:
+		if (len < (int)sizeof(Clipboard_Request_Header)) return _Reject(header);
+		break;
+	case NetworkMessages::CLIPBOARD_DATA:
+		if (len < (int)sizeof(Clipboard_Fragment_Header)) return _Reject(header);
+		break;
+	case NetworkMessages::SETTINGS:{
+		Settings_Header h;
+		if (len < (int)sizeof(h)) return _Reject(header);
+		memcpy(&h, data, sizeof(h));
+		break;
+	}
+	case NetworkMessages::DISCONNECTANDREMOVE:
+		DEBUG_MSG("Replay skipped a request to remove the service");
+		break;
+	case NetworkMessages::ELEVATEPROCESS:
+		if (len != (int)sizeof(Elevate_Header)) return _Reject(header);
+		DEBUG_MSG("Replay skipped a request to elevate");//the recorder zeroed the password
+		break;
+	default:
+		return;
+	}
+	_Decoded += 1;
+}
+RemoteDesktop::Replay_Stats RemoteDesktop::Replay_Sink::Replay(std::wstring filename, bool realtime){
+	Session_Player player(filename);
+	auto s = std::make_shared<SocketHandler>(INVALID_SOCKET, true);//never connected, nothing here sends
+	s->Authorized = true;
+	auto stats = player.Replay(DELEGATE(&RemoteDesktop::Replay_Sink::OnReceive), s, RECORDING_RECEIVED, realtime);
+	DEBUG_MSG("Replayed % messages, % bytes, % decoded, % rejected, handlers % us, total % us", stats.Messages, stats.Bytes, _Decoded, _Rejected, stats.HandlerMicroseconds, stats.WallMicroseconds);
+	return stats;
+}
@@ -0,0 +1,24 @@
+#ifndef REPLAY_SINK123_H
+#define REPLAY_SINK123_H
+#include <memory>
+#include <string>
+
+namespace RemoteDesktop{
+	class SocketHandler;
+	struct Packet_Header;
+	struct Replay_Stats;
+	//takes the messages a viewer sent in a recording in place of Server::OnReceive. Each one is checked and decoded the way the server's handler would, then dropped: no input is injected, nothing is written to disk, the clipboard, settings and secure attention sequence are left alone and a request to elevate or to remove the service is only logged. So a recording can be replayed on any machine without a Server and without touching it
+	class Replay_Sink{
+		long long _Decoded = 0, _Rejected = 0;
+		void _Reject(Packet_Header* header);
+
+	public:
+		void OnReceive(Packet_Header* header, const char* data, std::shared_ptr<RemoteDesktop::SocketHandler>& sh);
+		Replay_Stats Replay(std::wstring filename, bool realtime);
+
+		long long get_Decoded() const { return _Decoded; }
+		long long get_Rejected() const { return _Rejected; }//shorter than its type needs, the live handler would have asserted or read past it
+	};
+}
+
+#endif
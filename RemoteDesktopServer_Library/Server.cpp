@@ -19,15 +19,37 @@
 #include "NewConnectDialog.h"
 #include "..\RemoteDesktop_Library\Network_Server.h"
 #include "..\RemoteDesktop_Library\Network_Client.h"
+#include "..\RemoteDesktop_Library\Network_Mux.h"
 #include "Strsafe.h"
 #include "..\RemoteDesktop_Library\Config.h"
 #include "..\RemoteDesktop_Library\UserInfo.h"
 #include <algorithm>
 #include "..\RemoteDesktop_Library\ProcessUtils.h"
+#include "..\RemoteDesktop_Library\Frame_Tracer.h"
+#include "..\RemoteDesktop_Library\Metrics.h"
+#include "..\RemoteDesktop_Library\Metrics_Server.h"
+#include "..\RemoteDesktop_Library\Histogram.h"
+#include "..\RemoteDesktop_Library\Session_Recorder.h"
+#include "..\RemoteDesktop_Library\Timer_Wheel.h"
+#include "..\RemoteDesktop_Library\Encryption.h"
+#include <ctime>
 
 #define FRAME_CAPTURE_INTERVAL 50 //ms between checking for screen changes
+#define BROADCAST_KEYFRAME_INTERVAL 5000 //ms between full screens when broadcasting, a viewer joining through the gateway starts from the last set
+#define KEYFRAME_SPECULATIVE_INTERVAL 1000 //ms between compressing the screens again while a viewer waits to be allowed, a busy screen would otherwise be compressed every frame for nobody
+
+namespace RemoteDesktop{
+	namespace INTERNAL{
+		Metrics::Value& FramesSent = Metrics::Counter("rd_frames_sent_total", "Screen updates sent to viewers");
+		Metrics::Value& FrameBytes = Metrics::Counter("rd_frame_bytes_total", "Encoded bytes of screen updates before encryption");
+		Metrics::Value& KeyFramesSent = Metrics::Counter("rd_keyframes_sent_total", "Full screen images sent to new viewers or after a resolution change");
+		Metrics::Value& KeyFramesReused = Metrics::Counter("rd_keyframes_reused_total", "Keyframes a new viewer got already compressed because they were made while it waited to be allowed");
+		Histogram& FrameEncode = Metrics::Summary("rd_frame_encode_microseconds", "Time to copy and compress a changed screen region");
+	}
+}
 
 RemoteDesktop::Server::Server() :
+_ClientLock("server_clients"),
 _CADEventHandle(RAIIHANDLE(OpenEvent(EVENT_MODIFY_STATE, FALSE, L"Global\\SessionEventRDCad"))),
 _SelfRemoveEventHandle(RAIIHANDLE(OpenEvent(EVENT_MODIFY_STATE, FALSE, L"Global\\SessionEventRemoveSelf")))
 {
@@ -42,10 +64,14 @@ _SelfRemoveEventHandle(RAIIHANDLE(OpenEvent(EVENT_MODIFY_STATE, FALSE, L"Global\
 
 	_DesktopMonitor = std::make_unique<DesktopMonitor>();
 	_NewClients.reserve(10);//I reserve extra space to allow for accessing past the actual array bounds in some cases. This will only cause an error if the memory is outside of the array capacity
-	_ClipboardMonitor = std::make_unique<ClipboardMonitor>(DELEGATE(&RemoteDesktop::Server::_OnClipboardChanged));
+	_ClipboardMonitor = std::make_unique<ClipboardMonitor>(DELEGATE(&RemoteDesktop::Server::_OnClipboardChanged), DELEGATE(&RemoteDesktop::Server::_OnClipboardRequest));
 	_SystemTray = std::make_unique<SystemTray>();
 	_SystemTray->Start(DELEGATE(&RemoteDesktop::Server::_CreateSystemMenu));
-
+	if (MetricsPort()[0] != 0){
+		_MetricsCollector = Metrics::Add_Collector(DELEGATE(&RemoteDesktop::Server::_CollectMetrics));
+		_Metrics_Server = std::make_unique<Metrics_Server>();
+		_Metrics_Server->Start(MetricsPort());
+	}
 }
 RemoteDesktop::Server::~Server(){
 	if (_RemoveOnExit) {
@@ -55,6 +81,8 @@ RemoteDesktop::Server::~Server(){
 		else Cleanup_System_Configuration();
 	}
 	//i need to make sure these shut down before cointinuing
+	_Metrics_Server = nullptr;
+	if (_MetricsCollector != 0) Metrics::Remove_Collector(_MetricsCollector);
 	_NetworkServer = nullptr;
 	_DesktopMonitor = nullptr;
 	_ClipboardMonitor = nullptr;
@@ -90,53 +118,51 @@ void RemoteDesktop::Server::_Handle_Settings(Packet_Header* header, const char*
 
 	//DEBUG_MSG("Setting Quality to % and GrayScale to %", q, g);
 }
-void RemoteDesktop::Server::_OnClipboardChanged(const Clipboard_Data& c){
+void RemoteDesktop::Server::_OnClipboardChanged(const Clipboard_Announce_Header& h){
 	NetworkMsg msg;
-	int dibsize(c.m_pDataDIB.size()), htmlsize(c.m_pDataHTML.size()), rtfsize(c.m_pDataRTF.size()), textsize(c.m_pDataText.size());
-
-	msg.push_back(dibsize);
-	msg.data.push_back(DataPackage(c.m_pDataDIB.data(), dibsize));
-	msg.push_back(htmlsize);
-	msg.data.push_back(DataPackage(c.m_pDataHTML.data(), htmlsize));
-	msg.push_back(rtfsize);
-	msg.data.push_back(DataPackage(c.m_pDataRTF.data(), rtfsize));
-	msg.push_back(textsize);
-	msg.data.push_back(DataPackage(c.m_pDataText.data(), textsize));
-
-	_NetworkServer->Send(NetworkMessages::CLIPBOARDCHANGED, msg, INetwork::Auth_Types::AUTHORIZED);
+	msg.push_back(h);
+	_NetworkServer->Send(NetworkMessages::CLIPBOARD_FORMATS, msg, INetwork::Auth_Types::AUTHORIZED);
+}
+void RemoteDesktop::Server::_OnClipboardRequest(const Clipboard_Request_Header& h){
+	std::shared_ptr<SocketHandler> peer;
+	{
+		std::lock_guard<Profiled_Mutex> lock(_ClientLock);
+		peer = _ClipboardPeer.lock();
+	}
+	if (!peer) return;//the viewer that copied has disconnected, the paste will time out
+	NetworkMsg msg;
+	msg.push_back(h);
+	peer->Send(NetworkMessages::CLIPBOARD_REQUEST, msg);
 }
 void RemoteDesktop::Server::_Handle_ClipBoard(Packet_Header* header, const char* data, std::shared_ptr<RemoteDesktop::SocketHandler>& sh){
 	Clipboard_Data clip;
-	int dibsize(0), htmlsize(0), rtfsize(0), textsize(0);
-
-	dibsize = (*(int*)data);
-	data += sizeof(dibsize);
-	clip.m_pDataDIB.resize(dibsize);
-	memcpy(clip.m_pDataDIB.data(), data, dibsize);
-	data += dibsize;
-
-	htmlsize = (*(int*)data);
-	data += sizeof(htmlsize);
-	clip.m_pDataHTML.resize(htmlsize);
-	memcpy(clip.m_pDataHTML.data(), data, htmlsize);
-	data += htmlsize;
-
-	rtfsize = (*(int*)data);
-	data += sizeof(rtfsize);
-	clip.m_pDataRTF.resize(rtfsize);
-	memcpy(clip.m_pDataRTF.data(), data, rtfsize);
-	data += rtfsize;
-
-	textsize = (*(int*)data);
-	data += sizeof(textsize);
-	clip.m_pDataText.resize(textsize);
-	memcpy(clip.m_pDataText.data(), data, textsize);
-	data += textsize;
-	_ClipboardMonitor->Restore(clip);
+	if (Clipboard::Deserialize(data, header->PayloadLen, clip)) _ClipboardMonitor->Restore(clip);
+}
+void RemoteDesktop::Server::_Handle_ClipBoard_Formats(Packet_Header* header, const char* data, std::shared_ptr<RemoteDesktop::SocketHandler>& sh){
+	Clipboard_Announce_Header h;
+	if (header->PayloadLen < (int)sizeof(h)) return;
+	memcpy(&h, data, sizeof(h));
+	{
+		std::lock_guard<Profiled_Mutex> lock(_ClientLock);
+		_ClipboardPeer = sh;//clipboard ids are per viewer, so requests must go back to the one that announced
+	}
+	_ClipboardMonitor->Announce(h);
+}
+void RemoteDesktop::Server::_Handle_ClipBoard_Request(Packet_Header* header, const char* data, std::shared_ptr<RemoteDesktop::SocketHandler>& sh){
+	Clipboard_Request_Header h;
+	if (header->PayloadLen < (int)sizeof(h)) return;
+	memcpy(&h, data, sizeof(h));
+	_ClipboardMonitor->Queue_Send(h, sh);//only the peer that pasted needs the data
+}
+void RemoteDesktop::Server::_Handle_ClipBoard_Data(Packet_Header* header, const char* data, std::shared_ptr<RemoteDesktop::SocketHandler>& sh){
+	Clipboard_Fragment_Header h;
+	if (header->PayloadLen < (int)sizeof(h)) return;
+	memcpy(&h, data, sizeof(h));
+	_ClipboardMonitor->Receive(h, data + sizeof(h), header->PayloadLen - sizeof(h));
 }
 
 void RemoteDesktop::Server::_OnAllowConnection(std::wstring name){
-	std::lock_guard<std::mutex> lock(_ClientLock);
+	std::lock_guard<Profiled_Mutex> lock(_ClientLock);
 	DEBUG_MSG("Allowing %", ws2s(name));
 	_PendingNewClients.erase(std::remove_if(_PendingNewClients.begin(), _PendingNewClients.end(), [&](std::shared_ptr<SocketHandler>& ptr){
 		if (ptr->Connection_Info.full_name == name){
@@ -150,7 +176,7 @@ void RemoteDesktop::Server::_OnAllowConnection(std::wstring name){
 }
 void RemoteDesktop::Server::_OnDenyConnection(std::wstring name){
 	{
-		std::lock_guard<std::mutex> lock(_ClientLock);
+		std::lock_guard<Profiled_Mutex> lock(_ClientLock);
 		auto begit = std::remove_if(_PendingNewClients.begin(), _PendingNewClients.end(), [&](std::shared_ptr<RemoteDesktop::SocketHandler>& ptr) {
 			return ptr->Connection_Info.full_name == name;
 		});
@@ -286,6 +312,15 @@ void RemoteDesktop::Server::OnReceive(Packet_Header* header, const char* data, s
 	case NetworkMessages::CLIPBOARDCHANGED:
 		_Handle_ClipBoard(header, data, sh);
 		break;
+	case NetworkMessages::CLIPBOARD_FORMATS:
+		_Handle_ClipBoard_Formats(header, data, sh);
+		break;
+	case NetworkMessages::CLIPBOARD_REQUEST:
+		_Handle_ClipBoard_Request(header, data, sh);
+		break;
+	case NetworkMessages::CLIPBOARD_DATA:
+		_Handle_ClipBoard_Data(header, data, sh);
+		break;
 	case NetworkMessages::DISCONNECTANDREMOVE:
 		_Handle_DisconnectandRemove(header, data, sh);
 		break;
@@ -302,11 +337,19 @@ void RemoteDesktop::Server::OnReceive(Packet_Header* header, const char* data, s
 }
 void RemoteDesktop::Server::OnDisconnect(std::shared_ptr<RemoteDesktop::SocketHandler>& sh) {
 	if (!sh) return;
+	{
+		std::lock_guard<std::mutex> lock(_MetricsLock);
+		auto p = sh.get();
+		_MetricsClients.erase(std::remove_if(_MetricsClients.begin(), _MetricsClients.end(), [p](const std::weak_ptr<SocketHandler>& a){
+			auto s(a.lock());
+			return !s || s.get() == p;
+		}), _MetricsClients.end());
+	}
 	if (!sh->Authorized) {
 		_NewConnect_Dialog = nullptr;
 		return _OnDenyConnection(std::wstring(sh->Connection_Info.full_name));
 	}
-	SetLast_UserConnectName(L"");//set this to empty because the user will have to be allowed next connect attempt
+	if (sh->Spectator == 0) SetLast_UserConnectName(L"");//set this to empty because the user will have to be allowed next connect attempt. A spectator leaving says nothing about the one in control
 	auto usname = std::wstring(sh->Connection_Info.full_name);
 	if (usname.size() > 2){
 		std::vector<std::wstring> msgs;
@@ -322,10 +365,25 @@ void RemoteDesktop::Server::OnDisconnect(std::shared_ptr<RemoteDesktop::SocketHa
 
 }
 
+RemoteDesktop::Image& RemoteDesktop::Server::_Keyframe(const Screen& screen){
+	auto index = (size_t)screen.MonitorInfo.Index;
+	if (index >= _Keyframes.size()) _Keyframes.resize(index + 1);
+	auto& k = _Keyframes[index];
+	if (!k){
+		k = std::make_unique<Image>(screen.Image->Clone());
+		k->Compress();
+	}
+	return *k;
+}
+void RemoteDesktop::Server::_Drop_Keyframe(const Screen& screen){
+	auto index = (size_t)screen.MonitorInfo.Index;
+	if (index < _Keyframes.size()) _Keyframes[index].reset();
+}
 void RemoteDesktop::Server::_HandleNewClients(Screen& screen, std::vector<std::shared_ptr<SocketHandler>>& newclients){
 	if (newclients.empty()) return;
-	auto sendimg = screen.Image->Clone();
-	sendimg.Compress();
+	auto index = (size_t)screen.MonitorInfo.Index;
+	if (index < _Keyframes.size() && _Keyframes[index]) INTERNAL::KeyFramesReused.Add();
+	auto& sendimg = _Keyframe(screen);
 	NetworkMsg msg;
 	New_Image_Header h;
 	h.YOffset = screen.MonitorInfo.Offsety;
@@ -340,7 +398,10 @@ void RemoteDesktop::Server::_HandleNewClients(Screen& screen, std::vector<std::s
 
 	for (size_t i = 0; i < newclients.size(); i++){
 		auto a(newclients[i]);
-		if (a) a->Send(NetworkMessages::RESOLUTIONCHANGE, msg);
+		if (a->Spectator == 0){//a spectator starts from the keyframes the gateway holds
+			a->Send(NetworkMessages::RESOLUTIONCHANGE, msg);
+			INTERNAL::KeyFramesSent.Add();
+		}
 
 		std::wstring name = a->Connection_Info.full_name;
 		std::vector<std::wstring> msgs;
@@ -355,8 +416,8 @@ void RemoteDesktop::Server::_HandleNewClients(Screen& screen, std::vector<std::s
 	}
 }
 void RemoteDesktop::Server::_HandleResolutionChanged(const Screen& screen) {
-	auto sendimg(screen.Image->Clone());
-	sendimg.Compress();
+	_Drop_Keyframe(screen);
+	auto& sendimg = _Keyframe(screen);
 	NetworkMsg msg;
 	New_Image_Header h;
 	h.YOffset = screen.MonitorInfo.Offsety;
@@ -368,23 +429,51 @@ void RemoteDesktop::Server::_HandleResolutionChanged(const Screen& screen) {
 	msg.push_back(h);
 	msg.data.push_back(DataPackage((char*)sendimg.get_Data(), sendimg.size_in_bytes()));
 	_NetworkServer->Send(NetworkMessages::RESOLUTIONCHANGE, msg, INetwork::Auth_Types::AUTHORIZED);
+	INTERNAL::KeyFramesSent.Add();
+}
+void RemoteDesktop::Server::_Refresh_Broadcast(const Screen& screen){
+	auto broadcaster(_Broadcaster.lock());
+	if (!broadcaster) return;
+	auto& sendimg = _Keyframe(screen);//dropped whenever the screen changes, so it is current
+	NetworkMsg msg;
+	New_Image_Header h;
+	h.YOffset = screen.MonitorInfo.Offsety;
+	h.XOffset = screen.MonitorInfo.Offsetx;
+	h.Index = screen.MonitorInfo.Index;
+	h.Height = screen.Image->Height;
+	h.Width = screen.Image->Width;
+
+	msg.push_back(h);
+	msg.data.push_back(DataPackage((char*)sendimg.get_Data(), sendimg.size_in_bytes()));
+	if (broadcaster->Send_Refresh(NetworkMessages::RESOLUTIONCHANGE, msg) == Network_Return::COMPLETED) INTERNAL::KeyFramesSent.Add();
 }
 
 
 void RemoteDesktop::Server::_Handle_ScreenChanged(const Screen& screen, const Rect& rect){
+	_Drop_Keyframe(screen);
 
 	NetworkMsg msg;
+	Timer encodetimer(true);
 	auto imgdif = Image::Copy(*screen.Image, rect);
 	imgdif.Compress();
+	encodetimer.Stop();
+	INTERNAL::FrameEncode.Record(encodetimer.Elapsed_micro());
+	Frame_Tracer::Mark(Frame_Tracer::STAGE_ENCODE);
 	Update_Image_Header h;
 	h.rect = rect;
 	h.Index = screen.MonitorInfo.Index;
+	h.FrameID = Frame_Tracer::get_ID();
 
 	msg.push_back(h);
 	msg.data.push_back(DataPackage((char*)imgdif.get_Data(), imgdif.size_in_bytes()));
+	Frame_Tracer::Mark(Frame_Tracer::STAGE_ENQUEUE);
 
 	//DEBUG_MSG("_Handle_ScreenUpdates %, %, %", rect.height, rect.width, imgdif.size_in_bytes);
 	_NetworkServer->Send(NetworkMessages::UPDATEREGION, msg, INetwork::Auth_Types::AUTHORIZED);
+	INTERNAL::FramesSent.Add();
+	INTERNAL::FrameBytes.Add(imgdif.size_in_bytes());
+	Frame_Tracer::Mark(Frame_Tracer::STAGE_SEND);
+	Frame_Tracer::End();
 
 }
 void RemoteDesktop::Server::_Handle_UAC_Permission(){
@@ -401,18 +490,66 @@ void RemoteDesktop::Server::_Handle_MouseChanged(const MouseCapture& mousecaptur
 
 }
 void RemoteDesktop::Server::OnConnect(std::shared_ptr<RemoteDesktop::SocketHandler>& sh){
-	std::lock_guard<std::mutex> lock(_ClientLock);
+	std::lock_guard<Profiled_Mutex> lock(_ClientLock);
 	_PendingNewClients.push_back(sh);
 	sh->Authorized = false;
+	{
+		std::lock_guard<std::mutex> mlock(_MetricsLock);
+		_MetricsClients.push_back(sh);
+	}
+	if (RecordingFolder()[0] != 0){
+		static int counter = 0;
+		auto filename = std::wstring(RecordingFolder()) + L"\\session_" + std::to_wstring((long long)time(nullptr)) + L"_" + std::to_wstring(counter++) + L".rdr";
+		auto recorder = std::make_shared<Session_Recorder>(filename);
+		if (recorder->Is_Open()) sh->set_Recorder(recorder);
+	}
 	DEBUG_MSG("New Client OnConnect");
 }
+void RemoteDesktop::Server::_CollectMetrics(std::string& out){
+	std::vector<std::shared_ptr<SocketHandler>> clients;
+	{
+		std::lock_guard<std::mutex> lock(_MetricsLock);
+		for (auto& a : _MetricsClients){
+			auto s(a.lock());
+			if (s) clients.push_back(s);
+		}
+	}
+	auto authorized = std::count_if(clients.begin(), clients.end(), [](const std::shared_ptr<SocketHandler>& a){ return a->Authorized; });
+	Metrics::Write_Help(out, "rd_connections", "Connected viewers", "gauge");
+	Metrics::Write_Value(out, "rd_connections", "state=\"authorized\"", authorized);
+	Metrics::Write_Value(out, "rd_connections", "state=\"pending\"", clients.size() - authorized);
+
+	//traffic is read from the lock free counters of each connection
+	std::vector<std::pair<std::string, Traffic_Stats>> traffic;
+	std::vector<Traffic_Rates> rates;
+	for (auto& a : clients){
+		auto labels = Metrics::Label("peer", a->Connection_Info.ip_addr) + "," + Metrics::Label("user", a->Connection_Info.full_name);
+		traffic.push_back(std::make_pair(labels, a->Traffic.get_TrafficStats()));
+		rates.push_back(a->Traffic.get_Rates(10));
+	}
+	Metrics::Write_Help(out, "rd_connection_sent_bytes_total", "Bytes sent on the wire to each viewer", "counter");
+	for (auto& a : traffic) Metrics::Write_Value(out, "rd_connection_sent_bytes_total", a.first, a.second.CompressedSendBytes);
+	Metrics::Write_Help(out, "rd_connection_received_bytes_total", "Bytes received on the wire from each viewer", "counter");
+	for (auto& a : traffic) Metrics::Write_Value(out, "rd_connection_received_bytes_total", a.first, a.second.CompressedRecvBytes);
+	Metrics::Write_Help(out, "rd_connection_send_bytes_per_second", "Send rate to each viewer over the last 10 seconds", "gauge");
+	for (size_t i = 0; i < traffic.size(); i++) Metrics::Write_Value(out, "rd_connection_send_bytes_per_second", traffic[i].first, rates[i].CompressedSendBPS);
+	Metrics::Write_Help(out, "rd_connection_send_messages_per_second", "Messages sent to each viewer per second over the last 10 seconds", "gauge");
+	for (size_t i = 0; i < traffic.size(); i++) Metrics::Write_Value(out, "rd_connection_send_messages_per_second", traffic[i].first, rates[i].SendMPS);
+}
 void RemoteDesktop::Server::_ShowGatewayDialog(int id){
 	_GatewayConnect_Dialog = std::make_shared<GatewayConnect_Dialog>();
 	_GatewayConnect_Dialog->Show(id);
 }
 void RemoteDesktop::Server::Listen(std::wstring port, std::wstring host){
 
-	_NetworkServer = std::make_shared<Network_Server>();
+	auto network = std::make_shared<Network_Server>();
+	if (AdmissionSourceRate()[0] != 0){
+		wchar_t* end = nullptr;
+		auto rate = wcstod(AdmissionSourceRate(), &end);
+		if (end != nullptr && *end == 0 && rate > 0) network->set_Source_Rate(rate);
+		else DEBUG_MSG("Bad AdmissionSourceRate '%', using the default", ws2s(AdmissionSourceRate()));
+	}
+	_NetworkServer = network;
 	_NetworkServer->OnConnected = std::bind(&RemoteDesktop::Server::OnConnect, this, std::placeholders::_1);
 	_NetworkServer->OnReceived = std::bind(&RemoteDesktop::Server::OnReceive, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3);
 	_NetworkServer->OnDisconnect = std::bind(&RemoteDesktop::Server::OnDisconnect, this, std::placeholders::_1);
@@ -420,15 +557,23 @@ void RemoteDesktop::Server::Listen(std::wstring port, std::wstring host){
 	_Run();
 }
 void RemoteDesktop::Server::ReverseConnect(std::wstring port, std::wstring host, std::wstring gatewayurl){
-
-	_NetworkServer = std::make_shared<Network_Client>();
+	_Broadcasting = BroadcastToGateway()[0] == L'1';
+	std::shared_ptr<Network_Mux> mux;
+	std::shared_ptr<Network_Client> client;
+	if (!_Broadcasting && MultiplexGateway()[0] == L'1') _NetworkServer = mux = std::make_shared<Network_Mux>();//a broadcast already serves every viewer from one connection
+	else _NetworkServer = client = std::make_shared<Network_Client>();
 	_NetworkServer->OnConnected = std::bind(&RemoteDesktop::Server::OnConnect, this, std::placeholders::_1);
 	_NetworkServer->OnReceived = std::bind(&RemoteDesktop::Server::OnReceive, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3);
 	_NetworkServer->OnDisconnect = std::bind(&RemoteDesktop::Server::OnDisconnect, this, std::placeholders::_1);
-	auto ptr = (Network_Client*)_NetworkServer.get();
-
-	ptr->OnGatewayConnected = std::bind(&RemoteDesktop::Server::_ShowGatewayDialog, this, std::placeholders::_1);
-	ptr->Start(port, host, gatewayurl);
+	if (mux){
+		mux->OnGatewayConnected = std::bind(&RemoteDesktop::Server::_ShowGatewayDialog, this, std::placeholders::_1);
+		mux->Start(port, host, gatewayurl);
+	}
+	else {
+		client->OnGatewayConnected = std::bind(&RemoteDesktop::Server::_ShowGatewayDialog, this, std::placeholders::_1);
+		if (_Broadcasting) _Broadcaster = client;
+		client->Start(port, host, gatewayurl, _Broadcasting);
+	}
 	_Run();
 }
 
@@ -452,6 +597,8 @@ void RemoteDesktop::Server::_Run() {
 	DWORD dwEvent;
 	auto lastwaittime = FRAME_CAPTURE_INTERVAL;
 	std::vector<std::shared_ptr<SocketHandler>> tmpbuffer;
+	auto lastkeyframes = Timer_Wheel::Now();
+	long long lastspeculative = 0;
 
 	while (_NetworkServer->Is_Running()){
 		if (shutdownhandle.get() == NULL) std::this_thread::sleep_for(std::chrono::milliseconds(lastwaittime));//sleep
@@ -483,7 +630,7 @@ void RemoteDesktop::Server::_Run() {
 
 		virtualscreen->Update();
 		{
-			std::lock_guard<std::mutex> lock(_ClientLock);
+			std::lock_guard<Profiled_Mutex> lock(_ClientLock);
 			for (size_t i = 0; i < _NewClients.size(); i++) tmpbuffer.push_back(_NewClients[i]);
 			_NewClients.clear();
 		}
@@ -491,6 +638,23 @@ void RemoteDesktop::Server::_Run() {
 		for (auto& a : virtualscreen->Screens) _HandleNewClients(a, tmpbuffer);
 
 		tmpbuffer.clear();//make sure to clear the new clienrts
+		if (_Broadcasting && Timer_Wheel::Now() - lastkeyframes >= BROADCAST_KEYFRAME_INTERVAL){//the gateway drops the stream before the newest set, so spectators never replay more than this
+			for (auto& a : virtualscreen->Screens) _Refresh_Broadcast(a);
+			lastkeyframes = Timer_Wheel::Now();
+		}
+		auto waiting = false;
+		{
+			std::lock_guard<Profiled_Mutex> lock(_ClientLock);
+			waiting = std::any_of(_PendingNewClients.begin(), _PendingNewClients.end(), [](const std::shared_ptr<SocketHandler>& a){ return !a->Authorized && a->Spectator == 0 && a->get_State() != PEER_STATE_DISCONNECTED; });
+		}
+		if (!waiting){
+			_Keyframes.clear();
+			lastspeculative = 0;//the next viewer to wait gets its keyframes started right away
+		}
+		else if (Timer_Wheel::Now() - lastspeculative >= KEYFRAME_SPECULATIVE_INTERVAL){//speculative, the viewer may still be denied. A screen that changed since is compressed once it is allowed
+			for (auto& a : virtualscreen->Screens) _Keyframe(a);
+			lastspeculative = Timer_Wheel::Now();
+		}
 		t1.Stop();
 		auto tim = (int)t1.Elapsed_milli();
 		lastwaittime = FRAME_CAPTURE_INTERVAL - tim;
@@ -505,8 +669,10 @@ void RemoteDesktop::Server::AllStop()
 {
 	_PendingNewClients.clear();
 	_NewClients.clear();
+	_Keyframes.clear();
 	_DesktopMonitor = nullptr;
 	_NetworkServer.reset();
+	Encryption::Shutdown();//the next start gets a new static key pair
 
 	_ClipboardMonitor = nullptr;
 	_SystemTray = nullptr;
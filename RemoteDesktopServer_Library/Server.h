@@ -3,6 +3,7 @@
 #include <memory>
 #include <mutex>
 #include "..\RemoteDesktop_Library\Handle_Wrapper.h"
+#include "..\RemoteDesktop_Library\Lock_Profiler.h"
 #include <thread>
 
 
@@ -16,26 +17,45 @@ namespace RemoteDesktop{
 	class Rect;
 	class ClipboardMonitor;
 	struct Clipboard_Data;
+	struct Clipboard_Announce_Header;
+	struct Clipboard_Request_Header;
 	class SystemTray;
 	class GatewayConnect_Dialog;
 	class NewConnect_Dialog;
 	class INetwork;
+	class Network_Client;
 	class Screen;
+	class Image;
+	class Metrics_Server;
 
 	class Server{
 
-		std::mutex _ClientLock;
+		Profiled_Mutex _ClientLock;
 		std::vector<std::shared_ptr<SocketHandler>> _PendingNewClients; 
 		std::vector<std::shared_ptr<SocketHandler>> _NewClients;
 		std::unique_ptr<DesktopMonitor> _DesktopMonitor;
 		std::shared_ptr<INetwork> _NetworkServer;
 		
 		std::unique_ptr<ClipboardMonitor> _ClipboardMonitor;
+		std::weak_ptr<SocketHandler> _ClipboardPeer;//viewer whose clipboard is currently announced
 		std::unique_ptr<SystemTray> _SystemTray;
 
+		//only created when a metrics port is configured
+		std::unique_ptr<Metrics_Server> _Metrics_Server;
+		int _MetricsCollector = 0;
+		std::mutex _MetricsLock;//kept separate from _ClientLock so a scrape never holds up the capture loop
+		std::vector<std::weak_ptr<SocketHandler>> _MetricsClients;
+		void _CollectMetrics(std::string& out);
 
+
+		//compressed screens by monitor index. They are made while a viewer waits to be allowed so its keyframe is usually ready the moment it is, at most every KEYFRAME_SPECULATIVE_INTERVAL, and dropped as soon as their screen changes. Only touched by the capture loop
+		std::vector<std::unique_ptr<Image>> _Keyframes;
+		Image& _Keyframe(const Screen& screen);
+		void _Drop_Keyframe(const Screen& screen);
 		void _HandleNewClients(Screen& screen, std::vector<std::shared_ptr<SocketHandler>>& newclients);
 		void _HandleResolutionChanged(const Screen& screen);
+		//the keyframes a broadcast sends every BROADCAST_KEYFRAME_INTERVAL, only the gateway keeps them
+		void _Refresh_Broadcast(const Screen& screen);
 		void _Handle_ScreenChanged(const Screen& img, const Rect& rect);
 
 		void _Handle_MouseChanged(const MouseCapture& mousecapturing);
@@ -46,12 +66,16 @@ namespace RemoteDesktop{
 		void _Handle_File_Flush(Packet_Header* header, const char* data, std::shared_ptr<RemoteDesktop::SocketHandler>& sh);
 		void _Handle_Folder(Packet_Header* header, const char* data, std::shared_ptr<RemoteDesktop::SocketHandler>& sh);
 		void _Handle_ClipBoard(Packet_Header* header, const char* data, std::shared_ptr<RemoteDesktop::SocketHandler>& sh);
+		void _Handle_ClipBoard_Formats(Packet_Header* header, const char* data, std::shared_ptr<RemoteDesktop::SocketHandler>& sh);
+		void _Handle_ClipBoard_Request(Packet_Header* header, const char* data, std::shared_ptr<RemoteDesktop::SocketHandler>& sh);
+		void _Handle_ClipBoard_Data(Packet_Header* header, const char* data, std::shared_ptr<RemoteDesktop::SocketHandler>& sh);
 		void _Handle_DisconnectandRemove(Packet_Header* header, const char* data, std::shared_ptr<RemoteDesktop::SocketHandler>& sh);
 		void _Handle_Settings(Packet_Header* header, const char* data, std::shared_ptr<RemoteDesktop::SocketHandler>& sh);
 		void _Handle_ConnectionRequest(Packet_Header* header, const char* data, std::shared_ptr<RemoteDesktop::SocketHandler>& sh);
 		void _Handle_ElevateProcess(Packet_Header* header, const char* data, std::shared_ptr<RemoteDesktop::SocketHandler>& sh);
 
-		void _OnClipboardChanged(const Clipboard_Data& c);
+		void _OnClipboardChanged(const Clipboard_Announce_Header& h);
+		void _OnClipboardRequest(const Clipboard_Request_Header& h);
 		void _CreateSystemMenu();
 		void _TriggerShutDown();
 
@@ -64,6 +88,8 @@ namespace RemoteDesktop{
 
 		bool _RunningAsService = false;
 		bool _RunningReverseProxy = false;
+		bool _Broadcasting = false;
+		std::weak_ptr<Network_Client> _Broadcaster;//_NetworkServer while broadcasting
 
 		RAIIHANDLE_TYPE _CADEventHandle;
 		RAIIHANDLE_TYPE _SelfRemoveEventHandle;
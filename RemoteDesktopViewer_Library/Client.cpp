@@ -9,6 +9,7 @@
 #include "..\RemoteDesktop_Library\Clipboard_Monitor.h"
 #include <Lmcons.h>
 #include "..\RemoteDesktop_Library\UserInfo.h"
+#include "..\RemoteDesktop_Library\Frame_Tracer.h"
 
 
 RemoteDesktop::Client::Client(HWND hwnd,
@@ -18,7 +19,7 @@ RemoteDesktop::Client::Client(HWND hwnd,
 	void(__stdcall * ondisplaychanged)(int, int, int, int, int),
 	void(__stdcall * onconnectingattempt)(int, int)) : _HWND(hwnd), _OnConnect(onconnect), _OnDisconnect(ondisconnect), _OnDisplaysChanged(ondisplaychanged), _OnConnectingAttempt(onconnectingattempt) {
 	_Display = std::make_shared<Display>(hwnd, oncursorchange);
-	_ClipboardMonitor = std::make_shared<ClipboardMonitor>(DELEGATE(&RemoteDesktop::Client::_OnClipboardChanged));
+	_ClipboardMonitor = std::make_shared<ClipboardMonitor>(DELEGATE(&RemoteDesktop::Client::_OnClipboardChanged), DELEGATE(&RemoteDesktop::Client::_OnClipboardRequest));
 	DEBUG_MSG("Client()");
 }
 void Send(std::weak_ptr<RemoteDesktop::SocketHandler>& ptr, RemoteDesktop::NetworkMessages m, RemoteDesktop::NetworkMsg& msg){
@@ -32,73 +33,73 @@ RemoteDesktop::Client::~Client(){
 	_ClipboardMonitor = nullptr;
 	_Display = nullptr;
 }
-void RemoteDesktop::Client::OnDisconnect(){
+void RemoteDesktop::Client::OnDisconnect(std::shared_ptr<SocketHandler>& sh){
+	if (sh) return;//the connection dropped and Network_Client is reconnecting, only tell the ui once it gives up
 	_OnDisconnect();
 }
 void RemoteDesktop::Client::Connect(std::wstring port, std::wstring host, int id, std::wstring aeskey){
 	_NetworkClient = std::make_shared<Network_Client>();
 	_NetworkClient->OnConnected = std::bind(&RemoteDesktop::Client::OnConnect, this, std::placeholders::_1);
 	_NetworkClient->OnReceived = std::bind(&RemoteDesktop::Client::OnReceive, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3);
-	_NetworkClient->OnDisconnect = std::bind(&RemoteDesktop::Client::OnDisconnect, this);
+	_NetworkClient->OnDisconnect = std::bind(&RemoteDesktop::Client::OnDisconnect, this, std::placeholders::_1);
 	_NetworkClient->OnConnectingAttempt = _OnConnectingAttempt;
 	auto ptr = (Network_Client*)_NetworkClient.get();
+	ptr->OnKeysSent = std::bind(&RemoteDesktop::Client::_OnKeysSent, this, std::placeholders::_1);
 	ptr->Start(port, host, id, aeskey);
 }
 void RemoteDesktop::Client::Stop(){
 	_NetworkClient->Stop(true);
 }
-void RemoteDesktop::Client::_OnClipboardChanged(const Clipboard_Data& c){
-
+void RemoteDesktop::Client::_OnClipboardChanged(const Clipboard_Announce_Header& h){
 	NetworkMsg msg;
-	int dibsize(c.m_pDataDIB.size()), htmlsize(c.m_pDataHTML.size()), rtfsize(c.m_pDataRTF.size()), textsize(c.m_pDataText.size());
-
-	msg.push_back(dibsize);
-	msg.data.push_back(DataPackage(c.m_pDataDIB.data(), dibsize));
-	msg.push_back(htmlsize);
-	msg.data.push_back(DataPackage(c.m_pDataHTML.data(), htmlsize));
-	msg.push_back(rtfsize);
-	msg.data.push_back(DataPackage(c.m_pDataRTF.data(), rtfsize));
-	msg.push_back(textsize);
-	msg.data.push_back(DataPackage(c.m_pDataText.data(), textsize));
-	Send(Socket, NetworkMessages::CLIPBOARDCHANGED, msg);
-
+	msg.push_back(h);
+	Send(Socket, NetworkMessages::CLIPBOARD_FORMATS, msg);
+}
+void RemoteDesktop::Client::_OnClipboardRequest(const Clipboard_Request_Header& h){
+	NetworkMsg msg;
+	msg.push_back(h);
+	Send(Socket, NetworkMessages::CLIPBOARD_REQUEST, msg);
 }
 void RemoteDesktop::Client::_Handle_ClipBoard(Packet_Header* header, const char* data, std::shared_ptr<RemoteDesktop::SocketHandler>& sh){
 	Clipboard_Data clip;
-	int dibsize(0), htmlsize(0), rtfsize(0), textsize(0);
-
-	dibsize = (*(int*)data);
-	data += sizeof(dibsize);
-	clip.m_pDataDIB.resize(dibsize);
-	memcpy(clip.m_pDataDIB.data(), data, dibsize);
-	data += dibsize;
-
-	htmlsize = (*(int*)data);
-	data += sizeof(htmlsize);
-	clip.m_pDataHTML.resize(htmlsize);
-	memcpy(clip.m_pDataHTML.data(), data, htmlsize);
-	data += htmlsize;
-
-	rtfsize = (*(int*)data);
-	data += sizeof(rtfsize);
-	clip.m_pDataRTF.resize(rtfsize);
-	memcpy(clip.m_pDataRTF.data(), data, rtfsize);
-	data += rtfsize;
-
-	textsize = (*(int*)data);
-	data += sizeof(textsize);
-	clip.m_pDataText.resize(textsize);
-	memcpy(clip.m_pDataText.data(), data, textsize);
-	data += textsize;
-	_ClipboardMonitor->Restore(clip);
+	if (Clipboard::Deserialize(data, header->PayloadLen, clip)) _ClipboardMonitor->Restore(clip);
+}
+void RemoteDesktop::Client::_Handle_ClipBoard_Formats(Packet_Header* header, const char* data, std::shared_ptr<RemoteDesktop::SocketHandler>& sh){
+	Clipboard_Announce_Header h;
+	if (header->PayloadLen < (int)sizeof(h)) return;
+	memcpy(&h, data, sizeof(h));
+	_ClipboardMonitor->Announce(h);
+}
+void RemoteDesktop::Client::_Handle_ClipBoard_Request(Packet_Header* header, const char* data, std::shared_ptr<RemoteDesktop::SocketHandler>& sh){
+	Clipboard_Request_Header h;
+	if (header->PayloadLen < (int)sizeof(h)) return;
+	memcpy(&h, data, sizeof(h));
+	_ClipboardMonitor->Queue_Send(h, sh);//only the peer that pasted needs the data
+}
+void RemoteDesktop::Client::_Handle_ClipBoard_Data(Packet_Header* header, const char* data, std::shared_ptr<RemoteDesktop::SocketHandler>& sh){
+	Clipboard_Fragment_Header h;
+	if (header->PayloadLen < (int)sizeof(h)) return;
+	memcpy(&h, data, sizeof(h));
+	_ClipboardMonitor->Receive(h, data + sizeof(h), header->PayloadLen - sizeof(h));
 }
 
+//with a pre-AES key from the gateway the request can be encrypted before the server answered, it then arrives with the keys and saves a round trip
+void RemoteDesktop::Client::_OnKeysSent(std::shared_ptr<SocketHandler>& sh){
+	auto info = GetUserInfo();
+	NetworkMsg msg;
+	msg.push_back(info);
+	_Requested = sh->Send_Early(NetworkMessages::CONNECT_REQUEST, msg) == Network_Return::COMPLETED;
+}
 void RemoteDesktop::Client::OnConnect(std::shared_ptr<SocketHandler>& sh){
 	Socket = sh;
+	sh->set_Recorder(std::atomic_load(&_Recorder));
 	DEBUG_MSG("Connection Successful");
-	NetworkMsg msg;
-	msg.push_back(GetUserInfo());
-	Send(Socket, NetworkMessages::CONNECT_REQUEST, msg);
+	if (!_Requested){
+		auto info = GetUserInfo();
+		NetworkMsg msg;
+		msg.push_back(info);
+		Send(Socket, NetworkMessages::CONNECT_REQUEST, msg);
+	}
 	_OnConnect();
 }
 
@@ -156,6 +157,40 @@ RemoteDesktop::Traffic_Stats RemoteDesktop::Client::get_TrafficStats() const{
 	memset(&tmp, 0, sizeof(tmp));
 	return tmp;
 }
+bool RemoteDesktop::Client::Record(std::wstring filename){
+	std::shared_ptr<Session_Recorder> r;
+	if (!filename.empty()) {
+		r = std::make_shared<Session_Recorder>(filename);
+		if (!r->Is_Open()) return false;
+	}
+	std::atomic_store(&_Recorder, r);
+	std::shared_ptr<RemoteDesktop::SocketHandler> s(Socket.lock());
+	if (s) s->set_Recorder(r);
+	return true;
+}
+RemoteDesktop::Replay_Stats RemoteDesktop::Client::Replay(std::wstring filename, bool realtime){
+	Session_Player player(filename);
+	//the socket is never connected so anything the handlers try to send fails straight away
+	auto s = std::make_shared<SocketHandler>(INVALID_SOCKET, true);
+	s->Authorized = true;
+	return player.Replay(DELEGATE(&RemoteDesktop::Client::OnReceive), s, RECORDING_RECEIVED, realtime);
+}
+RemoteDesktop::Traffic_Rates RemoteDesktop::Client::get_TrafficRates(int seconds) const{
+	std::shared_ptr<RemoteDesktop::SocketHandler> s(Socket.lock());
+	if (s) return s->Traffic.get_Rates(seconds);
+
+	RemoteDesktop::Traffic_Rates tmp;
+	memset(&tmp, 0, sizeof(tmp));
+	return tmp;
+}
+long long RemoteDesktop::Client::get_TrafficMessageCount(int message_type, bool send) const{
+	std::shared_ptr<RemoteDesktop::SocketHandler> s(Socket.lock());
+	return s ? s->Traffic.get_MessageCount(message_type, send) : 0;
+}
+long long RemoteDesktop::Client::get_TrafficSizePercentile(double p, bool send) const{
+	std::shared_ptr<RemoteDesktop::SocketHandler> s(Socket.lock());
+	return s ? s->Traffic.get_SizePercentile(p, send) : 0;
+}
 void RemoteDesktop::Client::SendSettings(Settings_Header h){
 	NetworkMsg msg;
 	msg.push_back(h);
@@ -189,6 +224,7 @@ void RemoteDesktop::Client::SendFile(const char* absolute_path, const char* rela
 		}
 
 		std::ifstream infile(absolute_path, std::ifstream::binary);
+		Compression_Handler::File_Compression_Policy compressionpolicy(filename);
 
 		for (size_t chunk = 0; chunk < total_chunks && clienthold->get_State() != RemoteDesktop::PEER_STATE_DISCONNECTED; ++chunk)
 		{
@@ -203,7 +239,7 @@ void RemoteDesktop::Client::SendFile(const char* absolute_path, const char* rela
 			msg.push_back(fh);
 			msg.data.push_back(DataPackage(buffer.data(), fh.ChunkSize));
 
-			clienthold->Send(NetworkMessages::FILE, msg);
+			clienthold->Send(NetworkMessages::FILE, msg, compressionpolicy.Choose(buffer.data(), fh.ChunkSize));
 			fh.ID += 1;
 			onfilechanged(fh.ChunkSize);
 			//std::this_thread::sleep_for(std::chrono::milliseconds(5));//sleep to allow other traffic to flow
@@ -247,11 +283,14 @@ void RemoteDesktop::Client::_Handle_UpdateRegion(Packet_Header* header, const ch
 	Update_Image_Header h;
 	memcpy(&h, data, sizeof(h));
 	data += sizeof(h);
+	Frame_Tracer::set_ID(h.FrameID);
 
 	Image img(Image::Create_from_Compressed_Data((char*)data, header->PayloadLen - sizeof(h), h.rect.height, h.rect.width));
 	//DEBUG_MSG("_Handle_ScreenUpdates %, %, %", rect.height, rect.width, img.size_in_bytes);
 	auto copy = _Display;
 	if (copy) copy->Update(img, h);
+	Frame_Tracer::Mark(Frame_Tracer::STAGE_DECODE);
+	Frame_Tracer::End();
 }
 void RemoteDesktop::Client::_Handle_UACBlocked(Packet_Header* header, const char* data, std::shared_ptr<RemoteDesktop::SocketHandler>& sh){
 	auto copy = _Display;
@@ -281,6 +320,15 @@ void RemoteDesktop::Client::OnReceive(Packet_Header* header, const char* data, s
 	case (NetworkMessages::CLIPBOARDCHANGED) :
 		_Handle_ClipBoard(header, data, sh);
 		break;
+	case (NetworkMessages::CLIPBOARD_FORMATS) :
+		_Handle_ClipBoard_Formats(header, data, sh);
+		break;
+	case (NetworkMessages::CLIPBOARD_REQUEST) :
+		_Handle_ClipBoard_Request(header, data, sh);
+		break;
+	case (NetworkMessages::CLIPBOARD_DATA) :
+		_Handle_ClipBoard_Data(header, data, sh);
+		break;
 	case (NetworkMessages::UAC_BLOCKED) :
 		_Handle_UACBlocked(header, data, sh);
 		break;
@@ -1,6 +1,7 @@
 #ifndef CLIENT_H
 #define CLIENT_H
 #include "..\RemoteDesktop_Library\CommonNetwork.h"
+#include "..\RemoteDesktop_Library\Session_Recorder.h"
 
 namespace RemoteDesktop{
 
@@ -20,10 +21,16 @@ namespace RemoteDesktop{
 
 		HWND _HWND;
 
-		void OnDisconnect();
+		void OnDisconnect(std::shared_ptr<SocketHandler>& sh);
 		void OnConnect(std::shared_ptr<SocketHandler>& sh); 
-		void _OnClipboardChanged(const Clipboard_Data& c);
+		void _OnKeysSent(std::shared_ptr<SocketHandler>& sh);
+		bool _Requested = false;//the CONNECT_REQUEST of this connection already went out with the keys
+		void _OnClipboardChanged(const Clipboard_Announce_Header& h);
+		void _OnClipboardRequest(const Clipboard_Request_Header& h);
 		void _Handle_ClipBoard(Packet_Header* header, const char* data, std::shared_ptr<RemoteDesktop::SocketHandler>& sh);
+		void _Handle_ClipBoard_Formats(Packet_Header* header, const char* data, std::shared_ptr<RemoteDesktop::SocketHandler>& sh);
+		void _Handle_ClipBoard_Request(Packet_Header* header, const char* data, std::shared_ptr<RemoteDesktop::SocketHandler>& sh);
+		void _Handle_ClipBoard_Data(Packet_Header* header, const char* data, std::shared_ptr<RemoteDesktop::SocketHandler>& sh);
 		void _Handle_ResolutionChange(Packet_Header* header, const char* data, std::shared_ptr<RemoteDesktop::SocketHandler>& sh);
 		void _Handle_UpdateRegion(Packet_Header* header, const char* data, std::shared_ptr<RemoteDesktop::SocketHandler>& sh);
 		void _Handle_MouseChanged(Packet_Header* header, const char* data, std::shared_ptr<RemoteDesktop::SocketHandler>& sh);
@@ -44,6 +51,7 @@ namespace RemoteDesktop{
 		void SendFileOrFolder(std::string root1, std::string fullpath);
 		MouseEvent_Header _LastMouseEvent;
 		std::weak_ptr<RemoteDesktop::SocketHandler> Socket;
+		std::shared_ptr<Session_Recorder> _Recorder;//handed to each new connection, atomic_load/atomic_store only
 
 	public:
 		Client(HWND hwnd, void(__stdcall * onconnect)(), void(__stdcall * ondisconnect)(), void(__stdcall * oncursorchange)(int), void(__stdcall * ondisplaychanged)(int, int, int, int, int), void(__stdcall * onconnectingattempt)(int, int));
@@ -66,6 +74,14 @@ namespace RemoteDesktop{
 		void SetOnElevateSuccess(void(__stdcall * func)()){ _OnElevateSuccess = func; }
 
 		Traffic_Stats get_TrafficStats() const;
+		Traffic_Rates get_TrafficRates(int seconds) const;
+		long long get_TrafficMessageCount(int message_type, bool send) const;
+		long long get_TrafficSizePercentile(double p, bool send) const;
+
+		//records the current and any later connection to filename, an empty name stops recording
+		bool Record(std::wstring filename);
+		//feeds the messages received in a recording through the normal receive path without a network connection
+		Replay_Stats Replay(std::wstring filename, bool realtime);
 
 	};
 
@@ -1,6 +1,8 @@
 #include "stdafx.h"
 #include "DLL_API.h"
 #include "Client.h"
+#include "..\RemoteDesktop_Library\Profiler.h"
+#include "..\RemoteDesktop_Library\Encryption.h"
 
 void* __stdcall Create_Client(void* hwnd, void(__stdcall * onconnect)(), void(__stdcall * ondisconnect)(), void(__stdcall * oncursorchange)(int), void(__stdcall * ondisplaychanged)(int, int, int, int, int), void(__stdcall * onconnectingattempt)(int, int)){
 	return new RemoteDesktop::Client((HWND)hwnd, onconnect, ondisconnect, oncursorchange, ondisplaychanged, onconnectingattempt);
@@ -10,6 +12,7 @@ void __stdcall Destroy_Client(void* client){
 		auto c = (RemoteDesktop::Client*)client; 
 		delete c;
 	}
+	RemoteDesktop::Encryption::Shutdown();//joins the key pool's worker while the dll can still be unloaded safely
 }
 void __stdcall Connect(void* client,  wchar_t* port, wchar_t* ip_or_host,int id, wchar_t* aeskey){
 	if (client == NULL)return;
@@ -85,6 +88,72 @@ RemoteDesktop::Traffic_Stats __stdcall get_TrafficStats(void* client){
 	auto s= c->get_TrafficStats();
 	return s;
 }
+RemoteDesktop::Traffic_Rates __stdcall get_TrafficRates(void* client, int seconds){
+	if (client == NULL){
+		RemoteDesktop::Traffic_Rates tmp;
+		memset(&tmp, 0, sizeof(tmp));
+		return tmp;
+	}
+	auto c = (RemoteDesktop::Client*)client;
+	return c->get_TrafficRates(seconds);
+}
+long long __stdcall get_TrafficMessageCount(void* client, int message_type, bool send){
+	if (client == NULL) return 0;
+	auto c = (RemoteDesktop::Client*)client;
+	return c->get_TrafficMessageCount(message_type, send);
+}
+long long __stdcall get_TrafficSizePercentile(void* client, double p, bool send){
+	if (client == NULL) return 0;
+	auto c = (RemoteDesktop::Client*)client;
+	return c->get_TrafficSizePercentile(p, send);
+}
+void __stdcall set_FrameTracing(bool enabled){
+	RemoteDesktop::Frame_Tracer::set_Enabled(enabled);
+}
+bool __stdcall Record_Session(void* client, wchar_t* filename){
+	if (client == NULL) return false;
+	auto c = (RemoteDesktop::Client*)client;
+	return c->Record(filename == NULL ? std::wstring() : std::wstring(filename));
+}
+RemoteDesktop::Replay_Stats __stdcall Replay_Session(void* client, wchar_t* filename, bool realtime){
+	if (client == NULL || filename == NULL){
+		RemoteDesktop::Replay_Stats tmp;
+		memset(&tmp, 0, sizeof(tmp));
+		return tmp;
+	}
+	auto c = (RemoteDesktop::Client*)client;
+	return c->Replay(filename, realtime);
+}
+RemoteDesktop::Frame_Tracer::Stage_Stats __stdcall get_FrameStats(int stage){
+	if (stage < 0 || stage >= RemoteDesktop::Frame_Tracer::STAGE_COUNT){
+		RemoteDesktop::Frame_Tracer::Stage_Stats tmp;
+		memset(&tmp, 0, sizeof(tmp));
+		return tmp;
+	}
+	return RemoteDesktop::Frame_Tracer::get_Stats((RemoteDesktop::Frame_Tracer::Stages)stage);
+}
+void __stdcall set_Profiling(bool enabled){
+	RemoteDesktop::Profiler::set_Enabled(enabled);
+}
+bool __stdcall Save_Profile(wchar_t* filename){
+	if (filename == NULL) return false;
+	return RemoteDesktop::Profiler::Save(filename);
+}
+void __stdcall set_LockProfiling(bool enabled){
+	RemoteDesktop::Lock_Profiler::set_Enabled(enabled);
+}
+int __stdcall get_LockCount(){
+	return (int)RemoteDesktop::Lock_Profiler::get_Stats().size();
+}
+RemoteDesktop::Lock_Profiler::Lock_Stats __stdcall get_LockStats(int index){
+	auto stats = RemoteDesktop::Lock_Profiler::get_Stats();
+	if (index < 0 || index >= (int)stats.size()){
+		RemoteDesktop::Lock_Profiler::Lock_Stats tmp;
+		memset(&tmp, 0, sizeof(tmp));
+		return tmp;
+	}
+	return stats[index];
+}
 
 BOOL APIENTRY DllMain(HMODULE hModule,
 	DWORD  ul_reason_for_call,
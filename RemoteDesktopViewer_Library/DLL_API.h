@@ -2,6 +2,9 @@
 #define DLL_API123_H
 
 #include "..\RemoteDesktop_Library\CommonNetwork.h"
+#include "..\RemoteDesktop_Library\Frame_Tracer.h"
+#include "..\RemoteDesktop_Library\Session_Recorder.h"
+#include "..\RemoteDesktop_Library\Lock_Profiler.h"
 
 #define DLLEXPORT __declspec( dllexport )  
 
@@ -23,6 +26,22 @@ extern "C" {
 	DLLEXPORT void __stdcall SendFile(void* client, const char* absolute_path, const char* relative_path, void(__stdcall * onfilechanged)(int));
 	DLLEXPORT void __stdcall SendSettings(void* client, int img_quality, bool gray, bool shareclip);
 	DLLEXPORT RemoteDesktop::Traffic_Stats __stdcall get_TrafficStats(void* client);
+	DLLEXPORT RemoteDesktop::Traffic_Rates __stdcall get_TrafficRates(void* client, int seconds);
+	DLLEXPORT long long __stdcall get_TrafficMessageCount(void* client, int message_type, bool send);
+	DLLEXPORT long long __stdcall get_TrafficSizePercentile(void* client, double p, bool send);
+	//session recordings, pass a null or empty filename to stop recording
+	DLLEXPORT bool __stdcall Record_Session(void* client, wchar_t* filename);
+	DLLEXPORT RemoteDesktop::Replay_Stats __stdcall Replay_Session(void* client, wchar_t* filename, bool realtime);
+	//frame tracing is process wide, stage is a Frame_Tracer::Stages value
+	DLLEXPORT void __stdcall set_FrameTracing(bool enabled);
+	DLLEXPORT RemoteDesktop::Frame_Tracer::Stage_Stats __stdcall get_FrameStats(int stage);
+	//profiling zones are process wide too, the file is written in the chrome://tracing format
+	DLLEXPORT void __stdcall set_Profiling(bool enabled);
+	DLLEXPORT bool __stdcall Save_Profile(wchar_t* filename);
+	//lock contention is process wide as well, index runs from 0 to get_LockCount() - 1
+	DLLEXPORT void __stdcall set_LockProfiling(bool enabled);
+	DLLEXPORT int __stdcall get_LockCount();
+	DLLEXPORT RemoteDesktop::Lock_Profiler::Lock_Stats __stdcall get_LockStats(int index);
 		
 	//CALLBACKS
 	DLLEXPORT void __stdcall SetOnElevateFailed(void* client, void(__stdcall * func)());
@@ -2,10 +2,11 @@
 #include "Display.h"
 #include "..\RemoteDesktop_Library\Image.h"
 #include "CommonNetwork.h"
+#include "..\RemoteDesktop_Library\Frame_Tracer.h"
 #include <algorithm>
 
 RemoteDesktop::Display::Display(HWND hwnd, void(__stdcall * oncursorchange)(int)) : _HWND(hwnd), _OnCursorChange(oncursorchange),
-_Font(RAIIHFONT(CreateFont(36, 20, 0, 0, FW_DONTCARE, FALSE, FALSE, FALSE, DEFAULT_CHARSET, OUT_DEFAULT_PRECIS, CLIP_DEFAULT_PRECIS, CLEARTYPE_QUALITY, VARIABLE_PITCH, TEXT("Times New Roman")))){
+_Font(RAIIHFONT(CreateFont(36, 20, 0, 0, FW_DONTCARE, FALSE, FALSE, FALSE, DEFAULT_CHARSET, OUT_DEFAULT_PRECIS, CLIP_DEFAULT_PRECIS, CLEARTYPE_QUALITY, VARIABLE_PITCH, TEXT("Times New Roman")))), _DrawLock("display_draw"){
 	_System_Cursors = GetSystemCursors();
 
 	CURSORINFO cinfo;
@@ -36,7 +37,11 @@ void RemoteDesktop::Display::Draw(HDC hdc){
 		return;
 	}
 
-	std::lock_guard<std::mutex> lock(_DrawLock);
+	std::lock_guard<Profiled_Mutex> lock(_DrawLock);
+	if (_PresentPending != 0){
+		Frame_Tracer::Record(Frame_Tracer::STAGE_PRESENT, Frame_Tracer::Now() - _PresentPending);
+		_PresentPending = 0;
+	}
 
 	auto hMemDC(RAIIHDC(CreateCompatibleDC(hdc)));
 	auto xoffset = 0;
@@ -97,7 +102,7 @@ void RemoteDesktop::Display::Add(Image& img, New_Image_Header& h) {
 
 	img.Decompress();
 
-	std::lock_guard<std::mutex> lock(_DrawLock);
+	std::lock_guard<Profiled_Mutex> lock(_DrawLock);
 
 	auto hDC = GetDC(_HWND);
 	void* raw_data = nullptr;
@@ -139,7 +144,7 @@ void RemoteDesktop::Display::_CreateGreyedImages(){
 		bi.bmiHeader.biCompression = BI_RGB;
 		bi.bmiHeader.biSizeImage = ((a->Context.Width * bi.bmiHeader.biBitCount + 31) / 32) * 4 * a->Context.Height;
 
-		std::lock_guard<std::mutex> lock(_DrawLock);
+		std::lock_guard<Profiled_Mutex> lock(_DrawLock);
 
 		auto hDC = GetDC(_HWND);
 		void* raw_data = nullptr;
@@ -170,8 +175,9 @@ void RemoteDesktop::Display::Update(Image& img, Update_Image_Header& h){
 	if (!t) return;
 
 	img.Decompress();
-	std::lock_guard<std::mutex> lock(_DrawLock);
+	std::lock_guard<Profiled_Mutex> lock(_DrawLock);
 	Image::Copy(img, h.rect.left, h.rect.top, t->Context.Width * 4, (char*)t->raw_data, t->Context.Height, t->Context.Width);
+	if (_PresentPending == 0 && Frame_Tracer::get_Enabled()) _PresentPending = Frame_Tracer::Now();
 
 	InvalidateRect(_HWND, NULL, false);
 
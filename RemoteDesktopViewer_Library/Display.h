@@ -8,6 +8,7 @@
 #include "..\RemoteDesktop_Library\Handle_Wrapper.h"
 #include "..\RemoteDesktop_Library\Image.h"
 #include "..\RemoteDesktop_Library\CommonNetwork.h"
+#include "..\RemoteDesktop_Library\Lock_Profiler.h"
 
 namespace RemoteDesktop{
 	class HBITMAP_wrapper{
@@ -32,7 +33,7 @@ namespace RemoteDesktop{
 
 		RAIIHFONT_TYPE _Font;
 		HWND _HWND;
-		std::mutex _DrawLock;
+		Profiled_Mutex _DrawLock;
 	
 		std::vector<Cursor_Type> _System_Cursors;
 
@@ -41,6 +42,7 @@ namespace RemoteDesktop{
 		void(__stdcall * _OnCursorChange)(int c_type);
 		void _CreateGreyedImages();
 		bool _UAC_Block = false;
+		long long _PresentPending = 0;//Frame_Tracer time of the oldest update not yet painted
 
 	public:
 		Display(HWND hwnd, void(__stdcall * oncursorchange)(int));
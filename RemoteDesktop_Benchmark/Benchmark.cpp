@@ -0,0 +1,114 @@
+#include "stdafx.h"
+#include "Benchmark.h"
+#include "..\RemoteDesktop_Library\Allocation_Tracker.h"
+#include <algorithm>
+#include <ctime>
+
+#define BENCHMARK_SAMPLES 31 //batches timed per benchmark, the median of these is reported
+#define BENCHMARK_MINBATCH_US 2000 //a batch is grown until it takes at least this long so the timer resolution does not matter
+
+namespace RemoteDesktop{
+	namespace INTERNAL{
+		//user and kernel time of every thread in the process, in 100ns units
+		long long Process_Cpu(){
+			FILETIME created, exited, kernel, user;
+			if (!GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user)) return 0;
+			ULARGE_INTEGER k, u;
+			k.LowPart = kernel.dwLowDateTime;
+			k.HighPart = kernel.dwHighDateTime;
+			u.LowPart = user.dwLowDateTime;
+			u.HighPart = user.dwHighDateTime;
+			return (long long)(k.QuadPart + u.QuadPart);
+		}
+	}
+}
+
+RemoteDesktop::Benchmark_Runner::Benchmark_Runner(double minseconds, const std::string& filter) : _MinSeconds(minseconds), _Filter(filter){
+
+}
+bool RemoteDesktop::Benchmark_Runner::Enabled(const std::string& name) const{
+	return _Filter.empty() || name.find(_Filter) != std::string::npos;
+}
+void RemoteDesktop::Benchmark_Runner::Run(const std::string& name, const std::string& params, long long bytes, const std::function<void()>& body, bool steady){
+	if (!Enabled(name)) return;
+	body();//warm up caches and any lazily created buffers
+
+	long long batch = 1;
+	for (;;){//find a batch size that takes long enough to time reliably
+		Timer t(true);
+		for (long long i = 0; i < batch; i++) body();
+		t.Stop();
+		if (t.Elapsed_micro() >= BENCHMARK_MINBATCH_US || batch >= (1LL << 30)) break;
+		batch *= t.Elapsed_micro() > 0 ? std::max(2LL, BENCHMARK_MINBATCH_US / t.Elapsed_micro()) : 16;
+	}
+
+	std::vector<double> samples;
+	samples.reserve(BENCHMARK_SAMPLES);
+	auto budget = (long long)(_MinSeconds * 1000000.0);
+	long long spent = 0;
+	Allocation_Tracker::Allocation_Scope allocations;
+	auto cpu = INTERNAL::Process_Cpu();
+	while (samples.size() < 3 || (samples.size() < BENCHMARK_SAMPLES && spent < budget)){
+		Timer t(true);
+		for (long long i = 0; i < batch; i++) body();
+		t.Stop();
+		auto us = t.Elapsed_micro();
+		spent += us;
+		samples.push_back(us * 1000.0 / batch);
+	}
+
+	Benchmark_Result r;
+	r.Name = name;
+	r.Params = params;
+	r.Iterations = batch * (long long)samples.size();
+	r.Bytes = bytes;
+	r.Steady = steady;
+	r.Allocations = (double)allocations.get_Allocations() / r.Iterations;
+	r.Cpu_ns = (INTERNAL::Process_Cpu() - cpu) * 100.0 / r.Iterations;
+	r.Mean_ns = 0;
+	for (auto a : samples) r.Mean_ns += a;
+	r.Mean_ns /= samples.size();
+	std::sort(samples.begin(), samples.end());
+	r.Min_ns = samples.front();
+	r.Median_ns = samples[samples.size() / 2];
+	if (bytes > 0 && r.Median_ns > 0) r.MB_per_s = (bytes / (1024.0 * 1024.0)) / (r.Median_ns / 1000000000.0);
+	_Results.push_back(r);
+
+	if (bytes > 0) printf("%-32s %-28s %12.0f ns %12.0f ns min %10.1f MB/s %8.2f allocs\n", name.c_str(), params.c_str(), r.Median_ns, r.Min_ns, r.MB_per_s, r.Allocations);
+	else printf("%-32s %-28s %12.0f ns %12.0f ns min %24.2f allocs\n", name.c_str(), params.c_str(), r.Median_ns, r.Min_ns, r.Allocations);
+	if (steady && _Fail_On_Allocation && r.Allocations > 0){
+		printf("FAILED %s %s allocates in steady state\n", name.c_str(), params.c_str());
+		_Failures += 1;
+	}
+}
+
+bool RemoteDesktop::Benchmark_Runner::Check(bool ok, const std::string& name, const std::string& params, const std::string& expected){
+	if (ok) return true;
+	printf("FAILED %s %s %s\n", name.c_str(), params.c_str(), expected.c_str());
+	_Failures += 1;
+	return false;
+}
+std::string RemoteDesktop::Benchmark_Runner::to_Json() const{
+	std::string out;
+	char buffer[512];
+#if _DEBUG
+	auto config = "debug";
+#else
+	auto config = "release";
+#endif
+#if defined(_MSC_VER)
+	auto compiler = _MSC_VER;
+#else
+	auto compiler = 0;
+#endif
+	snprintf(buffer, sizeof(buffer), "{\n\"build\":{\"config\":\"%s\",\"compiler\":%d,\"pointer_bits\":%d,\"tsc\":%s,\"allocation_hooks\":%s,\"time\":%lld},\n\"results\":[\n", config, compiler, (int)(sizeof(void*) * 8), High_Clock::Using_TSC() ? "true" : "false", Allocation_Tracker::get_Hooked() ? "true" : "false", (long long)time(nullptr));
+	out += buffer;
+	for (size_t i = 0; i < _Results.size(); i++){
+		auto& r = _Results[i];
+		snprintf(buffer, sizeof(buffer), "{\"name\":\"%s\",\"params\":\"%s\",\"iterations\":%lld,\"bytes\":%lld,\"min_ns\":%.1f,\"median_ns\":%.1f,\"mean_ns\":%.1f,\"mb_per_s\":%.2f,\"cpu_ns\":%.1f,\"allocations\":%.3f,\"steady\":%s}%s\n",
+			r.Name.c_str(), r.Params.c_str(), r.Iterations, r.Bytes, r.Min_ns, r.Median_ns, r.Mean_ns, r.MB_per_s, r.Cpu_ns, r.Allocations, r.Steady ? "true" : "false", i + 1 < _Results.size() ? "," : "");
+		out += buffer;
+	}
+	out += "]\n}\n";
+	return out;
+}
@@ -0,0 +1,42 @@
+#ifndef BENCHMARK123_H
+#define BENCHMARK123_H
+#include <string>
+#include <vector>
+#include <functional>
+
+namespace RemoteDesktop{
+	struct Benchmark_Result{
+		std::string Name, Params;
+		long long Iterations = 0;
+		long long Bytes = 0;//processed by one iteration, 0 when throughput does not apply
+		double Min_ns = 0, Median_ns = 0, Mean_ns = 0;//per iteration
+		double MB_per_s = 0;//from the median
+		double Cpu_ns = 0;//process cpu time per iteration summed over every thread, higher than the wall time when the body keeps other threads busy
+		double Allocations = 0;//per iteration on the calling thread, only counted when the allocation hooks are in
+		bool Steady = false;//expected to run without touching the heap
+	};
+
+	//runs each body in batches until it has enough samples or used its time budget, then keeps the per iteration min, median and mean. Results are printed as they finish and can be written out as json to compare two builds
+	class Benchmark_Runner{
+		std::vector<Benchmark_Result> _Results;
+		double _MinSeconds;
+		std::string _Filter;
+		bool _Fail_On_Allocation = false;
+		int _Failures = 0;
+
+	public:
+		Benchmark_Runner(double minseconds, const std::string& filter);
+
+		bool Enabled(const std::string& name) const;//false when the name does not contain the filter, so expensive setup can be skipped
+		//steady marks a body that should not allocate once warmed up, with set_Fail_On_Allocation a steady body that does counts as a failure
+		void Run(const std::string& name, const std::string& params, long long bytes, const std::function<void()>& body, bool steady = false);
+		//for benchmarks that also assert what they measure, a false ok counts as a failure and prints what was expected
+		bool Check(bool ok, const std::string& name, const std::string& params, const std::string& expected);
+		void set_Fail_On_Allocation(bool f){ _Fail_On_Allocation = f; }
+		int get_Failures() const { return _Failures; }
+		const std::vector<Benchmark_Result>& get_Results() const { return _Results; }
+		std::string to_Json() const;
+	};
+}
+
+#endif
@@ -0,0 +1,1064 @@
+#include "stdafx.h"
+#include "Benchmarks.h"
+#include "Benchmark.h"
+#include "..\RemoteDesktop_Library\Image.h"
+#include "..\RemoteDesktop_Library\Compression_Handler.h"
+#include "..\RemoteDesktop_Library\Encryption.h"
+#include "..\RemoteDesktop_Library\SocketHandler.h"
+#include "..\RemoteDesktop_Library\NetworkSetup.h"
+#include "..\RemoteDesktop_Library\Concurrent_Queue.h"
+#include "..\RemoteDesktop_Library\Delegate.h"
+#include "..\RemoteDesktop_Library\Network_GatewayServer.h"
+#include "..\RemoteDesktop_Library\Gateway_Matchmaker.h"
+#include "..\RemoteDesktop_Library\Gateway_Socket.h"
+#include "..\RemoteDesktop_Library\Timer_Wheel.h"
+#include "..\RemoteDesktop_Library\Metrics.h"
+#include "..\RemoteDesktop_Library\Gateway.h"
+#include "..\RemoteDesktop_Library\Network_Mux.h"
+#include "..\RemoteDesktop_Library\Network_Client.h"
+#include <thread>
+#include <atomic>
+#include <deque>
+#include <future>
+#include <chrono>
+#include <psapi.h>
+
+#define BENCHMARK_QUEUE_ITEMS 100000 //items pushed through the queue per iteration
+#define BENCHMARK_GATEWAY_PORT L"45939"
+#define BENCHMARK_GATEWAY_BLOCK (1024 * 1024) //bytes received through the relay per iteration
+#define BENCHMARK_PARKED 100000 //servers waiting in the matchmaker
+#define BENCHMARK_ARRIVALS 1000 //viewers claiming a server per iteration
+#define BENCHMARK_CONNECTIONS 50000 //connections with a keepalive or idle timer
+#define BENCHMARK_IDLE_SESSIONS 10000
+#define BENCHMARK_FAIRNESS_RATE (8 * 1024 * 1024) //bytes per second the bulk session is capped at, stands in for a slow uplink
+#define BENCHMARK_PING_SIZE 64
+#define BENCHMARK_FAIRNESS_MAX_RTT 5000 //microseconds, the median round trip of the small session while the bulk one fills the shard
+#define BENCHMARK_FLOOD_MAX_RTT 5000 //microseconds, the median round trip of the live session while connections flood the gateway
+#define BENCHMARK_LINK_DELAY 20 //ms every write spends on the simulated link, one way
+#define BENCHMARK_BROADCAST_FRAME (64 * 1024) //bytes of each message the broadcasting server sends
+#define BENCHMARK_FLOOD_HELD 256 //connections the flood keeps open without sending anything, the oldest is closed for each new one
+#define BENCHMARK_ID_PORT L"45940" //the stub id service the reconnect benchmark asks
+#define BENCHMARK_MUX_SESSIONS 32 //sessions held open while the setup is timed, a multiplexing server keeps all of them on one shard
+#define BENCHMARK_MUX_MESSAGE (16 * MUX_WINDOW) //bytes of each message sent to the slow viewer, more than the gateway and loopback buffer between them
+#define BENCHMARK_MUX_STALL (3 * KEEPALIVE_INTERVAL) //ms the slow viewer stops reading for
+#define BENCHMARK_MUX_LATE 5000 //ms after the slow viewer reads again by which everything should have arrived
+
+namespace RemoteDesktop{
+	namespace INTERNAL{
+		struct Resolution{
+			int Width, Height;
+		};
+		const Resolution Benchmark_Resolutions[] = { { 1280, 720 }, { 1920, 1080 }, { 2560, 1440 } };
+		const int Benchmark_Qualities[] = { 30, 70, 90 };
+		const int Benchmark_Sizes[] = { 64, 1024, 64 * 1024, 1024 * 1024 };
+
+		std::string Benchmark_Params(const Resolution& r){
+			return std::to_string(r.Width) + "x" + std::to_string(r.Height);
+		}
+		unsigned int Benchmark_Random(unsigned int& state){
+			state = state * 1103515245 + 12345;
+			return state >> 16;
+		}
+		//looks roughly like a desktop: gradient wallpaper, flat title bars and lines of high contrast text
+		void Fill_Desktop(Image& img, unsigned int seed){
+			auto p = (unsigned int*)img.get_Data();
+			for (auto y = 0; y < img.Height; y++){
+				for (auto x = 0; x < img.Width; x++){
+					unsigned int c;
+					if ((y / 24) % 10 == 0) c = 0xFF2B579A;
+					else if ((x / 8 + y / 16) % 5 == 0 && (y % 16) < 12) c = (Benchmark_Random(seed) & 1) ? 0xFF000000 : 0xFFFFFFFF;
+					else c = 0xFF000000 | ((x * 255 / img.Width) << 16) | ((y * 255 / img.Height) << 8) | 0x80;
+					*p++ = c;
+				}
+			}
+		}
+		//a window sized change in the middle of the screen, like a dialog being painted
+		void Change_Region(Image& img, const Rect& r){
+			auto p = (unsigned int*)img.get_Data();
+			for (auto y = r.top; y < r.top + r.height; y++){
+				for (auto x = r.left; x < r.left + r.width; x++) p[y * img.Width + x] ^= 0x00FFFFFF;
+			}
+		}
+		std::vector<char> Fill_Payload(const std::string& kind, int size){
+			std::vector<char> v(size);
+			unsigned int seed = 42;
+			if (kind == "text"){
+				static const char words[] = "the quick brown fox jumps over the lazy dog while the server sends another frame ";
+				for (auto i = 0; i < size; i++) v[i] = words[(i + Benchmark_Random(seed) % 3) % (sizeof(words) - 1)];
+			}
+			else if (kind == "bitmap"){
+				Image img(64, 256);
+				Fill_Desktop(img, seed);
+				for (auto i = 0; i < size; i++) v[i] = img.get_Data()[i % img.size_in_bytes()];
+			}
+			else {
+				for (auto& a : v) a = (char)Benchmark_Random(seed);
+			}
+			return v;
+		}
+
+		//two SocketHandlers joined over loopback. The client sends a message, the server echoes it and the client waits for it, all on the calling thread by polling both sockets
+		class Socket_Round_Trip{
+			std::shared_ptr<SocketHandler> _Client, _Server;
+			Delegate<void, Packet_Header*, const char*, std::shared_ptr<SocketHandler>&> _OnReceive;
+			Delegate<void, std::shared_ptr<SocketHandler>&> _OnConnect;
+			Compression_Handler::Compression_Types _Compression = Compression_Handler::COMPRESSION_NONE;
+			int _Connected = 0, _Echoed = 0;
+
+			void _HandleConnect(std::shared_ptr<SocketHandler>& s){
+				_Connected += 1;
+			}
+			void _HandleReceive(Packet_Header* h, const char* d, std::shared_ptr<SocketHandler>& s){
+				if (s == _Server){
+					NetworkMsg msg;
+					msg.data.push_back(DataPackage(d, h->PayloadLen));
+					s->Send((NetworkMessages)h->Packet_Type, msg, _Compression);
+				}
+				else _Echoed += 1;
+			}
+			bool _Pump(){
+				for (auto s : { _Server, _Client }){
+					s->Receive();
+					if (SocketHandler::ProcessReceived(s, _OnReceive, _OnConnect) == Network_Return::FAILED) return false;
+				}
+				return true;
+			}
+			static bool _Socket_Pair(SOCKET& a, SOCKET& b){
+				a = b = INVALID_SOCKET;
+				auto listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+				if (listener == INVALID_SOCKET) return false;
+				sockaddr_in addr;
+				memset(&addr, 0, sizeof(addr));
+				addr.sin_family = AF_INET;
+				addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+				addr.sin_port = 0;//any free port
+				int len = sizeof(addr);
+				if (bind(listener, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 1) != 0 || getsockname(listener, (sockaddr*)&addr, &len) != 0){
+					closesocket(listener);
+					return false;
+				}
+				a = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+				if (a != INVALID_SOCKET && connect(a, (sockaddr*)&addr, sizeof(addr)) == 0) b = accept(listener, NULL, NULL);
+				closesocket(listener);
+				if (a == INVALID_SOCKET || b == INVALID_SOCKET) return false;
+				for (auto s : { a, b }){
+					u_long mode = 1;
+					ioctlsocket(s, FIONBIO, &mode);
+					int nodelay = 1;
+					setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (char*)&nodelay, sizeof(nodelay));
+				}
+				return true;
+			}
+		public:
+			Socket_Round_Trip(){
+				_OnReceive = DELEGATE(&RemoteDesktop::INTERNAL::Socket_Round_Trip::_HandleReceive);
+				_OnConnect = DELEGATE(&RemoteDesktop::INTERNAL::Socket_Round_Trip::_HandleConnect);
+			}
+			bool Connect(){
+				SOCKET a, b;
+				if (!_Socket_Pair(a, b)) return false;
+				_Client = std::make_shared<SocketHandler>(a, true);
+				_Server = std::make_shared<SocketHandler>(b, false);
+				_Server->Exchange_Keys(-1, -1, L"");
+				_Client->Exchange_Keys(-1, -1, L"");
+				while (_Connected < 2){
+					if (!_Pump()) return false;
+				}
+				return true;
+			}
+			void set_Compression(Compression_Handler::Compression_Types c){ _Compression = c; }
+			long long get_BufferBytes() const { return _Client->get_BufferBytes() + _Server->get_BufferBytes(); }
+			bool Round_Trip(const std::vector<char>& payload){
+				NetworkMsg msg;
+				msg.data.push_back(DataPackage(payload.data(), payload.size()));
+				auto target = _Echoed + 1;
+				if (_Client->Send(NetworkMessages::UPDATEREGION, msg, _Compression) == Network_Return::FAILED) return false;
+				while (_Echoed < target){
+					if (!_Pump()) return false;
+				}
+				return true;
+			}
+		};
+
+		//a viewer and a server SocketHandler joined by an in-memory link that holds every write for BENCHMARK_LINK_DELAY, all on the calling thread. Connect times the whole setup up to the viewer having its first keyframe. Sequential is how a viewer used to connect, the request after the key exchange and the keyframe compressed once it arrived. Pipelined sends the request with Send_Early and compresses the keyframe on another thread as soon as the keys agree, like the capture loop does while a viewer waits to be allowed
+		class Delayed_Connect{
+			typedef std::chrono::steady_clock Clock;
+			struct Flight{
+				Clock::time_point Due;
+				int Hops;//one way trips the data needed from the start of the connection, counting this one
+				std::vector<char> Data;
+			};
+			std::shared_ptr<SocketHandler> _Viewer, _Server;
+			std::deque<Flight> _ToViewer, _ToServer;
+			Delegate<void, Packet_Header*, const char*, std::shared_ptr<SocketHandler>&> _OnReceive;
+			Delegate<void, std::shared_ptr<SocketHandler>&> _OnConnect;
+			const Image& _Screen;
+			bool _Pipelined = false, _Requested = false, _Framed = false;
+			int _ViewerHops = 0, _ServerHops = 0, _FrameHops = 0;//the most each side has heard
+			std::future<Image> _Keyframe;
+
+			Network_Return _Request(std::shared_ptr<SocketHandler>& s, bool early){
+				User_Info_Header info;
+				memset(&info, 0, sizeof(info));
+				wcscpy_s(info.full_name, L"benchmark");
+				NetworkMsg msg;
+				msg.push_back(info);
+				return early ? s->Send_Early(NetworkMessages::CONNECT_REQUEST, msg) : s->Send(NetworkMessages::CONNECT_REQUEST, msg);
+			}
+			void _HandleConnect(std::shared_ptr<SocketHandler>& s){
+				if (s == _Viewer){
+					if (!_Requested) _Request(s, false);
+				}
+				else if (_Pipelined){
+					_Keyframe = std::async(std::launch::async, [this](){
+						auto img(_Screen.Clone());
+						img.Compress();
+						return img;
+					});
+				}
+			}
+			void _HandleReceive(Packet_Header* h, const char* d, std::shared_ptr<SocketHandler>& s){
+				if (s == _Viewer){
+					if (h->Packet_Type == NetworkMessages::RESOLUTIONCHANGE){
+						_Framed = true;
+						_FrameHops = _ViewerHops;
+					}
+					return;
+				}
+				if (h->Packet_Type != NetworkMessages::CONNECT_REQUEST) return;
+				Image img;
+				if (_Keyframe.valid()) img = _Keyframe.get();
+				else {
+					img = _Screen.Clone();
+					img.Compress();
+				}
+				New_Image_Header ih;
+				memset(&ih, 0, sizeof(ih));
+				ih.Width = _Screen.Width;
+				ih.Height = _Screen.Height;
+				NetworkMsg msg;
+				msg.push_back(ih);
+				msg.data.push_back(DataPackage(img.get_Data(), img.size_in_bytes()));
+				s->Send(NetworkMessages::RESOLUTIONCHANGE, msg);
+			}
+			bool _Deliver(std::deque<Flight>& q, std::shared_ptr<SocketHandler>& s, int& hops){
+				while (!q.empty() && q.front().Due <= Clock::now()){
+					auto f(std::move(q.front()));
+					q.pop_front();
+					hops = std::max(hops, f.Hops);
+					s->Receive(f.Data.data(), (int)f.Data.size());
+					if (SocketHandler::ProcessReceived(s, _OnReceive, _OnConnect) == Network_Return::FAILED) return false;
+				}
+				return true;
+			}
+			std::function<Network_Return(char*, int)> _Link(std::deque<Flight>& q, int& hops){
+				return [&q, &hops](char* d, int len){
+					Flight f;
+					f.Due = Clock::now() + std::chrono::milliseconds(BENCHMARK_LINK_DELAY);
+					f.Hops = hops + 1;
+					f.Data.assign(d, d + len);
+					q.push_back(std::move(f));
+					return Network_Return::COMPLETED;
+				};
+			}
+		public:
+			explicit Delayed_Connect(const Image& screen) : _Screen(screen){
+				_OnReceive = DELEGATE(&RemoteDesktop::INTERNAL::Delayed_Connect::_HandleReceive);
+				_OnConnect = DELEGATE(&RemoteDesktop::INTERNAL::Delayed_Connect::_HandleConnect);
+			}
+			//an empty aeskey means a plain key exchange, the request can then only go out once it finished
+			bool Connect(const std::wstring& aeskey, bool pipelined){
+				_Pipelined = pipelined;
+				_Requested = _Framed = false;
+				_ViewerHops = _ServerHops = _FrameHops = 0;
+				_ToViewer.clear();
+				_ToServer.clear();
+				_Viewer = std::make_shared<SocketHandler>(INVALID_SOCKET, true);
+				_Server = std::make_shared<SocketHandler>(INVALID_SOCKET, false);
+				_Viewer->Transport = _Link(_ToServer, _ViewerHops);
+				_Server->Transport = _Link(_ToViewer, _ServerHops);
+				_Server->Exchange_Keys(-1, 0, aeskey);
+				_Viewer->Exchange_Keys(0, -1, aeskey);
+				if (pipelined) _Requested = _Request(_Viewer, true) == Network_Return::COMPLETED;
+				auto giveup = Clock::now() + std::chrono::seconds(10);
+				while (!_Framed){
+					if (!_Deliver(_ToServer, _Server, _ServerHops) || !_Deliver(_ToViewer, _Viewer, _ViewerHops) || Clock::now() > giveup) return false;
+					std::this_thread::yield();//a sleep would round the delay up to the scheduler tick
+				}
+				return true;
+			}
+			//one way trips the first frame of the last Connect needed. Three when the request waits for the key exchange, two when it went out with the keys
+			int get_FrameHops() const { return _FrameHops; }
+		};
+	}
+}
+
+void RemoteDesktop::Benchmark_Image(Benchmark_Runner& runner){
+	for (auto& r : INTERNAL::Benchmark_Resolutions){
+		auto params = INTERNAL::Benchmark_Params(r);
+		auto bytes = (long long)r.Width * r.Height * 4;
+		Image first(r.Height, r.Width), second(r.Height, r.Width);
+		INTERNAL::Fill_Desktop(first, 1);
+		INTERNAL::Fill_Desktop(second, 1);
+		runner.Run("Image::Difference", params + " unchanged", bytes, [&](){ Image::Difference(first, second); }, true);
+		INTERNAL::Change_Region(second, Rect(r.Height / 2, r.Width / 2, 200, 100));
+		runner.Run("Image::Difference", params + " 200x100 changed", bytes, [&](){ Image::Difference(first, second); }, true);
+
+		Rect region(r.Height / 4, r.Width / 4, r.Width / 2, r.Height / 2);
+		runner.Run("Image::Copy", params + " quarter region", bytes / 4, [&](){ Image::Copy(first, region); });
+		std::vector<char> screen(bytes);
+		runner.Run("Image::Copy to screen", params, bytes, [&](){
+			Image::Copy(first, 0, 0, r.Width * 4, screen.data(), r.Height, r.Width);
+		}, true);
+		runner.Run("Image::Clone", params, bytes, [&](){ first.Clone(); });
+
+		auto quality = Image_Settings::Quality;
+		for (auto q : INTERNAL::Benchmark_Qualities){
+			Image_Settings::Quality = q;
+			auto qparams = params + " q" + std::to_string(q);
+			//Compress works in place so every iteration starts from a clone, Image::Clone above is that overhead
+			runner.Run("Image::Compress", qparams, bytes, [&](){
+				auto img(first.Clone());
+				img.Compress();
+			});
+			auto compressed(first.Clone());
+			compressed.Compress();
+			runner.Run("Image::Decompress", qparams, bytes, [&](){
+				auto img(Image::Create_from_Compressed_Data(compressed.get_Data(), compressed.size_in_bytes(), r.Height, r.Width));
+				img.Decompress();
+			});
+		}
+		Image_Settings::Quality = quality;
+	}
+}
+
+void RemoteDesktop::Benchmark_Compression(Benchmark_Runner& runner){
+	const char* kinds[] = { "text", "bitmap", "random" };
+	const int sizes[] = { 4 * 1024, 64 * 1024, 1024 * 1024 };
+	for (auto kind : kinds){
+		for (auto size : sizes){
+			auto payload = INTERNAL::Fill_Payload(kind, size);
+			std::vector<char> compressed(Compression_Handler::CompressionBound(size) + sizeof(int)), decompressed(size);
+			auto params = std::string(kind) + " " + std::to_string(size / 1024) + "KB";
+			runner.Run("Compression_Handler::Compress", params + " fast", size, [&](){
+				Compression_Handler::Compress(payload.data(), compressed.data(), size, compressed.size(), Compression_Handler::COMPRESSION_FAST);
+			}, true);
+			runner.Run("Compression_Handler::Compress", params + " high", size, [&](){
+				Compression_Handler::Compress(payload.data(), compressed.data(), size, compressed.size(), Compression_Handler::COMPRESSION_HIGH);
+			});
+			auto compressedsize = Compression_Handler::Compress(payload.data(), compressed.data(), size, compressed.size(), Compression_Handler::COMPRESSION_FAST);
+			if (compressedsize <= 0) continue;//not worth compressing, nothing to decompress
+			runner.Run("Compression_Handler::Decompress", params, size, [&](){
+				Compression_Handler::Decompress(compressed.data(), decompressed.data(), compressedsize, size);
+			}, true);
+		}
+	}
+}
+
+void RemoteDesktop::Benchmark_Encryption(Benchmark_Runner& runner){
+	runner.Run("Encryption::Key_Exchange", "fhmqv secp256r1", 0, [&](){
+		Encryption client, server;
+		client.Init(true);
+		server.Init(false);
+		client.Agree(server.get_Static_PublicKey(), server.get_Ephemeral_PublicKey(), false);
+		server.Agree(client.get_Static_PublicKey(), client.get_Ephemeral_PublicKey(), false);
+	});
+	//what one side of a reconnect storm costs, a server taking handshakes from viewers that did their half elsewhere. Process CPU includes the worker filling the ephemeral key pool, so the rate per core is what the whole handshake costs and not just the part on the connection's thread
+	Encryption peer;
+	peer.Init(true);
+	std::vector<char> peerstatic(peer.get_Static_PublicKey(), peer.get_Static_PublicKey() + peer.get_StaticPublicKeyLength());
+	std::vector<char> peerephemeral(peer.get_Ephemeral_PublicKey(), peer.get_Ephemeral_PublicKey() + peer.get_EphemeralPublicKeyLength());
+	runner.Run("Encryption::Key_Exchange", "fhmqv secp256r1 server side", 0, [&](){
+		Encryption server;
+		server.Init(false);
+		server.Agree(peerstatic.data(), peerephemeral.data(), false);
+	});
+	for (auto i = runner.get_Results().size() >= 2 ? runner.get_Results().size() - 2 : 0; i < runner.get_Results().size(); i++){
+		auto& r = runner.get_Results()[i];
+		if (r.Name == "Encryption::Key_Exchange" && r.Cpu_ns > 0) printf("%-32s %-28s %12.0f handshakes/s per core\n", r.Name.c_str(), r.Params.c_str(), 1000000000.0 / r.Cpu_ns);
+	}
+
+	Encryption e;
+	char key[32];
+	for (auto i = 0; i < (int)sizeof(key); i++) key[i] = (char)i;
+	e.set_AES_Key(key);
+	for (auto size : INTERNAL::Benchmark_Sizes){
+		auto payload = INTERNAL::Fill_Payload("random", size);
+		std::vector<char> out(size + IVSIZE * 2);
+		char iv[IVSIZE];
+		auto params = std::to_string(size) + "B";
+		runner.Run("Encryption::Ecrypt", params, size, [&](){ e.Ecrypt(payload.data(), out.data(), size, out.size(), iv); });
+		auto encrypted = e.Ecrypt(payload.data(), out.data(), size, out.size(), iv);
+		std::vector<char> plain(out.size());
+		runner.Run("Encryption::Decrypt", params, size, [&](){ e.Decrypt(out.data(), plain.data(), encrypted, iv); });
+	}
+}
+
+void RemoteDesktop::Benchmark_Socket(Benchmark_Runner& runner){
+	if (!runner.Enabled("SocketHandler")) return;
+	INTERNAL::Socket_Round_Trip rt;
+	if (!rt.Connect()){
+		printf("SocketHandler benchmarks skipped, could not connect over loopback\n");
+		return;
+	}
+	runner.Run("SocketHandler::Round_Trip", "handshake", 0, [&](){
+		INTERNAL::Socket_Round_Trip tmp;
+		tmp.Connect();
+	});
+	for (auto size : INTERNAL::Benchmark_Sizes){
+		auto payload = INTERNAL::Fill_Payload("bitmap", size);
+		auto params = std::to_string(size) + "B";
+		rt.set_Compression(Compression_Handler::COMPRESSION_NONE);
+		runner.Run("SocketHandler::Round_Trip", params + " uncompressed", size * 2, [&](){ rt.Round_Trip(payload); });
+		rt.set_Compression(Compression_Handler::COMPRESSION_FAST);
+		runner.Run("SocketHandler::Round_Trip", params + " fast", size * 2, [&](){ rt.Round_Trip(payload); });
+	}
+	//time to first frame, the pre-AES key stands in for the one the gateway hands both sides
+	Image screen(1080, 1920);
+	INTERNAL::Fill_Desktop(screen, 1);
+	INTERNAL::Delayed_Connect dc(screen);
+	const std::wstring keys[] = { L"", std::wstring(96, L'a') };
+	const bool pipelining[] = { false, true };
+	for (auto& key : keys){
+		for (auto pipelined : pipelining){
+			auto params = std::string(key.empty() ? "key exchange" : "pre-AES key") + (pipelined ? " pipelined" : " sequential") + " " + std::to_string(BENCHMARK_LINK_DELAY) + "ms link";
+			auto failed = false;
+			runner.Run("SocketHandler::First_Frame", params, 0, [&](){
+				if (!dc.Connect(key, pipelined)) failed = true;
+			});
+			if (failed) printf("SocketHandler::First_Frame %s did not get a frame\n", params.c_str());
+			if (pipelined && !key.empty()) runner.Check(!failed && dc.get_FrameHops() == 2, "SocketHandler::First_Frame", params, "the frame a single round trip in, the request sent before the keys were agreed");
+		}
+	}
+}
+
+namespace RemoteDesktop{
+	namespace INTERNAL{
+		void Process_Memory(long long& workingset, long long& privatebytes){
+			PROCESS_MEMORY_COUNTERS_EX m;
+			memset(&m, 0, sizeof(m));
+			GetProcessMemoryInfo(GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS*)&m, sizeof(m));
+			workingset = (long long)m.WorkingSetSize;
+			privatebytes = (long long)m.PrivateUsage;
+		}
+	}
+}
+//not timed, prints what idle connections cost
+void RemoteDesktop::Benchmark_Memory(Benchmark_Runner& runner){
+	if (!runner.Enabled("Memory")) return;
+	long long ws, pb, ws2, pb2;
+	INTERNAL::Process_Memory(ws, pb);
+	std::vector<std::shared_ptr<SocketHandler>> sessions;
+	long long buffers = 0;
+	for (auto i = 0; i < BENCHMARK_IDLE_SESSIONS; i++){
+		sessions.push_back(std::make_shared<SocketHandler>(INVALID_SOCKET, false));
+		buffers += sessions.back()->get_BufferBytes();
+	}
+	INTERNAL::Process_Memory(ws2, pb2);
+	printf("%-32s %-28s %12.1f MB working set %12.1f MB private, %lld bytes of buffers each\n", "Memory::Idle", (std::to_string(BENCHMARK_IDLE_SESSIONS) + " sessions").c_str(),
+		(ws2 - ws) / (1024.0 * 1024.0), (pb2 - pb) / (1024.0 * 1024.0), buffers / BENCHMARK_IDLE_SESSIONS);
+	sessions.clear();
+
+	//one busy connection going quiet, the keepalive after SOCKET_BUFFER_IDLE gives its buffers back
+	INTERNAL::Socket_Round_Trip rt;
+	if (!rt.Connect()) return;
+	auto payload = INTERNAL::Fill_Payload("bitmap", 1024 * 1024);
+	rt.Round_Trip(payload);
+	auto busy = rt.get_BufferBytes();
+	std::this_thread::sleep_for(std::chrono::milliseconds(SOCKET_BUFFER_IDLE + 100));
+	rt.Round_Trip(std::vector<char>(16));
+	printf("%-32s %-28s %12lld bytes busy %12lld bytes once quiet\n", "Memory::Shrink", "1MB messages", busy, rt.get_BufferBytes());
+}
+
+void RemoteDesktop::Benchmark_Queue(Benchmark_Runner& runner){
+	const int threads[] = { 1, 2, 4 };
+	for (auto t : threads){
+		auto params = std::to_string(t) + "x" + std::to_string(t) + " threads " + std::to_string(BENCHMARK_QUEUE_ITEMS) + " items";
+		Concurrent_Queue<int> q;//outside the body, its destructor sleeps
+		//the reported time is for the whole batch of items and includes starting the threads
+		runner.Run("Concurrent_Queue", params, 0, [&](){
+			std::vector<std::thread> workers;
+			auto share = BENCHMARK_QUEUE_ITEMS / t;
+			for (auto i = 0; i < t; i++){
+				workers.emplace_back([&q, share](){ for (auto j = 0; j < share; j++) q.push(j); });
+				workers.emplace_back([&q, share](){ for (auto j = 0; j < share; j++) q.pop(); });
+			}
+			for (auto& a : workers) a.join();
+		});
+	}
+}
+
+namespace RemoteDesktop{
+	namespace INTERNAL{
+		//a plain blocking socket that announces itself to the gateway and waits for the header of its peer
+		SOCKET Gateway_Connect(int dst_id, int src_id){
+			auto s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+			if (s == INVALID_SOCKET) return s;
+			sockaddr_in addr;
+			memset(&addr, 0, sizeof(addr));
+			addr.sin_family = AF_INET;
+			addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			addr.sin_port = htons((unsigned short)std::stoi(BENCHMARK_GATEWAY_PORT));
+			Proxy_Header h;
+			h.Dst_Id = dst_id;
+			h.Src_Id = src_id;
+			for (auto i = 0; i < 50; i++){//the gateway starts listening on its own thread
+				if (connect(s, (sockaddr*)&addr, sizeof(addr)) == 0){
+					if (send(s, (char*)&h, sizeof(h), 0) == sizeof(h)) return s;
+					break;
+				}
+				std::this_thread::sleep_for(std::chrono::milliseconds(20));
+			}
+			closesocket(s);
+			return INVALID_SOCKET;
+		}
+		bool Receive_All(SOCKET s, char* data, int len){
+			while (len > 0){
+				auto r = recv(s, data, len, 0);
+				if (r <= 0) return false;
+				data += r;
+				len -= r;
+			}
+			return true;
+		}
+		//connects both sides of session id and waits until the gateway forwarded each header, whatever did connect is in server and viewer
+		bool Gateway_Pair(int id, SOCKET& server, SOCKET& viewer){
+			Proxy_Header h;
+			server = Gateway_Connect(-1, id);
+			viewer = server != INVALID_SOCKET ? Gateway_Connect(id, -1) : INVALID_SOCKET;
+			return viewer != INVALID_SOCKET && Receive_All(server, (char*)&h, sizeof(h)) && Receive_All(viewer, (char*)&h, sizeof(h));
+		}
+		//a paired session that bounces small messages, the server side echoes them on its own thread. What the gateway does to its round trip is what the fairness and flood benchmarks measure
+		struct Ping_Session{
+			SOCKET Server = INVALID_SOCKET, Viewer = INVALID_SOCKET;
+			std::thread Echo;
+			bool Pair(int id){
+				if (!Gateway_Pair(id, Server, Viewer)) return false;
+				for (auto a : { Server, Viewer }){
+					int nodelay = 1;
+					setsockopt(a, IPPROTO_TCP, TCP_NODELAY, (char*)&nodelay, sizeof(nodelay));
+				}
+				auto server = Server;
+				Echo = std::thread([server](){
+					char ping[BENCHMARK_PING_SIZE];
+					while (Receive_All(server, ping, sizeof(ping))){
+						if (send(server, ping, sizeof(ping), 0) != sizeof(ping)) break;
+					}
+				});
+				return true;
+			}
+			void Round_Trip(){
+				char ping[BENCHMARK_PING_SIZE] = {};
+				send(Viewer, ping, sizeof(ping), 0);
+				Receive_All(Viewer, ping, sizeof(ping));
+			}
+			//the gateway drops the server with the viewer, which wakes up the echo. Call it before the gateway stops
+			void Close(){
+				if (Viewer != INVALID_SOCKET) closesocket(Viewer);
+				if (Echo.joinable()) Echo.join();
+				if (Server != INVALID_SOCKET) closesocket(Server);
+				Server = Viewer = INVALID_SOCKET;
+			}
+		};
+		//reads the frames a multiplexing server gets until the gateway opens a stream, the close of the last one and keepalive answers are skipped
+		bool Mux_Wait_Open(SOCKET s){
+			Mux_Header h;
+			std::vector<char> body;
+			while (Receive_All(s, (char*)&h, sizeof(h))){
+				body.resize(h.Type == MUX_DATA || h.Type == MUX_OPEN ? h.Length : 0);
+				if (!body.empty() && !Receive_All(s, body.data(), (int)body.size())) return false;
+				if (h.Type == MUX_OPEN) return true;
+			}
+			return false;
+		}
+		//reads what a broadcasting server gets until one viewer sent len bytes, the gateway's keepalives and the other frames are skipped. slot is the spectator it came from, 0 for the viewer in control
+		bool Broadcast_Wait(SOCKET s, int type, int len, int& slot){
+			Broadcast_Header h;
+			std::vector<char> body;
+			auto got = 0;
+			while (got < len && Receive_All(s, (char*)&h, sizeof(h))){
+				body.resize(h.Length);
+				if (!body.empty() && !Receive_All(s, body.data(), (int)body.size())) return false;
+				if (h.Type != type || (got > 0 && h.Slot != slot)) continue;
+				slot = h.Slot;
+				got += h.Length;
+			}
+			return got >= len;
+		}
+		//a frame from the broadcasting server, the header and the message go out in one send
+		bool Broadcast_Send(SOCKET s, std::vector<char>& frame, int type, int slot){
+			auto h = (Broadcast_Header*)frame.data();
+			h->Type = type;
+			h->Slot = slot;
+			h->Length = (int)(frame.size() - sizeof(Broadcast_Header));
+			return send(s, frame.data(), (int)frame.size(), 0) == (int)frame.size();
+		}
+	}
+}
+
+void RemoteDesktop::Benchmark_Timers(Benchmark_Runner& runner){
+	if (!runner.Enabled("Timers")) return;
+	struct Connection{
+		long long Last_Received;
+	};
+	std::vector<std::shared_ptr<Connection>> connections;
+	for (auto i = 0; i < BENCHMARK_CONNECTIONS; i++) connections.push_back(std::make_shared<Connection>());
+	auto params = std::to_string(BENCHMARK_CONNECTIONS) + " connections 1s";
+	//every iteration is one second of made up time in steps of the timer resolution, the connections are spread over the second
+	long long now = 0;
+	Connection_Timers<Connection> keepalives(now);
+	for (size_t i = 0; i < connections.size(); i++) keepalives.Add(connections[i], (long long)(i % 10 + 1) * CONNECTION_TIMER_RESOLUTION);
+	runner.Run("Timers::Wheel keepalive", params, 0, [&](){
+		for (auto i = 0; i < KEEPALIVE_INTERVAL / CONNECTION_TIMER_RESOLUTION; i++){
+			now += CONNECTION_TIMER_RESOLUTION;
+			keepalives.Advance(now, [](std::shared_ptr<Connection>& c, long long now){ return now + KEEPALIVE_INTERVAL; });
+		}
+	});
+
+	//the idle timeout alone, a busy connection is only looked at once per IDLE_TIMEOUT
+	now = 0;
+	Connection_Timers<Connection> idle(now);
+	for (size_t i = 0; i < connections.size(); i++) idle.Add(connections[i], (long long)(i % (IDLE_TIMEOUT / CONNECTION_TIMER_RESOLUTION) + 1) * CONNECTION_TIMER_RESOLUTION);
+	runner.Run("Timers::Wheel idle", params, 0, [&](){
+		for (auto i = 0; i < KEEPALIVE_INTERVAL / CONNECTION_TIMER_RESOLUTION; i++){
+			now += CONNECTION_TIMER_RESOLUTION;
+			idle.Advance(now, [](std::shared_ptr<Connection>& c, long long now){
+				c->Last_Received = now;//pretend it has been busy
+				return c->Last_Received + IDLE_TIMEOUT;
+			});
+		}
+	});
+
+	//what the network loops did before, every connection once a second
+	runner.Run("Timers::Scan", params, 0, [&](){
+		now += KEEPALIVE_INTERVAL;
+		for (auto& c : connections){
+			if (now - c->Last_Received >= IDLE_TIMEOUT) c->Last_Received = now;
+		}
+	});
+}
+void RemoteDesktop::Benchmark_Matchmaker(Benchmark_Runner& runner){
+	if (!runner.Enabled("Gateway")) return;
+	//no sockets behind these, the matchmaker only looks at the ids
+	auto fake = [](Gateway_Socket::ConnectionTypes type, int id){
+		auto s = std::make_shared<Gateway_Socket>(INVALID_SOCKET, nullptr);
+		s->Type = type;
+		if (type == Gateway_Socket::SERVER) s->Src_ID = id;
+		else s->Dst_ID = id;
+		return s;
+	};
+	std::vector<std::shared_ptr<Gateway_Socket>> servers;
+	for (auto i = 0; i < BENCHMARK_PARKED; i++) servers.push_back(fake(Gateway_Socket::SERVER, i));
+	auto viewer = fake(Gateway_Socket::VIEWER, 0);
+	std::shared_ptr<Gateway_Socket> peer, server, replaced;
+	long long now = 0;
+
+	Gateway_Matchmaker matchmaker(now);
+	for (auto& a : servers) matchmaker.Match(a, now, peer, replaced);
+	auto params = std::to_string(BENCHMARK_PARKED) + " parked " + std::to_string(BENCHMARK_ARRIVALS) + " viewers";
+	unsigned int seed = 7;
+	//a storm of viewers each claiming a random server, which reconnects and parks again right away
+	runner.Run("Gateway::Matchmaker claim", params, 0, [&](){
+		for (auto i = 0; i < BENCHMARK_ARRIVALS; i++){
+			viewer->Dst_ID = (int)(INTERNAL::Benchmark_Random(seed) % BENCHMARK_PARKED);
+			if (matchmaker.Match(viewer, now, peer, replaced) == Gateway_Matchmaker::MATCHED) matchmaker.Match(peer, now, server, replaced);
+		}
+	});
+
+	//every server arrives and then nobody comes for any of them
+	params = std::to_string(BENCHMARK_PARKED) + " parked";
+	std::vector<std::shared_ptr<Gateway_Socket>> expired;
+	runner.Run("Gateway::Matchmaker expire", params, 0, [&](){
+		Gateway_Matchmaker m(now);
+		for (auto& a : servers) m.Match(a, now, peer, replaced);
+		expired.clear();
+		m.Expire(now + MATCHMAKER_SERVER_TIMEOUT, expired);
+	});
+	if (expired.size() != BENCHMARK_PARKED) printf("Gateway::Matchmaker expire only dropped %d of %d\n", (int)expired.size(), BENCHMARK_PARKED);
+}
+void RemoteDesktop::Benchmark_Gateway(Benchmark_Runner& runner){
+	if (!runner.Enabled("Gateway")) return;
+	const int sessions[] = { 1, 4, 16 };
+	for (auto count : sessions){
+		GatewayServer gateway(nullptr, nullptr);
+		gateway.Start(BENCHMARK_GATEWAY_PORT, L"");
+		std::vector<SOCKET> servers, viewers;
+		auto paired = true;
+		for (auto i = 0; i < count && paired; i++){
+			SOCKET server, viewer;
+			paired = INTERNAL::Gateway_Pair(i, server, viewer);
+			if (server != INVALID_SOCKET) servers.push_back(server);
+			if (viewer != INVALID_SOCKET) viewers.push_back(viewer);
+		}
+		if (!paired){
+			printf("Gateway benchmarks skipped, could not pair over loopback\n");
+			for (auto a : servers) closesocket(a);
+			for (auto a : viewers) closesocket(a);
+			gateway.Stop(true);
+			return;
+		}
+		//every viewer streams as fast as the relay takes it, the timed body drains one block from each server
+		std::atomic<bool> running(true);
+		std::vector<std::thread> senders;
+		for (auto viewer : viewers){
+			senders.emplace_back([&running, viewer](){
+				auto payload = INTERNAL::Fill_Payload("random", 64 * 1024);
+				while (running){
+					if (send(viewer, payload.data(), payload.size(), 0) <= 0) break;
+				}
+			});
+		}
+		std::vector<char> block(BENCHMARK_GATEWAY_BLOCK);
+		auto relayed = gateway.get_Stats().Relayed;
+		auto params = std::to_string(count) + " sessions 1MB blocks";
+		runner.Run("Gateway::Relay", params, (long long)BENCHMARK_GATEWAY_BLOCK * count, [&](){
+			for (auto server : servers) INTERNAL::Receive_All(server, block.data(), block.size());
+		});
+		relayed = gateway.get_Stats().Relayed - relayed;
+
+		auto& r = runner.get_Results().back();
+		//the cpu time covers the gateway threads and both ends of the loopback connections
+		auto gbit = BENCHMARK_GATEWAY_BLOCK * 8.0 * count / 1000000000.0;
+		printf("%-32s %-28s %12.3f cpu seconds per Gbit, %lld bytes relayed\n", "Gateway::Relay", params.c_str(), r.Cpu_ns / 1000000000.0 / gbit, relayed);
+
+		running = false;
+		for (auto a : servers) closesocket(a);//the gateway drops the viewers with them, which wakes up the senders
+		for (auto& a : senders) a.join();
+		for (auto a : viewers) closesocket(a);
+		gateway.Stop(true);
+	}
+	//one session streams as fast as the relay takes it while a second one on the same shard bounces small messages, the round trip of the second is what the scheduling in Gateway_Shard is for. Run once with the bulk session uncapped and once capped the way a slow link would hold it back
+	const long long caps[] = { 0, BENCHMARK_FAIRNESS_RATE };
+	for (auto cap : caps){
+		GatewayServer gateway(nullptr, nullptr);
+		gateway.Start(BENCHMARK_GATEWAY_PORT, L"", 1);
+		gateway.set_Session_Limits(0, cap, 1);
+		SOCKET bulkserver, bulkviewer;
+		INTERNAL::Ping_Session ping;
+		auto paired = INTERNAL::Gateway_Pair(0, bulkserver, bulkviewer) && ping.Pair(1);
+		if (!paired){
+			printf("Gateway::Fairness skipped, could not pair over loopback\n");
+			for (auto a : { bulkserver, bulkviewer }) if (a != INVALID_SOCKET) closesocket(a);
+			ping.Close();
+			gateway.Stop(true);
+			return;
+		}
+		std::atomic<bool> running(true);
+		std::atomic<long long> drained(0);
+		std::thread sender([&running, bulkviewer](){
+			auto payload = INTERNAL::Fill_Payload("random", 64 * 1024);
+			while (running){
+				if (send(bulkviewer, payload.data(), payload.size(), 0) <= 0) break;
+			}
+		});
+		std::thread drain([&drained, bulkserver](){
+			std::vector<char> buffer(64 * 1024);
+			while (true){
+				auto r = recv(bulkserver, buffer.data(), buffer.size(), 0);
+				if (r <= 0) break;
+				drained += r;
+			}
+		});
+		auto params = cap == 0 ? std::string("bulk uncapped") : "bulk capped " + std::to_string(cap / (1024 * 1024)) + "MB/s";
+		auto start = std::chrono::steady_clock::now();
+		auto before = drained.load();
+		runner.Run("Gateway::Fairness", params, 0, [&](){ ping.Round_Trip(); });
+		auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		printf("%-32s %-28s %12.1f MB/s through the bulk session meanwhile\n", "Gateway::Fairness", params.c_str(), (drained - before) / seconds / (1024.0 * 1024.0));
+		runner.Check(drained > before, "Gateway::Fairness", params, "the bulk session to move data while the pings ran");
+		runner.Check(runner.get_Results().back().Median_ns <= BENCHMARK_FAIRNESS_MAX_RTT * 1000.0, "Gateway::Fairness", params, "a median round trip under " + std::to_string(BENCHMARK_FAIRNESS_MAX_RTT) + "us");
+
+		running = false;
+		closesocket(bulkserver);//the gateway drops the viewer with it, which wakes up the sender
+		for (auto a : { &sender, &drain }) a->join();
+		closesocket(bulkviewer);
+		ping.Close();
+		gateway.Stop(true);
+	}
+	//one broadcasting server and its viewers, the first controls it and the rest are spectators the server allowed. The timed body sends one frame and waits until every viewer has it, the join is a spectator arriving late, being allowed and getting the greeting and the last refresh
+	const int audiences[] = { 1, 4, 16 };
+	for (auto count : audiences){
+		GatewayServer gateway(nullptr, nullptr);
+		gateway.Start(BENCHMARK_GATEWAY_PORT, L"");
+		std::vector<char> greeting(sizeof(Proxy_Header) + Encryption::get_KeyExchangeLength());
+		auto keys = greeting.data() + sizeof(Proxy_Header);
+		auto keylength = (int)(greeting.size() - sizeof(Proxy_Header));
+		std::vector<char> frame(sizeof(Broadcast_Header) + sizeof(int) + BENCHMARK_BROADCAST_FRAME);
+		auto message = frame.data() + sizeof(Broadcast_Header);//what the viewers get
+		auto messagelength = (int)(frame.size() - sizeof(Broadcast_Header));
+		auto len = BENCHMARK_BROADCAST_FRAME;
+		memcpy(message, &len, sizeof(len));
+		std::vector<char> received(messagelength);
+		std::vector<char> answer(sizeof(Broadcast_Header));
+		std::vector<SOCKET> viewers;
+		auto server = INTERNAL::Gateway_Connect(GATEWAY_BROADCAST, 0);
+		//a spectator gets the greeting, sends its half of the key exchange and waits for the server to answer it
+		auto spectate = [&](int type){
+			auto s = INTERNAL::Gateway_Connect(0, -1);
+			if (s == INVALID_SOCKET) return s;
+			DWORD timeout = 5000;//a spectator the gateway forgot to drop fails the check instead of hanging
+			setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (char*)&timeout, sizeof(timeout));
+			auto slot = 0;
+			if (INTERNAL::Receive_All(s, greeting.data(), (int)greeting.size()) && send(s, keys, keylength, 0) == keylength && INTERNAL::Broadcast_Wait(server, BROADCAST_SPECTATOR, (int)greeting.size(), slot) && INTERNAL::Broadcast_Send(server, answer, type, slot)) return s;
+			closesocket(s);
+			return INVALID_SOCKET;
+		};
+		auto connected = server != INVALID_SOCKET;
+		if (connected){//the viewer in control, the server sees its header and key exchange in BROADCAST_DATA
+			auto controller = INTERNAL::Gateway_Connect(0, -1);
+			auto slot = 0;
+			if (controller != INVALID_SOCKET) viewers.push_back(controller);
+			connected = controller != INVALID_SOCKET && send(controller, keys, keylength, 0) == keylength && INTERNAL::Broadcast_Wait(server, BROADCAST_DATA, (int)greeting.size(), slot);
+		}
+		if (connected){//the server's half of the fake key exchange and a keyframe for a single monitor
+			connected = send(server, keys, keylength, 0) == keylength && INTERNAL::Broadcast_Send(server, frame, BROADCAST_KEYFRAME, 0);
+		}
+		for (auto i = 1; i < count && connected; i++){
+			auto s = spectate(BROADCAST_ALLOW);
+			if (s != INVALID_SOCKET) viewers.push_back(s);
+			connected = s != INVALID_SOCKET;
+		}
+		for (size_t i = 0; i < viewers.size() && connected; i++){//the spectators had the greeting already
+			connected = (i > 0 || INTERNAL::Receive_All(viewers[i], greeting.data(), (int)greeting.size())) && INTERNAL::Receive_All(viewers[i], received.data(), messagelength);
+		}
+		if (!connected){
+			printf("Gateway::Broadcast skipped, could not connect over loopback\n");
+			for (auto a : viewers) closesocket(a);
+			if (server != INVALID_SOCKET) closesocket(server);
+			gateway.Stop(true);
+			return;
+		}
+		auto params = std::to_string(count) + " viewers 64KB frames";
+		runner.Check(memcmp(received.data(), &len, sizeof(len)) == 0, "Gateway::Broadcast", params, "the viewers to get the keyframe without the Broadcast_Header");
+		runner.Run("Gateway::Broadcast", params, (long long)messagelength * count, [&](){
+			INTERNAL::Broadcast_Send(server, frame, BROADCAST_MESSAGE, 0);
+			for (auto a : viewers) INTERNAL::Receive_All(a, received.data(), messagelength);
+		});
+		auto stats = gateway.get_Stats();
+		printf("%-32s %-28s %12lld spectators %lld sessions\n", "Gateway::Broadcast", params.c_str(), stats.Spectators, stats.Sessions);
+		//the viewers already watching skip a refresh, a late spectator starts from it so the join only costs the greeting and the picture
+		message[sizeof(len)] = 'R';
+		INTERNAL::Broadcast_Send(server, frame, BROADCAST_REFRESH, 0);
+		message[sizeof(len)] = 'M';
+		INTERNAL::Broadcast_Send(server, frame, BROADCAST_MESSAGE, 0);
+		auto skipped = true;
+		for (auto a : viewers) skipped = INTERNAL::Receive_All(a, received.data(), messagelength) && received[sizeof(len)] == 'M' && skipped;
+		runner.Check(skipped, "Gateway::Broadcast", params, "the viewers already watching to skip the refresh");
+		auto late = spectate(BROADCAST_ALLOW);
+		auto refreshed = late != INVALID_SOCKET && INTERNAL::Receive_All(late, received.data(), messagelength) && received[sizeof(len)] == 'R' && INTERNAL::Receive_All(late, received.data(), messagelength) && received[sizeof(len)] == 'M';
+		if (late != INVALID_SOCKET) closesocket(late);
+		runner.Check(refreshed, "Gateway::Broadcast", params, "a late spectator to start at the refresh");
+		auto denied = spectate(BROADCAST_DENY);
+		char c;
+		auto dropped = denied != INVALID_SOCKET && recv(denied, &c, 1, 0) == 0;
+		if (denied != INVALID_SOCKET) closesocket(denied);
+		runner.Check(dropped, "Gateway::Broadcast", params, "a denied spectator to be closed without seeing the stream");
+		runner.Run("Gateway::Broadcast join", params, 0, [&](){
+			auto s = spectate(BROADCAST_ALLOW);
+			if (s == INVALID_SOCKET) return;
+			INTERNAL::Receive_All(s, received.data(), messagelength);
+			INTERNAL::Receive_All(s, received.data(), messagelength);
+			closesocket(s);
+		});
+		closesocket(server);//the gateway drops every viewer with it
+		for (auto a : viewers) closesocket(a);
+		gateway.Stop(true);
+	}
+	//a live session bounces small messages while another thread opens connections as fast as loopback allows and never sends a header, the round trip should look like the one without the flood
+	const bool floods[] = { false, true };
+	for (auto flooding : floods){
+		GatewayServer gateway(nullptr, nullptr);
+		gateway.Start(BENCHMARK_GATEWAY_PORT, L"", 1);
+		INTERNAL::Ping_Session ping;
+		if (!ping.Pair(0)){
+			printf("Gateway::Flood skipped, could not pair over loopback\n");
+			ping.Close();
+			gateway.Stop(true);
+			return;
+		}
+		std::atomic<bool> running(true);
+		std::atomic<long long> opened(0);
+		std::thread flood([&running, &opened, flooding](){
+			sockaddr_in addr;
+			memset(&addr, 0, sizeof(addr));
+			addr.sin_family = AF_INET;
+			addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			addr.sin_port = htons((unsigned short)std::stoi(BENCHMARK_GATEWAY_PORT));
+			std::deque<SOCKET> held;
+			while (running && flooding){
+				auto s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+				if (s == INVALID_SOCKET) break;
+				if (connect(s, (sockaddr*)&addr, sizeof(addr)) != 0){
+					closesocket(s);
+					continue;
+				}
+				opened += 1;
+				held.push_back(s);
+				if (held.size() <= BENCHMARK_FLOOD_HELD) continue;
+				closesocket(held.front());
+				held.pop_front();
+			}
+			for (auto a : held) closesocket(a);
+		});
+		auto& refused = Metrics::Counter("rd_gateway_rejected_total", "");
+		auto before = refused.get_Value();
+		auto start = std::chrono::steady_clock::now();
+		auto params = flooding ? std::string("connection flood") : std::string("quiet");
+		runner.Run("Gateway::Flood", params, 0, [&](){ ping.Round_Trip(); });
+		auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		printf("%-32s %-28s %12.0f connections per second, %lld refused\n", "Gateway::Flood", params.c_str(), opened / seconds, refused.get_Value() - before);
+
+		runner.Check(runner.get_Results().back().Median_ns <= BENCHMARK_FLOOD_MAX_RTT * 1000.0, "Gateway::Flood", params, "a median round trip under " + std::to_string(BENCHMARK_FLOOD_MAX_RTT) + "us");
+		if (flooding) runner.Check(refused.get_Value() > before, "Gateway::Flood", params, "the admission limits to refuse some of the flood");
+
+		running = false;
+		flood.join();
+		ping.Close();
+		gateway.Stop(true);
+	}
+	//sessions of one server through a multiplexed connection against a connection each. The setup is a viewer connecting until the server side knows about it, the memory is what the whole process grew by for each session held open, gateway and both ends together
+	const bool multiplexing[] = { false, true };
+	for (auto multiplexed : multiplexing){
+		GatewayServer gateway(nullptr, nullptr);
+		gateway.Start(BENCHMARK_GATEWAY_PORT, L"");
+		auto mux = multiplexed ? INTERNAL::Gateway_Connect(GATEWAY_MULTIPLEX, 0) : INVALID_SOCKET;
+		std::vector<SOCKET> held;
+		auto id = 0;
+		auto open = [&]() -> bool {
+			if (!multiplexed){
+				SOCKET server, viewer;
+				auto paired = INTERNAL::Gateway_Pair(id++, server, viewer);
+				for (auto a : { server, viewer }) if (a != INVALID_SOCKET) held.push_back(a);
+				return paired;
+			}
+			Mux_Header keepalive = { 0, MUX_KEEPALIVE, 0 };//the gateway drops a server it does not hear from
+			send(mux, (char*)&keepalive, sizeof(keepalive), 0);
+			auto viewer = INTERNAL::Gateway_Connect(0, -1);
+			if (viewer == INVALID_SOCKET) return false;
+			held.push_back(viewer);
+			return INTERNAL::Mux_Wait_Open(mux);
+		};
+		auto connected = !multiplexed || mux != INVALID_SOCKET;
+		long long ws = 0, pb = 0, ws2 = 0, pb2 = 0;
+		INTERNAL::Process_Memory(ws, pb);
+		for (auto i = 0; i < BENCHMARK_MUX_SESSIONS && connected; i++) connected = open();
+		INTERNAL::Process_Memory(ws2, pb2);
+		auto params = multiplexed ? std::string("multiplexed") : std::string("connection each");
+		if (!connected) printf("Gateway::Mux %s skipped, could not connect over loopback\n", params.c_str());
+		else {
+			printf("%-32s %-28s %12lld bytes per session, %lld gateway sockets\n", "Gateway::Mux", params.c_str(), (pb2 - pb) / BENCHMARK_MUX_SESSIONS, gateway.get_Stats().Connections);
+			runner.Run("Gateway::Mux setup", params, 0, [&](){
+				auto before = held.size();
+				open();
+				for (auto i = before; i < held.size(); i++) closesocket(held[i]);
+				held.resize(before);
+			});
+		}
+		if (mux != INVALID_SOCKET) closesocket(mux);
+		for (auto a : held) closesocket(a);
+		gateway.Stop(true);
+	}
+	//a server reconnecting to a gateway that is up, asking for its id on every attempt against keeping a Gateway_Lease. The id service is a stub on loopback that answers every POST at once and counts them, a real one adds its own latency on top
+	{
+		auto service = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = htons((unsigned short)std::stoi(BENCHMARK_ID_PORT));
+		if (service == INVALID_SOCKET || bind(service, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(service, SOMAXCONN) != 0){
+			printf("Gateway::Reconnect skipped, could not listen on loopback\n");
+			if (service != INVALID_SOCKET) closesocket(service);
+			return;
+		}
+		std::atomic<long long> requests(0);
+		std::thread idservice([service, &requests](){
+			auto content = "7\n" + std::string(96, 'a');//an id and the hex of a 48 byte key
+			auto reply = "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(content.size()) + "\r\nConnection: close\r\n\r\n" + content;
+			while (true){
+				auto s = accept(service, nullptr, nullptr);
+				if (s == INVALID_SOCKET) break;//closed below
+				std::string request;
+				char buffer[1024];
+				while (true){//the headers and as much of the form as they announce
+					auto r = recv(s, buffer, sizeof(buffer), 0);
+					if (r <= 0) break;
+					request.append(buffer, r);
+					auto end = request.find("\r\n\r\n");
+					if (end == std::string::npos) continue;
+					auto length = request.find("Content-Length: ");
+					auto body = length == std::string::npos ? 0 : (size_t)std::stoi(request.substr(length + 16));
+					if (request.size() >= end + 4 + body) break;
+				}
+				requests += 1;
+				send(s, reply.data(), (int)reply.size(), 0);
+				closesocket(s);
+			}
+		});
+		auto url = std::wstring(L"http://localhost:") + BENCHMARK_ID_PORT + L"/Support/GetID";
+		GatewayServer gateway(nullptr, nullptr);
+		gateway.Start(BENCHMARK_GATEWAY_PORT, L"");
+		const bool leasing[] = { false, true };
+		for (auto leased : leasing){
+			Gateway_Lease lease(url);
+			auto before = requests.load();
+			auto failed = false;
+			long long attempts = 0;//the runner also calls the body to warm up and size its batches
+			auto params = leased ? std::string("leased id") : std::string("id per attempt");
+			runner.Run("Gateway::Reconnect", params, 0, [&](){
+				int id = -1;
+				std::wstring aeskey;
+				attempts += 1;
+				if (!(leased ? lease.Get(id, aeskey) : GetGatewayID_and_Key(id, aeskey, url))){
+					failed = true;
+					return;
+				}
+				auto s = INTERNAL::Gateway_Connect(-1, id);//parked until the close reaches the gateway
+				if (s != INVALID_SOCKET) closesocket(s);
+			});
+			if (failed) printf("Gateway::Reconnect %s could not get an id from the stub\n", params.c_str());
+			else printf("%-32s %-28s %12.3f id requests per attempt\n", "Gateway::Reconnect", params.c_str(), (double)(requests - before) / std::max(attempts, 1LL));
+			runner.Check(!failed, "Gateway::Reconnect", params, "an id from the stub on every attempt");
+			if (leased) runner.Check(requests - before == 1, "Gateway::Reconnect", params, "one request to the stub, every reconnect after it reuses the lease");
+			else runner.Check(requests - before == attempts, "Gateway::Reconnect", params, "one request to the stub per attempt");
+		}
+		//a multiplexing server sends two messages of many MUX_WINDOWs to a viewer that stops reading first, so they wait for credit while the server's keepalives on the stream come due. Both should arrive once the viewer reads again, not after MUX_SEND_TIMEOUT with the viewer dropped
+		{
+			Network_Mux mux;
+			Network_Client viewer;
+			std::atomic<int> connected(0), received(0);
+			std::atomic<bool> dropped(false);
+			mux.OnConnected = [&connected](std::shared_ptr<SocketHandler>& s){ connected += 1; };
+			mux.OnDisconnect = [&dropped](std::shared_ptr<SocketHandler>& s){ dropped = true; };
+			viewer.OnConnected = [&connected](std::shared_ptr<SocketHandler>& s){ connected += 1; };
+			viewer.OnReceived = [&received](Packet_Header* p, const char* d, std::shared_ptr<SocketHandler>& s){
+				if (received++ == 0) std::this_thread::sleep_for(std::chrono::milliseconds(BENCHMARK_MUX_STALL));
+			};
+			mux.Start(BENCHMARK_GATEWAY_PORT, L"127.0.0.1", url);
+			viewer.Start(BENCHMARK_GATEWAY_PORT, L"127.0.0.1", 7, std::wstring(96, L'a'));//the id and key the stub hands out
+			for (auto i = 0; i < 250 && connected < 2; i++) std::this_thread::sleep_for(std::chrono::milliseconds(20));
+			auto params = std::string("slow viewer");
+			if (connected < 2) printf("Gateway::Mux %s skipped, could not connect over loopback\n", params.c_str());
+			else {
+				auto payload = INTERNAL::Fill_Payload("random", BENCHMARK_MUX_MESSAGE);
+				NetworkMsg msg, stall;
+				msg.data.push_back(DataPackage(payload.data(), payload.size()));
+				auto start = std::chrono::steady_clock::now();
+				mux.Send(NetworkMessages::MOUSEEVENT, stall, INetwork::Auth_Types::ALL);
+				mux.Send(NetworkMessages::UPDATEREGION, msg, INetwork::Auth_Types::ALL);
+				mux.Send(NetworkMessages::UPDATEREGION, msg, INetwork::Auth_Types::ALL);//waits for the first to drain
+				auto elapsed = [start](){ return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count(); };
+				while (received < 3 && !dropped && elapsed() < MUX_SEND_TIMEOUT) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+				auto late = elapsed() - BENCHMARK_MUX_STALL;
+				printf("%-32s %-28s %12lld ms after the viewer read again\n", "Gateway::Mux", params.c_str(), (long long)late);
+				runner.Check(received == 3 && !dropped, "Gateway::Mux", params, "both messages through and the stream kept open");
+				runner.Check(late <= BENCHMARK_MUX_LATE, "Gateway::Mux", params, "everything within " + std::to_string(BENCHMARK_MUX_LATE) + "ms of the viewer reading again");
+			}
+			viewer.Stop(true);
+			mux.Stop(true);
+		}
+		gateway.Stop(true);
+		closesocket(service);
+		idservice.join();
+	}
+}
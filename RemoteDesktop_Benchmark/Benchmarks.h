@@ -0,0 +1,18 @@
+#ifndef BENCHMARKS123_H
+#define BENCHMARKS123_H
+
+namespace RemoteDesktop{
+	class Benchmark_Runner;
+	//all of these build their own synthetic data, nothing is read from the machine they run on
+	void Benchmark_Image(Benchmark_Runner& runner);
+	void Benchmark_Compression(Benchmark_Runner& runner);
+	void Benchmark_Encryption(Benchmark_Runner& runner);
+	void Benchmark_Socket(Benchmark_Runner& runner);
+	void Benchmark_Queue(Benchmark_Runner& runner);
+	void Benchmark_Memory(Benchmark_Runner& runner);
+	void Benchmark_Timers(Benchmark_Runner& runner);
+	void Benchmark_Matchmaker(Benchmark_Runner& runner);
+	void Benchmark_Gateway(Benchmark_Runner& runner);
+}
+
+#endif
@@ -0,0 +1,52 @@
+// RemoteDesktop_Benchmark.cpp : micro benchmarks for the hot paths of the library, results go to the console and to a json file
+//
+
+#include "stdafx.h"
+#include "Benchmark.h"
+#include "Benchmarks.h"
+#include "..\RemoteDesktop_Library\NetworkSetup.h"
+#include "..\RemoteDesktop_Library\Allocation_Hooks.h"//counts allocations for the whole benchmark executable
+#include <fstream>
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+	double seconds = 0.5;
+	std::string filter;
+	std::wstring output = L"benchmark.json";
+	auto noalloc = false;
+	for (auto i = 1; i < argc; i++){
+		auto more = i + 1 < argc;
+		if (_wcsicmp(argv[i], L"-seconds") == 0 && more) seconds = _wtof(argv[++i]);
+		else if (_wcsicmp(argv[i], L"-filter") == 0 && more) filter = ws2s(argv[++i]);
+		else if (_wcsicmp(argv[i], L"-json") == 0 && more) output = argv[++i];
+		else if (_wcsicmp(argv[i], L"-noalloc") == 0) noalloc = true;
+		else {
+			wprintf(L"RemoteDesktop_Benchmark [-seconds 0.5] [-filter Image::] [-json benchmark.json] [-noalloc]\n");
+			wprintf(L"  -seconds time budget for each benchmark\n");
+			wprintf(L"  -filter  only run benchmarks whose name contains this\n");
+			wprintf(L"  -noalloc fail when a benchmark that should not allocate does\n");
+			return 1;
+		}
+	}
+	if (!RemoteDesktop::StartupNetwork()) return 1;
+	printf("clock %s, %lld ticks per second\n", RemoteDesktop::High_Clock::Using_TSC() ? "tsc" : "steady_clock", RemoteDesktop::High_Clock::Frequency());
+
+	RemoteDesktop::Benchmark_Runner runner(seconds, filter);
+	runner.set_Fail_On_Allocation(noalloc);
+	RemoteDesktop::Benchmark_Image(runner);
+	RemoteDesktop::Benchmark_Compression(runner);
+	RemoteDesktop::Benchmark_Encryption(runner);
+	RemoteDesktop::Benchmark_Socket(runner);
+	RemoteDesktop::Benchmark_Queue(runner);
+	RemoteDesktop::Benchmark_Memory(runner);
+	RemoteDesktop::Benchmark_Timers(runner);
+	RemoteDesktop::Benchmark_Matchmaker(runner);
+	RemoteDesktop::Benchmark_Gateway(runner);
+
+	std::ofstream f(output.c_str(), std::ios::trunc);
+	auto json = runner.to_Json();
+	f.write(json.data(), json.size());
+	RemoteDesktop::ShutDownNetwork();
+	if (!f.good()) return 1;
+	return runner.get_Failures() > 0 ? 2 : 0;
+}
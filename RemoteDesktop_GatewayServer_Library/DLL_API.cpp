@@ -16,7 +16,26 @@ void __stdcall Destroy_Server(void* server){
 void __stdcall Listen(void* server, wchar_t* ip_or_host, wchar_t* port){
 	if (server == nullptr) return;
 	auto ptr = (RemoteDesktop::GatewayServer*)server;
-	ptr->Start(ip_or_host, port);
+	ptr->Start(port, ip_or_host);
+}
+void __stdcall Start_Metrics(void* server, wchar_t* port){
+	if (server == nullptr || port == nullptr) return;
+	auto ptr = (RemoteDesktop::GatewayServer*)server;
+	ptr->Start_Metrics(port);
+}
+RemoteDesktop::Gateway_Stats __stdcall get_GatewayStats(void* server){
+	if (server == nullptr){
+		RemoteDesktop::Gateway_Stats tmp;
+		memset(&tmp, 0, sizeof(tmp));
+		return tmp;
+	}
+	auto ptr = (RemoteDesktop::GatewayServer*)server;
+	return ptr->get_Stats();
+}
+void __stdcall Set_SessionLimits(void* server, int id, long long rate, int weight){
+	if (server == nullptr) return;
+	auto ptr = (RemoteDesktop::GatewayServer*)server;
+	ptr->set_Session_Limits(id, rate, weight);
 }
 
 
@@ -2,6 +2,7 @@
 #define DLL_API123_H
 
 #include "..\RemoteDesktop_Library\CommonNetwork.h"
+#include "..\RemoteDesktop_Library\Network_GatewayServer.h"
 
 #define DLLEXPORT __declspec( dllexport )  
 
@@ -10,6 +11,11 @@ extern "C" {
 	DLLEXPORT void* __stdcall Create_Server(void(__stdcall * onconnect)(), void(__stdcall * ondisconnect)());
 	DLLEXPORT void __stdcall Destroy_Server(void* server);
 	DLLEXPORT void __stdcall Listen(void* server, wchar_t* ip_or_host, wchar_t* port);
+	DLLEXPORT void __stdcall Start_Metrics(void* server, wchar_t* port);
+	//connections, pairs and bytes relayed by the native relay
+	DLLEXPORT RemoteDesktop::Gateway_Stats __stdcall get_GatewayStats(void* server);
+	//rate in bytes per second per direction, 0 for no cap. id -1 sets the default for every server id without its own
+	DLLEXPORT void __stdcall Set_SessionLimits(void* server, int id, long long rate, int weight);
 
 }
 
@@ -0,0 +1,72 @@
+#include "stdafx.h"
+#include "Admission_Control.h"
+#include "Metrics.h"
+#include <algorithm>
+
+namespace RemoteDesktop{
+	namespace INTERNAL{
+		Metrics::Value& AdmissionSourceLimited = Metrics::Counter("rd_admission_source_limited_total", "Connections refused because their address opened too many too fast");
+		Metrics::Value& AdmissionGlobalLimited = Metrics::Counter("rd_admission_global_limited_total", "Connections refused because the listener took on too many too fast");
+		Metrics::Value& AdmissionHandshakeLimited = Metrics::Counter("rd_admission_handshake_limited_total", "Connections refused because too many key exchanges were already in progress");
+	}
+}
+
+RemoteDesktop::Admission_Control::Admission_Control(long long now, double sourcerate, double sourceburst, double globalrate, double globalburst, int maxhandshakes) :
+_SourceRate(sourcerate), _SourceBurst(std::max(sourceburst, 1.0)), _GlobalRate(globalrate), _GlobalBurst(std::max(globalburst, 1.0)), _MaxHandshakes(maxhandshakes) {
+	_Global.Tokens = _GlobalBurst;
+	_Global.Stamp = now;
+}
+void RemoteDesktop::Admission_Control::_Refill(Bucket& b, double rate, double burst, long long now){
+	if (now > b.Stamp) b.Tokens = std::min(burst, b.Tokens + rate * (now - b.Stamp) / 1000.0);
+	b.Stamp = now;
+}
+RemoteDesktop::Admission_Control::Verdicts RemoteDesktop::Admission_Control::Admit(unsigned long address, int handshakes, long long now, bool exempt){
+	if (handshakes >= _MaxHandshakes){//checked first, it costs nothing and takes no tokens
+		INTERNAL::AdmissionHandshakeLimited.Add();
+		return HANDSHAKE_LIMITED;
+	}
+	if (exempt){
+		_Refill(_Global, _GlobalRate, _GlobalBurst, now);
+		if (_Global.Tokens < 1.0){
+			INTERNAL::AdmissionGlobalLimited.Add();
+			return GLOBAL_LIMITED;
+		}
+		_Global.Tokens -= 1.0;
+		return ADMITTED;
+	}
+	auto found = _Sources.find(address);
+	if (found == _Sources.end()){
+		if (_Sources.size() >= ADMISSION_MAX_SOURCES) Expire(now);
+		if (_Sources.size() >= ADMISSION_MAX_SOURCES){//that many addresses in one burst, let them wait for room
+			INTERNAL::AdmissionSourceLimited.Add();
+			return SOURCE_LIMITED;
+		}
+		Bucket b;
+		b.Tokens = _SourceBurst;
+		b.Stamp = now;
+		found = _Sources.emplace(address, b).first;
+	}
+	auto& source = found->second;
+	_Refill(source, _SourceRate, _SourceBurst, now);
+	if (source.Tokens < 1.0){
+		INTERNAL::AdmissionSourceLimited.Add();
+		return SOURCE_LIMITED;
+	}
+	//an address over its own limit does not use up the tokens everyone else shares
+	_Refill(_Global, _GlobalRate, _GlobalBurst, now);
+	if (_Global.Tokens < 1.0){
+		INTERNAL::AdmissionGlobalLimited.Add();
+		return GLOBAL_LIMITED;
+	}
+	source.Tokens -= 1.0;
+	_Global.Tokens -= 1.0;
+	return ADMITTED;
+}
+void RemoteDesktop::Admission_Control::Expire(long long now){
+	auto beg = _Sources.begin();
+	while (beg != _Sources.end()){
+		_Refill(beg->second, _SourceRate, _SourceBurst, now);
+		if (beg->second.Tokens >= _SourceBurst) beg = _Sources.erase(beg);
+		else ++beg;
+	}
+}
@@ -0,0 +1,41 @@
+#ifndef ADMISSION_CONTROL123_H
+#define ADMISSION_CONTROL123_H
+#include <unordered_map>
+
+#define ADMISSION_SOURCE_RATE 2 //connections per second one address may open once it used up its burst
+#define ADMISSION_SOURCE_BURST 8
+#define ADMISSION_GLOBAL_RATE 50 //connections per second for the whole listener
+#define ADMISSION_GLOBAL_BURST 100
+#define ADMISSION_MAX_HANDSHAKES 16 //connections that have not finished their key exchange, each one costs an FHMQV agreement
+#define ADMISSION_HANDSHAKE_TIMEOUT 10000 //ms a new connection gets to finish its key exchange
+#define ADMISSION_MAX_SOURCES 65536 //addresses tracked at once, the ones whose bucket is full again are forgotten first
+
+namespace RemoteDesktop{
+	//decides at accept time whether a listener takes on a new connection, so a reconnect storm or a scanner cannot push out the sessions that are already running. Every address has a token bucket, the listener has one more for everyone together and the connections still in their handshake are capped.
+	//A refused connection is accepted and closed straight away, leaving it in the backlog would stop the listen socket from signaling the ones behind it. Not thread safe, it belongs to the accepting thread
+	class Admission_Control{
+		struct Bucket{
+			double Tokens;
+			long long Stamp;//Timer_Wheel::Now() of the last refill
+		};
+		std::unordered_map<unsigned long, Bucket> _Sources;//by IPv4 address in network order
+		Bucket _Global;
+		double _SourceRate, _SourceBurst, _GlobalRate, _GlobalBurst;
+		int _MaxHandshakes;
+
+		static void _Refill(Bucket& b, double rate, double burst, long long now);
+
+	public:
+		enum Verdicts{ ADMITTED, SOURCE_LIMITED, GLOBAL_LIMITED, HANDSHAKE_LIMITED };
+
+		Admission_Control(long long now, double sourcerate = ADMISSION_SOURCE_RATE, double sourceburst = ADMISSION_SOURCE_BURST, double globalrate = ADMISSION_GLOBAL_RATE, double globalburst = ADMISSION_GLOBAL_BURST, int maxhandshakes = ADMISSION_MAX_HANDSHAKES);
+
+		//handshakes is how many connections the caller has that did not finish theirs. Takes a token from both buckets when the connection is admitted, an exempt address only has the global one and the handshake cap
+		Verdicts Admit(unsigned long address, int handshakes, long long now, bool exempt = false);
+		//forgets the addresses that have not connected for long enough to have a full bucket again, call it every second or so
+		void Expire(long long now);
+		size_t get_Sources() const { return _Sources.size(); }
+	};
+}
+
+#endif
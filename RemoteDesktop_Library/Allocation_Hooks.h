@@ -0,0 +1,65 @@
+#ifndef ALLOCATION_HOOKS123_H
+#define ALLOCATION_HOOKS123_H
+#include "Allocation_Tracker.h"
+#include <new>
+#include <cstdlib>
+
+//replaces the global allocation functions for the whole module, so include this in exactly one .cpp of an executable or dll. The counters are thread local plain integers, a hooked allocation costs two increments on top of malloc
+namespace RemoteDesktop{
+	namespace Allocation_Tracker{
+		namespace _INTERNAL{
+			struct Hook_Installer{
+				Hook_Installer(){ Hooked = true; }
+			};
+			static Hook_Installer Installer;
+
+			inline void* Hooked_Alloc(size_t size){
+				Thread.Allocations += 1;
+				Thread.Bytes += size;
+				return malloc(size == 0 ? 1 : size);
+			}
+			inline void Hooked_Free(void* p){
+				if (p == nullptr) return;
+				Thread.Frees += 1;
+				free(p);
+			}
+		}
+	}
+}
+
+void* operator new(size_t size){
+	auto p = RemoteDesktop::Allocation_Tracker::_INTERNAL::Hooked_Alloc(size);
+	if (p == nullptr) throw std::bad_alloc();
+	return p;
+}
+void* operator new[](size_t size){
+	auto p = RemoteDesktop::Allocation_Tracker::_INTERNAL::Hooked_Alloc(size);
+	if (p == nullptr) throw std::bad_alloc();
+	return p;
+}
+void* operator new(size_t size, const std::nothrow_t&) noexcept{
+	return RemoteDesktop::Allocation_Tracker::_INTERNAL::Hooked_Alloc(size);
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept{
+	return RemoteDesktop::Allocation_Tracker::_INTERNAL::Hooked_Alloc(size);
+}
+void operator delete(void* p) noexcept{
+	RemoteDesktop::Allocation_Tracker::_INTERNAL::Hooked_Free(p);
+}
+void operator delete[](void* p) noexcept{
+	RemoteDesktop::Allocation_Tracker::_INTERNAL::Hooked_Free(p);
+}
+void operator delete(void* p, size_t) noexcept{
+	RemoteDesktop::Allocation_Tracker::_INTERNAL::Hooked_Free(p);
+}
+void operator delete[](void* p, size_t) noexcept{
+	RemoteDesktop::Allocation_Tracker::_INTERNAL::Hooked_Free(p);
+}
+void operator delete(void* p, const std::nothrow_t&) noexcept{
+	RemoteDesktop::Allocation_Tracker::_INTERNAL::Hooked_Free(p);
+}
+void operator delete[](void* p, const std::nothrow_t&) noexcept{
+	RemoteDesktop::Allocation_Tracker::_INTERNAL::Hooked_Free(p);
+}
+
+#endif
@@ -0,0 +1,94 @@
+#include "stdafx.h"
+#include "Allocation_Tracker.h"
+#include <atomic>
+
+#define ALLOCATION_WARMUP_FRAMES 30 //buffers are still growing to their working size during the first frames
+
+namespace RemoteDesktop{
+	namespace Allocation_Tracker{
+		namespace _INTERNAL{
+			thread_local Counts Thread = { 0, 0, 0 };
+			bool Hooked = false;
+			bool Enabled = true;
+			bool Fail = false;
+			std::atomic<long long> Violations(0), Frames(0);
+
+			struct Stage_Counter{
+				std::atomic<long long> Scopes, Allocations, Bytes, Max;
+			};
+			Stage_Counter Stages[Frame_Tracer::STAGE_COUNT];
+
+			struct Thread_Frame{
+				Counts Start, Last;
+				bool Active;
+			};
+			thread_local Thread_Frame Current = { { 0, 0, 0 }, { 0, 0, 0 }, false };
+
+			inline bool Tracking(){ return Hooked && Enabled; }
+		}
+	}
+}
+
+void RemoteDesktop::Allocation_Tracker::set_Enabled(bool e){
+	_INTERNAL::Enabled = e;
+}
+bool RemoteDesktop::Allocation_Tracker::get_Enabled(){
+	return _INTERNAL::Tracking();
+}
+void RemoteDesktop::Allocation_Tracker::set_Fail_On_Allocation(bool f){
+	_INTERNAL::Fail = f;
+}
+long long RemoteDesktop::Allocation_Tracker::get_Violations(){
+	return _INTERNAL::Violations;
+}
+long long RemoteDesktop::Allocation_Tracker::get_Frames(){
+	return _INTERNAL::Frames;
+}
+
+void RemoteDesktop::Allocation_Tracker::Begin(){
+	if (!_INTERNAL::Tracking()) return;
+	auto& f = _INTERNAL::Current;
+	f.Start = f.Last = _INTERNAL::Thread;
+	f.Active = true;
+}
+void RemoteDesktop::Allocation_Tracker::Mark(Frame_Tracer::Stages s){
+	auto& f = _INTERNAL::Current;
+	if (!_INTERNAL::Tracking() || !f.Active) return;
+	auto now = _INTERNAL::Thread;
+	auto allocations = now.Allocations - f.Last.Allocations;
+	auto& st = _INTERNAL::Stages[s];
+	st.Scopes += 1;
+	st.Allocations += allocations;
+	st.Bytes += now.Bytes - f.Last.Bytes;
+	auto max = st.Max.load();
+	while (allocations > max && !st.Max.compare_exchange_weak(max, allocations));
+	f.Last = now;
+}
+void RemoteDesktop::Allocation_Tracker::End(){
+	auto& f = _INTERNAL::Current;
+	if (!_INTERNAL::Tracking() || !f.Active) return;
+	f.Active = false;
+	auto allocations = _INTERNAL::Thread.Allocations - f.Start.Allocations;
+	auto frame = _INTERNAL::Frames.fetch_add(1);
+	if (_INTERNAL::Fail && frame >= ALLOCATION_WARMUP_FRAMES && allocations > 0){
+		_INTERNAL::Violations += 1;
+		DEBUG_MSG("Steady state frame % allocated % times", Frame_Tracer::get_ID(), allocations);
+	}
+}
+
+RemoteDesktop::Allocation_Tracker::Stage_Stats RemoteDesktop::Allocation_Tracker::get_Stats(Frame_Tracer::Stages s){
+	auto& st = _INTERNAL::Stages[s];
+	Stage_Stats r;
+	r.Scopes = st.Scopes;
+	r.Allocations = st.Allocations;
+	r.Bytes = st.Bytes;
+	r.Max_Allocations = st.Max;
+	return r;
+}
+void RemoteDesktop::Allocation_Tracker::Reset(){
+	for (auto& a : _INTERNAL::Stages){
+		a.Scopes = a.Allocations = a.Bytes = a.Max = 0;
+	}
+	_INTERNAL::Frames = 0;
+	_INTERNAL::Violations = 0;
+}
@@ -0,0 +1,48 @@
+#ifndef ALLOCATION_TRACKER123_H
+#define ALLOCATION_TRACKER123_H
+#include "Frame_Tracer.h"
+
+namespace RemoteDesktop{
+	//counts heap allocations per thread and charges them to the Frame_Tracer stage that made them. The counting happens in Allocation_Hooks.h, which replaces the global operator new and delete and has to be included by exactly one file of the executable or dll that wants it. Without the hooks every count stays at zero
+	namespace Allocation_Tracker{
+		struct Counts{
+			long long Allocations, Frees, Bytes;//bytes requested, frees do not know their size
+		};
+		struct Stage_Stats{
+			long long Scopes, Allocations, Bytes, Max_Allocations;//Max is the most any single frame made in this stage
+		};
+		namespace _INTERNAL{
+			extern thread_local Counts Thread;
+			extern bool Hooked;
+		}
+		inline const Counts& get_Thread_Counts(){ return _INTERNAL::Thread; }
+		inline bool get_Hooked(){ return _INTERNAL::Hooked; }
+
+		//on by default once the hooks are in
+		void set_Enabled(bool e);
+		bool get_Enabled();
+		//a frame that allocates anything once the first ALLOCATION_WARMUP_FRAMES are done is a violation. For tests and benchmarks, it only logs and counts
+		void set_Fail_On_Allocation(bool f);
+		long long get_Violations();
+
+		//called by Frame_Tracer, which calls these even while its own tracing is off
+		void Begin();
+		void Mark(Frame_Tracer::Stages s);
+		void End();
+
+		Stage_Stats get_Stats(Frame_Tracer::Stages s);
+		long long get_Frames();
+		void Reset();
+
+		//allocations made by this thread while the scope is alive, for a single message or a benchmark batch
+		class Allocation_Scope{
+			Counts _Start;
+		public:
+			Allocation_Scope() : _Start(_INTERNAL::Thread){}
+			long long get_Allocations() const { return _INTERNAL::Thread.Allocations - _Start.Allocations; }
+			long long get_Bytes() const { return _INTERNAL::Thread.Bytes - _Start.Bytes; }
+		};
+	}
+}
+
+#endif
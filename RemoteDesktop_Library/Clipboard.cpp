@@ -1,6 +1,7 @@
 #include "stdafx.h"
 #include "Clipboard.h"
 #include "Clipboard_Wrapper.h"
+#include "xxhash.h"
 
 const UINT formatUnicodeText = CF_UNICODETEXT;
 const UINT formatRTF = RegisterClipboardFormat(L"Rich Text Format");
@@ -59,7 +60,16 @@ void RemoteDesktop::Clipboard::Restore(void* hwnd, const Clipboard_Data& c){
 	if (!clipwrap.IsValid()) return;
 	if (!::EmptyClipboard()) return;
 
-	if (!c.m_pDataText.empty()){
+	Render(formatUnicodeText, c);
+	Render(formatRTF, c);
+	Render(formatHTML, c);
+	Render(formatDIB, c);
+	LastClipboard = c;//copy the contents 
+	DEBUG_MSG("END Restore Clipboard");
+}
+void RemoteDesktop::Clipboard::Render(UINT format, const Clipboard_Data& c){
+	if (format == formatUnicodeText){
+		if (c.m_pDataText.empty()) return;
 		int nConvertedSize = MultiByteToWideChar(CP_UTF8, 0, (LPCSTR)c.m_pDataText.data(), c.m_pDataText.size(), NULL, 0);
 		if (nConvertedSize > 0) {
 			HGLOBAL hData = GlobalAlloc(GMEM_MOVEABLE | GMEM_DDESHARE, nConvertedSize * sizeof(wchar_t));
@@ -82,9 +92,80 @@ void RemoteDesktop::Clipboard::Restore(void* hwnd, const Clipboard_Data& c){
 			}
 		}
 	}
-	_INTERNAL::RestoreClip(c.m_pDataRTF, ::SetClipboardData, formatRTF);
-	_INTERNAL::RestoreClip(c.m_pDataHTML, ::SetClipboardData, formatHTML);
-	_INTERNAL::RestoreClip(c.m_pDataDIB, ::SetClipboardData, formatDIB);
-	LastClipboard = c;//copy the contents 
-	DEBUG_MSG("END Restore Clipboard");
+	else if (format == formatRTF) _INTERNAL::RestoreClip(c.m_pDataRTF, ::SetClipboardData, formatRTF);
+	else if (format == formatHTML) _INTERNAL::RestoreClip(c.m_pDataHTML, ::SetClipboardData, formatHTML);
+	else if (format == formatDIB) _INTERNAL::RestoreClip(c.m_pDataDIB, ::SetClipboardData, formatDIB);
+}
+bool RemoteDesktop::Clipboard::Announce(void* hwnd, const Clipboard_Announce_Header& h){
+	Clipboard_Wrapper clipwrap(hwnd);
+	if (!clipwrap.IsValid()) return false;
+	if (!::EmptyClipboard()) return false;
+	//a NULL handle tells windows to send WM_RENDERFORMAT to hwnd when an application asks for the data
+	if (h.Text.Size > 0) ::SetClipboardData(formatUnicodeText, NULL);
+	if (h.RTF.Size > 0) ::SetClipboardData(formatRTF, NULL);
+	if (h.HTML.Size > 0) ::SetClipboardData(formatHTML, NULL);
+	if (h.DIB.Size > 0) ::SetClipboardData(formatDIB, NULL);
+	return true;
+}
+int RemoteDesktop::Clipboard::Get_Format(UINT format){
+	if (format == formatUnicodeText) return CLIPBOARD_TEXT;
+	else if (format == formatRTF) return CLIPBOARD_RTF;
+	else if (format == formatHTML) return CLIPBOARD_HTML;
+	else if (format == formatDIB) return CLIPBOARD_DIB;
+	return 0;
+}
+RemoteDesktop::Clipboard_Announce_Header RemoteDesktop::Clipboard::Describe(int id, const Clipboard_Data& c){
+	Clipboard_Announce_Header h;
+	h.ID = id;
+	h.DIB.Size = c.m_pDataDIB.size();
+	h.DIB.Hash = XXH64(c.m_pDataDIB.data(), c.m_pDataDIB.size(), 0);
+	h.HTML.Size = c.m_pDataHTML.size();
+	h.HTML.Hash = XXH64(c.m_pDataHTML.data(), c.m_pDataHTML.size(), 0);
+	h.RTF.Size = c.m_pDataRTF.size();
+	h.RTF.Hash = XXH64(c.m_pDataRTF.data(), c.m_pDataRTF.size(), 0);
+	h.Text.Size = c.m_pDataText.size();
+	h.Text.Hash = XXH64(c.m_pDataText.data(), c.m_pDataText.size(), 0);
+	return h;
+}
+bool RemoteDesktop::Clipboard::Deserialize(const char* data, int len, Clipboard_Data& c){
+	std::vector<char>* buffers[] = { &c.m_pDataDIB, &c.m_pDataHTML, &c.m_pDataRTF, &c.m_pDataText };
+	for (auto b : buffers){
+		int size = 0;
+		if (len < (int)sizeof(size)) return false;
+		memcpy(&size, data, sizeof(size));
+		data += sizeof(size);
+		len -= sizeof(size);
+		if (size < 0 || size > len) return false;//malformed
+		b->resize(size);
+		memcpy(b->data(), data, size);
+		data += size;
+		len -= size;
+	}
+	return true;
+}
+std::vector<char>* RemoteDesktop::Clipboard::Get_Buffer(Clipboard_Data& c, int format){
+	switch (format){
+	case(CLIPBOARD_DIB) :
+		return &c.m_pDataDIB;
+	case(CLIPBOARD_HTML) :
+		return &c.m_pDataHTML;
+	case(CLIPBOARD_RTF) :
+		return &c.m_pDataRTF;
+	case(CLIPBOARD_TEXT) :
+		return &c.m_pDataText;
+	}
+	return nullptr;
+}
+const RemoteDesktop::Clipboard_Format_Header* RemoteDesktop::Clipboard::Get_Header(const Clipboard_Announce_Header& h, int format){
+	switch (format){
+	case(CLIPBOARD_DIB) :
+		return &h.DIB;
+	case(CLIPBOARD_HTML) :
+		return &h.HTML;
+	case(CLIPBOARD_RTF) :
+		return &h.RTF;
+	case(CLIPBOARD_TEXT) :
+		return &h.Text;
+	}
+	return nullptr;
 }
\ No newline at end of file
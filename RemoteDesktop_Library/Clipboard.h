@@ -1,6 +1,7 @@
 #ifndef CLIPBOARD_DATA123_H
 #define CLIPBOARD_DATA123_H
 #include <vector>
+#include "CommonNetwork.h"
 
 namespace RemoteDesktop{
 	struct Clipboard_Data{
@@ -26,6 +27,17 @@ namespace RemoteDesktop{
 	namespace Clipboard{
 		bool Load(void* hwnd, Clipboard_Data& data);
 		void Restore(void* hwnd, const Clipboard_Data& c);
+
+		//delayed rendering. Announce takes ownership of the clipboard with empty formats, Render is called from WM_RENDERFORMAT to supply the data for one format
+		bool Announce(void* hwnd, const Clipboard_Announce_Header& h);
+		void Render(UINT format, const Clipboard_Data& c);
+		int Get_Format(UINT format);//maps a windows clipboard format to Clipboard_Formats, 0 if not supported
+
+		Clipboard_Announce_Header Describe(int id, const Clipboard_Data& c);
+		bool Deserialize(const char* data, int len, Clipboard_Data& c);
+		//format is a single flag from Clipboard_Formats, nullptr is returned for anything else
+		std::vector<char>* Get_Buffer(Clipboard_Data& c, int format);
+		const Clipboard_Format_Header* Get_Header(const Clipboard_Announce_Header& h, int format);
 		namespace _INTERNAL{
 			template<class T>void RestoreClip(const std::vector<char>& buffer, T cb, UINT format){
 				if (buffer.size() > 0) {
@@ -2,16 +2,27 @@
 #include "Clipboard_Monitor.h"
 #include "Desktop_Monitor.h"
 #include "Handle_Wrapper.h"
+#include "SocketHandler.h"
+#include "xxhash.h"
+#include "DIB_Codec.h"
 
-RemoteDesktop::ClipboardMonitor::ClipboardMonitor(Delegate<void, const Clipboard_Data&> c) : _OnClipboardChanged(c) {
+#define CLIPBOARDRENDERTIMEOUT 10000 //ms to wait without progress for the peer to send clipboard data when something is pasted
+#define CLIPBOARDCACHESIZE (1024*1024*32) //bytes of received clipboard data kept around for reuse
+#define CLIPBOARDMAXPENDINGSENDS 8 //requests beyond this are dropped, the peer will time out
+
+RemoteDesktop::ClipboardMonitor::ClipboardMonitor(Delegate<void, const Clipboard_Announce_Header&> c, Delegate<void, const Clipboard_Request_Header&> r) : _OnClipboardChanged(c), _OnClipboardRequest(r) {
 	_Running = true;
 	_BackGroundWorker = std::thread(&RemoteDesktop::ClipboardMonitor::_Run, this);
+	_SendThread = std::thread(&RemoteDesktop::ClipboardMonitor::_SendWorker, this);
 }
 
 RemoteDesktop::ClipboardMonitor::~ClipboardMonitor(){
 	_Running = false;
+	_RenderWait.notify_all();//release any paste that is waiting on the peer
+	_SendWait.notify_all();
 	BEGINTRY
 		if (std::this_thread::get_id() != _BackGroundWorker.get_id() && _BackGroundWorker.joinable()) _BackGroundWorker.join();
+		if (std::this_thread::get_id() != _SendThread.get_id() && _SendThread.joinable()) _SendThread.join();
 	ENDTRY
 }
 
@@ -28,6 +39,199 @@ void RemoteDesktop::ClipboardMonitor::Restore(const Clipboard_Data& c){
 		_IgnoreClipUpdateNotice = true;
 	}
 }
+void RemoteDesktop::ClipboardMonitor::Announce(const Clipboard_Announce_Header& h){
+	if (_ShareClipboard){
+		DEBUG_MSG("Clipboard Announce");
+		std::lock_guard<std::mutex> l(_ClipboardLock);
+		{
+			std::lock_guard<std::mutex> rl(_RenderLock);
+			_RemoteClipboard = h;
+		}
+		_IgnoreClipUpdateNotice = true;
+		Clipboard::Announce(_Hwnd, h);
+	}
+}
+void RemoteDesktop::ClipboardMonitor::Receive(const Clipboard_Fragment_Header& h, const char* data, int len){
+	std::lock_guard<std::mutex> l(_RenderLock);
+	if (h.ID != _RemoteClipboard.ID || h.Format != _RenderFormat || _RenderReady) return;//an old request, the peer has copied something else since
+	auto fh = Clipboard::Get_Header(_RemoteClipboard, h.Format);
+	auto buffer = Clipboard::Get_Buffer(_RenderData, h.Format);
+	//encoded bitmaps are only ever sent when they are smaller than the dib, so the announced size bounds every allocation
+	auto validencoding = fh != nullptr && (h.Encoding == CLIPBOARD_ENCODING_RAW ? h.Total == fh->Size : (h.Encoding == CLIPBOARD_ENCODING_DIB && h.Format == CLIPBOARD_DIB && h.Total <= fh->Size));
+	if (h.Total < 0 || buffer == nullptr || !validencoding || h.Offset != _RenderReceived || (h.Offset > 0 && h.Encoding != _RenderEncoding) || len < 0 || len > h.Total - h.Offset){
+		//the peer no longer has the data, or is sending something other than what it announced
+		DEBUG_MSG("Dropping clipboard format %", h.Format);
+		if (buffer) buffer->clear();
+		_RenderReady = true;
+		_RenderWait.notify_all();
+		return;
+	}
+	if (h.Offset == 0) {
+		buffer->resize(h.Total);
+		_RenderEncoding = h.Encoding;
+	}
+	memcpy(buffer->data() + h.Offset, data, len);
+	_RenderReceived += len;
+	if (_RenderReceived == h.Total){
+		if (_RenderEncoding == CLIPBOARD_ENCODING_DIB){
+			std::vector<char> dib;
+			if (DIB_Codec::Decode(buffer->data(), buffer->size(), fh->Size, dib)) buffer->swap(dib);
+			else buffer->clear();
+		}
+		if (XXH64(buffer->data(), buffer->size(), 0) != fh->Hash || (int)buffer->size() != fh->Size){
+			DEBUG_MSG("Clipboard hash mismatch on format %", h.Format);
+			buffer->clear();
+		}
+		_RenderReady = true;
+		_RenderWait.notify_all();
+	}
+}
+void RemoteDesktop::ClipboardMonitor::Queue_Send(const Clipboard_Request_Header& h, std::weak_ptr<SocketHandler> peer){
+	{
+		std::lock_guard<std::mutex> l(_SendLock);
+		if (_SendQueue.size() >= CLIPBOARDMAXPENDINGSENDS) return;
+		_SendQueue.push_back(std::make_pair(h, peer));
+	}
+	_SendWait.notify_one();
+}
+void RemoteDesktop::ClipboardMonitor::_SendWorker(){
+	while (_Running){
+		std::pair<Clipboard_Request_Header, std::weak_ptr<SocketHandler>> item;
+		{
+			std::unique_lock<std::mutex> l(_SendLock);
+			_SendWait.wait(l, [this](){ return !_SendQueue.empty() || !_Running; });
+			if (!_Running) return;
+			item = _SendQueue.front();
+			_SendQueue.pop_front();
+		}
+		_Send(item.first, item.second);
+	}
+}
+void RemoteDesktop::ClipboardMonitor::_Send(const Clipboard_Request_Header& h, std::weak_ptr<SocketHandler>& peer){
+	std::shared_ptr<Clipboard_Data> clip;
+	{//snapshots are never modified, so the lock is only needed to grab the pointer
+		std::lock_guard<std::mutex> l(_ClipboardLock);
+		if (_ShareClipboard && h.ID == _ClipboardID) clip = _Clipboard_Data;
+	}
+	Clipboard_Fragment_Header fh;
+	fh.ID = h.ID;
+	int formats[] = { CLIPBOARD_DIB, CLIPBOARD_HTML, CLIPBOARD_RTF, CLIPBOARD_TEXT };
+	for (auto format : formats){
+		if ((h.Formats & format) == 0) continue;
+		auto buffer = clip ? Clipboard::Get_Buffer(*clip, format) : nullptr;
+		auto compress = Compression_Handler::COMPRESSION_FAST;
+		fh.Format = format;
+		fh.Offset = 0;
+		fh.Encoding = CLIPBOARD_ENCODING_RAW;
+		if (buffer && format == CLIPBOARD_DIB){
+			if (_EncodedID != h.ID){
+				_EncodedID = h.ID;
+				if (!DIB_Codec::Encode(*buffer, _EncodedDIB)) _EncodedDIB.clear();
+			}
+			if (!_EncodedDIB.empty()){
+				buffer = &_EncodedDIB;
+				fh.Encoding = CLIPBOARD_ENCODING_DIB;
+				compress = Compression_Handler::COMPRESSION_NONE;//already lz4 compressed
+			}
+		}
+		fh.Total = buffer ? buffer->size() : -1;
+		do {
+			auto sh = peer.lock();
+			if (!sh || !_Running) return;
+			auto len = buffer ? std::min(CLIPBOARDCHUNKSIZE, fh.Total - fh.Offset) : 0;
+			NetworkMsg msg;
+			msg.push_back(fh);
+			msg.data.push_back(DataPackage(buffer ? buffer->data() + fh.Offset : nullptr, len));
+			if (sh->Send(NetworkMessages::CLIPBOARD_DATA, msg, compress) != Network_Return::COMPLETED) return;
+			fh.Offset += len;
+		} while (buffer && fh.Offset < fh.Total);
+	}
+}
+bool RemoteDesktop::ClipboardMonitor::_CacheFind(unsigned long long hash, int size, std::vector<char>& out){
+	for (auto it = _Cache.begin(); it != _Cache.end(); ++it){
+		if (it->first == hash && (int)it->second.size() == size){
+			_Cache.splice(_Cache.begin(), _Cache, it);//most recently used goes to the front
+			out = _Cache.front().second;
+			return true;
+		}
+	}
+	return false;
+}
+void RemoteDesktop::ClipboardMonitor::_CacheAdd(unsigned long long hash, std::vector<char>&& data){
+	if (data.empty() || data.size() > CLIPBOARDCACHESIZE) return;
+	for (auto& a : _Cache) if (a.first == hash && a.second.size() == data.size()) return;
+	_CacheSize += data.size();
+	_Cache.push_front(std::make_pair(hash, std::move(data)));
+	while (_CacheSize > CLIPBOARDCACHESIZE){
+		_CacheSize -= _Cache.back().second.size();
+		_Cache.pop_back();
+	}
+}
+//called on the monitor thread from inside another applications GetClipboardData, so the data has to be set before returning
+void RemoteDesktop::ClipboardMonitor::_Render(UINT format){
+	Clipboard_Request_Header req;
+	req.Formats = Clipboard::Get_Format(format);
+	if (req.Formats == 0) return;
+
+	std::shared_ptr<Clipboard_Data> local;
+	Clipboard_Announce_Header localdesc;
+	{
+		std::lock_guard<std::mutex> l(_ClipboardLock);
+		local = _Clipboard_Data;
+		localdesc = _Clipboard_Description;
+	}
+	std::unique_lock<std::mutex> l(_RenderLock);
+	auto fh = *Clipboard::Get_Header(_RemoteClipboard, req.Formats);
+	_RenderData = Clipboard_Data();
+	auto buffer = Clipboard::Get_Buffer(_RenderData, req.Formats);
+	auto localfh = Clipboard::Get_Header(localdesc, req.Formats);
+	//the peer copied something this side already has, either because it was copied here first or received before
+	if (local && localfh->Hash == fh.Hash && localfh->Size == fh.Size) *buffer = *Clipboard::Get_Buffer(*local, req.Formats);
+	else if (!_CacheFind(fh.Hash, fh.Size, *buffer)) {
+		req.ID = _RemoteClipboard.ID;
+		_RenderFormat = req.Formats;
+		_RenderReceived = 0;
+		_RenderReady = false;
+		l.unlock();
+		DEBUG_MSG("Requesting clipboard format % from peer", req.Formats);
+		if (_OnClipboardRequest) _OnClipboardRequest(req);
+		l.lock();
+
+		//large clipboards arrive in many fragments, keep waiting as long as they are still coming in
+		auto received = -1;
+		while (!_RenderReady && _Running && received != _RenderReceived){
+			received = _RenderReceived;
+			_RenderWait.wait_for(l, std::chrono::milliseconds(CLIPBOARDRENDERTIMEOUT), [this](){ return _RenderReady || !_Running; });
+		}
+		_RenderFormat = 0;
+		if (!_RenderReady){
+			DEBUG_MSG("Timed out waiting for clipboard data");
+			_RenderData = Clipboard_Data();
+			return;
+		}
+	}
+	else DEBUG_MSG("Clipboard format % found in cache", req.Formats);
+	Clipboard::Render(format, _RenderData);
+	_CacheAdd(fh.Hash, std::move(*buffer));//windows has its own copy now
+	_RenderData = Clipboard_Data();
+}
+
+LRESULT CALLBACK ClipboardWndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam) {
+	auto c = (RemoteDesktop::ClipboardMonitor *)GetWindowLongPtr(hWnd, GWLP_USERDATA);
+	if (c == NULL)
+		return DefWindowProc(hWnd, msg, wParam, lParam);
+	return c->WindowProc(hWnd, msg, wParam, lParam);
+}
+LRESULT RemoteDesktop::ClipboardMonitor::WindowProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam){
+	switch (msg){
+	case(WM_RENDERFORMAT) :
+		_Render((UINT)wParam);
+		return 0;
+	case(WM_RENDERALLFORMATS) :
+		return 0;//the window is going away. The data lives on the peer so the delayed formats are simply dropped
+	}
+	return DefWindowProc(hWnd, msg, wParam, lParam);
+}
 
 void RemoteDesktop::ClipboardMonitor::_Run(){
 	DesktopMonitor dekstopmonitor;
@@ -37,11 +241,12 @@ void RemoteDesktop::ClipboardMonitor::_Run(){
 	WNDCLASSEX wndclass = {};
 	memset(&wndclass, 0, sizeof(wndclass));
 	wndclass.cbSize = sizeof(WNDCLASSEX);
-	wndclass.lpfnWndProc = DefWindowProc;
+	wndclass.lpfnWndProc = ClipboardWndProc;
 	wndclass.lpszClassName = myclass;
 	if (RegisterClassEx(&wndclass))
 	{
 		_Hwnd = CreateWindowEx(0, myclass, L"clipwatcher", 0, 0, 0, 0, 0, HWND_MESSAGE, 0, 0, 0);
+		SetWindowLongPtr(_Hwnd, GWLP_USERDATA, (LONG_PTR)this);
 	}
 	else {
 		DEBUG_MSG("Error %", GetLastError());
@@ -63,14 +268,27 @@ void RemoteDesktop::ClipboardMonitor::_Run(){
 			else if (msg.message == WM_CLIPBOARDUPDATE){
 				if (_ShareClipboard){
 					DEBUG_MSG("Clipboard Update");
-					if (!_IgnoreClipUpdateNotice) {
-						Clipboard_Data c;
+					//when this window is the owner, the clipboard holds the peers delayed formats. Loading them would pull everything across the network and echo it back
+					if (!_IgnoreClipUpdateNotice && GetClipboardOwner() != _Hwnd) {
+						auto c = std::make_shared<Clipboard_Data>();
 						bool update = false;
+						int id = 0;
 						{//ensure lock is released timely
 							std::lock_guard<std::mutex> l(_ClipboardLock);
-							update = Clipboard::Load(_Hwnd, c);
+							update = Clipboard::Load(_Hwnd, *c);
+							if (update){
+								_Clipboard_Data = c;
+								id = ++_ClipboardID;
+							}
+						}
+						if (update) {
+							auto h = Clipboard::Describe(id, *c);
+							{
+								std::lock_guard<std::mutex> l(_ClipboardLock);
+								if (_ClipboardID == id) _Clipboard_Description = h;
+							}
+							_OnClipboardChanged(h);
 						}
-						if (update) _OnClipboardChanged(c);
 					}
 					_IgnoreClipUpdateNotice = false;
 				}
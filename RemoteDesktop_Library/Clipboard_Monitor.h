@@ -4,25 +4,69 @@
 #include "Clipboard.h"
 #include "Delegate.h"
 #include <mutex>
+#include <memory>
+#include <condition_variable>
+#include <deque>
+#include <list>
 
 namespace RemoteDesktop{
+	class SocketHandler;
 	class ClipboardMonitor{
 		void _Run();
+		void _Render(UINT format);
 		std::thread _BackGroundWorker;
 		std::mutex _ClipboardLock;
 		bool _Running = false;
 		HWND _Hwnd = NULL;
-		Clipboard_Data _Clipboard_Data;
-		Delegate<void, const Clipboard_Data&> _OnClipboardChanged;
+		//snapshot of the local clipboard, handed out to peers when they paste. A snapshot is never modified once taken, a new copy replaces it
+		std::shared_ptr<Clipboard_Data> _Clipboard_Data;
+		Clipboard_Announce_Header _Clipboard_Description;
+		int _ClipboardID = 0;
+		Delegate<void, const Clipboard_Announce_Header&> _OnClipboardChanged;
+		Delegate<void, const Clipboard_Request_Header&> _OnClipboardRequest;
 		bool _IgnoreClipUpdateNotice = false;
 		bool _ShareClipboard = true;
 
+		//state for the peers clipboard while this process owns the clipboard with delayed formats
+		std::mutex _RenderLock;
+		std::condition_variable _RenderWait;
+		Clipboard_Announce_Header _RemoteClipboard;
+		Clipboard_Data _RenderData;
+		int _RenderFormat = 0;
+		int _RenderReceived = 0;
+		int _RenderEncoding = CLIPBOARD_ENCODING_RAW;
+		bool _RenderReady = false;
+
+		//recently received formats keyed by hash, so copying the same thing again does not cross the network. Guarded by _RenderLock
+		std::list<std::pair<unsigned long long, std::vector<char>>> _Cache;
+		size_t _CacheSize = 0;
+		bool _CacheFind(unsigned long long hash, int size, std::vector<char>& out);
+		void _CacheAdd(unsigned long long hash, std::vector<char>&& data);
+
+		//requests from the peer are answered on this thread so the network thread is not held up streaming a large clipboard
+		void _SendWorker();
+		void _Send(const Clipboard_Request_Header& h, std::weak_ptr<SocketHandler>& peer);
+		std::thread _SendThread;
+		std::mutex _SendLock;
+		std::condition_variable _SendWait;
+		std::deque<std::pair<Clipboard_Request_Header, std::weak_ptr<SocketHandler>>> _SendQueue;
+		//the last encoded bitmap, so pasting the same image repeatedly only encodes it once. Only touched by the send thread
+		std::vector<char> _EncodedDIB;
+		int _EncodedID = 0;
+
 	public:
-		ClipboardMonitor(Delegate<void, const Clipboard_Data&> c);
+		ClipboardMonitor(Delegate<void, const Clipboard_Announce_Header&> c, Delegate<void, const Clipboard_Request_Header&> r);
 		~ClipboardMonitor();
 		void Restore(const Clipboard_Data& c);
+		//the peer copied something, only the formats are known until something is pasted
+		void Announce(const Clipboard_Announce_Header& h);
+		//the peer asked for data, it is streamed back to peer in fragments from a background thread
+		void Queue_Send(const Clipboard_Request_Header& h, std::weak_ptr<SocketHandler> peer);
+		//a fragment of data requested through the request callback has arrived
+		void Receive(const Clipboard_Fragment_Header& h, const char* data, int len);
 		void set_ShareClipBoard(bool s);
+		LRESULT WindowProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam);
 	};
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -50,6 +50,7 @@ namespace RemoteDesktop{
 	struct Update_Image_Header{
 		int Index;
 		Rect rect;
+		unsigned int FrameID;//Frame_Tracer id assigned by the server
 	};
 	struct MouseEvent_Header{
 		Point pos;
@@ -66,18 +67,78 @@ namespace RemoteDesktop{
 		int Dst_Id = -1;
 		int Src_Id = -1;
 	};
+	enum Mux_Types{
+		MUX_DATA,//Length bytes of the stream follow
+		MUX_OPEN,//gateway to server, a viewer arrived, its Proxy_Header follows
+		MUX_CLOSE,//either way, the stream is gone
+		MUX_CREDIT,//either way, the sender may put Length more bytes of the stream in flight
+		MUX_KEEPALIVE//server to gateway and back on stream 0, keeps the connection alive while no stream is open
+	};
+	struct Mux_Header{
+		int Stream;
+		int Type;
+		int Length;
+	};
+	enum Broadcast_Types{
+		BROADCAST_MESSAGE,//server to gateway, one message of the stream follows, the viewers get it as is
+		BROADCAST_KEYFRAME,//server to gateway, a message with the whole screen of monitor Slot, a late viewer can start from a full set of them
+		BROADCAST_REFRESH,//server to gateway, a keyframe only sent so late viewers have somewhere to start, the ones already watching skip it
+		BROADCAST_DATA,//gateway to server, bytes from the viewer in control, its Proxy_Header comes first
+		BROADCAST_SPECTATOR,//gateway to server, bytes from spectator Slot until it was answered, its Proxy_Header comes first
+		BROADCAST_LEFT,//gateway to server, spectator Slot is gone
+		BROADCAST_ALLOW,//server to gateway, spectator Slot may watch
+		BROADCAST_DENY,//server to gateway, drop spectator Slot
+		BROADCAST_KEEPALIVE//gateway to server, keeps the connection alive once the viewer in control left
+	};
+	//a broadcasting server and the gateway put one in front of everything they send each other, except the server's Proxy_Header and key exchange at the start
+	struct Broadcast_Header{
+		int Type;
+		int Slot;
+		int Length;//bytes that follow
+	};
 	struct File_Header{
 		char RelativePath[MAX_PATH];
 		int ID = 0;
 		int ChunkSize = 0;//in bytes
 		bool Last = false;
 	};
+	struct Clipboard_Format_Header{
+		int Size = 0;
+		unsigned long long Hash = 0;
+	};
+	//sent in place of the clipboard contents. The peer only asks for the data of a format when something is actually pasted
+	struct Clipboard_Announce_Header{
+		int ID = 0;
+		Clipboard_Format_Header DIB, HTML, RTF, Text;
+	};
+	struct Clipboard_Request_Header{
+		int ID = 0;
+		int Formats = 0;//bit flags from Clipboard_Formats
+	};
+	//clipboard data is streamed in pieces so a large copy does not hold up the socket
+	struct Clipboard_Fragment_Header{
+		int ID = 0;
+		int Format = 0;//a single flag from Clipboard_Formats
+		int Offset = 0;
+		int Total = 0;//-1 if the owner no longer has the data
+		int Encoding = 0;//Clipboard_Encodings, Total is the encoded size
+	};
 #pragma pack(pop)
 #define FILECHUNKSIZE (1024*100) // 100 KB
+#define CLIPBOARDCHUNKSIZE (1024*64) // 64 KB
 #define NETWORKHEADERSIZE sizeof(Packet_Encrypt_Header)
 #define TOTALHEADERSIZE sizeof(Packet_Encrypt_Header) + sizeof(Packet_Header)
 #define MAXMESSAGESIZE (1024*1024*50)  //50 MB is the largest single message that is allowed. This is to prevent crashing either the client or server by sending fake packet lengths
-#define STARTBUFFERSIZE (1024 *1024)
+#define SOCKET_MINBUFFERSIZE (4 * 1024) //every socket buffer starts here and doubles while messages need more
+#define SOCKET_BUFFER_IDLE 5000 //ms after the last message that needed a grown buffer before it is given back
+#define SOCKET_BUFFERCACHE_SIZE 16 //given back buffers kept for the next socket that grows
+#define SOCKET_BUFFERCACHE_MAXBUFFER (4 * 1024 * 1024) //anything bigger goes back to the heap
+#define GATEWAY_BROADCAST -2 //Dst_Id of a server that wants the gateway to relay it to every viewer of its id
+#define BROADCAST_SLOTS 16 //monitors a broadcast keeps keyframes for
+#define BROADCAST_SPECTATOR_MAX (16 * 1024) //bytes of a spectator passed to the server while it waits for an answer, its key exchange and connect request fit easily
+#define GATEWAY_MULTIPLEX -3 //Dst_Id of a server that carries every session of its id over one connection, framed with Mux_Header
+#define MUX_WINDOW (256 * 1024) //bytes of a stream either side may have in flight before the other grants more with MUX_CREDIT
+#define MUX_MAXFRAME (64 * 1024)
 
 	enum PeerState{
 		PEER_STATE_DISCONNECTED,
@@ -106,7 +167,21 @@ namespace RemoteDesktop{
 		KEEPALIVE,
 		UAC_BLOCKED,
 		ELEVATE_SUCCESS,
-		ELEVATE_FAILED
+		ELEVATE_FAILED,
+		CLIPBOARD_FORMATS,
+		CLIPBOARD_REQUEST,
+		CLIPBOARD_DATA
+	};
+	enum Clipboard_Formats{
+		CLIPBOARD_DIB = 1,
+		CLIPBOARD_HTML = 2,
+		CLIPBOARD_RTF = 4,
+		CLIPBOARD_TEXT = 8,
+		CLIPBOARD_ALL = CLIPBOARD_DIB | CLIPBOARD_HTML | CLIPBOARD_RTF | CLIPBOARD_TEXT
+	};
+	enum Clipboard_Encodings{
+		CLIPBOARD_ENCODING_RAW,
+		CLIPBOARD_ENCODING_DIB//DIB_Codec
 	};
 	enum Network_Return{
 		FAILED,
@@ -131,8 +206,14 @@ namespace RemoteDesktop{
 		long long CompressedSendBytes, CompressedRecvBytes;//overall lifetime totals 
 		long long UncompressedSendBytes, UncompressedRecvBytes;//overall lifetime totals 
 
+		long long CompressedSendBPS, CompressedRecvBPS;//over the last second
+		long long UncompressedSendBPS, UncompressedRecvBPS;//over the last second
+	};
+	//averages over a window of whole seconds
+	struct Traffic_Rates{
 		long long CompressedSendBPS, CompressedRecvBPS;
 		long long UncompressedSendBPS, UncompressedRecvBPS;
+		long long SendMPS, RecvMPS;//messages per second
 	};
 
 	inline void Validate(User_Info_Header& obj){
@@ -1,24 +1,65 @@
 #include "stdafx.h"
 #include "Compression_Handler.h"
+#include "Profiler.h"
 #include "lz4.h"
 #include "lz4hc.h"
 
+#define SAMPLECHUNKS 2 //number of chunks at the start of a file that are test compressed
+#define RESAMPLEINTERVAL 64 //re-evaluate the choice every N chunks
+#define HIGHCOMPRESSIONLEVEL 9
+#define INCOMPRESSIBLE_RATIO 0.90f//if lz4 cannot get below this, dont bother compressing
+#define HIGHLYCOMPRESSIBLE_RATIO 0.35f//if lz4 gets below this, the data is text like and worth the extra cpu for a better ratio
+
 int RemoteDesktop::Compression_Handler::CompressionBound(int s) {
 	return LZ4_COMPRESSBOUND(s);
 }
 //assume dest is big enough to hold the compressed data
-int RemoteDesktop::Compression_Handler::Compress(const char* source, char* dest, int inputSize, int dest_size){
-	if (inputSize < 1024){
+int RemoteDesktop::Compression_Handler::Compress(const char* source, char* dest, int inputSize, int dest_size, Compression_Types type){
+	PROFILE_ZONE("compress");
+	if (inputSize < 1024 || type == COMPRESSION_NONE){
 		assert(inputSize <= dest_size);
 		memcpy(dest, source, inputSize);
-		return -1;//no compression occurred too small to waste time trying
+		return -1;//no compression occurred too small to waste time trying, or the caller knows the data is already compressed
 	}
 	auto dstsize = (int*)dest;
-	auto compressedsize = LZ4_compress(source, dest + sizeof(int), inputSize);
+	auto compressedsize = 0;
+	if (type == COMPRESSION_HIGH) compressedsize = LZ4_compressHC2(source, dest + sizeof(int), inputSize, HIGHCOMPRESSIONLEVEL);
+	else compressedsize = LZ4_compress(source, dest + sizeof(int), inputSize);
+	if (compressedsize <= 0 || compressedsize + (int)sizeof(int) >= inputSize){
+		memcpy(dest, source, inputSize);
+		return -1;//the data grew, send it as is
+	}
 	*dstsize = inputSize;
 	assert(dest_size + sizeof(int) >= compressedsize);
 	return compressedsize + sizeof(int);//return new size of compressed data
 }
 int RemoteDesktop::Compression_Handler::Decompress(const char* source, char* dest, int compressedSize, int maxDecompressedSize){
+	PROFILE_ZONE("decompress");
 	return LZ4_decompress_safe(source + sizeof(int), dest, compressedSize - sizeof(int), maxDecompressedSize);
-}
\ No newline at end of file
+}
+
+RemoteDesktop::Compression_Handler::File_Compression_Policy::File_Compression_Policy(const std::string& filename){
+	static const char* compressedtypes[] = { ".zip", ".7z", ".rar", ".gz", ".bz2", ".xz", ".cab", ".jpg", ".jpeg", ".png", ".gif", ".mp3", ".mp4", ".mkv", ".avi", ".mov", ".wmv", ".docx", ".xlsx", ".pptx" };
+	auto ext = GetFileExtention(filename);
+	std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+	for (auto a : compressedtypes){
+		if (ext == a){
+			_Current = COMPRESSION_NONE;//start out assuming the data is already compressed, sampling below will correct this if wrong
+			break;
+		}
+	}
+}
+void RemoteDesktop::Compression_Handler::File_Compression_Policy::_Sample(const char* data, int len){
+	if (len < 1024) return;//too small to say anything useful
+	if ((int)_SampleBuffer.size() < CompressionBound(len)) _SampleBuffer.resize(CompressionBound(len));
+	auto compressedsize = LZ4_compress(data, _SampleBuffer.data(), len);
+	auto ratio = (float)compressedsize / (float)len;
+	if (compressedsize <= 0 || ratio >= INCOMPRESSIBLE_RATIO) _Current = COMPRESSION_NONE;
+	else if (ratio <= HIGHLYCOMPRESSIBLE_RATIO) _Current = COMPRESSION_HIGH;
+	else _Current = COMPRESSION_FAST;
+}
+RemoteDesktop::Compression_Handler::Compression_Types RemoteDesktop::Compression_Handler::File_Compression_Policy::Choose(const char* data, int len){
+	if (_ChunkCounter < SAMPLECHUNKS || (_ChunkCounter % RESAMPLEINTERVAL) == 0) _Sample(data, len);
+	_ChunkCounter += 1;
+	return _Current;
+}
@@ -1,17 +1,38 @@
 #ifndef COMPRESSION_HANDLER123_H
 #define COMPRESSION_HANDLER123_H
 #include <vector>
+#include <string>
 
 
 namespace RemoteDesktop{
 	namespace Compression_Handler{
+		//all types produce standard lz4 blocks so the receiving side does not need to know which one was used
+		enum Compression_Types{
+			COMPRESSION_NONE,
+			COMPRESSION_FAST,
+			COMPRESSION_HIGH
+		};
 
 		int CompressionBound(int s);//worst case compression where the size grows! This can happen if you compress something that is already compressed
-		int Compress(const char* source, char* dest, int inputSize, int dest_size);
+		int Compress(const char* source, char* dest, int inputSize, int dest_size, Compression_Types type = COMPRESSION_FAST);
 		int Decompress(const char* source, char* dest, int compressedSize, int maxDecompressedSize);
 		inline int Decompressed_Size(const char* source){ return *((int*)source); }
+
+		//picks a compression type per file by test compressing chunks. The first few chunks are sampled, then every RESAMPLEINTERVAL chunks the choice is re-evaluated since files like archives or logs can change content part way through
+		class File_Compression_Policy{
+			std::vector<char> _SampleBuffer;
+			Compression_Types _Current = COMPRESSION_FAST;
+			int _ChunkCounter = 0;
+			void _Sample(const char* data, int len);
+
+		public:
+			explicit File_Compression_Policy(const std::string& filename);
+			//call once per chunk, before sending it
+			Compression_Types Choose(const char* data, int len);
+			Compression_Types get_Current() const { return _Current; }
+		};
 	};
 }
 
 
-#endif
\ No newline at end of file
+#endif
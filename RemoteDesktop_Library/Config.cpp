@@ -4,6 +4,18 @@
 
 RemoteDesktop::Global_Settings RemoteDesktop::INTERNAL::_Global_Settings;
 
+namespace RemoteDesktop{
+	namespace INTERNAL{
+		//settings are appended to the file as they were added, a file written by an older build simply ends early and the rest keep their defaults
+		template<size_t N> void Read_Setting(std::ifstream& configfile, wchar_t(&setting)[N]){
+			wchar_t tmp[N];
+			if (!configfile.read((char*)tmp, sizeof(tmp))) return;
+			tmp[N - 1] = 0;
+			memcpy(setting, tmp, sizeof(tmp));
+		}
+	}
+}
+
 RemoteDesktop::Global_Settings::Global_Settings(){
 	memset(this, 0, sizeof(this));
 	wcsncpy_s(Service_Name, L"RAT_svc", ARRAYSIZE(Service_Name));
@@ -14,12 +26,22 @@ RemoteDesktop::Global_Settings::Global_Settings(){
 	wcsncpy_s(DisclaimerMessage, L"Do you agree to allow a support technician to connection to your computer?", ARRAYSIZE(DisclaimerMessage));
 	wcsncpy_s(Unique_ID, L"", ARRAYSIZE(Unique_ID));
 	wcsncpy_s(Last_UserConnectName, L"", ARRAYSIZE(Last_UserConnectName));
+	wcsncpy_s(MetricsPort, L"", ARRAYSIZE(MetricsPort));
+	wcsncpy_s(RecordingFolder, L"", ARRAYSIZE(RecordingFolder));
+	wcsncpy_s(BroadcastToGateway, L"", ARRAYSIZE(BroadcastToGateway));
+	wcsncpy_s(MultiplexGateway, L"", ARRAYSIZE(MultiplexGateway));
+	wcsncpy_s(AdmissionSourceRate, L"", ARRAYSIZE(AdmissionSourceRate));
 
 	auto config = GetExePath() + "\\" + RAT_TOOLCONFIG_FILE;
 	if (FileExists(config)){//file exists,read it in
 		std::ifstream configfile(config.c_str(), std::ios::binary);
 		configfile.read((char*)RemoteDesktop::INTERNAL::_Global_Settings.Unique_ID, sizeof(RemoteDesktop::INTERNAL::_Global_Settings.Unique_ID));
 		configfile.read((char*)RemoteDesktop::INTERNAL::_Global_Settings.Last_UserConnectName, sizeof(RemoteDesktop::INTERNAL::_Global_Settings.Last_UserConnectName));
+		RemoteDesktop::INTERNAL::Read_Setting(configfile, RemoteDesktop::INTERNAL::_Global_Settings.MetricsPort);
+		RemoteDesktop::INTERNAL::Read_Setting(configfile, RemoteDesktop::INTERNAL::_Global_Settings.RecordingFolder);
+		RemoteDesktop::INTERNAL::Read_Setting(configfile, RemoteDesktop::INTERNAL::_Global_Settings.BroadcastToGateway);
+		RemoteDesktop::INTERNAL::Read_Setting(configfile, RemoteDesktop::INTERNAL::_Global_Settings.MultiplexGateway);
+		RemoteDesktop::INTERNAL::Read_Setting(configfile, RemoteDesktop::INTERNAL::_Global_Settings.AdmissionSourceRate);
 	}
 }
 void RemoteDesktop::Global_Settings::FlushToDisk(){
@@ -27,6 +49,11 @@ void RemoteDesktop::Global_Settings::FlushToDisk(){
 	std::ofstream configfile(config.c_str(), std::ios::binary | std::ios::trunc);//clear the file each flush
 	configfile.write((char*)RemoteDesktop::INTERNAL::_Global_Settings.Unique_ID, sizeof(RemoteDesktop::INTERNAL::_Global_Settings.Unique_ID));
 	configfile.write((char*)RemoteDesktop::INTERNAL::_Global_Settings.Last_UserConnectName, sizeof(RemoteDesktop::INTERNAL::_Global_Settings.Last_UserConnectName));
+	configfile.write((char*)RemoteDesktop::INTERNAL::_Global_Settings.MetricsPort, sizeof(RemoteDesktop::INTERNAL::_Global_Settings.MetricsPort));
+	configfile.write((char*)RemoteDesktop::INTERNAL::_Global_Settings.RecordingFolder, sizeof(RemoteDesktop::INTERNAL::_Global_Settings.RecordingFolder));
+	configfile.write((char*)RemoteDesktop::INTERNAL::_Global_Settings.BroadcastToGateway, sizeof(RemoteDesktop::INTERNAL::_Global_Settings.BroadcastToGateway));
+	configfile.write((char*)RemoteDesktop::INTERNAL::_Global_Settings.MultiplexGateway, sizeof(RemoteDesktop::INTERNAL::_Global_Settings.MultiplexGateway));
+	configfile.write((char*)RemoteDesktop::INTERNAL::_Global_Settings.AdmissionSourceRate, sizeof(RemoteDesktop::INTERNAL::_Global_Settings.AdmissionSourceRate));
 }
 wchar_t* Service_Name(){
 	return RemoteDesktop::INTERNAL::_Global_Settings.Service_Name;
@@ -61,6 +88,21 @@ wchar_t* Unique_ID(){
 	}
 	return RemoteDesktop::INTERNAL::_Global_Settings.Unique_ID;
 }
+wchar_t* MetricsPort(){
+	return RemoteDesktop::INTERNAL::_Global_Settings.MetricsPort;
+}
+wchar_t* RecordingFolder(){
+	return RemoteDesktop::INTERNAL::_Global_Settings.RecordingFolder;
+}
+wchar_t* BroadcastToGateway(){
+	return RemoteDesktop::INTERNAL::_Global_Settings.BroadcastToGateway;
+}
+wchar_t* MultiplexGateway(){
+	return RemoteDesktop::INTERNAL::_Global_Settings.MultiplexGateway;
+}
+wchar_t* AdmissionSourceRate(){
+	return RemoteDesktop::INTERNAL::_Global_Settings.AdmissionSourceRate;
+}
 wchar_t* GetLast_UserConnectName(){
 	return RemoteDesktop::INTERNAL::_Global_Settings.Last_UserConnectName;
 }
@@ -17,6 +17,11 @@ namespace RemoteDesktop{
 		wchar_t DisclaimerMessage[512];
 		wchar_t Unique_ID[18];
 		wchar_t Last_UserConnectName[128];
+		wchar_t MetricsPort[8];//localhost port for the metrics endpoint, empty to disable it
+		wchar_t RecordingFolder[MAX_PATH];//every connection is recorded to a file in this folder, empty to disable it
+		wchar_t BroadcastToGateway[2];//"1" lets every viewer of the gateway id watch, the first one to connect keeps control
+		wchar_t MultiplexGateway[2];//"1" carries every viewer of the gateway id over one connection instead of one each
+		wchar_t AdmissionSourceRate[8];//connections per second one address may open on a direct server, empty for ADMISSION_SOURCE_RATE. A load test from another machine needs it raised
 		void FlushToDisk();
 	};	
 	namespace INTERNAL{
@@ -31,5 +36,10 @@ wchar_t* DefaultProxyGetSessionURL();
 wchar_t* DisclaimerMessage();
 wchar_t* Unique_ID();
 wchar_t* GetLast_UserConnectName();
+wchar_t* MetricsPort();
+wchar_t* RecordingFolder();
+wchar_t* BroadcastToGateway();
+wchar_t* MultiplexGateway();
+wchar_t* AdmissionSourceRate();
 void SetLast_UserConnectName(std::wstring name);
 #endif
\ No newline at end of file
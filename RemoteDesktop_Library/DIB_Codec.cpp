@@ -0,0 +1,148 @@
+#include "stdafx.h"
+#include "DIB_Codec.h"
+#include "lz4.h"
+#include "lz4hc.h"
+#include "Timer.h"
+
+#define DIBCOMPRESSIONLEVEL 4 //lz4hc level, higher levels gain very little on filtered data and take much longer on large screenshots
+
+namespace RemoteDesktop{
+	namespace DIB_Codec{
+		namespace _INTERNAL{
+#pragma pack(push, 1)
+			struct DIB_Codec_Header{
+				int PrefixSize = 0;//bitmap header, masks and color table, sent as is
+				int SuffixSize = 0;//anything after the pixels, sent as is
+				int RowBytes = 0;
+				int Rows = 0;
+				int Bpp = 0;//bytes per pixel used by the filters
+				int CompressedSize = 0;
+			};
+#pragma pack(pop)
+			enum Row_Filters{
+				FILTER_NONE,
+				FILTER_SUB,
+				FILTER_UP,
+				FILTER_AVERAGE,
+				FILTER_PAETH,
+				FILTER_COUNT
+			};
+			inline unsigned char Paeth(int a, int b, int c){
+				auto p = a + b - c;
+				auto pa = abs(p - a);
+				auto pb = abs(p - b);
+				auto pc = abs(p - c);
+				if (pa <= pb && pa <= pc) return (unsigned char)a;
+				if (pb <= pc) return (unsigned char)b;
+				return (unsigned char)c;
+			}
+			//row is the unfiltered row, prev is the unfiltered row above or nullptr for the first row
+			inline unsigned char Predict(int filter, const unsigned char* row, const unsigned char* prev, int i, int bpp){
+				unsigned char a = i >= bpp ? row[i - bpp] : 0;
+				unsigned char b = prev ? prev[i] : 0;
+				unsigned char c = (prev && i >= bpp) ? prev[i - bpp] : 0;
+				switch (filter){
+				case(FILTER_SUB) :
+					return a;
+				case(FILTER_UP) :
+					return b;
+				case(FILTER_AVERAGE) :
+					return (unsigned char)((a + b) / 2);
+				case(FILTER_PAETH) :
+					return Paeth(a, b, c);
+				}
+				return 0;
+			}
+			//same heuristic png encoders use, pick the filter with the smallest sum of absolute residuals
+			void FilterRow(const unsigned char* row, const unsigned char* prev, int rowbytes, int bpp, unsigned char* out){
+				auto best = 0;
+				auto bestcost = -1ll;
+				for (auto f = 0; f < FILTER_COUNT; f++){
+					long long cost = 0;
+					for (auto i = 0; i < rowbytes && (bestcost < 0 || cost < bestcost); i++){
+						cost += abs((signed char)(row[i] - Predict(f, row, prev, i, bpp)));
+					}
+					if (bestcost < 0 || cost < bestcost){
+						bestcost = cost;
+						best = f;
+					}
+				}
+				out[0] = (unsigned char)best;
+				for (auto i = 0; i < rowbytes; i++) out[i + 1] = (unsigned char)(row[i] - Predict(best, row, prev, i, bpp));
+			}
+			void UnfilterRow(const unsigned char* in, const unsigned char* prev, int rowbytes, int bpp, unsigned char* row){
+				auto f = in[0];
+				for (auto i = 0; i < rowbytes; i++) row[i] = (unsigned char)(in[i + 1] + Predict(f, row, prev, i, bpp));
+			}
+		}
+	}
+}
+
+bool RemoteDesktop::DIB_Codec::Encode(const std::vector<char>& dib, std::vector<char>& out){
+	using namespace _INTERNAL;
+	if (dib.size() < sizeof(BITMAPINFOHEADER)) return false;
+	auto t = Timer(true);
+	BITMAPINFOHEADER bi;
+	memcpy(&bi, dib.data(), sizeof(bi));
+	if (bi.biCompression != BI_RGB && bi.biCompression != BI_BITFIELDS) return false;//already compressed formats like jpeg or png dibs
+	if (bi.biWidth <= 0 || bi.biHeight == 0 || bi.biBitCount == 0 || bi.biSize < sizeof(bi)) return false;
+
+	size_t colors = bi.biClrUsed;
+	if (colors == 0 && bi.biBitCount <= 8) colors = (size_t)1 << bi.biBitCount;
+	size_t prefix = bi.biSize + colors * sizeof(RGBQUAD);
+	if (bi.biCompression == BI_BITFIELDS && bi.biSize == sizeof(BITMAPINFOHEADER)) prefix += 3 * sizeof(DWORD);
+
+	DIB_Codec_Header h;
+	h.RowBytes = ((bi.biWidth * bi.biBitCount + 31) / 32) * 4;
+	h.Rows = abs(bi.biHeight);
+	h.Bpp = bi.biBitCount >= 8 ? bi.biBitCount / 8 : 1;
+	auto pixels = (size_t)h.RowBytes * (size_t)h.Rows;
+	if (prefix + pixels > dib.size()) return false;
+	h.PrefixSize = prefix;
+	h.SuffixSize = dib.size() - prefix - pixels;
+
+	std::vector<unsigned char> filtered((h.RowBytes + 1) * (size_t)h.Rows);
+	auto src = (const unsigned char*)dib.data() + prefix;
+	for (auto r = 0; r < h.Rows; r++){
+		FilterRow(src + (size_t)r * h.RowBytes, r > 0 ? src + (size_t)(r - 1) * h.RowBytes : nullptr, h.RowBytes, h.Bpp, filtered.data() + (size_t)r * (h.RowBytes + 1));
+	}
+
+	auto headersize = sizeof(h) + h.PrefixSize + h.SuffixSize;
+	out.resize(headersize + LZ4_COMPRESSBOUND(filtered.size()));
+	h.CompressedSize = LZ4_compressHC2((const char*)filtered.data(), out.data() + headersize, filtered.size(), DIBCOMPRESSIONLEVEL);
+	if (h.CompressedSize <= 0 || headersize + h.CompressedSize >= dib.size()) return false;
+
+	memcpy(out.data(), &h, sizeof(h));
+	memcpy(out.data() + sizeof(h), dib.data(), h.PrefixSize);
+	memcpy(out.data() + sizeof(h) + h.PrefixSize, dib.data() + prefix + pixels, h.SuffixSize);
+	out.resize(headersize + h.CompressedSize);
+	t.Stop();
+	DEBUG_MSG("DIB encoded from % to % bytes in % ms", dib.size(), out.size(), t.Elapsed_milli());
+	return true;
+}
+bool RemoteDesktop::DIB_Codec::Decode(const char* data, int len, int maxsize, std::vector<char>& dib){
+	using namespace _INTERNAL;
+	DIB_Codec_Header h;
+	if (len < (int)sizeof(h)) return false;
+	memcpy(&h, data, sizeof(h));
+	if (h.PrefixSize < 0 || h.SuffixSize < 0 || h.RowBytes <= 0 || h.Rows <= 0 || h.Bpp <= 0 || h.Bpp > h.RowBytes || h.CompressedSize <= 0) return false;
+	auto pixels = (long long)h.RowBytes * (long long)h.Rows;
+	if ((long long)h.PrefixSize + h.SuffixSize + pixels > maxsize) return false;
+	if ((long long)sizeof(h) + h.PrefixSize + h.SuffixSize + h.CompressedSize > len) return false;
+	auto t = Timer(true);
+
+	std::vector<unsigned char> filtered((h.RowBytes + 1) * (size_t)h.Rows);
+	auto src = data + sizeof(h) + h.PrefixSize + h.SuffixSize;
+	if (LZ4_decompress_safe(src, (char*)filtered.data(), h.CompressedSize, filtered.size()) != (int)filtered.size()) return false;
+
+	dib.resize(h.PrefixSize + (size_t)pixels + h.SuffixSize);
+	memcpy(dib.data(), data + sizeof(h), h.PrefixSize);
+	auto dst = (unsigned char*)dib.data() + h.PrefixSize;
+	for (auto r = 0; r < h.Rows; r++){
+		UnfilterRow(filtered.data() + (size_t)r * (h.RowBytes + 1), r > 0 ? dst + (size_t)(r - 1) * h.RowBytes : nullptr, h.RowBytes, h.Bpp, dst + (size_t)r * h.RowBytes);
+	}
+	memcpy(dst + pixels, data + sizeof(h) + h.PrefixSize, h.SuffixSize);
+	t.Stop();
+	DEBUG_MSG("DIB decoded % bytes in % ms", dib.size(), t.Elapsed_milli());
+	return true;
+}
@@ -0,0 +1,15 @@
+#ifndef DIB_CODEC123_H
+#define DIB_CODEC123_H
+#include <vector>
+
+namespace RemoteDesktop{
+	//lossless compression for clipboard bitmaps. Each row of pixels is run through the best of the png prediction filters, which turns the flat areas and gradients of screenshots into runs of zeros, then the result is lz4hc compressed
+	namespace DIB_Codec{
+		//returns false if the dib is a type that is not supported or does not get smaller, send it as is in that case
+		bool Encode(const std::vector<char>& dib, std::vector<char>& out);
+		//maxsize is the largest dib the caller will accept, anything claiming to be bigger is rejected before allocating
+		bool Decode(const char* data, int len, int maxsize, std::vector<char>& dib);
+	};
+}
+
+#endif
@@ -1,5 +1,11 @@
 #include "stdafx.h"
 #include "Encryption.h"
+#include "Profiler.h"
+#include "Metrics.h"
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <vector>
 
 #include "cryptopp/integer.h"
 using CryptoPP::Integer;
@@ -24,15 +30,110 @@ using CryptoPP::FHMQV;
 #include "cryptopp/secblock.h"
 using CryptoPP::SecByteBlock;
 
+#define ENCRYPTION_EPHEMERAL_POOL 64 //key pairs kept ready, a burst of reconnects takes them faster than the worker makes them
+#define ENCRYPTION_EPHEMERAL_REFILL 32 //the worker starts again once the pool is down to this
+
 namespace RemoteDesktop{
 	class Encryption_Impl{
 	public:
 
 		Encryption_Impl() : AESKey(SHA256::DIGESTSIZE){}
 		AutoSeededRandomPool rnd;
-		std::unique_ptr<FHMQV<ECP>::Domain> fhmqv;
+		bool client = true;
 		SecByteBlock staticprivatekey, staticpublickey, ephemeralprivatekey, ephemeralpublickey, AESKey;
 	};
+	namespace INTERNAL{
+		Metrics::Value& EphemeralKeyMisses = Metrics::Counter("rd_ephemeral_key_misses_total", "Handshakes that generated their ephemeral key themselves because the pool was empty");
+
+		//the curve with its base point precomputed, once for the process. Precompute makes every ExponentiateBase after it several times faster, key generation is one and so is Agree for the own static key
+		const FHMQV<ECP>::Domain::GroupParameters& Precomputed(){
+			static const FHMQV<ECP>::Domain::GroupParameters parameters = [](){
+				FHMQV<ECP>::Domain::GroupParameters p(secp256r1());
+				p.Precompute();
+				return p;
+			}();
+			return parameters;
+		}
+		//one domain per role on each thread. The curve keeps its scratch points in mutable members so a domain cannot be shared between threads, each one copies the precomputed parameters instead
+		FHMQV<ECP>::Domain& Domain(bool client){
+			thread_local std::unique_ptr<FHMQV<ECP>::Domain> domains[2];
+			auto& d = domains[client ? 1 : 0];
+			if (!d) d = std::make_unique<FHMQV<ECP>::Domain>(Precomputed(), client);
+			return *d;
+		}
+		struct Key_Pair{
+			SecByteBlock Private, Public;
+		};
+		//the static key pair of the host and a stock of ephemeral ones. Sharing the static pair saves a key generation per handshake, the price is that a peer sees the same public key on every connection of the host until Encryption::Shutdown, and a leaked private key lets someone pose as it until then. Nothing here pins static keys, so a session never depends on it. Ephemeral pairs are used once, a worker thread makes them ahead of time so a handshake only has to do the agreement
+		class Key_Pool{
+			std::mutex _Lock;
+			std::condition_variable _Low;
+			std::vector<Key_Pair> _Ephemeral;
+			Key_Pair _Static;
+			bool _Stopping = false;
+			std::thread _Worker;
+
+			void _Run(){
+				AutoSeededRandomPool rnd;
+				auto& fhmqv = Domain(true);
+				while (true){
+					{
+						std::unique_lock<std::mutex> lock(_Lock);
+						_Low.wait(lock, [this](){ return _Stopping || _Ephemeral.size() <= ENCRYPTION_EPHEMERAL_REFILL; });
+						if (_Stopping) return;
+					}
+					for (auto full = false; !full;){
+						Key_Pair k;
+						k.Private.resize(fhmqv.EphemeralPrivateKeyLength());
+						k.Public.resize(fhmqv.EphemeralPublicKeyLength());
+						fhmqv.GenerateEphemeralKeyPair(rnd, k.Private, k.Public);
+						std::lock_guard<std::mutex> lock(_Lock);
+						_Ephemeral.push_back(Key_Pair());
+						_Ephemeral.back().Private.swap(k.Private);
+						_Ephemeral.back().Public.swap(k.Public);
+						full = _Stopping || _Ephemeral.size() >= ENCRYPTION_EPHEMERAL_POOL;
+					}
+				}
+			}
+
+		public:
+			Key_Pool(){
+				AutoSeededRandomPool rnd;
+				auto& fhmqv = Domain(true);
+				_Static.Private.resize(fhmqv.StaticPrivateKeyLength());
+				_Static.Public.resize(fhmqv.StaticPublicKeyLength());
+				fhmqv.GenerateStaticKeyPair(rnd, _Static.Private, _Static.Public);
+				_Ephemeral.reserve(ENCRYPTION_EPHEMERAL_POOL);
+				_Worker = std::thread(&Key_Pool::_Run, this);
+			}
+			~Key_Pool(){
+				{
+					std::lock_guard<std::mutex> lock(_Lock);
+					_Stopping = true;
+				}
+				_Low.notify_one();
+				_Worker.join();
+			}
+			const Key_Pair& get_Static() const { return _Static; }
+			//false when the pool is empty, the caller makes its own
+			bool Take(Key_Pair& k){
+				std::lock_guard<std::mutex> lock(_Lock);
+				if (_Ephemeral.empty()) return false;
+				k.Private.swap(_Ephemeral.back().Private);
+				k.Public.swap(_Ephemeral.back().Public);
+				_Ephemeral.pop_back();
+				if (_Ephemeral.size() <= ENCRYPTION_EPHEMERAL_REFILL) _Low.notify_one();
+				return true;
+			}
+		};
+		std::mutex KeysLock;
+		std::shared_ptr<Key_Pool> KeysPool;//created on first use, Encryption::Shutdown lets it go
+		std::shared_ptr<Key_Pool> Keys(){
+			std::lock_guard<std::mutex> lock(KeysLock);
+			if (!KeysPool) KeysPool = std::make_shared<Key_Pool>();
+			return KeysPool;
+		}
+	}
 }
 
 
@@ -47,10 +148,17 @@ RemoteDesktop::Encryption::~Encryption() {
 }
 
 int RemoteDesktop::Encryption::get_StaticPublicKeyLength() const{
-	return  _Encryption_Impl->fhmqv->StaticPublicKeyLength();
+	return (int)_Encryption_Impl->staticpublickey.size();
 }
 int RemoteDesktop::Encryption::get_EphemeralPublicKeyLength() const{
-	return  _Encryption_Impl->fhmqv->EphemeralPublicKeyLength();
+	return (int)_Encryption_Impl->ephemeralpublickey.size();
+}
+int RemoteDesktop::Encryption::get_KeyExchangeLength(){
+	static const int length = [](){
+		FHMQV<ECP>::Domain fhmqv(secp256r1(), true);
+		return (int)(fhmqv.StaticPublicKeyLength() + fhmqv.EphemeralPublicKeyLength());
+	}();
+	return length;
 }
 const char* RemoteDesktop::Encryption::get_Static_PublicKey() const{
 	return (const char*)_Encryption_Impl->staticpublickey.BytePtr();
@@ -66,33 +174,45 @@ void RemoteDesktop::Encryption::set_AES_Key(const char* k){
 void RemoteDesktop::Encryption::clear(){// clear everything
 	clear_keyexchange();
 	memset(_Encryption_Impl->AESKey.BytePtr(), 0, _Encryption_Impl->AESKey.SizeInBytes());
-	_Encryption_Impl->fhmqv.reset();
 }
 void RemoteDesktop::Encryption::clear_keyexchange(){// clear only the keys after the initial key  exchange is finished, keep the AES key intact, delete the ECC domain params
 	memset(_Encryption_Impl->ephemeralprivatekey.BytePtr(), 0, _Encryption_Impl->ephemeralprivatekey.SizeInBytes());
 	memset(_Encryption_Impl->staticprivatekey.BytePtr(), 0, _Encryption_Impl->staticprivatekey.SizeInBytes());
 	memset(_Encryption_Impl->staticpublickey.BytePtr(), 0, _Encryption_Impl->staticpublickey.SizeInBytes());
 	memset(_Encryption_Impl->ephemeralpublickey.BytePtr(), 0, _Encryption_Impl->ephemeralpublickey.SizeInBytes());
-	_Encryption_Impl->fhmqv.reset();
 }
 void RemoteDesktop::Encryption::Init(bool client){
 	clear();// just in case
-	const OID CURVE = secp256r1();
-	_Encryption_Impl->fhmqv = std::make_unique<FHMQV<ECP>::Domain>(CURVE, client);// allocate here
-	_Encryption_Impl->staticprivatekey.resize(_Encryption_Impl->fhmqv->StaticPrivateKeyLength());
-	_Encryption_Impl->staticpublickey.resize(_Encryption_Impl->fhmqv->StaticPublicKeyLength());
-	_Encryption_Impl->ephemeralprivatekey.resize(_Encryption_Impl->fhmqv->EphemeralPrivateKeyLength());
-	_Encryption_Impl->ephemeralpublickey.resize(_Encryption_Impl->fhmqv->EphemeralPublicKeyLength());
-	AutoSeededRandomPool rnd;
-	_Encryption_Impl->fhmqv->GenerateStaticKeyPair(rnd, _Encryption_Impl->staticprivatekey, _Encryption_Impl->staticpublickey);
-	_Encryption_Impl->fhmqv->GenerateEphemeralKeyPair(rnd, _Encryption_Impl->ephemeralprivatekey, _Encryption_Impl->ephemeralpublickey);
+	_Encryption_Impl->client = client;
+	auto keys(INTERNAL::Keys());
+	_Encryption_Impl->staticprivatekey = keys->get_Static().Private;//copies, clear_keyexchange wipes them
+	_Encryption_Impl->staticpublickey = keys->get_Static().Public;
+	INTERNAL::Key_Pair ephemeral;
+	if (!keys->Take(ephemeral)){
+		INTERNAL::EphemeralKeyMisses.Add();
+		auto& fhmqv = INTERNAL::Domain(client);
+		ephemeral.Private.resize(fhmqv.EphemeralPrivateKeyLength());
+		ephemeral.Public.resize(fhmqv.EphemeralPublicKeyLength());
+		fhmqv.GenerateEphemeralKeyPair(_Encryption_Impl->rnd, ephemeral.Private, ephemeral.Public);
+	}
+	_Encryption_Impl->ephemeralprivatekey.swap(ephemeral.Private);
+	_Encryption_Impl->ephemeralpublickey.swap(ephemeral.Public);
+}
 
+void RemoteDesktop::Encryption::Shutdown(){
+	std::shared_ptr<INTERNAL::Key_Pool> pool;
+	{
+		std::lock_guard<std::mutex> lock(INTERNAL::KeysLock);
+		pool.swap(INTERNAL::KeysPool);
+	}
+	//the worker is joined once the last Init still holding the pool is done with it
 }
 
 bool RemoteDesktop::Encryption::Agree(const char *staticOtherPublicKey, const char *ephemeralOtherPublicKey, bool usepreaes){
-	SecByteBlock sharedsecret(_Encryption_Impl->fhmqv->AgreedValueLength());
+	auto& fhmqv = INTERNAL::Domain(_Encryption_Impl->client);
+	SecByteBlock sharedsecret(fhmqv.AgreedValueLength());
 
-	bool verified = _Encryption_Impl->fhmqv->Agree(sharedsecret, _Encryption_Impl->staticprivatekey, _Encryption_Impl->ephemeralprivatekey, (byte*)staticOtherPublicKey, (byte*)ephemeralOtherPublicKey);
+	bool verified = fhmqv.Agree(sharedsecret, _Encryption_Impl->staticprivatekey, _Encryption_Impl->ephemeralprivatekey, (byte*)staticOtherPublicKey, (byte*)ephemeralOtherPublicKey);
 	if (verified){
 		if (!usepreaes){
 			DEBUG_MSG("Key Exchange Completed . . ");
@@ -108,6 +228,7 @@ bool RemoteDesktop::Encryption::Agree(const char *staticOtherPublicKey, const ch
 }
 
 bool RemoteDesktop::Encryption::Decrypt(char* in_data, char* out_data, int insize, char* iv){
+	PROFILE_ZONE("decrypt");
 	size_t multiple = insize / AES::BLOCKSIZE;
 	if (multiple * AES::BLOCKSIZE != insize) return false;// data not correctly sized
 	GCM<AES>::Decryption Decryptor;
@@ -131,6 +252,7 @@ bool RemoteDesktop::Encryption::Decrypt(char* in_data, char* out_data, int insiz
 }
 
 int RemoteDesktop::Encryption::Ecrypt(char* in_data, char* out_data, int insize, int outsize, char* iv){
+	PROFILE_ZONE("encrypt");
 	GCM<AES>::Encryption Encryptor;
 	try{// Crypto++ loves throwing stuff around! If any errors occur, it likely that something is seriously screwed up on our part
 		_Encryption_Impl->rnd.GenerateBlock((byte*)iv, AES::BLOCKSIZE);
@@ -15,7 +15,10 @@ namespace RemoteDesktop{
 		Encryption();
 		~Encryption();
 	
+		//the static key pair is shared by the host and the ephemeral one comes from a pool a worker thread keeps filled, so this is cheap
 		void Init(bool client);
+		//stops the worker of the key pool and drops the static key pair, the next Init starts a new pool. Call it when the host is done, before its module is unloaded, the worker cannot be joined from the destructors of statics under the loader lock
+		static void Shutdown();
 		bool Agree(const char *staticOtherPublicKey, const char *ephemeralOtherPublicKey, bool usepreaes);
 		bool Decrypt(char* in_data, char* out_data, int insize, char* iv);
 		int Ecrypt(char* in_data, char* out_data, int insize, int outsize, char* iv);//size will be rounded up to nearest 16 byte chunk. Encryption is in place!
@@ -24,6 +27,8 @@ namespace RemoteDesktop{
 		int get_EphemeralPublicKeyLength() const;
 		const char* get_Static_PublicKey() const; 
 		const char* get_Ephemeral_PublicKey() const;
+		//what each side sends after its Proxy_Header, both public keys. Lets the gateway find the end of the key exchange without doing one
+		static int get_KeyExchangeLength();
 		void set_AES_Key(const char* k);
 	};
 };
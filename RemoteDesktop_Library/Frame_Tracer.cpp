@@ -0,0 +1,140 @@
+#include "stdafx.h"
+#include "Frame_Tracer.h"
+#include "Histogram.h"
+#include "Allocation_Tracker.h"
+#include <atomic>
+#include <mutex>
+
+#define FRAMETRACE_RECENT 128 //number of individual frames kept
+#define FRAMETRACE_DUMPINTERVAL 10 //seconds between dumps to the debug output
+
+namespace RemoteDesktop{
+	namespace Frame_Tracer{
+		namespace _INTERNAL{
+#if _DEBUG
+			bool Enabled = true;
+#else
+			bool Enabled = false;
+#endif
+			std::atomic<unsigned int> NextID(1);
+			std::atomic<long long> LastDump(0);
+			Histogram Stages[STAGE_COUNT];
+
+			std::mutex RecentLock;
+			Frame_Trace Recent[FRAMETRACE_RECENT];
+			unsigned int RecentCounter = 0;
+
+			struct Thread_Frame{
+				Frame_Trace Trace;
+				long long Last = 0;
+			};
+			thread_local Thread_Frame Current;
+
+			inline long long to_Micro(long long ticks){ return High_Clock::to_Micro(ticks); }
+			void Clear(Thread_Frame& f, long long now){
+				f.Trace.ID = 0;
+				for (auto& a : f.Trace.Durations) a = -1;
+				f.Last = now;
+			}
+		}
+	}
+}
+void RemoteDesktop::Frame_Tracer::set_Enabled(bool e){
+	_INTERNAL::Enabled = e;
+}
+bool RemoteDesktop::Frame_Tracer::get_Enabled(){
+	return _INTERNAL::Enabled;
+}
+long long RemoteDesktop::Frame_Tracer::Now(){
+	return High_Clock::Now();
+}
+unsigned int RemoteDesktop::Frame_Tracer::Begin(){
+	auto id = _INTERNAL::NextID.fetch_add(1);
+	Allocation_Tracker::Begin();
+	if (!_INTERNAL::Enabled) return id;
+	_INTERNAL::Clear(_INTERNAL::Current, Now());
+	_INTERNAL::Current.Trace.ID = id;
+	return id;
+}
+void RemoteDesktop::Frame_Tracer::Begin_At(long long now){
+	Allocation_Tracker::Begin();
+	if (!_INTERNAL::Enabled) return;
+	_INTERNAL::Clear(_INTERNAL::Current, now != 0 ? now : Now());//0 when tracing was turned on after the data arrived
+}
+void RemoteDesktop::Frame_Tracer::set_ID(unsigned int id){
+	_INTERNAL::Current.Trace.ID = id;
+}
+unsigned int RemoteDesktop::Frame_Tracer::get_ID(){
+	return _INTERNAL::Current.Trace.ID;
+}
+void RemoteDesktop::Frame_Tracer::Mark(Stages s){
+	Allocation_Tracker::Mark(s);
+	if (!_INTERNAL::Enabled) return;
+	auto& f = _INTERNAL::Current;
+	auto now = Now();
+	f.Trace.Durations[s] = now - f.Last;
+	f.Last = now;
+}
+void RemoteDesktop::Frame_Tracer::End(){
+	Allocation_Tracker::End();
+	if (!_INTERNAL::Enabled) return;
+	auto& f = _INTERNAL::Current;
+	auto now = Now();
+	if (f.Trace.ID != 0){
+		for (auto i = 0; i < STAGE_COUNT; i++){
+			if (f.Trace.Durations[i] < 0) continue;
+			f.Trace.Durations[i] = _INTERNAL::to_Micro(f.Trace.Durations[i]);
+			_INTERNAL::Stages[i].Record(f.Trace.Durations[i]);
+		}
+		std::lock_guard<std::mutex> lock(_INTERNAL::RecentLock);
+		_INTERNAL::Recent[_INTERNAL::RecentCounter++ % FRAMETRACE_RECENT] = f.Trace;
+	}
+	_INTERNAL::Clear(f, now);//work after this point on the same thread belongs to the next frame
+
+	auto last = _INTERNAL::LastDump.load();
+	if (now - last > FRAMETRACE_DUMPINTERVAL * High_Clock::Frequency() && _INTERNAL::LastDump.compare_exchange_strong(last, now)){
+		if (last != 0) OutputDebugStringA(Dump().c_str());
+	}
+}
+void RemoteDesktop::Frame_Tracer::Record(Stages s, long long duration_ticks){
+	if (!_INTERNAL::Enabled) return;
+	_INTERNAL::Stages[s].Record(_INTERNAL::to_Micro(duration_ticks));
+}
+RemoteDesktop::Frame_Tracer::Stage_Stats RemoteDesktop::Frame_Tracer::get_Stats(Stages s){
+	Stage_Stats st;
+	auto& h = _INTERNAL::Stages[s];
+	st.Count = h.get_Count();
+	st.Min = h.get_Min();
+	st.Max = h.get_Max();
+	st.Mean = h.get_Mean();
+	st.P50 = h.get_Percentile(50.0);
+	st.P90 = h.get_Percentile(90.0);
+	st.P99 = h.get_Percentile(99.0);
+	return st;
+}
+long long RemoteDesktop::Frame_Tracer::get_Sum(Stages s){
+	return _INTERNAL::Stages[s].get_Sum();
+}
+std::vector<RemoteDesktop::Frame_Tracer::Frame_Trace> RemoteDesktop::Frame_Tracer::get_Recent(){
+	std::vector<Frame_Trace> ret;
+	std::lock_guard<std::mutex> lock(_INTERNAL::RecentLock);
+	auto count = std::min(_INTERNAL::RecentCounter, (unsigned int)FRAMETRACE_RECENT);
+	for (auto i = _INTERNAL::RecentCounter - count; i < _INTERNAL::RecentCounter; i++) ret.push_back(_INTERNAL::Recent[i % FRAMETRACE_RECENT]);
+	return ret;
+}
+std::string RemoteDesktop::Frame_Tracer::Dump(){
+	static const char* names[] = { "capture", "diff", "encode", "enqueue", "send", "receive", "decrypt", "decode", "present" };
+	std::ostringstream out;
+	out << "Frame pipeline (us)" << std::endl;
+	for (auto i = 0; i < STAGE_COUNT; i++){
+		auto st = get_Stats((Stages)i);
+		if (st.Count == 0) continue;
+		out << std::setw(8) << names[i] << " n=" << st.Count << " mean=" << st.Mean << " p50=" << st.P50 << " p90=" << st.P90 << " p99=" << st.P99 << " max=" << st.Max << std::endl;
+	}
+	return out.str();
+}
+void RemoteDesktop::Frame_Tracer::Reset(){
+	for (auto& a : _INTERNAL::Stages) a.Reset();
+	std::lock_guard<std::mutex> lock(_INTERNAL::RecentLock);
+	_INTERNAL::RecentCounter = 0;
+}
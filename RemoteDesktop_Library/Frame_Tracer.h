@@ -0,0 +1,54 @@
+#ifndef FRAME_TRACER123_H
+#define FRAME_TRACER123_H
+#include <vector>
+#include <string>
+
+namespace RemoteDesktop{
+	//follows each screen update through the pipeline. The server stamps capture through send, the viewer stamps receive through present. The clocks of the two machines are not compared, each side keeps its own per stage histograms and the frame id ties the two together
+	namespace Frame_Tracer{
+		enum Stages{
+			STAGE_CAPTURE,
+			STAGE_DIFF,
+			STAGE_ENCODE,
+			STAGE_ENQUEUE,
+			STAGE_SEND,
+			STAGE_RECEIVE,//time the data sat in the socket buffer before being processed
+			STAGE_DECRYPT,//includes decompression
+			STAGE_DECODE,
+			STAGE_PRESENT,//from the display being updated to it being painted
+			STAGE_COUNT
+		};
+		//all times are in microseconds
+		struct Stage_Stats{
+			long long Count, Min, Max, Mean, P50, P90, P99;
+		};
+		struct Frame_Trace{
+			unsigned int ID;
+			long long Durations[STAGE_COUNT];//-1 for stages that did not happen on this side
+		};
+
+		void set_Enabled(bool e);
+		bool get_Enabled();
+		long long Now();
+
+		//the functions below track one frame per thread
+		unsigned int Begin();//starts a new frame and returns its id
+		void Begin_At(long long now);//starts a frame that arrived at now, the id is not known yet
+		void set_ID(unsigned int id);
+		unsigned int get_ID();
+		void Mark(Stages s);//the stage that just finished on this thread
+		void End();//records the frame. Frames without an id are dropped
+
+		//for stages that finish on another thread
+		void Record(Stages s, long long duration_ticks);
+
+		Stage_Stats get_Stats(Stages s);
+		//total of every duration recorded, kept separately since Stage_Stats is handed out through the viewer's dll as is
+		long long get_Sum(Stages s);
+		std::vector<Frame_Trace> get_Recent();//oldest first
+		std::string Dump();
+		void Reset();
+	};
+}
+
+#endif
@@ -6,6 +6,7 @@
 #include "..\RemoteDesktop_Library\NetworkSetup.h"
 #include "Config.h"
 #include "UserInfo.h"
+#include "Timer_Wheel.h"
 
 bool RemoteDesktop::GetGatewayID_and_Key(int& id, std::wstring& aeskey, std::wstring gatewayurl){
 	char comp[MAX_COMPUTERNAME_LENGTH + 1];
@@ -44,3 +45,52 @@ bool RemoteDesktop::GetGatewayID_and_Key(int& id, std::wstring& aeskey, std::wst
 	return id != -1;
 
 }
+
+RemoteDesktop::Gateway_Lease::Gateway_Lease(std::wstring gatewayurl, long long duration, long long renew) : _GatewayUrl(gatewayurl), _Duration(duration), _Renew(renew), _Renewing(false), _Requests(0){
+
+}
+RemoteDesktop::Gateway_Lease::~Gateway_Lease(){
+	BEGINTRY
+		if (_Renewer.joinable()) _Renewer.join();
+	ENDTRY
+}
+bool RemoteDesktop::Gateway_Lease::_Fetch(){
+	int id = -1;
+	std::wstring aeskey;
+	_Requests += 1;
+	auto now = Timer_Wheel::Now();
+	if (!GetGatewayID_and_Key(id, aeskey, _GatewayUrl)) return false;
+	std::lock_guard<std::mutex> lock(_Lock);
+	_Id = id;
+	_AesKey = aeskey;
+	_Issued = now;
+	return true;
+}
+bool RemoteDesktop::Gateway_Lease::Get(int& id, std::wstring& aeskey){
+	auto now = Timer_Wheel::Now();
+	auto age = 0LL;
+	{
+		std::lock_guard<std::mutex> lock(_Lock);
+		age = now - _Issued;
+		if (_Id == -1 || age >= _Duration){
+			_Id = -1;
+			age = -1;
+		}
+	}
+	if (age < 0){
+		DEBUG_MSG("Gateway lease expired, asking for a new id");
+		if (!_Fetch()) return false;
+	}
+	else if (age >= _Renew && !_Renewing.exchange(true)){
+		if (_Renewer.joinable()) _Renewer.join();//finished, _Renewing was cleared on its way out
+		_Renewer = std::thread([this](){
+			if (!_Fetch()) DEBUG_MSG("Gateway lease renewal failed, keeping the old id until it expires");
+			_Renewing = false;
+		});
+	}
+	std::lock_guard<std::mutex> lock(_Lock);
+	if (_Id == -1) return false;
+	id = _Id;
+	aeskey = _AesKey;
+	return true;
+}
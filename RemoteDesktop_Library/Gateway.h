@@ -1,9 +1,43 @@
 #ifndef GATEWAY123_H
 #define GATEWAY123_H
+#include <string>
+#include <mutex>
+#include <thread>
+#include <atomic>
+
+#define GATEWAY_LEASE_DURATION 600000 //ms an id and key from the gateway are reused for before a connect attempt has to wait for new ones
+#define GATEWAY_LEASE_RENEW 300000 //ms after which a fresh id and key are asked for in the background
 
 namespace RemoteDesktop{
 	bool GetGatewayID_and_Key(int& id, std::wstring& aeskey, std::wstring gatewayurl);
+
+	//the id and key GetGatewayID_and_Key hands out, kept for the reconnect attempts that follow. Asking for them is a whole HTTP request with the computer, user and mac lookups in front of it, a client that lost the gateway would otherwise do all of that before every connect.
+	//Get only waits for the request when there is no lease or it ran out, a lease older than renew is replaced from a thread of its own while the old one is still handed out
+	class Gateway_Lease{
+		std::wstring _GatewayUrl;
+		long long _Duration, _Renew;
+		std::mutex _Lock;
+		int _Id = -1;
+		std::wstring _AesKey;
+		long long _Issued = 0;//Timer_Wheel::Now() of the request that got them
+		std::thread _Renewer;
+		std::atomic<bool> _Renewing;
+		std::atomic<long long> _Requests;
+
+		bool _Fetch();
+
+	public:
+		explicit Gateway_Lease(std::wstring gatewayurl, long long duration = GATEWAY_LEASE_DURATION, long long renew = GATEWAY_LEASE_RENEW);
+		~Gateway_Lease();
+		Gateway_Lease(const Gateway_Lease& other) = delete;
+		Gateway_Lease& operator=(const Gateway_Lease& other) = delete;
+
+		//false when there is no lease and the gateway could not be asked for one
+		bool Get(int& id, std::wstring& aeskey);
+		//requests sent to the gateway, including the ones from the background
+		long long get_Requests() const { return _Requests; }
+	};
 }
 
 
-#endif
\ No newline at end of file
+#endif
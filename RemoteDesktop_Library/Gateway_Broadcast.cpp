@@ -0,0 +1,274 @@
+#include "stdafx.h"
+#include "Gateway_Broadcast.h"
+#include "Gateway_Socket.h"
+#include "Metrics.h"
+#include "Timer_Wheel.h"
+#include <algorithm>
+
+namespace RemoteDesktop{
+	namespace INTERNAL{
+		extern Metrics::Value& GatewayRelayed;
+		Metrics::Value& GatewayBroadcastFrames = Metrics::Counter("rd_gateway_broadcast_frames_total", "Messages read from broadcasting servers");
+		Metrics::Value& GatewayBroadcastResyncs = Metrics::Counter("rd_gateway_broadcast_resyncs_total", "Spectators that fell behind a broadcast and started over from its keyframes");
+	}
+}
+
+RemoteDesktop::Gateway_Broadcast::Gateway_Broadcast(const Gateway_Socket& server, size_t keyexchangelength) : _Closed(false), _GreetingLength(sizeof(Proxy_Header) + keyexchangelength){
+	//the server's header is already read, the viewers get it in front of the key exchange like in a normal session
+	_Partial.resize(_GreetingLength);
+	memcpy(_Partial.data(), &server.get_Header(), sizeof(Proxy_Header));
+	_PartialCount = sizeof(Proxy_Header);
+}
+
+RemoteDesktop::Network_Return RemoteDesktop::Gateway_Broadcast::Read(Gateway_Socket& server, long long budget, long long& read){
+	read = 0;
+	while (read < budget){
+		auto amtrec = 0;
+		if (_Greeted && _FrameCount < sizeof(_Frame)) amtrec = recv(server.get_Socket(), (char*)&_Frame + _FrameCount, (int)(sizeof(_Frame) - _FrameCount), 0);
+		else amtrec = recv(server.get_Socket(), _Partial.data() + _PartialCount, (int)std::min((long long)(_Partial.size() - _PartialCount), budget - read), 0);
+		if (amtrec == 0) return server.Disconnect();
+		if (amtrec < 0) return WSAGetLastError() == WSAEWOULDBLOCK ? Network_Return::COMPLETED : server.Disconnect();
+		if (read == 0) server.Last_Received = Timer_Wheel::Now();
+		read += amtrec;
+		server.Relayed += amtrec;
+		if (!_Greeted){
+			_PartialCount += amtrec;
+			if (_PartialCount < _Partial.size()) continue;
+			{
+				std::lock_guard<std::mutex> lock(_Lock);
+				_Greeting = std::make_shared<const std::vector<char>>(std::move(_Partial));
+			}
+			_Greeted = true;
+			_Wake();
+			continue;
+		}
+		if (_FrameCount < sizeof(_Frame)){
+			_FrameCount += amtrec;
+			if (_FrameCount < sizeof(_Frame)) continue;
+			if (_Frame.Type == BROADCAST_ALLOW || _Frame.Type == BROADCAST_DENY){
+				{
+					std::lock_guard<std::mutex> lock(_Lock);
+					auto found = _Answers.find(_Frame.Slot);
+					if (found != _Answers.end()) found->second = _Frame.Type;//a spectator that already left is not brought back
+				}
+				_Wake();
+				_FrameCount = 0;
+				continue;
+			}
+			if ((_Frame.Type != BROADCAST_MESSAGE && _Frame.Type != BROADCAST_KEYFRAME && _Frame.Type != BROADCAST_REFRESH) || _Frame.Length <= 0 || _Frame.Length >= MAXMESSAGESIZE){
+				DEBUG_MSG("Gateway_Broadcast bad frame % %", _Frame.Type, _Frame.Length);
+				return server.Disconnect();
+			}
+			_Partial.resize(_Frame.Length);
+			_PartialCount = 0;
+			continue;
+		}
+		_PartialCount += amtrec;
+		if (_PartialCount < _Partial.size()) continue;
+		_Append(std::move(_Partial), _Frame.Type, _Frame.Slot);
+		_FrameCount = 0;
+	}
+	return Network_Return::PARTIALLY_COMPLETED;
+}
+void RemoteDesktop::Gateway_Broadcast::_Append(std::vector<char>&& frame, int type, int slot){
+	INTERNAL::GatewayBroadcastFrames.Add();
+	auto keyframe = type != BROADCAST_MESSAGE;
+	auto bit = 1 << (slot & (BROADCAST_SLOTS - 1));
+	{
+		std::lock_guard<std::mutex> lock(_Lock);
+		auto seq = _Front + (long long)_Log.size();
+		if (keyframe){
+			if (!_LastKeyframe){//the server sends every monitor one after the other
+				_Pending = seq;
+				_PendingSlots = 0;
+			}
+			_PendingSlots |= bit;
+		}
+		_LastKeyframe = keyframe;
+		_Bytes += frame.size();
+		Entry e;
+		e.Data = std::make_shared<const std::vector<char>>(std::move(frame));
+		e.Type = type;
+		_Log.push_back(e);
+		//a set that covers at least the monitors the log starts with makes everything before it useless. A single monitor changing resolution does not, it stays in the log like any other message
+		if (keyframe && _Pending >= _Front && (_PendingSlots & _Slots) == _Slots){
+			while (_Front < _Pending){
+				_Bytes -= _Log.front().Data->size();
+				_Log.pop_front();
+				_Front += 1;
+			}
+			_Slots = _PendingSlots;
+			_Synced = true;
+		}
+		//the server sends a fresh set every BROADCAST_KEYFRAME_INTERVAL, until then nobody new can start from what is left
+		while (_Bytes > BROADCAST_CACHE_MAX && _Log.size() > 1){
+			_Bytes -= _Log.front().Data->size();
+			_Log.pop_front();
+			_Front += 1;
+			_Synced = false;
+		}
+	}
+	_Wake();
+}
+RemoteDesktop::Network_Return RemoteDesktop::Gateway_Broadcast::Write(Gateway_Socket& viewer){
+	while (true){
+		if (viewer.Outbox.empty()){
+			std::lock_guard<std::mutex> lock(_Lock);
+			if (viewer.Cursor < 0){
+				if (!_Greeting) return Network_Return::COMPLETED;
+				viewer.Outbox.push_back(_Greeting);
+				viewer.Cursor = 0;
+			}
+			else {
+				if (viewer.Type == Gateway_Socket::SPECTATOR){//checked every time, the server can still drop one it allowed
+					auto found = _Answers.find(viewer.Spectator);
+					auto answer = found == _Answers.end() ? BROADCAST_DENY : found->second;
+					if (answer == BROADCAST_DENY) return viewer.Disconnect();
+					if (answer != BROADCAST_ALLOW) return Network_Return::COMPLETED;//only the key exchange until the server allowed it
+					viewer.Allowed = true;
+				}
+				if (viewer.Cursor < _Front){
+					if (!_Synced) return Network_Return::COMPLETED;//waits for the next full set of keyframes
+					if (viewer.Cursor > 0) INTERNAL::GatewayBroadcastResyncs.Add();
+					viewer.Cursor = _Front;
+					viewer.Streaming = false;//it needs the keyframes the log starts with, refreshed or not
+				}
+				while (viewer.Cursor < _Front + (long long)_Log.size() && viewer.Outbox.size() < BROADCAST_READAHEAD){
+					auto& e = _Log[(size_t)(viewer.Cursor - _Front)];
+					viewer.Cursor += 1;
+					if (e.Type == BROADCAST_REFRESH && viewer.Streaming) continue;//it has that screen already
+					if (e.Type == BROADCAST_MESSAGE) viewer.Streaming = true;
+					viewer.Outbox.push_back(e.Data);
+				}
+			}
+			if (viewer.Outbox.empty()) return Network_Return::COMPLETED;
+		}
+		auto& frame = *viewer.Outbox.front();
+		while (viewer.Outbox_Sent < frame.size()){
+			auto sent = send(viewer.get_Socket(), frame.data() + viewer.Outbox_Sent, (int)(frame.size() - viewer.Outbox_Sent), 0);
+			if (sent <= 0){
+				if (WSAGetLastError() == WSAEWOULDBLOCK) return Network_Return::PARTIALLY_COMPLETED;//its FD_WRITE calls back in here
+				return viewer.Disconnect();
+			}
+			viewer.Outbox_Sent += sent;
+			INTERNAL::GatewayRelayed.Add(sent);
+		}
+		viewer.Outbox.pop_front();
+		viewer.Outbox_Sent = 0;
+	}
+}
+RemoteDesktop::Network_Return RemoteDesktop::Gateway_Broadcast::Forward(Gateway_Socket& viewer, long long budget, long long& read){
+	read = 0;
+	auto spectator = viewer.Type == Gateway_Socket::SPECTATOR;
+	std::shared_ptr<Gateway_Socket> server;
+	if (!spectator){//the viewer in control sits on the server's shard
+		server = viewer.Paired_Socket.lock();
+		if (!server || server->Is_Disconnected()) return viewer.Disconnect();
+		if (Flush(*server) != Network_Return::COMPLETED) return Network_Return::PARTIALLY_COMPLETED;//the server's FD_WRITE serves it again
+	}
+	char buffer[16 * 1024];
+	while (read < budget){
+		auto amtrec = recv(viewer.get_Socket(), buffer, (int)std::min((long long)sizeof(buffer), budget - read), 0);
+		if (amtrec == 0) return viewer.Disconnect();
+		if (amtrec < 0) return WSAGetLastError() == WSAEWOULDBLOCK ? Network_Return::COMPLETED : viewer.Disconnect();
+		if (read == 0) viewer.Last_Received = Timer_Wheel::Now();
+		read += amtrec;
+		if (spectator && (viewer.Allowed || viewer.Relayed >= BROADCAST_SPECTATOR_MAX)) continue;//its keepalives, once it asked to watch the server has nothing more to learn from it
+		auto first = viewer.Relayed == 0;//the server needs its Proxy_Header in front of the key exchange
+		auto len = amtrec + (first ? (int)sizeof(Proxy_Header) : 0);
+		std::vector<char> frame(sizeof(Broadcast_Header) + len);
+		Broadcast_Header h;
+		h.Type = spectator ? BROADCAST_SPECTATOR : BROADCAST_DATA;
+		h.Slot = viewer.Spectator;
+		h.Length = len;
+		memcpy(frame.data(), &h, sizeof(h));
+		auto beg = frame.data() + sizeof(h);
+		if (first){
+			memcpy(beg, &viewer.get_Header(), sizeof(Proxy_Header));
+			beg += sizeof(Proxy_Header);
+		}
+		memcpy(beg, buffer, amtrec);
+		if (!_Queue(std::move(frame), spectator)){
+			DEBUG_MSG("Gateway_Broadcast the server is not taking what its viewers send, dropping spectator %", viewer.Spectator);
+			return viewer.Disconnect();
+		}
+		viewer.Relayed += len;
+		INTERNAL::GatewayRelayed.Add(len);
+		if (spectator) _Wake_Server();
+		else if (Flush(*server) != Network_Return::COMPLETED) return Network_Return::PARTIALLY_COMPLETED;
+	}
+	return Network_Return::PARTIALLY_COMPLETED;
+}
+RemoteDesktop::Network_Return RemoteDesktop::Gateway_Broadcast::Flush(Gateway_Socket& server){
+	while (true){
+		Frame frame;
+		{
+			std::lock_guard<std::mutex> lock(_Lock);
+			if (_Upstream.empty()) return Network_Return::COMPLETED;
+			frame = _Upstream.front();
+		}
+		while (_UpstreamSent < frame->size()){
+			auto sent = send(server.get_Socket(), frame->data() + _UpstreamSent, (int)(frame->size() - _UpstreamSent), 0);
+			if (sent <= 0){
+				if (WSAGetLastError() == WSAEWOULDBLOCK) return Network_Return::PARTIALLY_COMPLETED;//its FD_WRITE calls back in here
+				return server.Disconnect();
+			}
+			_UpstreamSent += sent;
+		}
+		_UpstreamSent = 0;
+		std::lock_guard<std::mutex> lock(_Lock);
+		_UpstreamBytes -= frame->size();
+		_Upstream.pop_front();
+	}
+}
+void RemoteDesktop::Gateway_Broadcast::Keepalive(Gateway_Socket& server){
+	_Queue(BROADCAST_KEEPALIVE, 0);
+	Flush(server);
+}
+bool RemoteDesktop::Gateway_Broadcast::_Queue(std::vector<char>&& frame, bool limited){
+	std::lock_guard<std::mutex> lock(_Lock);
+	if (limited && _UpstreamBytes >= BROADCAST_UPSTREAM_MAX) return false;
+	_UpstreamBytes += frame.size();
+	_Upstream.push_back(std::make_shared<const std::vector<char>>(std::move(frame)));
+	return true;
+}
+void RemoteDesktop::Gateway_Broadcast::_Queue(Broadcast_Types type, int slot){
+	std::vector<char> frame(sizeof(Broadcast_Header));
+	auto h = (Broadcast_Header*)frame.data();
+	h->Type = type;
+	h->Slot = slot;
+	h->Length = 0;
+	_Queue(std::move(frame), false);
+}
+int RemoteDesktop::Gateway_Broadcast::Add_Spectator(){
+	std::lock_guard<std::mutex> lock(_Lock);
+	_Spectators += 1;
+	_Answers[_Spectators] = -1;
+	return _Spectators;
+}
+void RemoteDesktop::Gateway_Broadcast::Leave(const Gateway_Socket& spectator){
+	{
+		std::lock_guard<std::mutex> lock(_Lock);
+		_Answers.erase(spectator.Spectator);
+	}
+	if (spectator.Relayed == 0 || _Closed) return;//the server never heard of it
+	_Queue(BROADCAST_LEFT, spectator.Spectator);
+	_Wake_Server();
+}
+void RemoteDesktop::Gateway_Broadcast::Join(void* wake, bool server){
+	std::lock_guard<std::mutex> lock(_Lock);
+	if (server) _ServerWake = wake;
+	else if (std::find(_Wakes.begin(), _Wakes.end(), wake) == _Wakes.end()) _Wakes.push_back(wake);
+}
+void RemoteDesktop::Gateway_Broadcast::Close(){
+	_Closed = true;
+	_Wake();
+}
+void RemoteDesktop::Gateway_Broadcast::_Wake(){
+	std::lock_guard<std::mutex> lock(_Lock);
+	for (auto a : _Wakes) WSASetEvent(a);
+}
+void RemoteDesktop::Gateway_Broadcast::_Wake_Server(){
+	std::lock_guard<std::mutex> lock(_Lock);
+	if (_ServerWake) WSASetEvent(_ServerWake);
+}
@@ -0,0 +1,85 @@
+#ifndef GATEWAY_BROADCAST123_H
+#define GATEWAY_BROADCAST123_H
+#include "CommonNetwork.h"
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <unordered_map>
+
+#define BROADCAST_CACHE_MAX (32 * 1024 * 1024) //bytes of the stream kept for spectators that join late or fall behind
+#define BROADCAST_READAHEAD 16 //frames a spectator takes from the log at once
+#define BROADCAST_UPSTREAM_MAX (1024 * 1024) //bytes queued for the server before a spectator asking to watch is dropped instead
+
+namespace RemoteDesktop{
+	class Gateway_Socket;
+	//one server stream relayed to every viewer of its id. A server that sent GATEWAY_BROADCAST as its Dst_Id is paired with the first viewer like any other, that viewer is the only one whose input reaches the server. Every viewer after it is a spectator.
+	//Gateway sessions use the AES key the gateway handed out for the id, every viewer of it has the same one. So the server encrypts each message once and the gateway copies it to everyone. After its key exchange the server puts a Broadcast_Header in front of every message, the ones with a whole screen are BROADCAST_KEYFRAME and the log kept here starts at the last full set of them so a new spectator gets the picture straight away. A spectator that falls behind what the log still holds starts over from there. The server sends a set of BROADCAST_REFRESH every so often so that is never far back, the viewers already watching skip those.
+	//Everything going to the server is framed as well. The viewer in control is BROADCAST_DATA, a spectator is passed on as BROADCAST_SPECTATOR until the server answers it, up to BROADCAST_SPECTATOR_MAX bytes, so it is allowed or denied like any other viewer. It gets the server's key exchange right away and the rest of the stream only once it was allowed
+	class Gateway_Broadcast{
+		typedef std::shared_ptr<const std::vector<char>> Frame;
+		struct Entry{
+			Frame Data;
+			int Type;//Broadcast_Types, one the server sends
+		};
+		std::mutex _Lock;
+		std::deque<Entry> _Log;
+		long long _Front = 0;//sequence number of _Log.front()
+		long long _Bytes = 0;
+		bool _Synced = true;//_Log starts at the beginning of the stream or of a full set of keyframes
+		long long _Pending = -1;//where the keyframes that are arriving right now started
+		int _PendingSlots = 0, _Slots = 0;//bit per monitor, what the pending set and the one _Log starts with cover
+		bool _LastKeyframe = false;
+		Frame _Greeting;//the server's Proxy_Header and its half of the key exchange
+		std::vector<void*> _Wakes;//WSAEVENTs of the shards with a viewer
+		void* _ServerWake = nullptr;//the shard with the server
+		std::atomic<bool> _Closed;
+		std::unordered_map<int, int> _Answers;//by spectator id, BROADCAST_ALLOW or BROADCAST_DENY once the server decided, -1 until then
+		int _Spectators = 0;//the last id handed out
+		std::deque<Frame> _Upstream;//framed, for the server
+		long long _UpstreamBytes = 0;
+
+		//only touched by the shard reading the server
+		std::vector<char> _Partial;
+		size_t _PartialCount = 0;
+		size_t _GreetingLength;
+		bool _Greeted = false;
+		Broadcast_Header _Frame;
+		size_t _FrameCount = 0;
+		size_t _UpstreamSent = 0;//of _Upstream.front()
+
+		void _Append(std::vector<char>&& frame, int type, int slot);
+		bool _Queue(std::vector<char>&& frame, bool limited);
+		void _Queue(Broadcast_Types type, int slot);
+		void _Wake();
+		void _Wake_Server();
+
+	public:
+		Gateway_Broadcast(const Gateway_Socket& server, size_t keyexchangelength);
+		Gateway_Broadcast(const Gateway_Broadcast& other) = delete;
+		Gateway_Broadcast& operator=(const Gateway_Broadcast& other) = delete;
+
+		//called by the shard that owns the server socket when it is readable, same contract as Gateway_Socket::Relay
+		Network_Return Read(Gateway_Socket& server, long long budget, long long& read);
+		//sends a viewer of the broadcast whatever it has not had yet, called when it is writable or the shard was woken
+		Network_Return Write(Gateway_Socket& viewer);
+		//reads a viewer of the broadcast and passes on what the server should see, same contract as Gateway_Socket::Relay. The viewer in control is not read while the server is not taking what it sent
+		Network_Return Forward(Gateway_Socket& viewer, long long budget, long long& read);
+		//sends the server what its viewers sent, called by its shard when it is writable or the shard was woken
+		Network_Return Flush(Gateway_Socket& server);
+		//called by the server's shard every KEEPALIVE_INTERVAL
+		void Keepalive(Gateway_Socket& server);
+		//the id a new spectator goes to the server with
+		int Add_Spectator();
+		//a spectator is gone, the server is told if it ever heard of it
+		void Leave(const Gateway_Socket& spectator);
+		//a shard that holds a viewer or the server of this broadcast, it is woken whenever there is something new for it
+		void Join(void* wake, bool server);
+		//the server is gone, the shards drop its viewers when they are woken
+		void Close();
+		bool Is_Closed() const { return _Closed; }
+	};
+}
+
+#endif
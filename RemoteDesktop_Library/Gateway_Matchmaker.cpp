@@ -0,0 +1,84 @@
+#include "stdafx.h"
+#include "Gateway_Matchmaker.h"
+#include "Gateway_Socket.h"
+
+namespace RemoteDesktop{
+	namespace _INTERNAL{
+		//timers are not cancelled when a connection is claimed, the key carries the generation so a stale one is ignored when it comes due
+		unsigned long long Matchmaker_Key(bool viewer, unsigned int generation, int id){
+			return (viewer ? 0x8000000000000000ULL : 0) | ((unsigned long long)(generation & 0x7fffffff) << 32) | (unsigned int)id;
+		}
+	}
+}
+
+RemoteDesktop::Gateway_Matchmaker::Gateway_Matchmaker(long long now) : _Wheel(MATCHMAKER_WHEEL_RESOLUTION, now), _Generation(0), _Parked(0){
+
+}
+RemoteDesktop::Gateway_Matchmaker::Results RemoteDesktop::Gateway_Matchmaker::Match(const std::shared_ptr<Gateway_Socket>& ptr, long long now, std::shared_ptr<Gateway_Socket>& peer, std::shared_ptr<Gateway_Socket>& replaced){
+	auto viewer = ptr->Type == Gateway_Socket::VIEWER;
+	auto id = viewer ? ptr->Dst_ID : ptr->Src_ID;
+	auto& stripe = _Get_Stripe(id);
+	unsigned int generation = 0;
+	{
+		std::lock_guard<std::mutex> lock(stripe.Lock);
+		auto& others = viewer ? stripe.Servers : stripe.Viewers;
+		auto found = others.find(id);
+		if (found != others.end()){
+			peer = std::move(found->second.Socket);
+			others.erase(found);
+			_Parked -= 1;
+			return MATCHED;
+		}
+		generation = _Generation++;
+		auto& slot = (viewer ? stripe.Viewers : stripe.Servers)[id];
+		if (slot.Socket) replaced = std::move(slot.Socket);
+		else _Parked += 1;
+		slot.Socket = ptr;
+		slot.Generation = generation;
+	}
+	std::lock_guard<std::mutex> lock(_WheelLock);
+	_Wheel.Add(_INTERNAL::Matchmaker_Key(viewer, generation, id), now + (viewer ? MATCHMAKER_VIEWER_TIMEOUT : MATCHMAKER_SERVER_TIMEOUT));
+	return PARKED;
+}
+bool RemoteDesktop::Gateway_Matchmaker::Take_Viewer(int id, std::shared_ptr<Gateway_Socket>& viewer){
+	auto& stripe = _Get_Stripe(id);
+	std::lock_guard<std::mutex> lock(stripe.Lock);
+	auto found = stripe.Viewers.find(id);
+	if (found == stripe.Viewers.end()) return false;
+	viewer = std::move(found->second.Socket);
+	stripe.Viewers.erase(found);
+	_Parked -= 1;
+	return true;//its timer is now stale and ignored
+}
+void RemoteDesktop::Gateway_Matchmaker::Expire(long long now, std::vector<std::shared_ptr<Gateway_Socket>>& expired){
+	std::vector<unsigned long long> due;
+	{
+		std::lock_guard<std::mutex> lock(_WheelLock);
+		_Wheel.Advance(now, due);
+	}
+	for (auto key : due){
+		auto viewer = (key & 0x8000000000000000ULL) != 0;
+		auto generation = (unsigned int)(key >> 32) & 0x7fffffff;
+		auto id = (int)(unsigned int)key;
+		auto& stripe = _Get_Stripe(id);
+		std::lock_guard<std::mutex> lock(stripe.Lock);
+		auto& parked = viewer ? stripe.Viewers : stripe.Servers;
+		auto found = parked.find(id);
+		if (found == parked.end() || (found->second.Generation & 0x7fffffff) != generation) continue;//claimed or replaced since
+		expired.push_back(std::move(found->second.Socket));
+		parked.erase(found);
+		_Parked -= 1;
+	}
+}
+void RemoteDesktop::Gateway_Matchmaker::Clear(std::vector<std::shared_ptr<Gateway_Socket>>& dropped){
+	for (auto& stripe : _Stripes){
+		std::lock_guard<std::mutex> lock(stripe.Lock);
+		for (auto& a : stripe.Servers) dropped.push_back(std::move(a.second.Socket));
+		for (auto& a : stripe.Viewers) dropped.push_back(std::move(a.second.Socket));
+		_Parked -= (long long)(stripe.Servers.size() + stripe.Viewers.size());
+		stripe.Servers.clear();
+		stripe.Viewers.clear();
+	}
+	std::lock_guard<std::mutex> lock(_WheelLock);
+	_Wheel.Clear();
+}
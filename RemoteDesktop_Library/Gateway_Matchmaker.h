@@ -0,0 +1,52 @@
+#ifndef GATEWAY_MATCHMAKER123_H
+#define GATEWAY_MATCHMAKER123_H
+#include "Timer_Wheel.h"
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <atomic>
+#include <unordered_map>
+
+#define MATCHMAKER_STRIPES 16
+#define MATCHMAKER_VIEWER_TIMEOUT 10000 //ms a viewer waits for its server, same as the old C# gateway
+#define MATCHMAKER_SERVER_TIMEOUT 500000 //ms a server waits for a viewer
+#define MATCHMAKER_WHEEL_RESOLUTION 1000
+
+namespace RemoteDesktop{
+	class Gateway_Socket;
+	//connections that sent their header and wait for the other side, keyed by the id they asked for. A viewer claims its server, or a server its viewer, with one lookup instead of a scan over every connection.
+	//The table is split in stripes each with its own lock so it can be shared between threads. Every parked connection gets a deadline in a Timer_Wheel, Expire hands back the ones that waited too long
+	class Gateway_Matchmaker{
+		struct Parked{
+			std::shared_ptr<Gateway_Socket> Socket;
+			unsigned int Generation;
+		};
+		struct Stripe{
+			std::mutex Lock;
+			std::unordered_map<int, Parked> Servers, Viewers;
+		};
+		Stripe _Stripes[MATCHMAKER_STRIPES];
+		std::mutex _WheelLock;
+		Timer_Wheel _Wheel;
+		std::atomic<unsigned int> _Generation;
+		std::atomic<long long> _Parked;
+
+		Stripe& _Get_Stripe(int id){ return _Stripes[(unsigned int)id % MATCHMAKER_STRIPES]; }
+
+	public:
+		enum Results { PARKED, MATCHED };
+		explicit Gateway_Matchmaker(long long now);
+
+		//now in ms from the same clock given to Expire. MATCHED takes the waiting peer out of the table, PARKED leaves ptr in it. A connection that was already parked with the same id and type is pushed out by the newer one and returned in replaced
+		Results Match(const std::shared_ptr<Gateway_Socket>& ptr, long long now, std::shared_ptr<Gateway_Socket>& peer, std::shared_ptr<Gateway_Socket>& replaced);
+		//takes the viewer waiting for id out of the table, false when there is none. For a server that does not go through Match
+		bool Take_Viewer(int id, std::shared_ptr<Gateway_Socket>& viewer);
+		//appends the connections whose wait ran out, they are no longer in the table
+		void Expire(long long now, std::vector<std::shared_ptr<Gateway_Socket>>& expired);
+		//empties the table, appending everything that was parked
+		void Clear(std::vector<std::shared_ptr<Gateway_Socket>>& dropped);
+		long long get_Parked() const { return _Parked; }
+	};
+}
+
+#endif
@@ -0,0 +1,203 @@
+#include "stdafx.h"
+#include "Gateway_Mux.h"
+#include "Gateway_Socket.h"
+#include "Metrics.h"
+#include "Timer_Wheel.h"
+#include <algorithm>
+
+namespace RemoteDesktop{
+	namespace INTERNAL{
+		Metrics::Value& GatewayStreams = Metrics::Counter("rd_gateway_streams_total", "Viewers carried over a multiplexing server's connection");
+	}
+}
+
+RemoteDesktop::Gateway_Mux::Gateway_Mux(const std::shared_ptr<Gateway_Socket>& server, Gateway_Shard* shard) : _Server(server), _Shard(shard), _Closed(false){
+
+}
+void RemoteDesktop::Gateway_Mux::Open(const std::shared_ptr<Gateway_Socket>& viewer){
+	if (_Closed){
+		viewer->Disconnect();
+		return;
+	}
+	INTERNAL::GatewayStreams.Add();
+	Stream s;
+	s.Viewer = viewer;
+	_Streams[viewer->Stream] = std::move(s);
+	//the server answers on the stream with its own header and key exchange, like it would on a connection of its own
+	_Queue(viewer->Stream, MUX_OPEN, (const char*)&viewer->get_Header(), sizeof(Proxy_Header));
+	_Flush();
+}
+RemoteDesktop::Network_Return RemoteDesktop::Gateway_Mux::Relay(Gateway_Socket& s, long long budget, long long& read){
+	read = 0;
+	if (s.Type == Gateway_Socket::SERVER) return _Read_Server(s, budget, read);
+	return _Read_Viewer(s, budget, read);
+}
+RemoteDesktop::Network_Return RemoteDesktop::Gateway_Mux::_Read_Server(Gateway_Socket& server, long long budget, long long& read){
+	while (read < budget){
+		int amtrec = 0;
+		if (_HeaderCount < sizeof(Mux_Header)) amtrec = recv(server.get_Socket(), (char*)&_Header + _HeaderCount, (int)(sizeof(Mux_Header) - _HeaderCount), 0);
+		else amtrec = recv(server.get_Socket(), _Body.data() + _BodyCount, (int)std::min((long long)(_Body.size() - _BodyCount), budget - read), 0);
+		if (amtrec == 0) return server.Disconnect();
+		if (amtrec < 0) return WSAGetLastError() == WSAEWOULDBLOCK ? Network_Return::COMPLETED : server.Disconnect();
+		if (read == 0) server.Last_Received = Timer_Wheel::Now();
+		read += amtrec;
+		if (_HeaderCount < sizeof(Mux_Header)){
+			_HeaderCount += amtrec;
+			if (_HeaderCount < sizeof(Mux_Header)) continue;
+			if (_Header.Length < 0 || _Header.Length > MUX_MAXFRAME) return server.Disconnect();
+			_Body.resize(_Header.Type == MUX_DATA ? _Header.Length : 0);
+			_BodyCount = 0;
+		}
+		else _BodyCount += amtrec;
+		if (_BodyCount < _Body.size()) continue;
+		if (_Frame(server) == Network_Return::FAILED) return Network_Return::FAILED;
+		_HeaderCount = 0;
+	}
+	return Network_Return::PARTIALLY_COMPLETED;
+}
+RemoteDesktop::Network_Return RemoteDesktop::Gateway_Mux::_Frame(Gateway_Socket& server){
+	auto found = _Streams.find(_Header.Stream);
+	switch (_Header.Type){
+	case MUX_DATA:
+		server.Relayed += _Body.size();
+		if (found != _Streams.end()){//otherwise it was closed while this was on its way
+			auto& s = found->second;
+			if (s.Downstream.size() - s.Downstream_Sent + _Body.size() > MUX_WINDOW) return server.Disconnect();//it ignored the window
+			if (s.Downstream_Sent == s.Downstream.size()){
+				s.Downstream.clear();
+				s.Downstream_Sent = 0;
+			}
+			s.Downstream.insert(s.Downstream.end(), _Body.begin(), _Body.end());
+			auto viewer = s.Viewer.lock();
+			if (viewer) _Deliver(*viewer, s);
+		}
+		break;
+	case MUX_CREDIT:
+		if (found != _Streams.end()){
+			auto blocked = found->second.Credit <= 0;
+			found->second.Credit += _Header.Length;
+			auto viewer = found->second.Viewer.lock();
+			if (blocked && viewer) _Unblocked.push_back(viewer);
+		}
+		break;
+	case MUX_CLOSE:
+		if (found != _Streams.end()){
+			auto viewer = found->second.Viewer.lock();
+			_Streams.erase(found);
+			if (viewer) viewer->Disconnect();
+		}
+		break;
+	case MUX_KEEPALIVE:
+		_Queue(0, MUX_KEEPALIVE, nullptr, 0);
+		_Flush();
+		break;
+	default:
+		return server.Disconnect();
+	}
+	return Network_Return::COMPLETED;
+}
+RemoteDesktop::Network_Return RemoteDesktop::Gateway_Mux::_Read_Viewer(Gateway_Socket& viewer, long long budget, long long& read){
+	auto found = _Streams.find(viewer.Stream);
+	if (found == _Streams.end()) return viewer.Disconnect();
+	auto& s = found->second;
+	auto ret = Network_Return::COMPLETED;
+	while (read < budget && s.Credit > 0){//without credit it is left alone until the server grants some, see Take_Unblocked
+		auto len = (int)std::min(std::min(budget - read, s.Credit), (long long)MUX_MAXFRAME);
+		std::vector<char> frame(sizeof(Mux_Header) + len);
+		auto amtrec = recv(viewer.get_Socket(), frame.data() + sizeof(Mux_Header), len, 0);
+		if (amtrec == 0){
+			ret = viewer.Disconnect();
+			break;
+		}
+		if (amtrec < 0){
+			if (WSAGetLastError() != WSAEWOULDBLOCK) ret = viewer.Disconnect();
+			break;
+		}
+		if (read == 0) viewer.Last_Received = Timer_Wheel::Now();
+		Mux_Header h;
+		h.Stream = viewer.Stream;
+		h.Type = MUX_DATA;
+		h.Length = amtrec;
+		memcpy(frame.data(), &h, sizeof(h));
+		frame.resize(sizeof(Mux_Header) + amtrec);
+		_Outbox.push_back(std::move(frame));
+		s.Credit -= amtrec;
+		read += amtrec;
+		viewer.Relayed += amtrec;
+	}
+	_Flush();
+	if (ret == Network_Return::COMPLETED && read >= budget) ret = Network_Return::PARTIALLY_COMPLETED;
+	return ret;
+}
+void RemoteDesktop::Gateway_Mux::_Deliver(Gateway_Socket& viewer, Stream& s){
+	auto before = s.Downstream_Sent;
+	while (s.Downstream_Sent < s.Downstream.size()){
+		auto sent = send(viewer.get_Socket(), s.Downstream.data() + s.Downstream_Sent, (int)(s.Downstream.size() - s.Downstream_Sent), 0);
+		if (sent <= 0){//the viewer's FD_WRITE calls back in here
+			if (WSAGetLastError() != WSAEWOULDBLOCK) viewer.Disconnect();
+			break;
+		}
+		s.Downstream_Sent += sent;
+	}
+	if (s.Downstream_Sent == before) return;
+	_Queue(viewer.Stream, MUX_CREDIT, nullptr, (int)(s.Downstream_Sent - before));
+	_Flush();
+}
+void RemoteDesktop::Gateway_Mux::_Queue(int stream, int type, const char* data, int len){
+	Mux_Header h;
+	h.Stream = stream;
+	h.Type = type;
+	h.Length = len;
+	std::vector<char> frame(sizeof(h) + (data ? len : 0));
+	memcpy(frame.data(), &h, sizeof(h));
+	if (data) memcpy(frame.data() + sizeof(h), data, len);
+	_Outbox.push_back(std::move(frame));
+}
+void RemoteDesktop::Gateway_Mux::_Flush(){
+	auto server = _Server.lock();
+	if (!server || server->Is_Disconnected()){
+		_Outbox.clear();
+		_Outbox_Sent = 0;
+		return;
+	}
+	while (!_Outbox.empty()){
+		auto& frame = _Outbox.front();
+		while (_Outbox_Sent < frame.size()){
+			auto sent = send(server->get_Socket(), frame.data() + _Outbox_Sent, (int)(frame.size() - _Outbox_Sent), 0);
+			if (sent <= 0){//the server's FD_WRITE calls back in here
+				if (WSAGetLastError() != WSAEWOULDBLOCK) server->Disconnect();
+				return;
+			}
+			_Outbox_Sent += sent;
+		}
+		_Outbox.pop_front();
+		_Outbox_Sent = 0;
+	}
+}
+void RemoteDesktop::Gateway_Mux::Writable(Gateway_Socket& s){
+	if (s.Type == Gateway_Socket::SERVER) return _Flush();
+	auto found = _Streams.find(s.Stream);
+	if (found != _Streams.end()) _Deliver(s, found->second);
+}
+void RemoteDesktop::Gateway_Mux::Take_Unblocked(std::vector<std::shared_ptr<Gateway_Socket>>& ready){
+	ready.insert(ready.end(), _Unblocked.begin(), _Unblocked.end());
+	_Unblocked.clear();
+}
+void RemoteDesktop::Gateway_Mux::Close_Stream(Gateway_Socket& viewer){
+	auto found = _Streams.find(viewer.Stream);
+	if (found == _Streams.end()) return;
+	_Streams.erase(found);
+	_Queue(viewer.Stream, MUX_CLOSE, nullptr, 0);
+	_Flush();
+}
+void RemoteDesktop::Gateway_Mux::Close(){
+	_Closed = true;
+	for (auto& a : _Streams){
+		auto viewer = a.second.Viewer.lock();
+		if (viewer) viewer->Disconnect();
+	}
+	_Streams.clear();
+	_Outbox.clear();
+	_Outbox_Sent = 0;
+	_Unblocked.clear();
+}
@@ -0,0 +1,68 @@
+#ifndef GATEWAY_MUX123_H
+#define GATEWAY_MUX123_H
+#include "CommonNetwork.h"
+#include <memory>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <unordered_map>
+
+namespace RemoteDesktop{
+	class Gateway_Socket;
+	class Gateway_Shard;
+	//every session of one server carried over a single connection. A server that sent GATEWAY_MULTIPLEX as its Dst_Id stays connected, each viewer of its id becomes a stream and what goes between them is framed with a Mux_Header on the server's side. The viewers see a plain connection.
+	//Each direction of a stream may have MUX_WINDOW bytes in flight, the receiving side grants more with MUX_CREDIT as it hands them on. A viewer is not read from while the server has not granted anything, so one that floods cannot hold up the others on the shared connection.
+	//The server and all of its streams live on the same Gateway_Shard, nothing here is locked. Only Next_Stream and get_Shard are used from the accepting thread
+	class Gateway_Mux{
+		struct Stream{
+			std::weak_ptr<Gateway_Socket> Viewer;
+			long long Credit = MUX_WINDOW;//bytes of the viewer's input the server still takes
+			std::vector<char> Downstream;//from the server, not yet taken by the viewer
+			size_t Downstream_Sent = 0;
+		};
+		std::weak_ptr<Gateway_Socket> _Server;
+		Gateway_Shard* _Shard;
+		int _NextStream = 1;
+		std::atomic<bool> _Closed;
+
+		std::unordered_map<int, Stream> _Streams;
+		std::deque<std::vector<char>> _Outbox;//frames for the server
+		size_t _Outbox_Sent = 0;//of _Outbox.front()
+		Mux_Header _Header;//of the frame being read from the server
+		size_t _HeaderCount = 0;
+		std::vector<char> _Body;
+		size_t _BodyCount = 0;
+		std::vector<std::shared_ptr<Gateway_Socket>> _Unblocked;
+
+		void _Queue(int stream, int type, const char* data, int len);
+		void _Flush();
+		void _Deliver(Gateway_Socket& viewer, Stream& s);
+		Network_Return _Frame(Gateway_Socket& server);
+		Network_Return _Read_Server(Gateway_Socket& server, long long budget, long long& read);
+		Network_Return _Read_Viewer(Gateway_Socket& viewer, long long budget, long long& read);
+
+	public:
+		Gateway_Mux(const std::shared_ptr<Gateway_Socket>& server, Gateway_Shard* shard);
+		Gateway_Mux(const Gateway_Mux& other) = delete;
+		Gateway_Mux& operator=(const Gateway_Mux& other) = delete;
+
+		int Next_Stream(){ return _NextStream++; }
+		Gateway_Shard* get_Shard() const { return _Shard; }
+
+		//a viewer the shard just took over, the server is told about it
+		void Open(const std::shared_ptr<Gateway_Socket>& viewer);
+		//same contract as Gateway_Socket::Relay for the server and its viewers
+		Network_Return Relay(Gateway_Socket& s, long long budget, long long& read);
+		//s drained what was queued for it
+		void Writable(Gateway_Socket& s);
+		//appends the viewers the server granted credit to since the last call, they may have input waiting that nothing will signal again
+		void Take_Unblocked(std::vector<std::shared_ptr<Gateway_Socket>>& ready);
+		//the viewer is gone, the server is told
+		void Close_Stream(Gateway_Socket& viewer);
+		//the server is gone, so are its viewers
+		void Close();
+		bool Is_Closed() const { return _Closed; }
+	};
+}
+
+#endif
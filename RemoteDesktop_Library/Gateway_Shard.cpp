@@ -0,0 +1,280 @@
+#include "stdafx.h"
+#include "Gateway_Shard.h"
+#include "Gateway_Socket.h"
+#include "Metrics.h"
+#include "Timer_Wheel.h"
+#include "Gateway_Broadcast.h"
+#include "Gateway_Mux.h"
+#include <algorithm>
+#include <limits>
+
+namespace RemoteDesktop{
+	namespace INTERNAL{
+		extern Metrics::Value& GatewayConnections;
+		extern Metrics::Value& GatewaySessions;
+		extern Metrics::Value& GatewaySpectators;
+	}
+}
+
+RemoteDesktop::Gateway_Shard::Gateway_Shard(void(__stdcall * ondisconnect)()) : _Wake(WSACreateEvent()), _Sessions(0), _Relayed(0), _Sockets(0), _Spectators(0), _OnDisconnect(ondisconnect){
+
+}
+RemoteDesktop::Gateway_Shard::~Gateway_Shard(){
+	Stop();
+	if (_Wake != WSA_INVALID_EVENT) WSACloseEvent(_Wake);
+}
+void RemoteDesktop::Gateway_Shard::Start(){
+	Stop();
+	_Running = true;
+	_BackgroundWorker = std::thread(&RemoteDesktop::Gateway_Shard::_Run, this);
+}
+void RemoteDesktop::Gateway_Shard::Stop(){
+	_Running = false;
+	WSASetEvent(_Wake);
+	BEGINTRY
+		if (std::this_thread::get_id() != _BackgroundWorker.get_id() && _BackgroundWorker.joinable()) _BackgroundWorker.join();
+	ENDTRY
+}
+bool RemoteDesktop::Gateway_Shard::Add(std::shared_ptr<Gateway_Socket>& a, std::shared_ptr<Gateway_Socket>& b){
+	if (_Sockets + 2 > GATEWAY_SHARD_SOCKETS) return false;//only the accepting thread adds, so this cannot race past the limit
+	{
+		std::lock_guard<std::mutex> lock(_InboxLock);
+		_Inbox.push_back(a);
+		_Inbox.push_back(b);
+	}
+	_Sessions += 1;
+	_Sockets += 2;
+	WSASetEvent(_Wake);
+	return true;
+}
+bool RemoteDesktop::Gateway_Shard::Add(std::shared_ptr<Gateway_Socket>& a){
+	if (_Sockets + 1 > GATEWAY_SHARD_SOCKETS) return false;
+	{
+		std::lock_guard<std::mutex> lock(_InboxLock);
+		_Inbox.push_back(a);
+	}
+	_Sockets += 1;
+	if (a->Type == Gateway_Socket::SPECTATOR) _Spectators += 1;
+	else if (a->Mux && a->Type == Gateway_Socket::VIEWER) _Sessions += 1;
+	WSASetEvent(_Wake);
+	return true;
+}
+//a socket that leaves the shard, through the arrays or straight from the inbox
+void RemoteDesktop::Gateway_Shard::_Forget(const std::shared_ptr<Gateway_Socket>& ptr){
+	_Sockets -= 1;
+	INTERNAL::GatewayConnections.Add(-1);
+	if (ptr->Mux && ptr->Type == Gateway_Socket::VIEWER){//a stream has no peer to count it in _HandleDisconnect
+		_Sessions -= 1;
+		INTERNAL::GatewaySessions.Add(-1);
+		if (_OnDisconnect) _OnDisconnect();
+	}
+	if (ptr->Type != Gateway_Socket::SPECTATOR) return;
+	_Spectators -= 1;
+	INTERNAL::GatewaySpectators.Add(-1);
+}
+
+void RemoteDesktop::Gateway_Shard::_Take_Inbox(std::vector<WSAEVENT>& eventarray, std::vector<std::shared_ptr<Gateway_Socket>>& socketarray, Connection_Timers<Gateway_Socket>& timers){
+	std::vector<std::shared_ptr<Gateway_Socket>> inbox;
+	{
+		std::lock_guard<std::mutex> lock(_InboxLock);
+		inbox.swap(_Inbox);
+	}
+	for (auto& a : inbox){
+		auto newevent = WSACreateEvent();
+		//replaces the event the accepting thread used, from here on only this thread touches the socket
+		if (newevent == WSA_INVALID_EVENT || WSAEventSelect(a->get_Socket(), newevent, FD_READ | FD_WRITE | FD_CLOSE) != 0){
+			if (newevent != WSA_INVALID_EVENT) WSACloseEvent(newevent);
+			a->Disconnect();
+			_Forget(a);
+			continue;
+		}
+		eventarray.push_back(newevent);
+		socketarray.push_back(a);
+		timers.Add(a, a->Broadcast && a->Type == Gateway_Socket::SERVER ? a->Last_Received + KEEPALIVE_INTERVAL : a->Last_Received + IDLE_TIMEOUT);
+		if (a->Broadcast) a->Broadcast->Join(_Wake, a->Type == Gateway_Socket::SERVER);
+		if (a->Mux && a->Type == Gateway_Socket::VIEWER) a->Mux->Open(a);
+	}
+	auto now = Timer_Wheel::Now();
+	for (auto& a : inbox){
+		if (!a->Is_Disconnected()) _Serve(a, now);//sends the header queued by the pairing and anything that arrived since
+	}
+	//a socket that failed above never made it into the arrays, drop its peer here
+	for (auto& a : inbox){
+		if (a->Is_Disconnected() && std::find(socketarray.begin(), socketarray.end(), a) == socketarray.end()) _HandleDisconnect(a);
+	}
+}
+void RemoteDesktop::Gateway_Shard::_Run(){
+	std::vector<WSAEVENT> EventArray;
+	auto socketarray = std::vector<std::shared_ptr<Gateway_Socket>>();
+	EventArray.reserve(WSA_MAXIMUM_WAIT_EVENTS);
+	socketarray.reserve(WSA_MAXIMUM_WAIT_EVENTS);
+	EventArray.push_back(_Wake);
+	socketarray.push_back(nullptr);
+	Connection_Timers<Gateway_Socket> timers(Timer_Wheel::Now());
+
+	WSANETWORKEVENTS NetworkEvents;
+	while (_Running){
+		long long wait = 1000;
+		for (auto& a : _Throttled) wait = std::min(wait, a->Throttled_For());
+		auto Index = WSAWaitForMultipleEvents(EventArray.size(), EventArray.data(), FALSE, (DWORD)wait, FALSE);
+		if (!_Running) continue;
+		auto now = Timer_Wheel::Now();
+		auto idle = false;
+		timers.Advance(now, [&idle](std::shared_ptr<Gateway_Socket>& s, long long now) -> long long {
+			if (s->Is_Disconnected()) return 0;
+			if (now - s->Last_Received < IDLE_TIMEOUT){
+				if (!s->Broadcast || s->Type != Gateway_Socket::SERVER) return s->Last_Received + IDLE_TIMEOUT;
+				s->Broadcast->Keepalive(*s);//the server drops a connection it hears nothing on, once the viewer in control left nobody else talks to it
+				return std::min(now + KEEPALIVE_INTERVAL, s->Last_Received + IDLE_TIMEOUT);
+			}
+			DEBUG_MSG("Gateway_Shard nothing received for % ms, dropping the session", now - s->Last_Received);
+			s->Disconnect();
+			idle = true;
+			return 0;
+		});
+		if (idle){//the arrays moved under Index, whatever was signaled is still signaled on the next wait
+			_RemoveDisconnected(EventArray, socketarray);
+			continue;
+		}
+		//a throttled socket got no recv call so nothing rearms its FD_READ, it is picked up here once its bucket has refilled
+		auto beg = _Throttled.begin();
+		while (beg != _Throttled.end()){
+			if ((*beg)->Is_Disconnected() || (*beg)->Allowance(now) > 0){
+				if (!(*beg)->Is_Disconnected()) _Ready.push_back(*beg);
+				beg = _Throttled.erase(beg);
+				continue;
+			}
+			++beg;
+		}
+		if (Index == 0){
+			WSAResetEvent(_Wake);
+			_Take_Inbox(EventArray, socketarray, timers);
+			_Fan_Out(socketarray);
+		}
+		else if (Index != WSA_WAIT_FAILED && Index != WSA_WAIT_TIMEOUT && Index < EventArray.size()){
+			//the wait only reports the lowest signaled index, so look at every socket after it too or one busy session would starve the ones behind it
+			for (auto i = (size_t)Index; i < EventArray.size(); i++){
+				if (i != Index && WSAWaitForMultipleEvents(1, &EventArray[i], FALSE, 0, FALSE) != WSA_WAIT_EVENT_0) continue;
+				auto& s = socketarray[i];
+				if (WSAEnumNetworkEvents(s->get_Socket(), EventArray[i], &NetworkEvents) != 0){
+					s->Disconnect();
+					continue;
+				}
+				if ((NetworkEvents.lNetworkEvents & FD_WRITE) == FD_WRITE){//s drained, whatever its peer was holding back can go now
+					auto peer = s->Paired_Socket.lock();
+					if (s->Mux) s->Mux->Writable(*s);
+					else if (s->Broadcast && s->Type != Gateway_Socket::SERVER) s->Broadcast->Write(*s);
+					else {
+						if (s->Broadcast) s->Broadcast->Flush(*s);//what its viewers sent, the one in control is read again below
+						if (peer) _Ready.push_back(peer);
+					}
+				}
+				if ((NetworkEvents.lNetworkEvents & FD_CLOSE) == FD_CLOSE){//hand over what is left without waiting for a turn
+					long long read = 0;
+					auto before = s->Relayed;
+					s->Relay(std::numeric_limits<long long>::max(), read);
+					_Relayed += s->Relayed - before;
+					s->Disconnect();
+				}
+				else if ((NetworkEvents.lNetworkEvents & FD_READ) == FD_READ) _Ready.push_back(s);
+			}
+		}
+		_Schedule(now);
+		_RemoveDisconnected(EventArray, socketarray);
+	}
+	_Throttled.clear();
+	for (size_t beg = 1; beg < socketarray.size(); beg++) socketarray[beg]->Disconnect();
+	_RemoveDisconnected(EventArray, socketarray);
+	{//pairs that never got picked up
+		std::lock_guard<std::mutex> lock(_InboxLock);
+		for (auto& a : _Inbox){
+			_HandleDisconnect(a);
+			_Forget(a);
+		}
+		_Inbox.clear();
+	}
+	DEBUG_MSG("Gateway_Shard Exiting");
+}
+void RemoteDesktop::Gateway_Shard::_Fan_Out(std::vector<std::shared_ptr<Gateway_Socket>>& socketarray){
+	for (size_t beg = 1; beg < socketarray.size(); beg++){
+		auto& s = socketarray[beg];
+		if (!s->Broadcast || s->Is_Disconnected()) continue;
+		if (s->Type == Gateway_Socket::SERVER) s->Broadcast->Flush(*s);//spectators asking to watch and leaving
+		else if (s->Broadcast->Is_Closed()) s->Disconnect();
+		else s->Broadcast->Write(*s);
+	}
+}
+void RemoteDesktop::Gateway_Shard::_Schedule(long long now){
+	//a socket can be in here twice, once for its own FD_READ and once for its peer's FD_WRITE
+	for (size_t i = 1; i < _Ready.size(); i++){
+		if (std::find(_Ready.begin(), _Ready.begin() + i, _Ready[i]) != _Ready.begin() + i) _Ready[i] = nullptr;
+	}
+	_Ready.erase(std::remove(_Ready.begin(), _Ready.end(), nullptr), _Ready.end());
+	std::stable_partition(_Ready.begin(), _Ready.end(), [](const std::shared_ptr<Gateway_Socket>& a){ return !a->Backlogged; });
+	for (size_t i = 0; i < _Ready.size(); i++){//serving a multiplexing server can append the viewers it unblocked
+		auto ptr = _Ready[i];
+		_Serve(ptr, now);
+	}
+	_Ready.clear();
+}
+void RemoteDesktop::Gateway_Shard::_Serve(std::shared_ptr<Gateway_Socket>& ptr, long long now){
+	if (ptr->Is_Disconnected()) return;
+	auto allowance = ptr->Allowance(now);
+	if (allowance <= 0){
+		if (std::find(_Throttled.begin(), _Throttled.end(), ptr) == _Throttled.end()) _Throttled.push_back(ptr);
+		return;
+	}
+	auto quantum = (long long)RELAY_QUANTUM * std::max(ptr->Weight, 1);
+	ptr->Deficit += quantum;
+	auto budget = std::min(ptr->Deficit, allowance);
+	long long read = 0;
+	auto before = ptr->Relayed;
+	ptr->Relay(budget, read);
+	_Relayed += ptr->Relayed - before;
+	ptr->Spend(read);
+	if (ptr->Mux && ptr->Type == Gateway_Socket::SERVER) ptr->Mux->Take_Unblocked(_Ready);
+	ptr->Backlogged = read >= budget;
+	//an empty queue keeps no credit, and one held back by its rate cap does not bank more than a round
+	ptr->Deficit = ptr->Backlogged ? std::min(ptr->Deficit - read, quantum) : 0;
+	if (ptr->Backlogged && budget == allowance && ptr->Rate > 0 && std::find(_Throttled.begin(), _Throttled.end(), ptr) == _Throttled.end()){
+		_Throttled.push_back(ptr);//its FD_READ was rearmed but the bucket is empty until it refills
+	}
+}
+void RemoteDesktop::Gateway_Shard::_HandleDisconnect(std::shared_ptr<Gateway_Socket>& ptr){
+	ptr->Disconnect();
+	if (ptr->Broadcast && ptr->Type == Gateway_Socket::SERVER) ptr->Broadcast->Close();
+	if (ptr->Broadcast && ptr->Type == Gateway_Socket::SPECTATOR) ptr->Broadcast->Leave(*ptr);
+	if (ptr->Mux){//the streams are counted as they leave, see _Forget
+		if (ptr->Type == Gateway_Socket::SERVER) ptr->Mux->Close();
+		else ptr->Mux->Close_Stream(*ptr);
+		return;
+	}
+	auto peer = ptr->Paired_Socket.lock();
+	if (!peer) return;
+	//unlink both sides so the pair is only counted once
+	ptr->Paired_Socket.reset();
+	peer->Paired_Socket.reset();
+	if (!peer->Is_Broadcaster()) peer->Disconnect();//the first viewer leaving does not end a broadcast for everyone else
+	_Sessions -= 1;
+	INTERNAL::GatewaySessions.Add(-1);
+	if (_OnDisconnect) _OnDisconnect();
+}
+void RemoteDesktop::Gateway_Shard::_RemoveDisconnected(std::vector<WSAEVENT>& eventarray, std::vector<std::shared_ptr<Gateway_Socket>>& socketarray){
+	for (size_t beg = 1; beg < socketarray.size(); beg++){//first pass so a dropped socket takes its peer with it
+		if (socketarray[beg]->Is_Disconnected()) _HandleDisconnect(socketarray[beg]);
+	}
+	//order does not matter here, the last socket fills the hole instead of shifting everything after it down
+	size_t index = 1;
+	while (index < socketarray.size()){
+		if (socketarray[index]->Is_Disconnected()){
+			WSACloseEvent(eventarray[index]);
+			eventarray[index] = eventarray.back();
+			eventarray.pop_back();
+			_Forget(socketarray[index]);
+			socketarray[index] = socketarray.back();
+			socketarray.pop_back();
+			continue;
+		}
+		++index;
+	}
+}
@@ -0,0 +1,57 @@
+#ifndef GATEWAY_SHARD123_H
+#define GATEWAY_SHARD123_H
+#include <thread>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <atomic>
+
+#define GATEWAY_SHARD_SOCKETS (WSA_MAXIMUM_WAIT_EVENTS - 1) //one wait slot is the wake up event, a session takes two and a spectator one
+#define RELAY_QUANTUM (64 * 1024) //bytes a socket may read per round for each unit of its weight
+
+namespace RemoteDesktop{
+	class Gateway_Socket;
+	template<class T> class Connection_Timers;
+	//an event loop on its own thread that relays the sessions handed to it. Both sockets of a session live on the same shard so the relay never needs a lock, the only shared state is the inbox the accepting thread hands new pairs through. A session where either side has not sent anything for IDLE_TIMEOUT is dropped, both ends send keepalives through it so that only happens when one of them is gone.
+	//Viewers of a Gateway_Broadcast can sit on any shard. The wake up event doubles as the signal that one of the broadcasts has something new, each of them is then sent what it is missing, and the server of one is sent what its spectators had for it. A Gateway_Mux keeps its server and all of its viewers on one shard, each viewer counts as a session of its own.
+	//Every pass of the loop is a deficit round robin round over the sockets with something to read. Each gets RELAY_QUANTUM times its Weight, capped by its Rate, and credit it did not use only carries over while it still has data waiting. Sockets that emptied their queue last round go first since they carry input and small updates, a bulk transfer then only delays them by its own quantum
+	class Gateway_Shard{
+		std::thread _BackgroundWorker;
+		bool _Running = false;
+		void* _Wake;//WSAEVENT, set when the inbox has something
+		std::mutex _InboxLock;
+		std::vector<std::shared_ptr<Gateway_Socket>> _Inbox;//pairs, one after the other
+		std::atomic<long long> _Sessions, _Relayed, _Sockets, _Spectators;
+		std::vector<std::shared_ptr<Gateway_Socket>> _Ready;//to be served this round, kept so the loop does not allocate
+		std::vector<std::shared_ptr<Gateway_Socket>> _Throttled;//over their rate cap, back in _Ready once it allows them
+		void(__stdcall * _OnDisconnect)();
+
+		void _Run();
+		void _Take_Inbox(std::vector<void*>& eventarray, std::vector<std::shared_ptr<Gateway_Socket>>& socketarray, Connection_Timers<Gateway_Socket>& timers);
+		void _Serve(std::shared_ptr<Gateway_Socket>& ptr, long long now);
+		void _Schedule(long long now);
+		void _Fan_Out(std::vector<std::shared_ptr<Gateway_Socket>>& socketarray);
+		void _Forget(const std::shared_ptr<Gateway_Socket>& ptr);
+		void _HandleDisconnect(std::shared_ptr<Gateway_Socket>& ptr);
+		void _RemoveDisconnected(std::vector<void*>& eventarray, std::vector<std::shared_ptr<Gateway_Socket>>& socketarray);
+
+	public:
+		explicit Gateway_Shard(void(__stdcall * ondisconnect)());
+		~Gateway_Shard();
+
+		void Start();
+		void Stop();
+		//takes over two sockets that were just paired, false when the shard is full
+		bool Add(std::shared_ptr<Gateway_Socket>& a, std::shared_ptr<Gateway_Socket>& b);
+		//takes over a spectator of a broadcast, a multiplexing server or one of its viewers
+		bool Add(std::shared_ptr<Gateway_Socket>& a);
+
+		//these include the ones still in the inbox
+		long long get_Sessions() const { return _Sessions; }
+		long long get_Sockets() const { return _Sockets; }
+		long long get_Spectators() const { return _Spectators; }
+		long long get_Relayed() const { return _Relayed; }
+	};
+}
+
+#endif
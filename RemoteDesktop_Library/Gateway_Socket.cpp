@@ -1,8 +1,115 @@
 #include "stdafx.h"
 #include "Gateway_Socket.h"
-#include "NetworkSetup.h"
+#include "PacketBufferPool.h"
+#include "Metrics.h"
+#include "Timer_Wheel.h"
+#include "Gateway_Broadcast.h"
+#include "Gateway_Mux.h"
+#include <algorithm>
+#include <limits>
 
-void RemoteDesktop::Gateway_Socket::Receive(){
-	ReceiveLoop(_Socket->socket, _Buffer, _BufferCount);
+namespace RemoteDesktop{
+	namespace INTERNAL{
+		Metrics::Value& GatewayRelayed = Metrics::Counter("rd_gateway_relayed_bytes_total", "Bytes the gateway forwarded between paired viewers and servers");
+		Metrics::Value& GatewayStalls = Metrics::Counter("rd_gateway_relay_stalls_total", "Times a relayed socket could not take more data and its peer was paused");
+	}
+}
 
-}
\ No newline at end of file
+RemoteDesktop::Gateway_Socket::Gateway_Socket(SOCKET socket, PacketBufferPool* pool) : _Socket(RAIISOCKET(socket)), _Pool(pool){
+
+}
+RemoteDesktop::Gateway_Socket::~Gateway_Socket(){
+	_Release();
+}
+void RemoteDesktop::Gateway_Socket::_Release(){
+	if (_Pending == nullptr) return;
+	_Pool->Release(_Pending);
+	_Pending = nullptr;
+	_PendingBeg = _PendingEnd = 0;
+}
+
+RemoteDesktop::Network_Return RemoteDesktop::Gateway_Socket::Read_Header(){
+	if (_HeaderCount < (int)sizeof(_Header)){
+		auto amtrec = recv(get_Socket(), (char*)&_Header + _HeaderCount, (int)sizeof(_Header) - _HeaderCount, 0);
+		if (amtrec == 0) return Disconnect();
+		if (amtrec < 0) return WSAGetLastError() == WSAEWOULDBLOCK ? Network_Return::PARTIALLY_COMPLETED : Disconnect();
+		_HeaderCount += amtrec;
+		if (_HeaderCount < (int)sizeof(_Header)) return Network_Return::PARTIALLY_COMPLETED;
+	}
+	Dst_ID = _Header.Dst_Id;
+	Src_ID = _Header.Src_Id;
+	if ((Dst_ID == -1 || Dst_ID == GATEWAY_BROADCAST || Dst_ID == GATEWAY_MULTIPLEX) && Src_ID >= 0) Type = SERVER;
+	else if (Src_ID == -1 && Dst_ID >= 0) Type = VIEWER;
+	else {
+		DEBUG_MSG("Gateway_Socket bad header % %", Dst_ID, Src_ID);
+		return Disconnect();
+	}
+	return Network_Return::COMPLETED;
+}
+void RemoteDesktop::Gateway_Socket::Pair(){
+	assert(_Pending == nullptr);
+	_Pending = _Pool->Acquire();
+	memcpy(_Pending, &_Header, sizeof(_Header));
+	_PendingBeg = 0;
+	_PendingEnd = sizeof(_Header);
+	Last_Received = Timer_Wheel::Now();
+}
+
+RemoteDesktop::Network_Return RemoteDesktop::Gateway_Socket::_Flush(Gateway_Socket& peer){
+	while (_PendingBeg < _PendingEnd){
+		auto sent = send(peer.get_Socket(), _Pending + _PendingBeg, _PendingEnd - _PendingBeg, 0);
+		if (sent <= 0){
+			if (WSAGetLastError() == WSAEWOULDBLOCK){//the peer gets an FD_WRITE once it drains, which calls back into Relay
+				INTERNAL::GatewayStalls.Add();
+				return Network_Return::PARTIALLY_COMPLETED;
+			}
+			peer.Disconnect();
+			return Disconnect();
+		}
+		_PendingBeg += sent;
+		Relayed += sent;
+		INTERNAL::GatewayRelayed.Add(sent);
+	}
+	_PendingBeg = _PendingEnd = 0;
+	return Network_Return::COMPLETED;
+}
+RemoteDesktop::Network_Return RemoteDesktop::Gateway_Socket::Relay(long long budget, long long& read){
+	read = 0;
+	if (Broadcast) return Type == SERVER ? Broadcast->Read(*this, budget, read) : Broadcast->Forward(*this, budget, read);
+	if (Mux) return Mux->Relay(*this, budget, read);
+	auto peer = Paired_Socket.lock();
+	if (!peer || peer->Is_Disconnected()) return Disconnect();
+	if (_PendingEnd > _PendingBeg){
+		auto ret = _Flush(*peer);
+		if (ret != Network_Return::COMPLETED) return ret;
+	}
+	if (_Pending == nullptr) _Pending = _Pool->Acquire();
+	for (auto i = 0; read < budget; i++){
+		auto amtrec = recv(get_Socket(), _Pending, (int)std::min((long long)_Pool->get_ChunkSize(), budget - read), 0);
+		if (amtrec == 0) return Disconnect();//orderly shutdown, the peer is closed with it
+		if (amtrec < 0){
+			if (WSAGetLastError() != WSAEWOULDBLOCK) return Disconnect();
+			_Release();//nothing in flight, give the chunk to another socket
+			return Network_Return::COMPLETED;
+		}
+		_PendingBeg = 0;
+		_PendingEnd = amtrec;
+		read += amtrec;
+		if (i == 0) Last_Received = Timer_Wheel::Now();
+		auto ret = _Flush(*peer);
+		if (ret != Network_Return::COMPLETED) return ret;
+	}
+	return Network_Return::PARTIALLY_COMPLETED;//more could be waiting, the recv above rearms FD_READ
+}
+long long RemoteDesktop::Gateway_Socket::Allowance(long long now){
+	if (Rate <= 0) return std::numeric_limits<long long>::max();
+	auto burst = std::max(Rate * RELAY_BURST / 1000.0, 1.0);
+	if (_Refilled == 0) _Tokens = burst;
+	else _Tokens = std::min(_Tokens + Rate * (now - _Refilled) / 1000.0, burst);
+	_Refilled = now;
+	return (long long)_Tokens;
+}
+long long RemoteDesktop::Gateway_Socket::Throttled_For() const{
+	if (Rate <= 0 || _Tokens >= 1.0) return 0;
+	return (long long)((1.0 - _Tokens) * 1000.0 / Rate) + 1;
+}
@@ -2,28 +2,87 @@
 #define GATEWAY_SOCKET123_H
 #include "Handle_Wrapper.h"
 #include "CommonNetwork.h"
+#include <memory>
+#include <deque>
+#include <vector>
+
+#define RELAY_BURST 100 //ms worth of its rate cap a socket may relay at once after a pause
 
 namespace RemoteDesktop{
+	class PacketBufferPool;
+	class Gateway_Broadcast;
+	class Gateway_Mux;
+	//one connection through the gateway. Every connection starts with a Proxy_Header, servers send -1 as Dst_Id and their own id as Src_Id, viewers send the id of the server they want as Dst_Id and -1 as Src_Id.
+	//Once a viewer and a server are paired the bytes are copied from one socket to the other through chunks of a PacketBufferPool, the gateway never looks at them. The header is forwarded too because the peers expect it in front of the key exchange.
+	//A server that sends GATEWAY_BROADCAST as its Dst_Id is relayed to every viewer of its id, see Gateway_Broadcast. One that sends GATEWAY_MULTIPLEX carries all of its sessions over its own connection, see Gateway_Mux
 	class Gateway_Socket{
 
 		RAIISOCKET_TYPE _Socket;
-		std::vector<char> _Buffer;
-		int _BufferCount = 0;
-		PeerState State = PEER_STATE_DISCONNECTED;
+		PacketBufferPool* _Pool;
+		Proxy_Header _Header;
+		int _HeaderCount = 0;
+		//read from this socket, not yet taken by the peer. While it holds anything this socket is not read from so a slow receiver holds back its sender
+		char* _Pending = nullptr;
+		int _PendingBeg = 0, _PendingEnd = 0;
+		PeerState State = PEER_STATE_CONNECTED;
+		double _Tokens = 0.0;//token bucket for Rate
+		long long _Refilled = 0;
+
+		Network_Return _Flush(Gateway_Socket& peer);
+		void _Release();
 
 	public:
-		enum ConnectionTypes { VIEWER, SERVER };
-		explicit Gateway_Socket(SOCKET socket) : _Socket(RAIISOCKET(socket)){}
-		void Receive();
+		enum ConnectionTypes { UNKNOWN, VIEWER, SERVER, SPECTATOR };
+		Gateway_Socket(SOCKET socket, PacketBufferPool* pool);
+		~Gateway_Socket();
 
+		SOCKET get_Socket() const { return _Socket->socket; }
+		bool Is_Disconnected() const { return State == PEER_STATE_DISCONNECTED; }
 		Network_Return Disconnect(){ State = PEER_STATE_DISCONNECTED; return Network_Return::FAILED; }
 
+		//COMPLETED once the whole Proxy_Header is in and it names a viewer or a server
+		Network_Return Read_Header();
+		const Proxy_Header& get_Header() const { return _Header; }
+		bool Is_Broadcaster() const { return Type == SERVER && Dst_ID == GATEWAY_BROADCAST; }
+		bool Is_Multiplexer() const { return Type == SERVER && Dst_ID == GATEWAY_MULTIPLEX; }
+		//queues the header for the peer set in Paired_Socket
+		void Pair();
+		//moves up to budget bytes read from this socket to the peer, read says how many were taken. Call it when this socket is readable or when the peer is writable again. The server and the viewers of a Gateway_Broadcast and the sockets of a Gateway_Mux go through those instead
+		Network_Return Relay(long long budget, long long& read);
+
+		//bytes the rate cap lets this socket read right now
+		long long Allowance(long long now);
+		//ms until Allowance is above 0 again
+		long long Throttled_For() const;
+		void Spend(long long bytes){ if (Rate > 0) _Tokens -= bytes; }
+
+		ConnectionTypes Type = UNKNOWN;
 		int Dst_ID = -1;
 		int Src_ID = -1;
+		long long Relayed = 0;//bytes this socket handed to its peer
+		long long Last_Received = 0;//Timer_Wheel::Now() of the pairing or the last read that got something
+
+		//set by the gateway before the pair goes to a shard, see Gateway_Shard for how they are used
+		int Weight = 1;
+		long long Rate = 0;//bytes per second this socket may read, 0 for no cap
+		long long Deficit = 0;
+		bool Backlogged = false;//used up its whole budget the last time it was served
 
-		RAIISOCKET_TYPE ThisSocket;
 		std::weak_ptr<Gateway_Socket> Paired_Socket;
+
+		//set on the server and every viewer of a broadcast
+		std::shared_ptr<Gateway_Broadcast> Broadcast;
+		long long Cursor = -1;//the next message of the broadcast this viewer gets, -1 until it was sent the server's key exchange
+		int Spectator = 0;//its id in what goes to the server, 0 for the viewer in control
+		bool Allowed = false;//a spectator gets nothing past the key exchange until the server allowed it
+		bool Streaming = false;//past the keyframes it started from, the refreshed ones after that are skipped
+		std::deque<std::shared_ptr<const std::vector<char>>> Outbox;
+		size_t Outbox_Sent = 0;//of Outbox.front()
+
+		//set on a multiplexing server and every viewer it carries
+		std::shared_ptr<Gateway_Mux> Mux;
+		int Stream = 0;//the viewer's stream on the server's connection
 	};
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,58 @@
+#include "stdafx.h"
+#include "Histogram.h"
+#include <intrin.h>
+#include <climits>
+
+RemoteDesktop::Histogram::Histogram(){
+	Reset();
+}
+int RemoteDesktop::Histogram::_Index(long long v){
+	if (v < HISTOGRAM_SUBBUCKETS) return (int)v;
+	unsigned long msb = 0;
+	auto high = (unsigned long)((unsigned long long)v >> 32);
+	if (high != 0) {
+		_BitScanReverse(&msb, high);
+		msb += 32;
+	}
+	else _BitScanReverse(&msb, (unsigned long)v);
+	auto sub = (int)((unsigned long long)v >> (msb - 4)) & (HISTOGRAM_SUBBUCKETS - 1);
+	return (msb - 3) * HISTOGRAM_SUBBUCKETS + sub;
+}
+long long RemoteDesktop::Histogram::_Value(int index){
+	if (index < HISTOGRAM_SUBBUCKETS) return index;
+	auto msb = index / HISTOGRAM_SUBBUCKETS + 3;
+	auto sub = index % HISTOGRAM_SUBBUCKETS;
+	return (long long)(HISTOGRAM_SUBBUCKETS + sub) << (msb - 4);
+}
+void RemoteDesktop::Histogram::Record(long long v){
+	if (v < 0) return;
+	_Buckets[_Index(v)].fetch_add(1, std::memory_order_relaxed);
+	_Count.fetch_add(1, std::memory_order_relaxed);
+	_Sum.fetch_add(v, std::memory_order_relaxed);
+	auto m = _Min.load(std::memory_order_relaxed);
+	while (v < m && !_Min.compare_exchange_weak(m, v, std::memory_order_relaxed));
+	m = _Max.load(std::memory_order_relaxed);
+	while (v > m && !_Max.compare_exchange_weak(m, v, std::memory_order_relaxed));
+}
+void RemoteDesktop::Histogram::Reset(){
+	for (auto& a : _Buckets) a = 0;
+	_Count = 0;
+	_Sum = 0;
+	_Min = LLONG_MAX;
+	_Max = 0;
+}
+long long RemoteDesktop::Histogram::get_Percentile(double p) const{
+	auto count = _Count.load();
+	if (count <= 0) return 0;
+	auto target = (long long)((p / 100.0) * count + 0.5);
+	if (target < 1) target = 1;
+	long long seen = 0;
+	for (auto i = 0; i < HISTOGRAM_BUCKETS; i++){
+		seen += _Buckets[i].load(std::memory_order_relaxed);
+		if (seen >= target) {
+			auto v = i + 1 < HISTOGRAM_BUCKETS ? (_Value(i) + _Value(i + 1)) / 2 : _Value(i);//middle of the bucket
+			return std::max(std::min(v, _Max.load()), get_Min());
+		}
+	}
+	return _Max;
+}
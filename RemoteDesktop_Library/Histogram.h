@@ -0,0 +1,33 @@
+#ifndef HISTOGRAM123_H
+#define HISTOGRAM123_H
+#include <atomic>
+
+#define HISTOGRAM_SUBBUCKETS 16 //buckets per power of two, so every value is stored within about 6%
+#define HISTOGRAM_BUCKETS ((64 - 3) * HISTOGRAM_SUBBUCKETS)
+
+namespace RemoteDesktop{
+	//log linear histogram in the style of HdrHistogram. Fixed memory and lock free, so any thread can record while another reads
+	class Histogram{
+		std::atomic<unsigned int> _Buckets[HISTOGRAM_BUCKETS];
+		std::atomic<long long> _Count, _Sum, _Min, _Max;
+
+		static int _Index(long long v);
+		static long long _Value(int index);
+	public:
+		Histogram();
+		Histogram(const Histogram& other) = delete;
+
+		void Record(long long v);//negative values are ignored
+		void Reset();
+
+		long long get_Count() const { return _Count; }
+		long long get_Sum() const { return _Sum; }
+		long long get_Min() const { return _Count > 0 ? _Min.load() : 0; }
+		long long get_Max() const { return _Max; }
+		long long get_Mean() const { return _Count > 0 ? _Sum / _Count : 0; }
+		//p is 0 to 100
+		long long get_Percentile(double p) const;
+	};
+}
+
+#endif
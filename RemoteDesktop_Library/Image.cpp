@@ -3,26 +3,38 @@
 #include "turbojpeg.h"
 #include <memory>
 #include "Timer.h"
+#include "Profiler.h"
+#include "Metrics.h"
 #include "Handle_Wrapper.h"
 
 std::vector<std::vector<char>> RemoteDesktop::INTERNAL::BufferCache;
-std::mutex RemoteDesktop::INTERNAL::BufferCacheLock;
+RemoteDesktop::Profiled_Mutex RemoteDesktop::INTERNAL::BufferCacheLock("image_buffer_cache");
+namespace RemoteDesktop{
+	namespace INTERNAL{
+		Metrics::Value& ImageBufferHits = Metrics::Counter("rd_image_buffer_pool_hits_total", "Images that reused a cached pixel buffer");
+		Metrics::Value& ImageBufferMisses = Metrics::Counter("rd_image_buffer_pool_misses_total", "Images that found the pixel buffer cache empty and will allocate");
+	}
+}
 
 int RemoteDesktop::Image_Settings::Quality = 70;
 bool RemoteDesktop::Image_Settings::GrazyScale = false;
 void RemoteDesktop::Image::GetNewBuffer(){
 	if (!INTERNAL::BufferCache.empty()){
-		std::lock_guard<std::mutex> lock(INTERNAL::BufferCacheLock);
+		std::lock_guard<Profiled_Mutex> lock(INTERNAL::BufferCacheLock);
 		if (!INTERNAL::BufferCache.empty()){
 			data = std::move(INTERNAL::BufferCache.back());
 			INTERNAL::BufferCache.pop_back();
+			INTERNAL::ImageBufferHits.Add();
+			return;
 		}
 	}
+	INTERNAL::ImageBufferMisses.Add();
 }
 
 
 void RemoteDesktop::Image::Compress(){
 	if (Compressed) return;//already done
+	PROFILE_ZONE("encode");
 
 	//I Kind of cheat below by using static variables. . .  This means the compress and decompress functions are NOT THREAD SAFE, but this isnt a problem yet because I never access these functions from different threads at the same time
 
@@ -55,6 +67,7 @@ void RemoteDesktop::Image::Compress(){
 }
 void RemoteDesktop::Image::Decompress(){
 	if (!Compressed) return;//already done
+	PROFILE_ZONE("decode");
 
 	auto compfree = [](void* handle){tjDestroy(handle); };
 	auto _jpegDecompressor(std::unique_ptr<void, decltype(compfree)>(tjInitDecompress(), compfree));
@@ -100,6 +113,7 @@ RemoteDesktop::Image RemoteDesktop::Image::Clone() const{
 
 
 RemoteDesktop::Rect RemoteDesktop::Image::Difference(Image& first, Image& second){
+	PROFILE_ZONE("diff");
 	assert(first.Height == second.Height);
 	assert(first.Width == second.Width);
 	assert(first.Pixel_Stride == second.Pixel_Stride);
@@ -3,6 +3,7 @@
 #include "Rect.h"
 #include <vector>
 #include <mutex>
+#include "Lock_Profiler.h"
 
 #define MAX_DISPLAYS 4
 
@@ -14,7 +15,7 @@ namespace RemoteDesktop{
 	namespace INTERNAL{
 		//improves speed when memory allocations are kept down because vector resize always does a memset on the unintialized elements
 		extern std::vector<std::vector<char>> BufferCache;
-		extern std::mutex BufferCacheLock;
+		extern Profiled_Mutex BufferCacheLock;
 	}
 	class Image{
 
@@ -45,7 +46,7 @@ namespace RemoteDesktop{
 		}
 		~Image(){
 			if (data.size() > 100 || INTERNAL::BufferCache.size()<15){
-				std::lock_guard<std::mutex> lock(INTERNAL::BufferCacheLock);
+				std::lock_guard<Profiled_Mutex> lock(INTERNAL::BufferCacheLock);
 				INTERNAL::BufferCache.emplace_back(std::move(data));
 			}
 		}
@@ -0,0 +1,66 @@
+#include "stdafx.h"
+#include "Lock_Profiler.h"
+#include <deque>
+#include <cstring>
+
+namespace RemoteDesktop{
+	namespace Lock_Profiler{
+		namespace _INTERNAL{
+			std::atomic<bool> Enabled(true);
+			struct Site_Registry{
+				std::mutex Lock;
+				std::deque<Site> Sites;//deque so the pointers handed out stay valid
+			};
+			//function static so locks can be created from other statics
+			Site_Registry& get_Sites(){
+				static Site_Registry r;
+				return r;
+			}
+			void Clear(Site& s){
+				s.Acquisitions = s.Contended = s.Wait_Total = s.Wait_Max = s.Hold_Total = s.Hold_Max = 0;
+			}
+		}
+	}
+}
+
+RemoteDesktop::Lock_Profiler::_INTERNAL::Site* RemoteDesktop::Lock_Profiler::_INTERNAL::Register(const char* name){
+	auto& r = get_Sites();
+	std::lock_guard<std::mutex> lock(r.Lock);
+	for (auto& a : r.Sites){
+		if (strcmp(a.Name, name) == 0) return &a;
+	}
+	r.Sites.emplace_back();
+	auto& s = r.Sites.back();
+	s.Name = name;
+	Clear(s);
+	return &s;
+}
+void RemoteDesktop::Lock_Profiler::set_Enabled(bool e){
+	_INTERNAL::Enabled = e;
+}
+bool RemoteDesktop::Lock_Profiler::get_Enabled(){
+	return _INTERNAL::Enabled;
+}
+std::vector<RemoteDesktop::Lock_Profiler::Lock_Stats> RemoteDesktop::Lock_Profiler::get_Stats(){
+	std::vector<Lock_Stats> ret;
+	auto& r = _INTERNAL::get_Sites();
+	std::lock_guard<std::mutex> lock(r.Lock);
+	ret.reserve(r.Sites.size());
+	for (auto& a : r.Sites){
+		Lock_Stats s;
+		s.Name = a.Name;
+		s.Acquisitions = a.Acquisitions;
+		s.Contended = a.Contended;
+		s.Wait_Total = High_Clock::to_Micro(a.Wait_Total);
+		s.Wait_Max = High_Clock::to_Micro(a.Wait_Max);
+		s.Hold_Total = High_Clock::to_Micro(a.Hold_Total);
+		s.Hold_Max = High_Clock::to_Micro(a.Hold_Max);
+		ret.push_back(s);
+	}
+	return ret;
+}
+void RemoteDesktop::Lock_Profiler::Reset(){
+	auto& r = _INTERNAL::get_Sites();
+	std::lock_guard<std::mutex> lock(r.Lock);
+	for (auto& a : r.Sites) _INTERNAL::Clear(a);
+}
@@ -0,0 +1,93 @@
+#ifndef LOCK_PROFILER123_H
+#define LOCK_PROFILER123_H
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include "Timer.h"
+
+namespace RemoteDesktop{
+	//wait and hold times of the locks on the hot paths. Every Profiled_Mutex created with the same name adds into the same site, so all of the sockets send locks show up as one line
+	namespace Lock_Profiler{
+		//times are in microseconds
+		struct Lock_Stats{
+			const char* Name;
+			long long Acquisitions, Contended;//Contended counts the acquisitions that had to wait
+			long long Wait_Total, Wait_Max, Hold_Total, Hold_Max;
+		};
+		namespace _INTERNAL{
+			struct Site{
+				const char* Name;
+				std::atomic<long long> Acquisitions, Contended, Wait_Total, Wait_Max, Hold_Total, Hold_Max;//ticks
+			};
+			extern std::atomic<bool> Enabled;
+			Site* Register(const char* name);
+			inline void Record_Max(std::atomic<long long>& m, long long v){
+				auto cur = m.load(std::memory_order_relaxed);
+				while (v > cur && !m.compare_exchange_weak(cur, v, std::memory_order_relaxed));
+			}
+		}
+		//on by default, an uncontended lock costs two clock reads and a few relaxed adds
+		void set_Enabled(bool e);
+		bool get_Enabled();
+		std::vector<Lock_Stats> get_Stats();//in the order the sites were first created
+		void Reset();
+	}
+
+	//drop in for std::mutex that works with std::lock_guard and std::unique_lock. It cannot be used with std::condition_variable, use std::condition_variable_any for that. name must be a string literal, only the pointer is kept
+	class Profiled_Mutex{
+		std::mutex _Mutex;
+		Lock_Profiler::_INTERNAL::Site* _Site;
+		long long _Acquired = 0;//0 when this acquisition is not being timed
+
+		void _Acquire(long long waited){
+			auto& s = *_Site;
+			s.Acquisitions.fetch_add(1, std::memory_order_relaxed);
+			if (waited > 0){
+				s.Contended.fetch_add(1, std::memory_order_relaxed);
+				s.Wait_Total.fetch_add(waited, std::memory_order_relaxed);
+				Lock_Profiler::_INTERNAL::Record_Max(s.Wait_Max, waited);
+			}
+		}
+
+	public:
+		explicit Profiled_Mutex(const char* name) : _Site(Lock_Profiler::_INTERNAL::Register(name)){}
+		Profiled_Mutex(const Profiled_Mutex& other) = delete;
+		Profiled_Mutex& operator=(const Profiled_Mutex& other) = delete;
+
+		void lock(){
+			if (!Lock_Profiler::_INTERNAL::Enabled.load(std::memory_order_relaxed)){
+				_Mutex.lock();
+				_Acquired = 0;
+				return;
+			}
+			long long waited = 0;
+			if (!_Mutex.try_lock()){//only pay for the extra clock read when someone else holds it
+				auto start = High_Clock::Now();
+				_Mutex.lock();
+				_Acquired = High_Clock::Now();
+				waited = _Acquired - start;
+			}
+			else _Acquired = High_Clock::Now();
+			_Acquire(waited);
+		}
+		bool try_lock(){
+			if (!_Mutex.try_lock()) return false;
+			if (Lock_Profiler::_INTERNAL::Enabled.load(std::memory_order_relaxed)){
+				_Acquired = High_Clock::Now();
+				_Acquire(0);
+			}
+			else _Acquired = 0;
+			return true;
+		}
+		void unlock(){
+			if (_Acquired != 0){
+				auto held = High_Clock::Now() - _Acquired;
+				_Site->Hold_Total.fetch_add(held, std::memory_order_relaxed);
+				Lock_Profiler::_INTERNAL::Record_Max(_Site->Hold_Max, held);
+			}
+			_Mutex.unlock();
+		}
+	};
+}
+
+#endif
@@ -0,0 +1,189 @@
+#include "stdafx.h"
+#include "Metrics.h"
+#include "Histogram.h"
+#include "Frame_Tracer.h"
+#include "Allocation_Tracker.h"
+#include "Lock_Profiler.h"
+#include <deque>
+#include <vector>
+#include <memory>
+#include <mutex>
+
+namespace RemoteDesktop{
+	namespace Metrics{
+		namespace _INTERNAL{
+			enum Metric_Types{
+				METRIC_COUNTER,
+				METRIC_GAUGE,
+				METRIC_SUMMARY
+			};
+			struct Entry{
+				Entry(const char* n, const char* h, Metric_Types t) : Name(n), Help(h), Type(t){}
+				std::string Name, Help;
+				Metric_Types Type;
+				Value Val;
+				std::unique_ptr<Histogram> Hist;
+			};
+			struct Registry{
+				std::mutex Lock;
+				std::deque<Entry> Entries;//deque so references handed out stay valid as it grows
+				std::vector<std::pair<int, Delegate<void, std::string&>>> Collectors;
+				int NextCollector = 1;
+			};
+			//function static so metrics can be registered from other statics
+			Registry& get_Registry(){
+				static Registry r;
+				return r;
+			}
+			Entry& Find(const char* name, const char* help, Metric_Types type){
+				auto& r = get_Registry();
+				std::lock_guard<std::mutex> lock(r.Lock);
+				for (auto& a : r.Entries){
+					if (a.Name == name) return a;
+				}
+				r.Entries.emplace_back(name, help, type);
+				auto& e = r.Entries.back();
+				if (type == METRIC_SUMMARY) e.Hist = std::make_unique<Histogram>();
+				return e;
+			}
+			const char* Stage_Names[] = { "capture", "diff", "encode", "enqueue", "send", "receive", "decrypt", "decode", "present" };
+			static_assert(sizeof(Stage_Names) / sizeof(Stage_Names[0]) == Frame_Tracer::STAGE_COUNT, "stage names are out of date");
+			void Write_Tracer(std::string& out){
+				Write_Help(out, "rd_frame_stage_microseconds", "Time spent in each stage of the frame pipeline, only while frame tracing is enabled", "summary");
+				for (auto i = 0; i < Frame_Tracer::STAGE_COUNT; i++){
+					auto s = Frame_Tracer::get_Stats((Frame_Tracer::Stages)i);
+					if (s.Count == 0) continue;
+					std::string stage = std::string("stage=\"") + Stage_Names[i] + "\"";
+					Write_Value(out, "rd_frame_stage_microseconds", stage + ",quantile=\"0.5\"", s.P50);
+					Write_Value(out, "rd_frame_stage_microseconds", stage + ",quantile=\"0.9\"", s.P90);
+					Write_Value(out, "rd_frame_stage_microseconds", stage + ",quantile=\"0.99\"", s.P99);
+					Write_Value(out, "rd_frame_stage_microseconds_sum", stage, Frame_Tracer::get_Sum((Frame_Tracer::Stages)i));
+					Write_Value(out, "rd_frame_stage_microseconds_count", stage, s.Count);
+				}
+			}
+			void Write_Allocations(std::string& out){
+				Write_Help(out, "rd_frame_allocations_total", "Heap allocations made in each stage of the frame pipeline", "counter");
+				for (auto i = 0; i < Frame_Tracer::STAGE_COUNT; i++){
+					Write_Value(out, "rd_frame_allocations_total", std::string("stage=\"") + Stage_Names[i] + "\"", Allocation_Tracker::get_Stats((Frame_Tracer::Stages)i).Allocations);
+				}
+				Write_Help(out, "rd_frame_allocated_bytes_total", "Bytes requested from the heap in each stage of the frame pipeline", "counter");
+				for (auto i = 0; i < Frame_Tracer::STAGE_COUNT; i++){
+					Write_Value(out, "rd_frame_allocated_bytes_total", std::string("stage=\"") + Stage_Names[i] + "\"", Allocation_Tracker::get_Stats((Frame_Tracer::Stages)i).Bytes);
+				}
+				Write_Help(out, "rd_frame_allocation_violations_total", "Frames past the warm up that allocated while allocation checks were on", "counter");
+				Write_Value(out, "rd_frame_allocation_violations_total", "", Allocation_Tracker::get_Violations());
+			}
+			void Write_Locks(std::string& out){
+				auto stats = Lock_Profiler::get_Stats();
+				if (stats.empty()) return;
+				Write_Help(out, "rd_lock_acquisitions_total", "Times each lock site was taken", "counter");
+				for (auto& a : stats) Write_Value(out, "rd_lock_acquisitions_total", std::string("lock=\"") + a.Name + "\"", a.Acquisitions);
+				Write_Help(out, "rd_lock_contended_total", "Times each lock site was already held and the caller had to wait", "counter");
+				for (auto& a : stats) Write_Value(out, "rd_lock_contended_total", std::string("lock=\"") + a.Name + "\"", a.Contended);
+				Write_Help(out, "rd_lock_wait_microseconds_total", "Time spent waiting for each lock site", "counter");
+				for (auto& a : stats) Write_Value(out, "rd_lock_wait_microseconds_total", std::string("lock=\"") + a.Name + "\"", a.Wait_Total);
+				Write_Help(out, "rd_lock_wait_max_microseconds", "Longest single wait for each lock site", "gauge");
+				for (auto& a : stats) Write_Value(out, "rd_lock_wait_max_microseconds", std::string("lock=\"") + a.Name + "\"", a.Wait_Max);
+				Write_Help(out, "rd_lock_hold_microseconds_total", "Time each lock site was held", "counter");
+				for (auto& a : stats) Write_Value(out, "rd_lock_hold_microseconds_total", std::string("lock=\"") + a.Name + "\"", a.Hold_Total);
+				Write_Help(out, "rd_lock_hold_max_microseconds", "Longest single hold of each lock site", "gauge");
+				for (auto& a : stats) Write_Value(out, "rd_lock_hold_max_microseconds", std::string("lock=\"") + a.Name + "\"", a.Hold_Max);
+			}
+		}
+	}
+}
+
+RemoteDesktop::Metrics::Value& RemoteDesktop::Metrics::Counter(const char* name, const char* help){
+	return _INTERNAL::Find(name, help, _INTERNAL::METRIC_COUNTER).Val;
+}
+RemoteDesktop::Metrics::Value& RemoteDesktop::Metrics::Gauge(const char* name, const char* help){
+	return _INTERNAL::Find(name, help, _INTERNAL::METRIC_GAUGE).Val;
+}
+RemoteDesktop::Histogram& RemoteDesktop::Metrics::Summary(const char* name, const char* help){
+	auto& e = _INTERNAL::Find(name, help, _INTERNAL::METRIC_SUMMARY);
+	assert(e.Hist);
+	return *e.Hist;
+}
+int RemoteDesktop::Metrics::Add_Collector(Delegate<void, std::string&> c){
+	auto& r = _INTERNAL::get_Registry();
+	std::lock_guard<std::mutex> lock(r.Lock);
+	auto id = r.NextCollector++;
+	r.Collectors.push_back(std::make_pair(id, c));
+	return id;
+}
+void RemoteDesktop::Metrics::Remove_Collector(int id){
+	auto& r = _INTERNAL::get_Registry();
+	std::lock_guard<std::mutex> lock(r.Lock);
+	r.Collectors.erase(std::remove_if(r.Collectors.begin(), r.Collectors.end(), [id](const std::pair<int, Delegate<void, std::string&>>& a){ return a.first == id; }), r.Collectors.end());
+}
+
+std::string RemoteDesktop::Metrics::Snapshot(){
+	std::string out;
+	out.reserve(16 * 1024);
+	auto& r = _INTERNAL::get_Registry();
+	std::lock_guard<std::mutex> lock(r.Lock);
+	for (auto& a : r.Entries){
+		switch (a.Type){
+		case(_INTERNAL::METRIC_COUNTER) :
+			Write_Help(out, a.Name.c_str(), a.Help.c_str(), "counter");
+			Write_Value(out, a.Name.c_str(), "", a.Val.get_Value());
+			break;
+		case(_INTERNAL::METRIC_GAUGE) :
+			Write_Help(out, a.Name.c_str(), a.Help.c_str(), "gauge");
+			Write_Value(out, a.Name.c_str(), "", a.Val.get_Value());
+			break;
+		case(_INTERNAL::METRIC_SUMMARY) :
+			Write_Help(out, a.Name.c_str(), a.Help.c_str(), "summary");
+			Write_Summary(out, a.Name.c_str(), "", *a.Hist);
+			break;
+		}
+	}
+	for (auto& a : r.Collectors) a.second(out);
+	if (Frame_Tracer::get_Enabled()) _INTERNAL::Write_Tracer(out);
+	if (Allocation_Tracker::get_Enabled()) _INTERNAL::Write_Allocations(out);
+	if (Lock_Profiler::get_Enabled()) _INTERNAL::Write_Locks(out);
+	return out;
+}
+
+void RemoteDesktop::Metrics::Write_Help(std::string& out, const char* name, const char* help, const char* type){
+	out += "# HELP ";
+	out += name;
+	out += ' ';
+	out += help;
+	out += "\n# TYPE ";
+	out += name;
+	out += ' ';
+	out += type;
+	out += '\n';
+}
+void RemoteDesktop::Metrics::Write_Value(std::string& out, const char* name, const std::string& labels, long long v){
+	out += name;
+	if (!labels.empty()){
+		out += '{';
+		out += labels;
+		out += '}';
+	}
+	out += ' ';
+	out += std::to_string(v);
+	out += '\n';
+}
+void RemoteDesktop::Metrics::Write_Summary(std::string& out, const char* name, const std::string& labels, const Histogram& h){
+	auto sep = labels.empty() ? std::string() : labels + ",";
+	Write_Value(out, name, sep + "quantile=\"0.5\"", h.get_Percentile(50.0));
+	Write_Value(out, name, sep + "quantile=\"0.9\"", h.get_Percentile(90.0));
+	Write_Value(out, name, sep + "quantile=\"0.99\"", h.get_Percentile(99.0));
+	Write_Value(out, (std::string(name) + "_sum").c_str(), labels, h.get_Sum());
+	Write_Value(out, (std::string(name) + "_count").c_str(), labels, h.get_Count());
+}
+std::string RemoteDesktop::Metrics::Label(const char* name, const std::wstring& value){
+	std::string out(name);
+	out += "=\"";
+	for (auto c : ws2s(value)){
+		if (c == 0) break;
+		if (c == '\\' || c == '"') out += '\\';
+		if (c == '\n') out += "\\n";
+		else out += c;
+	}
+	out += '"';
+	return out;
+}
@@ -0,0 +1,42 @@
+#ifndef METRICS123_H
+#define METRICS123_H
+#include <atomic>
+#include <string>
+#include "Delegate.h"
+
+namespace RemoteDesktop{
+	class Histogram;
+	//process wide metrics for the metrics endpoint, written out in the prometheus text format. Hot paths look a metric up once (usually into a function static) and update it with a single relaxed atomic.
+	//The registry lock is only taken when a metric is first registered and while a snapshot is built
+	namespace Metrics{
+		class Value{
+			std::atomic<long long> _Value;
+		public:
+			Value() : _Value(0){}
+			Value(const Value& other) = delete;
+			void Add(long long v = 1){ _Value.fetch_add(v, std::memory_order_relaxed); }
+			void Set(long long v){ _Value.store(v, std::memory_order_relaxed); }
+			long long get_Value() const { return _Value.load(std::memory_order_relaxed); }
+		};
+
+		//registering the same name twice returns the same metric. The returned references live until the process exits
+		Value& Counter(const char* name, const char* help);
+		Value& Gauge(const char* name, const char* help);
+		Histogram& Summary(const char* name, const char* help);//exported with 50/90/99 quantiles
+
+		//collectors are called while a snapshot is built for metrics with labels, or values owned by other objects like per connection traffic.
+		//Remove_Collector waits for a running snapshot to finish so the owner can be destroyed right after. Collectors must not register metrics
+		int Add_Collector(Delegate<void, std::string&> c);
+		void Remove_Collector(int id);
+
+		std::string Snapshot();
+
+		//helpers for collectors
+		void Write_Help(std::string& out, const char* name, const char* help, const char* type);
+		void Write_Value(std::string& out, const char* name, const std::string& labels, long long v);
+		void Write_Summary(std::string& out, const char* name, const std::string& labels, const Histogram& h);
+		std::string Label(const char* name, const std::wstring& value);//name="value" with the value escaped
+	};
+}
+
+#endif
@@ -0,0 +1,115 @@
+#include "stdafx.h"
+#include "Metrics_Server.h"
+#include "Metrics.h"
+#include "Profiler.h"
+#include "NetworkSetup.h"
+
+#define METRICS_MAXREQUEST 4096 //anything bigger is not a scrape
+#define METRICS_TIMEOUT 2000 //ms a client gets to send its request
+
+RemoteDesktop::Metrics_Server::Metrics_Server(){
+
+}
+RemoteDesktop::Metrics_Server::~Metrics_Server(){
+	Stop();
+}
+void RemoteDesktop::Metrics_Server::Start(std::wstring port){
+	Stop();
+	wchar_t* end = nullptr;
+	auto p = wcstol(port.c_str(), &end, 10);
+	if (port.empty() || end == nullptr || *end != 0 || p <= 0 || p > 65535){//a typo in the config must not take the host down with it
+		DEBUG_MSG("Metrics_Server bad port '%', not started", ws2s(port));
+		return;
+	}
+	_Port = (unsigned short)p;
+	_Running = true;
+	_BackgroundWorker = std::thread(&RemoteDesktop::Metrics_Server::_Run, this);
+}
+void RemoteDesktop::Metrics_Server::Stop(){
+	_Running = false;
+	BEGINTRY
+		if (std::this_thread::get_id() != _BackgroundWorker.get_id() && _BackgroundWorker.joinable()) _BackgroundWorker.join();
+	ENDTRY
+}
+
+void RemoteDesktop::Metrics_Server::_Run(){
+	if (!StartupNetwork()) return;
+	auto listensocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (listensocket == INVALID_SOCKET) return;
+	sockaddr_in service;
+	memset(&service, 0, sizeof(service));
+	service.sin_family = AF_INET;
+	service.sin_port = htons(_Port);
+	service.sin_addr.s_addr = htonl(INADDR_LOOPBACK);//never expose this outside of the machine
+
+	if (bind(listensocket, (SOCKADDR *)& service, sizeof(service)) != 0 || listen(listensocket, 4) != 0) {
+		DEBUG_MSG("Metrics_Server could not listen on port % error %", _Port, WSAGetLastError());
+		closesocket(listensocket);
+		return;
+	}
+	DEBUG_MSG("Metrics_Server listening on 127.0.0.1:%", _Port);
+	while (_Running){
+		fd_set readset;
+		FD_ZERO(&readset);
+		FD_SET(listensocket, &readset);
+		TIMEVAL timeout;
+		timeout.tv_sec = 1;//wake up once a second to check _Running
+		timeout.tv_usec = 0;
+		if (select(0, &readset, NULL, NULL, &timeout) <= 0) continue;
+		auto s = accept(listensocket, NULL, NULL);
+		if (s == INVALID_SOCKET) continue;
+		_Serve(s);
+		closesocket(s);
+	}
+	closesocket(listensocket);
+	DEBUG_MSG("Metrics_Server Exiting");
+}
+void RemoteDesktop::Metrics_Server::_Serve(SOCKET s){
+	DWORD timeout = METRICS_TIMEOUT;
+	setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (char*)&timeout, sizeof(timeout));
+	setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, (char*)&timeout, sizeof(timeout));
+
+	std::string request;
+	char buffer[512];
+	while (request.find("\r\n\r\n") == std::string::npos){
+		auto r = recv(s, buffer, sizeof(buffer), 0);
+		if (r <= 0) return;
+		request.append(buffer, r);
+		if (request.size() > METRICS_MAXREQUEST) return;
+	}
+	std::string body, status, type = "text/plain; version=0.0.4";
+	if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 6, "GET / ") == 0){
+		status = "200 OK";
+		body = Metrics::Snapshot();
+	}
+	else if (request.compare(0, 17, "GET /trace/start ") == 0){
+		Profiler::set_Enabled(true);
+		status = "200 OK";
+		body = "profiling\n";
+	}
+	else if (request.compare(0, 16, "GET /trace/stop ") == 0){
+		Profiler::set_Enabled(false);
+		status = "200 OK";
+		body = "stopped\n";
+	}
+	else if (request.compare(0, 11, "GET /trace ") == 0){//load the result in chrome://tracing
+		status = "200 OK";
+		type = "application/json";
+		body = Profiler::Dump();
+	}
+	else {
+		status = "404 Not Found";
+		body = "not found\n";
+	}
+	std::string response = "HTTP/1.1 " + status + "\r\nContent-Type: " + type + "\r\nContent-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n";
+	response += body;
+
+	auto beg = response.data();
+	auto len = (int)response.size();
+	while (len > 0){
+		auto sent = send(s, beg, len, 0);
+		if (sent <= 0) return;
+		beg += sent;
+		len -= sent;
+	}
+}
@@ -0,0 +1,24 @@
+#ifndef METRICS_SERVER123_H
+#define METRICS_SERVER123_H
+#include <string>
+#include <thread>
+
+namespace RemoteDesktop{
+	//minimal http server that answers GET /metrics with Metrics::Snapshot(), and GET /trace/start, /trace/stop and /trace with the Profiler zones. It only binds to the loopback address and handles one request at a time, it is meant for a local scraper or agent, not for the outside world
+	class Metrics_Server{
+		std::thread _BackgroundWorker;
+		unsigned short _Port = 0;
+		bool _Running = false;
+		void _Run();
+		void _Serve(SOCKET s);
+
+	public:
+		Metrics_Server();
+		~Metrics_Server();
+
+		void Start(std::wstring port);
+		void Stop();
+	};
+}
+
+#endif
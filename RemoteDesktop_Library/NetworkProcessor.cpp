@@ -4,6 +4,13 @@
 #include "Desktop_Monitor.h"
 #include "NetworkSetup.h"
 #include <future>
+#include "Metrics.h"
+
+namespace RemoteDesktop{
+	namespace INTERNAL{
+		Metrics::Value& ReceiveQueueDepth = Metrics::Gauge("rd_receive_queue_depth", "Sockets with received data waiting to be processed");
+	}
+}
 
 RemoteDesktop::NetworkProcessor::NetworkProcessor(Delegate<void, Packet_Header*, const char*, std::shared_ptr<SocketHandler>&>& receive_callback, Delegate<void, std::shared_ptr<SocketHandler>&>& onconnect_callback):
 _Receive_callback(receive_callback), _Onconnect_callback(onconnect_callback) {
@@ -24,12 +31,21 @@ void RemoteDesktop::NetworkProcessor::_Run(){
 		
 		if (!DesktopMonitor::Is_InputDesktopSelected()) _DesktopMonitor.Switch_to_Desktop(DesktopMonitor::Desktops::INPUT);
 		auto socket(_Queue.pop());
-		if (socket) RemoteDesktop::SocketHandler::ProcessReceived(socket, _Receive_callback ,_Onconnect_callback);
+		if (socket) {
+			INTERNAL::ReceiveQueueDepth.Add(-1);
+			RemoteDesktop::SocketHandler::ProcessReceived(socket, _Receive_callback, _Onconnect_callback);
+		}
 	}
 	DEBUG_MSG("NetworkProcessor EndRun()");
 }
 
 void RemoteDesktop::NetworkProcessor::Receive(std::shared_ptr<SocketHandler>& h){
 	h->Receive();
+	INTERNAL::ReceiveQueueDepth.Add();
+	_Queue.push(h);
+}
+void RemoteDesktop::NetworkProcessor::Receive(std::shared_ptr<SocketHandler>& h, const char* data, int len){
+	h->Receive(data, len);
+	INTERNAL::ReceiveQueueDepth.Add();
 	_Queue.push(h);
 }
\ No newline at end of file
@@ -25,6 +25,8 @@ namespace RemoteDesktop{
 		~NetworkProcessor();
 
 		void Receive(std::shared_ptr<SocketHandler>& h);
+		//for a connection carried by another, data is what arrived for it
+		void Receive(std::shared_ptr<SocketHandler>& h, const char* data, int len);
 
 	};
 
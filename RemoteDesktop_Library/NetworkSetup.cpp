@@ -1,5 +1,6 @@
 #include "stdafx.h"
 #include "NetworkSetup.h"
+#include "Profiler.h"
 #include <thread>
 #include <Iphlpapi.h>
 #include "Handle_Wrapper.h"
@@ -7,6 +8,7 @@
 #include "Firewall.h"
 #include "SocketHandler.h"
 #include "Config.h"
+#include <algorithm>
 
 bool RemoteDesktop::_INTERNAL::NetworkStarted = false;
 
@@ -84,6 +86,13 @@ void RemoteDesktop::StandardSocketSetup(SOCKET socket){
 		DEBUG_MSG("failed to sent TCP_NODELY with error = %", errmsg);
 	}
 }
+void RemoteDesktop::Refuse(SOCKET socket){
+	linger l;
+	l.l_onoff = 1;
+	l.l_linger = 0;
+	setsockopt(socket, SOL_SOCKET, SO_LINGER, (char*)&l, sizeof(l));
+	closesocket(socket);
+}
 SOCKET RemoteDesktop::Connect(std::wstring port, std::wstring host){
 	if (!StartupNetwork()) return INVALID_SOCKET;
 	std::chrono::milliseconds dura(1000);
@@ -231,6 +240,7 @@ std::string RemoteDesktop::GetIP(){
 	return ipaddr;
 }
 RemoteDesktop::Network_Return RemoteDesktop::SendLoop(SOCKET sock, char* data, int len){
+	PROFILE_ZONE("send");
 	auto timer = std::chrono::high_resolution_clock::now();
 	int startlen = len;
 	assert(sock != INVALID_SOCKET);
@@ -273,7 +283,7 @@ RemoteDesktop::Network_Return RemoteDesktop::CheckState(SOCKET sock){
 
 RemoteDesktop::Network_Return RemoteDesktop::ReceiveLoop(SOCKET sock, std::vector<char>& outdata, int& datareceived){
 	assert(sock != INVALID_SOCKET);
-	if (datareceived - outdata.size() < STARTBUFFERSIZE) outdata.resize(outdata.size() + STARTBUFFERSIZE);//grow ahead by chunks
+	if ((size_t)datareceived >= outdata.size()) outdata.resize(std::max(outdata.size() * 2, (size_t)SOCKET_MINBUFFERSIZE));//doubles only while the data keeps coming
 	auto amtrec = recv(sock, outdata.data() + datareceived, outdata.size() - datareceived, 0);//read as much as possible
 	if (amtrec > 0){
 		datareceived += amtrec;
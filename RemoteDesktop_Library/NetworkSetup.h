@@ -18,6 +18,8 @@ namespace RemoteDesktop{
 	SOCKET Connect(std::wstring port, std::wstring host);
 	SOCKET Listen(std::wstring port, std::wstring host, int backlog = 10);
 	void StandardSocketSetup(SOCKET socket);
+	//closes a connection a listener accepted but does not want, with a reset so nothing is left in TIME_WAIT
+	void Refuse(SOCKET socket);
 	std::string GetMAC();
 	std::string GetIP();
 	RemoteDesktop::Network_Return SendLoop(SOCKET sock, char* data, int len);
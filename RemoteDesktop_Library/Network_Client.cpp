@@ -6,6 +6,8 @@
 #include "NetworkProcessor.h"
 #include <chrono>
 #include "Desktop_Monitor.h"
+#include "Timer_Wheel.h"
+#include <random>
 
 RemoteDesktop::Network_Client::Network_Client(){
 	_DesktopMonitor = std::make_unique<DesktopMonitor>();
@@ -28,21 +30,24 @@ void RemoteDesktop::Network_Client::Start(std::wstring port, std::wstring host,
 	Setup(port, host);
 	_BackgroundWorker = std::thread(&RemoteDesktop::Network_Client::_Run_Standard, this, id, aeskey);
 }
-void RemoteDesktop::Network_Client::Start(std::wstring port, std::wstring host, std::wstring gatewayurl){
+void RemoteDesktop::Network_Client::Start(std::wstring port, std::wstring host, std::wstring gatewayurl, bool broadcast){
 	Stop(true);//ensure threads have been stopped
 	Setup(port, host);
+	_Broadcast = broadcast;
 	_BackgroundWorker = std::thread(&RemoteDesktop::Network_Client::_Run_Gateway, this, gatewayurl);
 }
 
 void RemoteDesktop::Network_Client::_Run_Gateway(std::wstring gatewayurl){
 	int counter = 0;
+	Gateway_Lease lease(gatewayurl);//the same id for every attempt until it runs out
 
 	while (_Running && ++counter < MaxConnectAttempts){
 		int src_id = -1;
 		std::wstring aeskey;
 		DEBUG_MSG("Connecting to gateway to get id .. .");
-		if (!GetGatewayID_and_Key(src_id, aeskey, gatewayurl)){
+		if (!lease.Get(src_id, aeskey)){
 			DEBUG_MSG("Failed to connect to gateway . . ");
+			_Wait_Reconnect(counter);
 			continue;
 		}
 		DEBUG_MSG("Connected to gateway id server . . . %", src_id);
@@ -51,13 +56,19 @@ void RemoteDesktop::Network_Client::_Run_Gateway(std::wstring gatewayurl){
 		if (OnConnectingAttempt) OnConnectingAttempt(counter, MaxConnectAttempts);
 
 		auto sock = RemoteDesktop::Connect(_Dst_Port, _Dst_Host);
-		if (sock == INVALID_SOCKET) continue;
+		if (sock == INVALID_SOCKET){
+			_Wait_Reconnect(counter);
+			continue;
+		}
 		if (OnGatewayConnected) OnGatewayConnected(src_id);
 		counter = 0;//reset timer
 		MaxConnectAttempts = DEFAULTMAXCONNECTATTEMPTS;//set this to a specific value
 
 		std::shared_ptr<SocketHandler> socket(std::make_shared<SocketHandler>(sock, true));
-		socket->Exchange_Keys(-1, src_id, aeskey);
+		socket->Broadcast = _Broadcast;
+		_AESKey = aeskey;
+		socket->Exchange_Keys(_Broadcast ? GATEWAY_BROADCAST : -1, src_id, aeskey);
+		if (OnKeysSent) OnKeysSent(socket);
 		_Run(socket);
 		_HandleDisconnect(socket);
 		_ShouldDisconnect = false;
@@ -70,6 +81,13 @@ void RemoteDesktop::Network_Client::_Run_Gateway(std::wstring gatewayurl){
 }
 
 
+void RemoteDesktop::Network_Client::_Wait_Reconnect(int attempt){
+	std::mt19937 mt(std::random_device{}());
+	auto delay = std::min((long long)RECONNECT_BASEDELAY << std::min(std::max(attempt - 1, 0), 16), (long long)RECONNECT_MAXDELAY);
+	delay = delay / 2 + std::uniform_int_distribution<long long>(0, delay / 2)(mt);
+	auto until = Timer_Wheel::Now() + delay;
+	while (_Running && Timer_Wheel::Now() < until) std::this_thread::sleep_for(std::chrono::milliseconds(50));//Stop should not wait out the whole delay
+}
 void RemoteDesktop::Network_Client::_HandleConnect(std::shared_ptr<SocketHandler>& s){
 	if (_Running && OnConnected) OnConnected(s);
 	
@@ -82,9 +100,11 @@ void RemoteDesktop::Network_Client::_HandleDisconnect(std::shared_ptr<SocketHand
 		if (!DesktopMonitor::Is_InputDesktopSelected()) _DesktopMonitor->Switch_to_Desktop(DesktopMonitor::Desktops::INPUT);
 		OnDisconnect(s);
 	}
+	if (s && s->Spectator != 0) return;//the broadcast goes on without it
 	_ShouldDisconnect = true;
 }
 void RemoteDesktop::Network_Client::_HandleReceive(Packet_Header* p, const char* d, std::shared_ptr<SocketHandler>& s){
+	if (s->Spectator != 0 && p->Packet_Type != NetworkMessages::CONNECT_REQUEST) return;//a spectator only ever asks to watch, input that got through before the gateway heard the answer is dropped
 	if (_Running && OnReceived) OnReceived(p, d, s);
 }
 
@@ -95,13 +115,18 @@ void RemoteDesktop::Network_Client::_Run_Standard(int dst_id, std::wstring aeske
 		if (OnConnectingAttempt) OnConnectingAttempt(counter, MaxConnectAttempts);
 		DEBUG_MSG("Connecting to server . . . %", dst_id);
 		auto sock = RemoteDesktop::Connect(_Dst_Port, _Dst_Host);
-		if (sock == INVALID_SOCKET) continue;
+		if (sock == INVALID_SOCKET){
+			_Wait_Reconnect(counter);
+			continue;
+		}
 		counter = 0;//reset timer
 
 		MaxConnectAttempts = DEFAULTMAXCONNECTATTEMPTS;//set this to a specific value
 		std::shared_ptr<SocketHandler> socket(std::make_shared<SocketHandler>(sock, true));
 		socket->Exchange_Keys(dst_id, -1, aeskey);
+		if (OnKeysSent) OnKeysSent(socket);
 		_Run(socket);
+		_HandleDisconnect(socket);//same as the gateway path, a dropped connection is reported before reconnecting
 		_ShouldDisconnect = false;
 	}
 	std::shared_ptr<SocketHandler> emptysocket;
@@ -119,7 +144,10 @@ void RemoteDesktop::Network_Client::_Run(std::shared_ptr<SocketHandler>& socket)
 	NetworkProcessor processor(DELEGATE(&RemoteDesktop::Network_Client::_HandleReceive), DELEGATE(&RemoteDesktop::Network_Client::_HandleConnect));
 	WSANETWORKEVENTS NetworkEvents;
 	DEBUG_MSG("Starting Loop");
-	auto timer = std::chrono::high_resolution_clock::now();
+	Connection_Timers<SocketHandler> timers(Timer_Wheel::Now());
+	timers.Add(socket, Timer_Wheel::Now() + KEEPALIVE_INTERVAL);
+	auto dropped = false;
+	Broadcast_Frame frame;
 	while (_Running && !_ShouldDisconnect) {
 
 		auto Index = WaitForSingleObject(newevent.get(), 1000);
@@ -129,23 +157,103 @@ void RemoteDesktop::Network_Client::_Run(std::shared_ptr<SocketHandler>& socket)
 			WSAEnumNetworkEvents(socket->get_Socket(), newevent.get(), &NetworkEvents);
 			if (((NetworkEvents.lNetworkEvents & FD_READ) == FD_READ)
 				&& NetworkEvents.iErrorCode[FD_READ_BIT] == ERROR_SUCCESS){
-				processor.Receive(socket);
+				if (!_Broadcast) processor.Receive(socket);
+				else if (_Read_Broadcast(socket, frame, processor) == Network_Return::FAILED) break;
 			}
 			else if (((NetworkEvents.lNetworkEvents & FD_CLOSE) == FD_CLOSE) && NetworkEvents.iErrorCode[FD_CLOSE_BIT] == ERROR_SUCCESS){
 				break;// get out of loop and try reconnecting
 			}
 		}
-		if (std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - timer).count() > 1000){
-			if (RemoteDesktop::SocketHandler::CheckState(socket) == RemoteDesktop::Network_Return::FAILED) {
-				break;// get out of the loop and try reconnecting
-			}
-			timer = std::chrono::high_resolution_clock::now();
-		}
-
+		timers.Advance(Timer_Wheel::Now(), [&dropped](std::shared_ptr<SocketHandler>& s, long long now){
+			auto next = RemoteDesktop::SocketHandler::Keepalive(s, now);
+			dropped = next == 0;
+			return next;
+		});
+		if (dropped) break;// get out of the loop and try reconnecting
+		if (_Broadcast) _Answer_Spectators(socket);
 	}
 	socket->Disconnect();
+	_Close_Spectators();
 	DEBUG_MSG("Ending Loop");
 }
+RemoteDesktop::Network_Return RemoteDesktop::Network_Client::_Read_Broadcast(std::shared_ptr<SocketHandler>& socket, Broadcast_Frame& frame, NetworkProcessor& processor){
+	while (true){//until the socket is empty, that rearms FD_READ
+		auto amtrec = 0;
+		if (frame.HeaderCount < sizeof(frame.Header)) amtrec = recv(socket->get_Socket(), (char*)&frame.Header + frame.HeaderCount, (int)(sizeof(frame.Header) - frame.HeaderCount), 0);
+		else amtrec = recv(socket->get_Socket(), frame.Body.data() + frame.BodyCount, (int)(frame.Body.size() - frame.BodyCount), 0);
+		if (amtrec == 0) return socket->Disconnect();
+		if (amtrec < 0) return WSAGetLastError() == WSAEWOULDBLOCK ? Network_Return::COMPLETED : socket->Disconnect();
+		socket->Last_Received = Timer_Wheel::Now();//the gateway's keepalives count, the viewer in control may be long gone
+		if (frame.HeaderCount < sizeof(frame.Header)){
+			frame.HeaderCount += amtrec;
+			if (frame.HeaderCount < sizeof(frame.Header)) continue;
+			if (frame.Header.Length < 0 || frame.Header.Length >= MAXMESSAGESIZE) return socket->Disconnect();
+			frame.Body.resize(frame.Header.Length);
+			frame.BodyCount = 0;
+		}
+		else frame.BodyCount += amtrec;
+		if (frame.BodyCount < frame.Body.size()) continue;
+		_Broadcast_Frame(frame.Header, frame.Body, socket, processor);
+		frame.HeaderCount = 0;
+	}
+}
+void RemoteDesktop::Network_Client::_Broadcast_Frame(const Broadcast_Header& h, std::vector<char>& body, std::shared_ptr<SocketHandler>& socket, NetworkProcessor& processor){
+	switch (h.Type){
+	case BROADCAST_DATA:
+		if (!body.empty()) processor.Receive(socket, body.data(), (int)body.size());
+		break;
+	case BROADCAST_SPECTATOR:{
+		if (body.empty()) break;
+		auto& s = _Spectators[h.Slot];
+		if (!s.Socket){
+			s.Socket = std::make_shared<SocketHandler>(INVALID_SOCKET, true);
+			s.Socket->Spectator = h.Slot;
+			s.Socket->Transport = [](char* data, int len){ return Network_Return::COMPLETED; };//it gets the stream from the gateway, nothing is sent to it alone
+			s.Socket->Exchange_Keys(-1, -1, _AESKey);//same key as every viewer of the id, so its connect request can be read
+			DEBUG_MSG("Spectator % is asking to watch", h.Slot);
+		}
+		if (!s.Allowed && !s.Denied) processor.Receive(s.Socket, body.data(), (int)body.size());
+		break;
+	}
+	case BROADCAST_LEFT:{
+		auto found = _Spectators.find(h.Slot);
+		if (found == _Spectators.end()) break;
+		auto s = found->second;
+		_Spectators.erase(found);
+		if (s.Denied) break;//already reported
+		s.Socket->Disconnect();
+		_HandleDisconnect(s.Socket);
+		break;
+	}
+	default://BROADCAST_KEEPALIVE, receiving it was the point
+		break;
+	}
+}
+void RemoteDesktop::Network_Client::_Answer_Spectators(std::shared_ptr<SocketHandler>& socket){
+	for (auto& a : _Spectators){
+		auto& s = a.second;
+		if (s.Denied) continue;
+		if (s.Socket->get_State() == PEER_STATE_DISCONNECTED){//denied, or dropped after it was allowed
+			s.Denied = true;
+			socket->Send_Gateway(BROADCAST_DENY, a.first);
+			_HandleDisconnect(s.Socket);
+		}
+		else if (!s.Allowed && s.Socket->Authorized){
+			s.Allowed = true;
+			socket->Send_Gateway(BROADCAST_ALLOW, a.first);
+			DEBUG_MSG("Spectator % may watch", a.first);
+		}
+	}
+}
+void RemoteDesktop::Network_Client::_Close_Spectators(){
+	std::unordered_map<int, Spectator> spectators;
+	spectators.swap(_Spectators);
+	for (auto& a : spectators){
+		if (a.second.Denied) continue;
+		a.second.Socket->Disconnect();
+		_HandleDisconnect(a.second.Socket);
+	}
+}
 
 RemoteDesktop::Network_Return RemoteDesktop::Network_Client::Send(RemoteDesktop::NetworkMessages m, const RemoteDesktop::NetworkMsg& msg, Auth_Types to_which_type){
 	std::shared_ptr<SocketHandler> s(_Socket.lock());
@@ -156,6 +264,11 @@ RemoteDesktop::Network_Return RemoteDesktop::Network_Client::Send(RemoteDesktop:
 	}
 	return RemoteDesktop::Network_Return::FAILED;//indicate failure
 }
+RemoteDesktop::Network_Return RemoteDesktop::Network_Client::Send_Refresh(RemoteDesktop::NetworkMessages m, const RemoteDesktop::NetworkMsg& msg){
+	std::shared_ptr<SocketHandler> s(_Socket.lock());
+	if (!s || !s->Authorized) return RemoteDesktop::Network_Return::FAILED;
+	return s->Send_Refresh(m, msg);
+}
 void RemoteDesktop::Network_Client::Stop(bool blocking) {
 	_Running = false;
 	_ShouldDisconnect = true;	
@@ -3,14 +3,32 @@
 #include "INetwork.h"
 #include <memory>
 #include <thread>
+#include <vector>
+#include <unordered_map>
+
+#define RECONNECT_BASEDELAY 250 //ms waited after the first failed attempt, doubled for every one after it
+#define RECONNECT_MAXDELAY 4000
 
 namespace RemoteDesktop{
 	class SocketHandler;
 	class DesktopMonitor;
-
+	class NetworkProcessor;
+	//a broadcast is framed with Broadcast_Header both ways, see Gateway_Broadcast for the gateway's side. The viewer in control talks to the SocketHandler of the connection, every spectator gets a SocketHandler without a socket that goes through OnConnected and OnReceived like any viewer so it has to be allowed the same way. The gateway holds back the stream from a spectator until it hears that it was
 	class Network_Client : public INetwork{
+		struct Broadcast_Frame{
+			Broadcast_Header Header;
+			size_t HeaderCount = 0;
+			std::vector<char> Body;
+			size_t BodyCount = 0;
+		};
+		struct Spectator{
+			std::shared_ptr<SocketHandler> Socket;
+			bool Allowed = false;
+			bool Denied = false;//or dropped here, kept until the gateway says it left so nothing it still sent starts a new request
+		};
 
 		bool _ShouldDisconnect = false;
+		bool _Broadcast = false;
 		void _Run_Standard(int dst_id, std::wstring aeskey); 
 		void _Run_Gateway(std::wstring gatewayurl);
 		void _Run(std::shared_ptr<SocketHandler>& socket);
@@ -18,8 +36,17 @@ namespace RemoteDesktop{
 		std::thread _BackgroundWorker;
 		int MaxConnectAttempts = DEFAULTMAXCONNECTATTEMPTS;
 		void Setup(std::wstring port, std::wstring host);
+		//backs off before the next connect attempt, spread out so a crowd of clients that lost the same gateway do not all come back in the same instant
+		void _Wait_Reconnect(int attempt);
 
 		std::weak_ptr<SocketHandler> _Socket;
+		std::wstring _AESKey;//of the gateway session, the spectators of a broadcast use it too
+		std::unordered_map<int, Spectator> _Spectators;//by the gateway's id, only touched by the thread in _Run
+		Network_Return _Read_Broadcast(std::shared_ptr<SocketHandler>& socket, Broadcast_Frame& frame, NetworkProcessor& processor);
+		void _Broadcast_Frame(const Broadcast_Header& h, std::vector<char>& body, std::shared_ptr<SocketHandler>& socket, NetworkProcessor& processor);
+		//passes on to the gateway what the Server decided for each spectator
+		void _Answer_Spectators(std::shared_ptr<SocketHandler>& socket);
+		void _Close_Spectators();
 		std::unique_ptr<DesktopMonitor> _DesktopMonitor;
 
 		void _HandleViewerDisconnect(std::weak_ptr<SocketHandler>& ptr);
@@ -34,15 +61,20 @@ namespace RemoteDesktop{
 		virtual ~Network_Client();	
 		virtual void Start(std::wstring port, std::wstring host) override;
 		void Start(std::wstring port, std::wstring host, int id, std::wstring aeskey);
-		void Start(std::wstring port, std::wstring host, std::wstring gatewayurl);
+		//broadcast lets every viewer of the gateway id watch, only the first one to connect controls the machine
+		void Start(std::wstring port, std::wstring host, std::wstring gatewayurl, bool broadcast = false);
 
 		virtual void Stop(bool blocking = false)override;
 		virtual void Set_RetryAttempts(int num_of_retry)override { MaxConnectAttempts = num_of_retry; }
 		virtual int Get_RetryAttempts(int num_of_retry) const override { return MaxConnectAttempts; }
 		virtual RemoteDesktop::Network_Return Send(RemoteDesktop::NetworkMessages m, const RemoteDesktop::NetworkMsg& msg, Auth_Types to_which_type) override;
 		virtual int Connection_Count() const override { return 1; }
+		//for a broadcast, see SocketHandler::Send_Refresh. Nothing is sent before the viewer in control was allowed
+		RemoteDesktop::Network_Return Send_Refresh(RemoteDesktop::NetworkMessages m, const RemoteDesktop::NetworkMsg& msg);
 
 		std::function<void(int)> OnGatewayConnected;
+		//right after this side sent its keys, before the peer answered. Whatever is sent here with SocketHandler::Send_Early goes out in the same flight
+		std::function<void(std::shared_ptr<SocketHandler>&)> OnKeysSent;
 	};
 
 }
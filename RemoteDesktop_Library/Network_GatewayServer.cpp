@@ -2,46 +2,88 @@
 #include "Network_GatewayServer.h"
 #include "NetworkSetup.h"
 #include "Gateway_Socket.h"
+#include "PacketBufferPool.h"
+#include "Gateway_Shard.h"
+#include "Gateway_Matchmaker.h"
+#include "Gateway_Broadcast.h"
+#include "Gateway_Mux.h"
+#include "Encryption.h"
+#include "Metrics.h"
+#include "Metrics_Server.h"
+#include "Timer_Wheel.h"
+#include "Admission_Control.h"
+#include <algorithm>
 
-RemoteDesktop::GatewayServer::GatewayServer(void(__stdcall * onconnect)(), void(__stdcall * ondisconnect)()): _OnConnect(onconnect), _OnDisconnect(ondisconnect) {
+namespace RemoteDesktop{
+	namespace INTERNAL{
+		Metrics::Value& GatewayConnections = Metrics::Gauge("rd_gateway_connections", "Sockets connected to the gateway");
+		Metrics::Value& GatewayAccepted = Metrics::Counter("rd_gateway_accepted_total", "Connections accepted by the gateway");
+		Metrics::Value& GatewaySessions = Metrics::Gauge("rd_gateway_sessions", "Viewer and server pairs the gateway is relaying");
+		Metrics::Value& GatewayRejected = Metrics::Counter("rd_gateway_rejected_total", "Connections dropped because they came too fast, their header was bad, a newer connection took their id or no shard had room");
+		Metrics::Value& GatewayExpired = Metrics::Counter("rd_gateway_expired_total", "Connections dropped because their peer did not show up in time");
+		Metrics::Value& GatewaySpectators = Metrics::Gauge("rd_gateway_spectators", "Viewers watching a broadcast they do not control");
+	}
+}
+
+RemoteDesktop::GatewayServer::GatewayServer(void(__stdcall * onconnect)(), void(__stdcall * ondisconnect)()): _OnConnect(onconnect), _OnDisconnect(ondisconnect),
+_Pool(std::make_unique<PacketBufferPool>(RELAY_CHUNKSIZE, RELAY_POOLSIZE)), _Matchmaker(std::make_unique<Gateway_Matchmaker>(Timer_Wheel::Now())), _Connections(0) {
 
 }
 RemoteDesktop::GatewayServer::~GatewayServer(){
 	Stop(true);
+	_Metrics_Server = nullptr;
+}
+void RemoteDesktop::GatewayServer::Start_Metrics(std::wstring port){
+	_Metrics_Server = std::make_unique<Metrics_Server>();
+	_Metrics_Server->Start(port);
 }
 
-void RemoteDesktop::GatewayServer::Start(std::wstring port, std::wstring host){
+void RemoteDesktop::GatewayServer::Start(std::wstring port, std::wstring host, int shards){
 	Stop(true);//ensure threads have been stopped
 	_Host = host;
 	_Port = port;
+	if (shards <= 0) shards = (int)std::thread::hardware_concurrency();
+	shards = std::min(std::max(shards, 1), GATEWAY_MAXSHARDS);
+	_Shards.clear();
+	for (auto i = 0; i < shards; i++){
+		_Shards.emplace_back(std::make_unique<Gateway_Shard>(_OnDisconnect));
+		_Shards.back()->Start();
+	}
 	_Running = true;
 	_BackgroundWorker = std::thread(&RemoteDesktop::GatewayServer::_Run, this);
 }
 void RemoteDesktop::GatewayServer::Stop(bool blocking){
 	_Running = false;
 	BEGINTRY
-		if (std::this_thread::get_id() != _BackgroundWorker.get_id() && _BackgroundWorker.joinable() && blocking)_BackgroundWorker.join();
+		if (std::this_thread::get_id() != _BackgroundWorker.get_id() && _BackgroundWorker.joinable() && blocking) _BackgroundWorker.join();//_Run stops and joins the shards on its way out
 	ENDTRY
 }
 
-void _HandleNewConnect(SOCKET sock, std::vector<WSAEVENT>& eventarray, std::vector<std::shared_ptr<RemoteDesktop::Gateway_Socket>>& socketarray){
+void _HandleNewConnect(SOCKET sock, std::vector<WSAEVENT>& eventarray, std::vector<std::shared_ptr<RemoteDesktop::Gateway_Socket>>& socketarray, RemoteDesktop::PacketBufferPool* pool, RemoteDesktop::Connection_Timers<RemoteDesktop::Gateway_Socket>& timers, RemoteDesktop::Admission_Control& admission){
 	DEBUG_MSG("BaseServer OnConnect Called");
 	int sockaddrlen = sizeof(sockaddr_in);
 	sockaddr_in addr;
 	auto connectsocket = accept(sock, (sockaddr*)&addr, &sockaddrlen);
 	if (connectsocket == INVALID_SOCKET) return;
+	//everything in the wait set besides the listen socket is still sending its header
+	if (admission.Admit(addr.sin_addr.s_addr, (int)socketarray.size() - 1, RemoteDesktop::Timer_Wheel::Now()) != RemoteDesktop::Admission_Control::ADMITTED){
+		RemoteDesktop::Refuse(connectsocket);
+		RemoteDesktop::INTERNAL::GatewayRejected.Add();
+		return;
+	}
 	auto newevent = WSACreateEvent();
 	if (newevent == WSA_INVALID_EVENT){
 		closesocket(connectsocket);
 		return;
 	}
-	//set socket to non blocking
-	u_long iMode = 1;
-	ioctlsocket(connectsocket, FIONBIO, &iMode);
+	RemoteDesktop::StandardSocketSetup(connectsocket);//non blocking and no delay, relayed data should not sit in the gateway
 	WSAEventSelect(connectsocket, newevent, FD_READ | FD_CLOSE);
 
-	socketarray.push_back(std::make_shared<RemoteDesktop::Gateway_Socket>(connectsocket));
+	socketarray.push_back(std::make_shared<RemoteDesktop::Gateway_Socket>(connectsocket, pool));
 	eventarray.push_back(newevent);
+	timers.Add(socketarray.back(), RemoteDesktop::Timer_Wheel::Now() + GATEWAY_HEADER_TIMEOUT);
+	RemoteDesktop::INTERNAL::GatewayAccepted.Add();
+	RemoteDesktop::INTERNAL::GatewayConnections.Add();
 	DEBUG_MSG("BaseServer OnConnect End");
 }
 
@@ -53,74 +95,286 @@ void RemoteDesktop::GatewayServer::_Run(){
 	socketarray.reserve(WSA_MAXIMUM_WAIT_EVENTS);
 
 	SOCKET listensocket = RemoteDesktop::Listen(_Port, _Host);
-	if (listensocket == INVALID_SOCKET) return;
+	if (listensocket == INVALID_SOCKET) {
+		DEBUG_MSG("GatewayServer could not listen on %", ws2s(_Port));
+		_Running = false;
+		for (auto& a : _Shards) a->Stop();
+		return;
+	}
 
 	auto newevent = WSACreateEvent();
 	WSAEventSelect(listensocket, newevent, FD_ACCEPT | FD_CLOSE);
 
 	EventArray.push_back(newevent);
-	socketarray.push_back(std::make_shared<Gateway_Socket>(listensocket));
+	socketarray.push_back(std::make_shared<Gateway_Socket>(listensocket, _Pool.get()));
 
 	WSANETWORKEVENTS NetworkEvents;
-	auto timer = std::chrono::high_resolution_clock::now();
+	Connection_Timers<Gateway_Socket> timers(Timer_Wheel::Now());
+	Admission_Control admission(Timer_Wheel::Now(), GATEWAY_ADMISSION_SOURCE_RATE, GATEWAY_ADMISSION_SOURCE_BURST, GATEWAY_ADMISSION_GLOBAL_RATE, GATEWAY_ADMISSION_GLOBAL_BURST, WSA_MAXIMUM_WAIT_EVENTS - 2);
+	auto expire = Timer_Wheel::Now();
 	while (_Running && !EventArray.empty()) {
 
 		auto Index = WSAWaitForMultipleEvents(EventArray.size(), EventArray.data(), FALSE, 1000, FALSE);
 
 		if ((Index != WSA_WAIT_FAILED) && (Index != WSA_WAIT_TIMEOUT) && _Running) {
-
-			WSAEnumNetworkEvents(socketarray[Index]->ThisSocket->socket, EventArray[Index], &NetworkEvents);
-			if (((NetworkEvents.lNetworkEvents & FD_ACCEPT) == FD_ACCEPT) && NetworkEvents.iErrorCode[FD_ACCEPT_BIT] == ERROR_SUCCESS){
-				if (EventArray.size() >= WSA_MAXIMUM_WAIT_EVENTS - 1) continue;// ignore this event too many connections
-				_HandleNewConnect(listensocket, EventArray, socketarray);
-			}
-			else if (((NetworkEvents.lNetworkEvents & FD_READ) == FD_READ) && NetworkEvents.iErrorCode[FD_READ_BIT] == ERROR_SUCCESS){
-				socketarray[Index]->Receive();
-			}
-			else if (((NetworkEvents.lNetworkEvents & FD_CLOSE) == FD_CLOSE) && NetworkEvents.iErrorCode[FD_CLOSE_BIT] == ERROR_SUCCESS){
-				if (Index == 0) {//stop all processing, set running to false and next loop will fail and cleanup
+			auto s = socketarray[Index];
+			WSAEnumNetworkEvents(s->get_Socket(), EventArray[Index], &NetworkEvents);
+			if (Index == 0){
+				if (((NetworkEvents.lNetworkEvents & FD_ACCEPT) == FD_ACCEPT) && NetworkEvents.iErrorCode[FD_ACCEPT_BIT] == ERROR_SUCCESS){
+					_HandleNewConnect(listensocket, EventArray, socketarray, _Pool.get(), timers, admission);
+					_Count(socketarray);
+				}
+				else if ((NetworkEvents.lNetworkEvents & FD_CLOSE) == FD_CLOSE){//stop all processing, set running to false and next loop will fail and cleanup
 					_Running = false;
 					continue;
 				}
 			}
+			else {
+				if ((NetworkEvents.lNetworkEvents & FD_CLOSE) == FD_CLOSE) s->Disconnect();
+				else if (((NetworkEvents.lNetworkEvents & FD_READ) == FD_READ) && s->Type == Gateway_Socket::UNKNOWN){
+					if (s->Read_Header() == Network_Return::COMPLETED) _HandleConnect(s);
+				}
+				//a parked socket keeps its data in the kernel until the pairing
+				_Remove(EventArray, socketarray);
+			}
 		}
-		//once every second send a keep alive. this will trigger disconnects 
-		if (std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - timer).count() > 1000){
-			_CheckForDisconnects(EventArray, socketarray);
-			timer = std::chrono::high_resolution_clock::now();
+		auto now = Timer_Wheel::Now();
+		auto timedout = false;
+		timers.Advance(now, [&timedout](std::shared_ptr<Gateway_Socket>& s, long long now){
+			if (s->Type == Gateway_Socket::UNKNOWN && !s->Is_Disconnected()){//still no header, most likely nothing is ever coming
+				s->Disconnect();
+				timedout = true;
+			}
+			return 0;
+		});
+		if (timedout) _Remove(EventArray, socketarray);
+		//once every second drop the peers that waited too long
+		if (now - expire >= 1000){
+			_Expire(now);
+			admission.Expire(now);
+			expire = now;
 		}
 	}
-	for (size_t beg = 1; beg < socketarray.size(); beg++){
-		//OnDisconnect(sharedrockarray->at(beg));//let all callers know about the disconnect, skip slot 0 which is the listen socket
-	}
+	RemoteDesktop::INTERNAL::GatewayConnections.Add(-(long long)(socketarray.size() - 1));
+	socketarray.clear();
+	std::vector<std::shared_ptr<Gateway_Socket>> parked;
+	_Matchmaker->Clear(parked);
+	RemoteDesktop::INTERNAL::GatewayConnections.Add(-(long long)parked.size());
+	_Broadcasts.clear();
+	_Multiplexers.clear();
+	_Count(socketarray);
 	//cleanup code here
 	for (auto x : EventArray) WSACloseEvent(x);
+	for (auto& a : _Shards) a->Stop();//however the loop ended, nothing is relayed once the accepting thread is gone
 	DEBUG_MSG("_Listen Exiting");
 }
 void RemoteDesktop::GatewayServer::_HandleConnect(std::shared_ptr<Gateway_Socket>& ptr){
-
+	auto id = ptr->Type == Gateway_Socket::SERVER ? ptr->Src_ID : ptr->Dst_ID;
+	//from here on this thread stops watching the socket, do it before a shard can associate its own event
+	WSAEventSelect(ptr->get_Socket(), NULL, 0);
+	if (ptr->Type == Gateway_Socket::VIEWER){
+		auto found = _Broadcasts.find(id);
+		if (found != _Broadcasts.end()){
+			if (!found->second->Is_Closed()) return _Spectate(ptr, found->second);
+			_Broadcasts.erase(found);
+		}
+		auto mux = _Multiplexers.find(id);
+		if (mux != _Multiplexers.end()){
+			if (!mux->second->Is_Closed()){
+				if (_Open_Stream(ptr, mux->second)) return;
+				DEBUG_MSG("GatewayServer the multiplexing server of id % has no room, dropping a viewer", id);
+				INTERNAL::GatewayRejected.Add();
+				ptr->Disconnect();//still in the wait set, _Remove counts it
+				return;
+			}
+			_Multiplexers.erase(mux);
+		}
+	}
+	else if (ptr->Is_Multiplexer()) return _Multiplex(ptr, id);
+	std::shared_ptr<Gateway_Socket> other;
+	while (true){
+		std::shared_ptr<Gateway_Socket> replaced;
+		auto result = _Matchmaker->Match(ptr, Timer_Wheel::Now(), other, replaced);
+		if (replaced){//most likely the same side reconnecting after its old connection died while parked
+			DEBUG_MSG("GatewayServer replaced the connection waiting with id %", id);
+			INTERNAL::GatewayRejected.Add();
+			_Drop(replaced);
+		}
+		if (result == Gateway_Matchmaker::PARKED) return;
+		//nothing watches a parked socket, make sure it is still there before pairing with it
+		if (RemoteDesktop::CheckState(other->get_Socket()) != RemoteDesktop::Network_Return::FAILED) break;
+		_Drop(other);
+	}
+	Gateway_Shard* shard = nullptr;
+	for (auto& a : _Shards){
+		if (!shard || a->get_Sessions() < shard->get_Sessions()) shard = a.get();
+	}
+	ptr->Paired_Socket = other;
+	other->Paired_Socket = ptr;
+	_Apply_Limits(id, *ptr, *other);
+	auto& server = ptr->Type == Gateway_Socket::SERVER ? ptr : other;
+	auto& viewer = ptr->Type == Gateway_Socket::SERVER ? other : ptr;
+	if (server->Is_Broadcaster()){//the viewers get the server's header from the broadcast along with its key exchange, the server gets the viewer's in front of the first bytes it sends
+		auto broadcast = std::make_shared<Gateway_Broadcast>(*server, Encryption::get_KeyExchangeLength());
+		server->Broadcast = viewer->Broadcast = broadcast;
+		server->Last_Received = viewer->Last_Received = Timer_Wheel::Now();
+		_Broadcasts[id] = broadcast;
+	}
+	else {
+		server->Pair();
+		viewer->Pair();
+	}
+	if (!shard || !shard->Add(ptr, other)){
+		DEBUG_MSG("GatewayServer every shard is full, dropping id %", id);
+		INTERNAL::GatewayRejected.Add(2);
+		_Broadcasts.erase(id);
+		ptr->Disconnect();//still in the wait set, _Remove counts it
+		_Drop(other);
+		return;
+	}
+	DEBUG_MSG("GatewayServer paired id %", id);
+	INTERNAL::GatewaySessions.Add();
+	if (_OnConnect) _OnConnect();
 }
-void RemoteDesktop::GatewayServer::_HandleDisconnect(std::shared_ptr<Gateway_Socket>& ptr){
-	
+//the viewer only watches, it goes to whichever shard has room and is fed from the broadcast's log there once the server allowed it
+void RemoteDesktop::GatewayServer::_Spectate(std::shared_ptr<Gateway_Socket>& ptr, std::shared_ptr<Gateway_Broadcast>& broadcast){
+	ptr->Type = Gateway_Socket::SPECTATOR;
+	ptr->Broadcast = broadcast;
+	ptr->Spectator = broadcast->Add_Spectator();
+	ptr->Last_Received = Timer_Wheel::Now();
+	Gateway_Shard* shard = nullptr;
+	for (auto& a : _Shards){
+		if (!shard || a->get_Sockets() < shard->get_Sockets()) shard = a.get();
+	}
+	INTERNAL::GatewaySpectators.Add();
+	if (!shard || !shard->Add(ptr)){
+		DEBUG_MSG("GatewayServer every shard is full, dropping a spectator of id %", ptr->Dst_ID);
+		broadcast->Leave(*ptr);
+		INTERNAL::GatewaySpectators.Add(-1);
+		INTERNAL::GatewayRejected.Add();
+		ptr->Disconnect();//still in the wait set, _Remove counts it
+		return;
+	}
+	DEBUG_MSG("GatewayServer spectator joined id %", ptr->Dst_ID);
+}
+//the server is never parked, it waits on a shard for its viewers. A newer connection for the same id takes over, the old one keeps the streams it has until it drops
+void RemoteDesktop::GatewayServer::_Multiplex(std::shared_ptr<Gateway_Socket>& ptr, int id){
+	Gateway_Shard* shard = nullptr;
+	for (auto& a : _Shards){
+		if (!shard || a->get_Sockets() < shard->get_Sockets()) shard = a.get();
+	}
+	auto mux = std::make_shared<Gateway_Mux>(ptr, shard);
+	ptr->Mux = mux;
+	ptr->Weight = GATEWAY_SHARD_SOCKETS;//it relays for every stream it carries
+	ptr->Last_Received = Timer_Wheel::Now();
+	if (!shard || !shard->Add(ptr)){
+		DEBUG_MSG("GatewayServer every shard is full, dropping the multiplexing server of id %", id);
+		INTERNAL::GatewayRejected.Add();
+		ptr->Mux = nullptr;
+		ptr->Disconnect();//still in the wait set, _Remove counts it
+		return;
+	}
+	_Multiplexers[id] = mux;
+	DEBUG_MSG("GatewayServer multiplexing id %", id);
+	//a viewer that came before the server did
+	std::shared_ptr<Gateway_Socket> viewer;
+	if (!_Matchmaker->Take_Viewer(id, viewer)) return;
+	if (RemoteDesktop::CheckState(viewer->get_Socket()) == RemoteDesktop::Network_Return::FAILED || !_Open_Stream(viewer, mux)) _Drop(viewer);
+}
+//the viewer's header goes to the server in the stream's MUX_OPEN, the server answers with its own and the key exchange as if the viewer had its own connection
+bool RemoteDesktop::GatewayServer::_Open_Stream(std::shared_ptr<Gateway_Socket>& ptr, std::shared_ptr<Gateway_Mux>& mux){
+	ptr->Mux = mux;
+	ptr->Stream = mux->Next_Stream();
+	ptr->Last_Received = Timer_Wheel::Now();
+	_Apply_Limits(ptr->Dst_ID, *ptr, *ptr);
+	if (!mux->get_Shard()->Add(ptr)){
+		ptr->Mux = nullptr;
+		return false;
+	}
+	DEBUG_MSG("GatewayServer stream % opened for id %", ptr->Stream, ptr->Dst_ID);
+	INTERNAL::GatewaySessions.Add();
+	if (_OnConnect) _OnConnect();
+	return true;
+}
+void RemoteDesktop::GatewayServer::set_Session_Limits(int id, long long rate, int weight){
+	std::lock_guard<std::mutex> lock(_LimitsLock);
+	Session_Limits l;
+	l.Rate = std::max(rate, 0LL);
+	l.Weight = std::max(weight, 1);
+	if (id == -1) _DefaultLimits = l;
+	else _Limits[id] = l;
+}
+void RemoteDesktop::GatewayServer::_Apply_Limits(int id, Gateway_Socket& a, Gateway_Socket& b){
+	std::lock_guard<std::mutex> lock(_LimitsLock);
+	auto found = _Limits.find(id);
+	auto& l = found == _Limits.end() ? _DefaultLimits : found->second;
+	a.Rate = b.Rate = l.Rate;
+	a.Weight = b.Weight = l.Weight;
+}
+//for sockets that already left the wait set
+void RemoteDesktop::GatewayServer::_Drop(std::shared_ptr<Gateway_Socket>& ptr){
+	ptr->Disconnect();
+	ptr->Paired_Socket.reset();
+	ptr = nullptr;
+	INTERNAL::GatewayConnections.Add(-1);
+}
+void RemoteDesktop::GatewayServer::_Count(std::vector<std::shared_ptr<Gateway_Socket>>& socketarray){
+	_Connections = socketarray.empty() ? 0 : (long long)socketarray.size() - 1;
+}
+RemoteDesktop::Gateway_Stats RemoteDesktop::GatewayServer::get_Stats() const{
+	Gateway_Stats s;
+	s.Waiting = _Matchmaker->get_Parked();
+	s.Connections = _Connections + s.Waiting;
+	s.Sessions = 0;
+	s.Relayed = 0;
+	s.Spectators = 0;
+	for (auto& a : _Shards){
+		s.Sessions += a->get_Sessions();
+		s.Relayed += a->get_Relayed();
+		s.Spectators += a->get_Spectators();
+		s.Connections += a->get_Sockets();
+	}
+	return s;
 }
 
-void RemoteDesktop::GatewayServer::_CheckForDisconnects(std::vector<WSAEVENT>& eventarray, std::vector<std::shared_ptr<Gateway_Socket>>& socketarray){
-
+void RemoteDesktop::GatewayServer::_Expire(long long now){
+	std::vector<std::shared_ptr<Gateway_Socket>> expired;
+	_Matchmaker->Expire(now, expired);
+	for (auto& a : expired){
+		DEBUG_MSG("GatewayServer nobody came for id %", a->Type == Gateway_Socket::SERVER ? a->Src_ID : a->Dst_ID);
+		_Drop(a);
+	}
+	INTERNAL::GatewayExpired.Add((long long)expired.size());
+	auto beg = _Broadcasts.begin();
+	while (beg != _Broadcasts.end()){
+		if (beg->second->Is_Closed()) beg = _Broadcasts.erase(beg);
+		else ++beg;
+	}
+	auto mux = _Multiplexers.begin();
+	while (mux != _Multiplexers.end()){
+		if (mux->second->Is_Closed()) mux = _Multiplexers.erase(mux);
+		else ++mux;
+	}
+}
+//drops the sockets that disconnected and lets go of the ones whose header is in, those are parked in the matchmaker or were given to a shard
+void RemoteDesktop::GatewayServer::_Remove(std::vector<WSAEVENT>& eventarray, std::vector<std::shared_ptr<Gateway_Socket>>& socketarray){
 	if (socketarray.size() <= 1) return;
-	auto beg = socketarray.begin() + 1;
-	if (beg >= socketarray.end()) return;
-	while (beg != socketarray.end()){
-		if (RemoteDesktop::CheckState((*beg)->ThisSocket->socket) == RemoteDesktop::Network_Return::FAILED){
-			_HandleDisconnect(*beg);
-			
-			//get the index before deletion
-			int index = beg - socketarray.begin();
-			beg = socketarray.erase(beg);
+	auto removed = false;
+	size_t index = 1;
+	while (index < socketarray.size()){
+		auto disconnected = socketarray[index]->Is_Disconnected();
+		if (disconnected || socketarray[index]->Type != Gateway_Socket::UNKNOWN){
+			//the last socket fills the hole, the order does not matter
 			WSACloseEvent(eventarray[index]);
-			eventarray.erase(eventarray.begin() + index);
+			eventarray[index] = eventarray.back();
+			eventarray.pop_back();
+			socketarray[index] = socketarray.back();
+			socketarray.pop_back();
+			if (disconnected) INTERNAL::GatewayConnections.Add(-1);
+			removed = true;
 			continue;
 		}
-		++beg;
+		++index;
 	}
-
-}
\ No newline at end of file
+	if (removed) _Count(socketarray);
+}
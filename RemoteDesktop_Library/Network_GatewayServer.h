@@ -3,29 +3,85 @@
 #include <string>
 #include <thread>
 #include <memory>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+
+#define RELAY_CHUNKSIZE (64 * 1024)
+#define RELAY_POOLSIZE 64 //free chunks kept around, the pool only grows past this while that much data is stuck in flight
+#define GATEWAY_MAXSHARDS 16
+#define GATEWAY_HEADER_TIMEOUT 10000 //ms a new connection gets to send its Proxy_Header
+#define GATEWAY_ADMISSION_SOURCE_RATE 20 //connections per second from one address, a whole office can sit behind one
+#define GATEWAY_ADMISSION_SOURCE_BURST 100
+#define GATEWAY_ADMISSION_GLOBAL_RATE 1000 //every server comes back at once after the gateway restarts, they retry with a backoff
+#define GATEWAY_ADMISSION_GLOBAL_BURST 2000
 
 namespace RemoteDesktop{
 	class Gateway_Socket;
+	class Metrics_Server;
+	class PacketBufferPool;
+	class Gateway_Shard;
+	class Gateway_Matchmaker;
+	class Gateway_Broadcast;
+	class Gateway_Mux;
+	struct Gateway_Stats{
+		long long Connections;//not counting the listen socket
+		long long Waiting;//sent their header and wait for the other side
+		long long Sessions;//viewer and server pairs, and viewers carried by a multiplexing server
+		long long Relayed;//bytes forwarded in both directions since the server was created
+		long long Spectators;//viewers of a broadcast after its first, counted in Connections but not in Sessions
+	};
+	//pairs viewers with servers by the ids in their Proxy_Header and relays the bytes between them. The thread in _Run accepts connections and reads their headers, then either claims the waiting peer from the Gateway_Matchmaker or parks the connection there. Each pair is handed to the Gateway_Shard with the fewest sessions which relays it on its own thread.
+	//A server that asks for GATEWAY_BROADCAST is paired with its first viewer the same way, every viewer of its id that comes while it is still connected asks the server for permission and then watches through a Gateway_Broadcast on the shard with the fewest sockets.
+	//A server that asks for GATEWAY_MULTIPLEX stays connected and every viewer of its id becomes a stream of its Gateway_Mux, on the shard the server went to. So one server has at most GATEWAY_SHARD_SOCKETS - 1 viewers at once this way, the ones after that are refused.
+	//Every loop uses WSAEventSelect, so the accepting thread reads up to WSA_MAXIMUM_WAIT_EVENTS headers at once, an Admission_Control refuses what comes in faster than that or faster than its buckets allow and each shard holds GATEWAY_SHARD_SOCKETS sockets. Parked connections are not in any wait set, there is no limit on them but one that drops while parked is only noticed when it is claimed or expires. The callbacks are called from whichever thread made or dropped the pair
 	class GatewayServer{
-		std::thread _BackgroundWorker;		
+		std::thread _BackgroundWorker;
 		std::wstring _Host, _Port;
 		void _Run();
-		bool _Running = false; 
-		
+		bool _Running = false;
+
 		void _HandleConnect(std::shared_ptr<Gateway_Socket>& ptr);
-		void _HandleDisconnect(std::shared_ptr<Gateway_Socket>& ptr);
+		void _Drop(std::shared_ptr<Gateway_Socket>& ptr);
+		void _Spectate(std::shared_ptr<Gateway_Socket>& ptr, std::shared_ptr<Gateway_Broadcast>& broadcast);
+		void _Multiplex(std::shared_ptr<Gateway_Socket>& ptr, int id);
+		bool _Open_Stream(std::shared_ptr<Gateway_Socket>& ptr, std::shared_ptr<Gateway_Mux>& mux);
 
 		void(__stdcall * _OnConnect)();
 		void(__stdcall * _OnDisconnect)();
-		void _CheckForDisconnects(std::vector<void*>& eventarray, std::vector<std::shared_ptr<Gateway_Socket>>& socketarray);
+		void _Expire(long long now);
+		void _Remove(std::vector<void*>& eventarray, std::vector<std::shared_ptr<Gateway_Socket>>& socketarray);
+		void _Count(std::vector<std::shared_ptr<Gateway_Socket>>& socketarray);
+		std::unique_ptr<Metrics_Server> _Metrics_Server;
+		std::unique_ptr<PacketBufferPool> _Pool;
+		std::vector<std::unique_ptr<Gateway_Shard>> _Shards;
+		std::unique_ptr<Gateway_Matchmaker> _Matchmaker;
+		std::atomic<long long> _Connections;//still sending their header
+		std::unordered_map<int, std::shared_ptr<Gateway_Broadcast>> _Broadcasts;//by server id, only touched by the accepting thread
+		std::unordered_map<int, std::shared_ptr<Gateway_Mux>> _Multiplexers;//same
+		struct Session_Limits{
+			long long Rate;
+			int Weight;
+		};
+		std::mutex _LimitsLock;
+		std::unordered_map<int, Session_Limits> _Limits;//by server id
+		Session_Limits _DefaultLimits = { 0, 1 };
+		void _Apply_Limits(int id, Gateway_Socket& a, Gateway_Socket& b);
 
 	public:
 		GatewayServer(void(__stdcall * onconnect)(), void(__stdcall * ondisconnect)());
 		~GatewayServer();
 
-		void Start(std::wstring port, std::wstring host);
+		//shards 0 uses one per core
+		void Start(std::wstring port, std::wstring host, int shards = 0);
 		void Stop(bool blocking = false);
+		//serves the process metrics on localhost:port
+		void Start_Metrics(std::wstring port);
+		Gateway_Stats get_Stats() const;
+		//caps what each side of the sessions with this server id may send through the relay in bytes per second, 0 for no cap. The weight is its share of the shard when sessions compete, 1 is the default. id -1 sets the values for every id without its own, changes apply from the next pairing
+		void set_Session_Limits(int id, long long rate, int weight);
 	};
 }
 
-#endif
\ No newline at end of file
+#endif
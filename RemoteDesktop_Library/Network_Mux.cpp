@@ -0,0 +1,320 @@
+#include "stdafx.h"
+#include "Network_Mux.h"
+#include "Network_Client.h"
+#include "NetworkSetup.h"
+#include "SocketHandler.h"
+#include "Gateway.h"
+#include "NetworkProcessor.h"
+#include "Desktop_Monitor.h"
+#include "Timer_Wheel.h"
+#include <chrono>
+#include <random>
+#include <algorithm>
+
+RemoteDesktop::Network_Mux::Network_Mux(){
+	_DesktopMonitor = std::make_unique<DesktopMonitor>();
+}
+RemoteDesktop::Network_Mux::~Network_Mux(){
+	Stop(true);
+}
+void RemoteDesktop::Network_Mux::Start(std::wstring port, std::wstring host, std::wstring gatewayurl){
+	Stop(true);//ensure threads have been stopped
+	_Dst_Host = host;
+	_Dst_Port = port;
+	_Running = true;
+	_BackgroundWorker = std::thread(&RemoteDesktop::Network_Mux::_Run, this, gatewayurl);
+}
+void RemoteDesktop::Network_Mux::Stop(bool blocking){
+	_Running = false;
+	_CreditChanged.notify_all();
+	BEGINTRY
+		if (std::this_thread::get_id() != _BackgroundWorker.get_id() && _BackgroundWorker.joinable() && blocking) _BackgroundWorker.join();
+	ENDTRY
+}
+
+void RemoteDesktop::Network_Mux::_Run(std::wstring gatewayurl){
+	int counter = 0;
+	Gateway_Lease lease(gatewayurl);
+	while (_Running && ++counter < MaxConnectAttempts){
+		int src_id = -1;
+		std::wstring aeskey;
+		DEBUG_MSG("Connecting to gateway to get id .. .");
+		if (!lease.Get(src_id, aeskey)){
+			DEBUG_MSG("Failed to connect to gateway . . ");
+			_Wait_Reconnect(counter);
+			continue;
+		}
+		if (OnConnectingAttempt) OnConnectingAttempt(counter, MaxConnectAttempts);
+		auto sock = RemoteDesktop::Connect(_Dst_Port, _Dst_Host);
+		if (sock == INVALID_SOCKET){
+			_Wait_Reconnect(counter);
+			continue;
+		}
+		Proxy_Header header;
+		header.Dst_Id = GATEWAY_MULTIPLEX;
+		header.Src_Id = src_id;
+		if (SendLoop(sock, (char*)&header, sizeof(header)) == Network_Return::FAILED){
+			closesocket(sock);
+			_Wait_Reconnect(counter);
+			continue;
+		}
+		if (OnGatewayConnected) OnGatewayConnected(src_id);
+		counter = 0;//reset timer
+		MaxConnectAttempts = DEFAULTMAXCONNECTATTEMPTS;
+		{
+			std::lock_guard<std::mutex> lock(_SendLock);
+			_Connection = sock;
+		}
+		_Serve(sock, src_id, aeskey);
+		{
+			std::lock_guard<std::mutex> lock(_SendLock);
+			_Connection = INVALID_SOCKET;
+		}
+		closesocket(sock);
+	}
+	_Running = false;
+	_CreditChanged.notify_all();
+}
+void RemoteDesktop::Network_Mux::_Wait_Reconnect(int attempt){
+	std::mt19937 mt(std::random_device{}());
+	auto delay = std::min((long long)RECONNECT_BASEDELAY << std::min(std::max(attempt - 1, 0), 16), (long long)RECONNECT_MAXDELAY);
+	delay = delay / 2 + std::uniform_int_distribution<long long>(0, delay / 2)(mt);
+	auto until = Timer_Wheel::Now() + delay;
+	while (_Running && Timer_Wheel::Now() < until) std::this_thread::sleep_for(std::chrono::milliseconds(50));
+}
+
+void RemoteDesktop::Network_Mux::_Serve(SOCKET sock, int src_id, std::wstring aeskey){
+	auto newevent(RAIIWSAEVENT(WSACreateEvent()));
+	WSAEventSelect(sock, newevent.get(), FD_CLOSE | FD_READ);
+	NetworkProcessor processor(DELEGATE(&RemoteDesktop::Network_Mux::_HandleReceive), DELEGATE(&RemoteDesktop::Network_Mux::_HandleConnect));
+	Connection_Timers<SocketHandler> timers(Timer_Wheel::Now());
+	WSANETWORKEVENTS NetworkEvents;
+	Mux_Header header;
+	size_t headercount = 0;
+	std::vector<char> body;
+	size_t bodycount = 0;
+	auto lastreceived = Timer_Wheel::Now();
+	auto lastkeepalive = lastreceived;
+	auto dropped = false;
+	while (_Running && !dropped){
+		auto Index = WaitForSingleObject(newevent.get(), 1000);
+		if ((Index != WSA_WAIT_FAILED) && (Index != WSA_WAIT_TIMEOUT)){
+			WSAEnumNetworkEvents(sock, newevent.get(), &NetworkEvents);
+			if ((NetworkEvents.lNetworkEvents & FD_READ) == FD_READ){
+				while (!dropped){//until the socket is empty, that rearms FD_READ
+					auto amtrec = 0;
+					if (headercount < sizeof(header)) amtrec = recv(sock, (char*)&header + headercount, (int)(sizeof(header) - headercount), 0);
+					else amtrec = recv(sock, body.data() + bodycount, (int)(body.size() - bodycount), 0);
+					if (amtrec == 0) dropped = true;
+					if (amtrec <= 0){
+						if (amtrec < 0 && WSAGetLastError() != WSAEWOULDBLOCK) dropped = true;
+						break;
+					}
+					lastreceived = Timer_Wheel::Now();
+					if (headercount < sizeof(header)){
+						headercount += amtrec;
+						if (headercount < sizeof(header)) continue;
+						if (header.Length < 0 || header.Length > MUX_MAXFRAME){
+							dropped = true;
+							break;
+						}
+						body.resize(header.Type == MUX_DATA || header.Type == MUX_OPEN ? header.Length : 0);
+						bodycount = 0;
+					}
+					else bodycount += amtrec;
+					if (bodycount < body.size()) continue;
+					_Frame(header, body, src_id, aeskey, processor, timers);
+					headercount = 0;
+				}
+			}
+			else if ((NetworkEvents.lNetworkEvents & FD_CLOSE) == FD_CLOSE) dropped = true;
+		}
+		auto now = Timer_Wheel::Now();
+		if (now - lastreceived >= IDLE_TIMEOUT){//the gateway answers every keepalive
+			DEBUG_MSG("Nothing received from the gateway for % ms, reconnecting", now - lastreceived);
+			dropped = true;
+		}
+		else if (now - lastkeepalive >= KEEPALIVE_INTERVAL){
+			if (_Send_Frame(0, MUX_KEEPALIVE, nullptr, 0) == Network_Return::FAILED) dropped = true;
+			lastkeepalive = now;
+		}
+		timers.Advance(now, [](std::shared_ptr<SocketHandler>& s, long long now){ return RemoteDesktop::SocketHandler::Keepalive(s, now); });
+		_Reap();
+	}
+	_Close_Streams();
+	DEBUG_MSG("Ending Loop");
+}
+void RemoteDesktop::Network_Mux::_Frame(const Mux_Header& h, std::vector<char>& body, int src_id, const std::wstring& aeskey, NetworkProcessor& processor, Connection_Timers<SocketHandler>& timers){
+	std::shared_ptr<SocketHandler> socket;
+	switch (h.Type){
+	case MUX_OPEN:{//the viewer's Proxy_Header is in body, the answer is the same as on a connection of its own
+		socket = std::make_shared<SocketHandler>(INVALID_SOCKET, true);
+		auto stream = h.Stream;
+		socket->Transport = [this, stream](char* data, int len){ return _Write(stream, data, len); };
+		{
+			std::lock_guard<std::mutex> lock(_StreamsLock);
+			Stream s;
+			s.Socket = socket;
+			_Streams[stream] = s;
+		}
+		DEBUG_MSG("Gateway opened stream %", stream);
+		socket->Exchange_Keys(-1, src_id, aeskey);
+		timers.Add(socket, Timer_Wheel::Now() + KEEPALIVE_INTERVAL);
+		break;
+	}
+	case MUX_DATA:
+		{
+			std::lock_guard<std::mutex> lock(_StreamsLock);
+			auto found = _Streams.find(h.Stream);
+			if (found != _Streams.end()) socket = found->second.Socket;
+		}
+		if (!socket || body.empty()) break;
+		processor.Receive(socket, body.data(), (int)body.size());
+		//what a viewer sends is small, it is granted again as soon as it is queued
+		_Send_Frame(h.Stream, MUX_CREDIT, nullptr, (int)body.size());
+		break;
+	case MUX_CREDIT:
+		{
+			std::lock_guard<std::mutex> lock(_StreamsLock);
+			auto found = _Streams.find(h.Stream);
+			if (found != _Streams.end()){
+				found->second.Credit += h.Length;
+				_Flush(h.Stream, found->second);
+			}
+		}
+		_CreditChanged.notify_all();
+		break;
+	case MUX_CLOSE:
+		{
+			std::lock_guard<std::mutex> lock(_StreamsLock);
+			auto found = _Streams.find(h.Stream);
+			if (found != _Streams.end()){
+				socket = found->second.Socket;
+				_Streams.erase(found);
+			}
+		}
+		_CreditChanged.notify_all();
+		if (!socket) break;
+		socket->Disconnect();
+		_HandleDisconnect(socket);
+		break;
+	default://MUX_KEEPALIVE, receiving it was the point
+		break;
+	}
+}
+void RemoteDesktop::Network_Mux::_Reap(){
+	std::vector<std::pair<int, std::shared_ptr<SocketHandler>>> dropped;
+	{
+		std::lock_guard<std::mutex> lock(_StreamsLock);
+		auto beg = _Streams.begin();
+		while (beg != _Streams.end()){
+			if (beg->second.Socket->get_State() == PEER_STATE_DISCONNECTED){
+				dropped.push_back(std::make_pair(beg->first, beg->second.Socket));
+				beg = _Streams.erase(beg);
+			}
+			else ++beg;
+		}
+	}
+	if (dropped.empty()) return;
+	_CreditChanged.notify_all();
+	for (auto& a : dropped){
+		_Send_Frame(a.first, MUX_CLOSE, nullptr, 0);
+		_HandleDisconnect(a.second);
+	}
+}
+void RemoteDesktop::Network_Mux::_Close_Streams(){
+	std::unordered_map<int, Stream> streams;
+	{
+		std::lock_guard<std::mutex> lock(_StreamsLock);
+		streams.swap(_Streams);
+	}
+	_CreditChanged.notify_all();
+	for (auto& a : streams){
+		a.second.Socket->Disconnect();
+		_HandleDisconnect(a.second.Socket);
+	}
+}
+
+RemoteDesktop::Network_Return RemoteDesktop::Network_Mux::_Send_Frame(int stream, int type, const char* data, int len){
+	Mux_Header h;
+	h.Stream = stream;
+	h.Type = type;
+	h.Length = len;
+	std::lock_guard<std::mutex> lock(_SendLock);
+	if (_Connection == INVALID_SOCKET) return Network_Return::FAILED;
+	auto framelen = sizeof(h) + (data ? len : 0);
+	if (_SendBuffer.size() < framelen) _SendBuffer.resize(framelen);
+	memcpy(_SendBuffer.data(), &h, sizeof(h));
+	if (data) memcpy(_SendBuffer.data() + sizeof(h), data, len);
+	return SendLoop(_Connection, _SendBuffer.data(), (int)framelen);//one send per frame, the header should not go out in a segment of its own
+}
+RemoteDesktop::Network_Return RemoteDesktop::Network_Mux::_Write(int stream, char* data, int len){
+	std::lock_guard<std::mutex> lock(_StreamsLock);
+	auto found = _Streams.find(stream);
+	if (!_Running || found == _Streams.end()) return Network_Return::FAILED;
+	auto& s = found->second;
+	if (s.Sent > 0){//only what is still queued is kept, that is bounded by Send waiting for room
+		s.Queued.erase(s.Queued.begin(), s.Queued.begin() + s.Sent);
+		s.Sent = 0;
+	}
+	s.Queued.insert(s.Queued.end(), data, data + len);
+	return _Flush(stream, s);
+}
+RemoteDesktop::Network_Return RemoteDesktop::Network_Mux::_Flush(int stream, Stream& s){
+	while (s.Sent < s.Queued.size() && s.Credit > 0){
+		auto count = (int)std::min(std::min((long long)(s.Queued.size() - s.Sent), s.Credit), (long long)MUX_MAXFRAME);
+		if (_Send_Frame(stream, MUX_DATA, s.Queued.data() + s.Sent, count) == Network_Return::FAILED) return Network_Return::FAILED;
+		s.Credit -= count;
+		s.Sent += count;
+	}
+	if (s.Sent == s.Queued.size()){
+		s.Queued.clear();
+		s.Sent = 0;
+	}
+	return Network_Return::COMPLETED;
+}
+bool RemoteDesktop::Network_Mux::_Wait_Room(int stream){
+	if (std::this_thread::get_id() == _BackgroundWorker.get_id()) return true;//a reply from a handler, this thread is the one that grants credit
+	std::unique_lock<std::mutex> lock(_StreamsLock);
+	return _CreditChanged.wait_for(lock, std::chrono::milliseconds(MUX_SEND_TIMEOUT), [this, stream](){
+		auto found = _Streams.find(stream);
+		return !_Running || found == _Streams.end() || (long long)(found->second.Queued.size() - found->second.Sent) < MUX_WINDOW;
+	});
+}
+
+void RemoteDesktop::Network_Mux::_HandleConnect(std::shared_ptr<SocketHandler>& s){
+	if (_Running && OnConnected) OnConnected(s);
+}
+void RemoteDesktop::Network_Mux::_HandleDisconnect(std::shared_ptr<SocketHandler>& s){
+	if (_Running && OnDisconnect) {
+		if (!DesktopMonitor::Is_InputDesktopSelected()) _DesktopMonitor->Switch_to_Desktop(DesktopMonitor::Desktops::INPUT);
+		OnDisconnect(s);
+	}
+}
+void RemoteDesktop::Network_Mux::_HandleReceive(Packet_Header* p, const char* d, std::shared_ptr<SocketHandler>& s){
+	if (_Running && OnReceived) OnReceived(p, d, s);
+}
+
+RemoteDesktop::Network_Return RemoteDesktop::Network_Mux::Send(RemoteDesktop::NetworkMessages m, const RemoteDesktop::NetworkMsg& msg, Auth_Types to_which_type){
+	std::vector<std::pair<int, std::shared_ptr<SocketHandler>>> sockets;
+	{
+		std::lock_guard<std::mutex> lock(_StreamsLock);
+		for (auto& a : _Streams) sockets.push_back(std::make_pair(a.first, a.second.Socket));
+	}
+	for (auto& a : sockets){
+		auto& s = a.second;
+		if (to_which_type == Auth_Types::AUTHORIZED && !s->Authorized) continue;
+		if (to_which_type == Auth_Types::NOT_AUTHORIZED && s->Authorized) continue;
+		if (!_Wait_Room(a.first)){
+			DEBUG_MSG("Stream % has not taken what is queued for % ms, dropping it", a.first, MUX_SEND_TIMEOUT);
+			s->Disconnect();//reaped by the thread reading the connection
+			continue;
+		}
+		s->Send(m, msg);
+	}
+	return RemoteDesktop::Network_Return::COMPLETED;
+}
+int RemoteDesktop::Network_Mux::Connection_Count() const{
+	std::lock_guard<std::mutex> lock(_StreamsLock);
+	return (int)_Streams.size();
+}
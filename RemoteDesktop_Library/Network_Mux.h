@@ -0,0 +1,76 @@
+#ifndef NETWORK_MUX123_H
+#define NETWORK_MUX123_H
+#include "INetwork.h"
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <vector>
+
+#define MUX_SEND_TIMEOUT 30000 //ms Send waits for a viewer to take what is queued for it before dropping it, same as SendLoop gives a stuck socket
+
+namespace RemoteDesktop{
+	class SocketHandler;
+	class DesktopMonitor;
+	class NetworkProcessor;
+	template<class T> class Connection_Timers;
+	//a reverse connection that carries every viewer of the gateway id over one socket, see Gateway_Mux for the gateway's side. Each viewer still gets a SocketHandler with its own key exchange, only instead of a socket its bytes go through Transport as MUX_DATA frames of its stream. So a new viewer costs the gateway no connect and no pairing and the server no socket, the end to end encryption is the same as over a connection of its own.
+	//Each stream may have MUX_WINDOW bytes in flight towards its viewer, what is written past that is queued on the stream and goes out from the thread reading the connection as the gateway grants more. A write never waits for credit, so a SocketHandler's send lock is only held as long as queueing takes and the reading thread can send keepalives and replies on any stream without being stuck behind a keyframe. Send holds the capture thread back instead, until less than MUX_WINDOW is queued for each viewer it sends to
+	class Network_Mux : public INetwork{
+		struct Stream{
+			std::shared_ptr<SocketHandler> Socket;
+			long long Credit = MUX_WINDOW;
+			std::vector<char> Queued;//written but not yet sent for want of credit, from Sent on
+			size_t Sent = 0;
+		};
+		std::thread _BackgroundWorker;
+		std::wstring _Dst_Host, _Dst_Port;
+		int MaxConnectAttempts = DEFAULTMAXCONNECTATTEMPTS;
+
+		std::mutex _SendLock;//one frame at a time on the connection
+		SOCKET _Connection = INVALID_SOCKET;
+		std::vector<char> _SendBuffer;
+		mutable std::mutex _StreamsLock;
+		std::condition_variable _CreditChanged;
+		std::unordered_map<int, Stream> _Streams;
+		std::unique_ptr<DesktopMonitor> _DesktopMonitor;
+
+		void _Run(std::wstring gatewayurl);
+		void _Serve(SOCKET sock, int src_id, std::wstring aeskey);
+		void _Frame(const Mux_Header& h, std::vector<char>& body, int src_id, const std::wstring& aeskey, NetworkProcessor& processor, Connection_Timers<SocketHandler>& timers);
+		//the streams whose SocketHandler was dropped on this side, the gateway is told
+		void _Reap();
+		void _Close_Streams();
+		Network_Return _Send_Frame(int stream, int type, const char* data, int len);
+		Network_Return _Write(int stream, char* data, int len);
+		//sends what is queued on the stream as far as its credit goes, _StreamsLock is held
+		Network_Return _Flush(int stream, Stream& s);
+		//false if the viewer has not taken what is queued for it within MUX_SEND_TIMEOUT
+		bool _Wait_Room(int stream);
+		void _Wait_Reconnect(int attempt);
+
+		void _HandleConnect(std::shared_ptr<SocketHandler>& ptr);
+		void _HandleDisconnect(std::shared_ptr<SocketHandler>& ptr);
+		void _HandleReceive(Packet_Header* p, const char* d, std::shared_ptr<SocketHandler>& ptr);
+
+	public:
+		Network_Mux();
+		virtual ~Network_Mux();
+
+		//there is no direct connection without a gateway, use Start with the gateway url
+		virtual void Start(std::wstring port, std::wstring host) override { Start(port, host, L""); }
+		void Start(std::wstring port, std::wstring host, std::wstring gatewayurl);
+
+		virtual void Stop(bool blocking = false)override;
+		virtual void Set_RetryAttempts(int num_of_retry)override { MaxConnectAttempts = num_of_retry; }
+		virtual int Get_RetryAttempts(int num_of_retry) const override { return MaxConnectAttempts; }
+		virtual RemoteDesktop::Network_Return Send(RemoteDesktop::NetworkMessages m, const RemoteDesktop::NetworkMsg& msg, Auth_Types to_which_type) override;
+		virtual int Connection_Count() const override;
+
+		std::function<void(int)> OnGatewayConnected;
+	};
+
+}
+
+#endif
@@ -6,14 +6,29 @@
 #include "NetworkProcessor.h"
 #include <chrono>
 #include "Desktop_Monitor.h"
+#include "Timer_Wheel.h"
+#include "Admission_Control.h"
+#include <algorithm>
+
+namespace RemoteDesktop{
+	namespace _INTERNAL{
+		bool In_Handshake(const SocketHandler& s){
+			return s.get_State() == PEER_STATE_EXCHANGING_KEYS || s.get_State() == PEER_STATE_EXCHANGING_KEYS_USE_PRE_AES;
+		}
+	}
+}
 
-RemoteDesktop::Network_Server::Network_Server(){
+RemoteDesktop::Network_Server::Network_Server() : _SourceRate(ADMISSION_SOURCE_RATE), _SourceBurst(ADMISSION_SOURCE_BURST){
 	DEBUG_MSG("Starting Server");
 	_DesktopMonitor = std::make_unique<DesktopMonitor>();
 }
 RemoteDesktop::Network_Server::~Network_Server(){
 	Stop(true);
 }
+void RemoteDesktop::Network_Server::set_Source_Rate(double rate){
+	_SourceRate = rate;
+	_SourceBurst = rate * ADMISSION_SOURCE_BURST / ADMISSION_SOURCE_RATE;
+}
 
 void RemoteDesktop::Network_Server::Start(std::wstring port, std::wstring host){
 	Stop(true);//ensure threads have been stopped
@@ -48,7 +63,10 @@ void RemoteDesktop::Network_Server::_Run(){
 
 	NetworkProcessor processor(DELEGATE(&RemoteDesktop::Network_Server::_HandleReceive), DELEGATE(&RemoteDesktop::Network_Server::_HandleConnect));
 	WSANETWORKEVENTS NetworkEvents;
-	auto timer = std::chrono::high_resolution_clock::now();
+	Connection_Timers<SocketHandler> timers(Timer_Wheel::Now());
+	Admission_Control admission(Timer_Wheel::Now(), _SourceRate, _SourceBurst);
+	auto expire = Timer_Wheel::Now();
+	std::vector<std::shared_ptr<SocketHandler>> dropped;
 	while (_Running && !EventArray.empty()) {
 
 		auto Index = WSAWaitForMultipleEvents(EventArray.size(), EventArray.data(), FALSE, 1000, FALSE);
@@ -57,8 +75,7 @@ void RemoteDesktop::Network_Server::_Run(){
 
 			WSAEnumNetworkEvents(sharedrockarray->at(Index)->get_Socket(), EventArray[Index], &NetworkEvents);
 			if (((NetworkEvents.lNetworkEvents & FD_ACCEPT) == FD_ACCEPT) && NetworkEvents.iErrorCode[FD_ACCEPT_BIT] == ERROR_SUCCESS){
-				if (EventArray.size() >= WSA_MAXIMUM_WAIT_EVENTS - 1) continue;// ignore this event too many connections
-				_HandleNewConnect(listensocket, EventArray, *sharedrockarray);
+				_HandleNewConnect(listensocket, EventArray, *sharedrockarray, timers, admission);
 			}
 			else if (((NetworkEvents.lNetworkEvents & FD_READ) == FD_READ) && NetworkEvents.iErrorCode[FD_READ_BIT] == ERROR_SUCCESS){
 				processor.Receive(sharedrockarray->at(Index));
@@ -70,10 +87,22 @@ void RemoteDesktop::Network_Server::_Run(){
 				}
 			}
 		}
-		//once every second send a keep alive. this will trigger disconnects 
-		if (std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - timer).count() > 1000){
-			_CheckForDisconnects(EventArray, *sharedrockarray);
-			timer = std::chrono::high_resolution_clock::now();
+		//only the connections whose keepalive is due are looked at. A failed keepalive, a peer that has gone quiet or one that never finished its key exchange drops the connection
+		auto now = Timer_Wheel::Now();
+		timers.Advance(now, [&dropped](std::shared_ptr<SocketHandler>& s, long long now){
+			if (s->Accepted != 0 && _INTERNAL::In_Handshake(*s) && now - s->Accepted >= ADMISSION_HANDSHAKE_TIMEOUT){
+				DEBUG_MSG("No key exchange after % ms, disconnecting", now - s->Accepted);
+				dropped.push_back(s);
+				return 0LL;
+			}
+			auto next = RemoteDesktop::SocketHandler::Keepalive(s, now);
+			if (next == 0) dropped.push_back(s);
+			return next;
+		});
+		if (!dropped.empty()) _Remove(EventArray, *sharedrockarray, dropped);
+		if (now - expire >= 1000){
+			admission.Expire(now);
+			expire = now;
 		}
 	}
 	for (size_t beg = 1; beg < sharedrockarray->size(); beg++){
@@ -112,12 +141,19 @@ void RemoteDesktop::Network_Server::_HandleReceive(Packet_Header* p, const char*
 	if (_Running && OnReceived) OnReceived(p, d, s);
 }
 
-void RemoteDesktop::Network_Server::_HandleNewConnect(SOCKET sock, std::vector<WSAEVENT>& eventarray, std::vector<std::shared_ptr<SocketHandler>>& socketarray){
+void RemoteDesktop::Network_Server::_HandleNewConnect(SOCKET sock, std::vector<WSAEVENT>& eventarray, std::vector<std::shared_ptr<SocketHandler>>& socketarray, Connection_Timers<SocketHandler>& timers, Admission_Control& admission){
 	DEBUG_MSG("BaseServer OnConnect Called");
 	int sockaddrlen = sizeof(sockaddr_in);
 	sockaddr_in addr;
 	auto connectsocket = accept(sock, (sockaddr*)&addr, &sockaddrlen);
 	if (connectsocket == INVALID_SOCKET) return;
+	auto handshakes = (int)std::count_if(socketarray.begin() + 1, socketarray.end(), [](const std::shared_ptr<SocketHandler>& s){ return _INTERNAL::In_Handshake(*s); });
+	auto loopback = (ntohl(addr.sin_addr.s_addr) >> 24) == 127;//a load test on the same machine opens every viewer from one address
+	if (eventarray.size() >= WSA_MAXIMUM_WAIT_EVENTS - 1 || admission.Admit(addr.sin_addr.s_addr, handshakes, Timer_Wheel::Now(), loopback) != Admission_Control::ADMITTED){
+		DEBUG_MSG("BaseServer refused a connection, % handshakes in progress", handshakes);
+		RemoteDesktop::Refuse(connectsocket);
+		return;
+	}
 	auto newevent = WSACreateEvent();
 	if (newevent == WSA_INVALID_EVENT){
 		closesocket(connectsocket);
@@ -129,29 +165,29 @@ void RemoteDesktop::Network_Server::_HandleNewConnect(SOCKET sock, std::vector<W
 	WSAEventSelect(connectsocket, newevent, FD_READ | FD_CLOSE);
 
 	auto newsocket = std::make_shared<SocketHandler>(connectsocket, false);
+	newsocket->Accepted = Timer_Wheel::Now();
 
 	socketarray.push_back(newsocket);
 	eventarray.push_back(newevent);
+	timers.Add(newsocket, Timer_Wheel::Now() + KEEPALIVE_INTERVAL);
 	newsocket->Exchange_Keys(-1, -1, L"");
 	DEBUG_MSG("BaseServer OnConnect End");
 }
-void RemoteDesktop::Network_Server::_CheckForDisconnects(std::vector<WSAEVENT>& eventarray, std::vector<std::shared_ptr<SocketHandler>>& socketarray){
-
-	if (socketarray.size() <= 1) return;
-	auto beg = socketarray.begin() + 1;
-	if (beg >= socketarray.end()) return;
-	while (beg != socketarray.end()){
-		if (RemoteDesktop::SocketHandler::CheckState(*beg) == RemoteDesktop::Network_Return::FAILED){
-			_HandleDisconnect(*beg);
-			//get the index before deletion
-			int index = beg - socketarray.begin();
-			DEBUG_MSG("Disconnecting Index %", index);
-			beg = socketarray.erase(beg);
-			WSACloseEvent(eventarray[index]);
-			eventarray.erase(eventarray.begin() + index);
-			continue;
-		}
-		++beg;
+//the order of the sockets does not matter, the last one takes the place of a dropped one instead of shifting everything after it down
+void RemoteDesktop::Network_Server::_Remove(std::vector<WSAEVENT>& eventarray, std::vector<std::shared_ptr<SocketHandler>>& socketarray, std::vector<std::shared_ptr<SocketHandler>>& dropped){
+	for (auto& a : dropped){
+		auto found = std::find(socketarray.begin() + 1, socketarray.end(), a);
+		if (found == socketarray.end()) continue;
+		a->Disconnect();
+		_HandleDisconnect(a);
+		//get the index before deletion
+		auto index = found - socketarray.begin();
+		DEBUG_MSG("Disconnecting Index %", index);
+		WSACloseEvent(eventarray[index]);
+		eventarray[index] = eventarray.back();
+		eventarray.pop_back();
+		*found = socketarray.back();
+		socketarray.pop_back();
 	}
-
+	dropped.clear();
 }
\ No newline at end of file
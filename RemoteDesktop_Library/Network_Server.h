@@ -10,6 +10,8 @@ namespace RemoteDesktop{
 
 	class SocketHandler;
 	class DesktopMonitor;
+	template<class T> class Connection_Timers;
+	class Admission_Control;
 	class Network_Server : public INetwork{
 
 		void _Run();
@@ -17,10 +19,12 @@ namespace RemoteDesktop{
 		std::wstring _Host, _Port;
 		std::thread _BackgroundWorker;
 		int MaxConnectAttempts = DEFAULTMAXCONNECTATTEMPTS;
+		double _SourceRate, _SourceBurst;
 		//weak ptrs are not expensive.. a single atomic operation is all it takes to convert to shared_ptr, but this ensures the lifetime of the sockets is managed correctly.
 		std::weak_ptr<std::vector<std::shared_ptr<SocketHandler>>> _Sockets;
-		void _CheckForDisconnects(std::vector<WSAEVENT>& eventarray, std::vector<std::shared_ptr<SocketHandler>>& socketarray);
-		void _HandleNewConnect(SOCKET sock, std::vector<WSAEVENT>& EventArray, std::vector<std::shared_ptr<SocketHandler>>& SocketArray);
+		void _Remove(std::vector<WSAEVENT>& eventarray, std::vector<std::shared_ptr<SocketHandler>>& socketarray, std::vector<std::shared_ptr<SocketHandler>>& dropped);
+		//new connections go through the Admission_Control before anything is allocated or a key generated for them
+		void _HandleNewConnect(SOCKET sock, std::vector<WSAEVENT>& EventArray, std::vector<std::shared_ptr<SocketHandler>>& SocketArray, Connection_Timers<SocketHandler>& timers, Admission_Control& admission);
 	
 		void _HandleConnect(std::shared_ptr<SocketHandler>& ptr);
 		void _HandleDisconnect(std::shared_ptr<SocketHandler>& ptr);
@@ -34,6 +38,8 @@ namespace RemoteDesktop{
 		virtual void Stop(bool blocking = false) override;
 		virtual void Set_RetryAttempts(int num_of_retry)override { MaxConnectAttempts = num_of_retry; }
 		virtual int Get_RetryAttempts(int num_of_retry) const override{ return MaxConnectAttempts; }
+		//connections per second one address may open, the burst grows with it. Call it before Start. Loopback is never held to it, only to the limits for the whole listener
+		void set_Source_Rate(double rate);
 
 		virtual RemoteDesktop::Network_Return Send(RemoteDesktop::NetworkMessages m, const RemoteDesktop::NetworkMsg& msg, Auth_Types to_which_type) override;
 
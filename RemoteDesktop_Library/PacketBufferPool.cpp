@@ -0,0 +1,52 @@
+#include "stdafx.h"
+#include "PacketBufferPool.h"
+#include "Metrics.h"
+
+namespace RemoteDesktop{
+	namespace INTERNAL{
+		Metrics::Value& PoolChunksAllocated = Metrics::Counter("rd_packet_pool_allocations_total", "Chunks the packet buffer pools had to take from the heap");
+		Metrics::Value& PoolBytes = Metrics::Gauge("rd_packet_pool_bytes", "Memory held by the packet buffer pools, in use or cached");
+	}
+}
+
+RemoteDesktop::PacketBufferPool::PacketBufferPool(size_t chunksize, size_t maxfree) : _ChunkSize(chunksize), _MaxFree(maxfree){
+	_Free.reserve(maxfree);
+}
+RemoteDesktop::PacketBufferPool::~PacketBufferPool(){
+	std::lock_guard<std::mutex> lock(_Lock);
+	assert(_Outstanding == 0);
+	for (auto a : _Free) delete[] a;
+	INTERNAL::PoolBytes.Add(-(long long)(_Free.size() * _ChunkSize));
+	_Free.clear();
+}
+char* RemoteDesktop::PacketBufferPool::Acquire(){
+	{
+		std::lock_guard<std::mutex> lock(_Lock);
+		_Outstanding += 1;
+		if (!_Free.empty()){
+			auto p = _Free.back();
+			_Free.pop_back();
+			return p;
+		}
+	}
+	INTERNAL::PoolChunksAllocated.Add();
+	INTERNAL::PoolBytes.Add(_ChunkSize);
+	return new char[_ChunkSize];
+}
+void RemoteDesktop::PacketBufferPool::Release(char* chunk){
+	if (chunk == nullptr) return;
+	{
+		std::lock_guard<std::mutex> lock(_Lock);
+		_Outstanding -= 1;
+		if (_Free.size() < _MaxFree){
+			_Free.push_back(chunk);
+			return;
+		}
+	}
+	INTERNAL::PoolBytes.Add(-(long long)_ChunkSize);
+	delete[] chunk;
+}
+long long RemoteDesktop::PacketBufferPool::get_Outstanding(){
+	std::lock_guard<std::mutex> lock(_Lock);
+	return _Outstanding;
+}
@@ -1,10 +1,26 @@
 #ifndef PACKETBUFFERPOOL123_H
 #define PACKETBUFFERPOOL123_H
+#include <vector>
+#include <mutex>
 
 namespace RemoteDesktop{
+	//fixed size chunks for code that only needs a buffer while data is in flight, like the gateway relay. Released chunks are kept for reuse up to maxfree, the rest go back to the heap
 	class PacketBufferPool{
+		std::mutex _Lock;
+		std::vector<char*> _Free;
+		size_t _ChunkSize, _MaxFree;
+		long long _Outstanding = 0;
 
+	public:
+		PacketBufferPool(size_t chunksize, size_t maxfree);
+		~PacketBufferPool();
+		PacketBufferPool(const PacketBufferPool& other) = delete;
+		PacketBufferPool& operator=(const PacketBufferPool& other) = delete;
 
+		char* Acquire();
+		void Release(char* chunk);//null is ignored
+		size_t get_ChunkSize() const { return _ChunkSize; }
+		long long get_Outstanding();//chunks acquired and not yet released
 	};
 }
 
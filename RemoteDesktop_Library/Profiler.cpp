@@ -0,0 +1,151 @@
+#include "stdafx.h"
+#include "Profiler.h"
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <fstream>
+#include <thread>
+
+#define PROFILER_EVENTS 16384 //per thread, a full buffer drops zones until the next reset
+#define PROFILER_MAXTHREADS 128
+
+namespace RemoteDesktop{
+	namespace Profiler{
+		namespace _INTERNAL{
+			std::atomic<bool> Enabled(false);
+			std::atomic<unsigned int> Generation(1);//bumped by Reset, each buffer clears itself when it sees a new one
+			std::atomic<long long> Base(0);//ticks at the last reset, timestamps in the dump are relative to it
+			std::atomic<long long> Dropped(0);
+
+			struct Event{
+				const char* Name;
+				long long Start, End;
+			};
+			struct Thread_Buffer{
+				int Thread_ID = 0;
+				std::atomic<bool> Exited;
+				std::atomic<unsigned int> Generation;
+				std::atomic<unsigned int> Count;//events below this index are complete and safe to read
+				std::atomic<bool> Busy;//held by Dump while it reads the events and by the owner while it clears them for a new generation
+				Event Events[PROFILER_EVENTS];
+			};
+			std::mutex BuffersLock;
+			std::vector<std::unique_ptr<Thread_Buffer>> Buffers;//kept after their thread exits so its zones still show up in the dump
+			int NextThread = 1;
+
+			//lets a buffer be handed to a new thread once its owner has exited
+			struct Thread_Owner{
+				Thread_Buffer* Buffer = nullptr;
+				~Thread_Owner(){ if (Buffer) Buffer->Exited = true; }
+			};
+			thread_local Thread_Owner Current;
+
+			Thread_Buffer* Register(){
+				std::lock_guard<std::mutex> lock(BuffersLock);
+				Thread_Buffer* b = nullptr;
+				auto gen = Generation.load();
+				for (auto& a : Buffers){//prefer a buffer whose zones were already cleared or dumped
+					if (a->Exited && (a->Generation != gen || a->Count == 0)) {
+						b = a.get();
+						break;
+					}
+				}
+				if (!b){
+					if (Buffers.size() >= PROFILER_MAXTHREADS) return nullptr;
+					Buffers.emplace_back(std::make_unique<Thread_Buffer>());
+					b = Buffers.back().get();
+				}
+				b->Thread_ID = NextThread++;
+				b->Count = 0;
+				b->Generation = gen;
+				b->Exited = false;
+				b->Busy = false;
+				return b;
+			}
+		}
+	}
+}
+
+void RemoteDesktop::Profiler::_INTERNAL::Record(const char* name, long long start, long long end){
+	auto b = Current.Buffer;
+	if (!b){
+		b = Current.Buffer = Register();
+		if (!b){
+			Dropped += 1;
+			return;
+		}
+	}
+	auto gen = Generation.load(std::memory_order_acquire);
+	if (b->Generation.load(std::memory_order_relaxed) != gen){
+		if (b->Busy.exchange(true, std::memory_order_acquire)){//Dump is reading the old events, drop this one rather than wait on it
+			Dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		b->Count.store(0, std::memory_order_relaxed);
+		b->Generation.store(gen, std::memory_order_release);
+		b->Busy.store(false, std::memory_order_release);
+	}
+	auto i = b->Count.load(std::memory_order_relaxed);
+	if (i >= PROFILER_EVENTS){
+		Dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	auto& e = b->Events[i];
+	e.Name = name;
+	e.Start = start;
+	e.End = end;
+	b->Count.store(i + 1, std::memory_order_release);//publishes the event to Dump
+}
+
+void RemoteDesktop::Profiler::set_Enabled(bool e){
+	if (e && !_INTERNAL::Enabled) Reset();
+	_INTERNAL::Enabled = e;
+}
+bool RemoteDesktop::Profiler::get_Enabled(){
+	return _INTERNAL::Enabled;
+}
+void RemoteDesktop::Profiler::Reset(){
+	_INTERNAL::Base = High_Clock::Now();
+	_INTERNAL::Dropped = 0;
+	_INTERNAL::Generation.fetch_add(1, std::memory_order_release);
+}
+long long RemoteDesktop::Profiler::get_Dropped(){
+	return _INTERNAL::Dropped;
+}
+
+std::string RemoteDesktop::Profiler::Dump(){
+	auto gen = _INTERNAL::Generation.load(std::memory_order_acquire);
+	auto base = _INTERNAL::Base.load();
+	auto tomicro = 1000000.0 / High_Clock::Frequency();
+	std::string out;
+	out.reserve(64 * 1024);
+	out += "{\"traceEvents\":[";
+	auto first = true;
+	char buffer[256];
+	std::lock_guard<std::mutex> lock(_INTERNAL::BuffersLock);//only keeps buffers from being handed to another thread, writers never take it
+	for (auto& b : _INTERNAL::Buffers){
+		while (b->Busy.exchange(true, std::memory_order_acquire)) std::this_thread::yield();//the owner only holds it while resetting its count
+		if (b->Generation.load(std::memory_order_acquire) != gen) {
+			b->Busy.store(false, std::memory_order_release);
+			continue;
+		}
+		auto count = b->Count.load(std::memory_order_acquire);
+		for (unsigned int i = 0; i < count; i++){
+			auto& e = b->Events[i];
+			if (e.Start < base) continue;//started before the reset
+			snprintf(buffer, sizeof(buffer), "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", first ? "" : ",\n", e.Name, b->Thread_ID, (e.Start - base) * tomicro, (e.End - e.Start) * tomicro);
+			out += buffer;
+			first = false;
+		}
+		b->Busy.store(false, std::memory_order_release);
+	}
+	out += "],\"displayTimeUnit\":\"ms\"}\n";
+	return out;
+}
+bool RemoteDesktop::Profiler::Save(const std::wstring& filename){
+	std::ofstream f(filename.c_str(), std::ios::binary | std::ios::trunc);
+	if (!f.is_open()) return false;
+	auto d = Dump();
+	f.write(d.data(), d.size());
+	return f.good();
+}
@@ -0,0 +1,43 @@
+#ifndef PROFILER123_H
+#define PROFILER123_H
+#include <string>
+#include <atomic>
+#include "Timer.h"
+
+namespace RemoteDesktop{
+	//scoped timing zones around the hot paths. Each thread writes into its own buffer without locks and the whole thing can be exported in the chrome://tracing json format. While disabled a zone costs one relaxed load and a branch, define RD_PROFILER_DISABLED to compile them out entirely
+	namespace Profiler{
+		namespace _INTERNAL{
+			extern std::atomic<bool> Enabled;
+			void Record(const char* name, long long start, long long end);
+		}
+		void set_Enabled(bool e);//enabling also clears anything recorded before
+		bool get_Enabled();
+		void Reset();
+
+		std::string Dump();//chrome trace json of every zone recorded since the last reset
+		bool Save(const std::wstring& filename);
+		long long get_Dropped();//zones lost because a thread buffer was full
+
+		//name must be a string literal, only the pointer is kept
+		class Zone{
+			const char* _Name;
+			long long _Start;
+		public:
+			explicit Zone(const char* name) : _Name(name), _Start(_INTERNAL::Enabled.load(std::memory_order_relaxed) ? High_Clock::Now() : 0){}
+			~Zone(){ if (_Start != 0) _INTERNAL::Record(_Name, _Start, High_Clock::Now()); }
+			Zone(const Zone& other) = delete;
+			Zone& operator=(const Zone& other) = delete;
+		};
+	}
+}
+
+#define PROFILER_CONCAT2(a, b) a##b
+#define PROFILER_CONCAT(a, b) PROFILER_CONCAT2(a, b)
+#ifdef RD_PROFILER_DISABLED
+#define PROFILE_ZONE(name)
+#else
+#define PROFILE_ZONE(name) RemoteDesktop::Profiler::Zone PROFILER_CONCAT(_Profile_Zone, __LINE__)(name)
+#endif
+
+#endif
@@ -0,0 +1,90 @@
+#include "stdafx.h"
+#include "Session_Recorder.h"
+#include "Compression_Handler.h"
+#include <ctime>
+#include <thread>
+
+RemoteDesktop::Session_Recorder::Session_Recorder(const std::wstring& filename) : _File(filename.c_str(), std::ios::binary | std::ios::trunc){
+	_Start = std::chrono::high_resolution_clock::now();
+	Recording_File_Header h;
+	h.Started = (long long)time(nullptr);
+	if (_File.is_open()) _File.write((char*)&h, sizeof(h));
+	else DEBUG_MSG("Session_Recorder could not open %", ws2s(filename));
+}
+RemoteDesktop::Session_Recorder::~Session_Recorder(){
+	std::lock_guard<std::mutex> lock(_Lock);
+	if (_File.is_open()) _File.flush();
+}
+void RemoteDesktop::Session_Recorder::Record_Received(const Packet_Header& h, const char* data){
+	_Write(RECORDING_RECEIVED, h.Packet_Type, data, h.PayloadLen);
+}
+void RemoteDesktop::Session_Recorder::Record_Sent(NetworkMessages m, const char* data, int len){
+	_Write(RECORDING_SENT, m, data, len);
+}
+void RemoteDesktop::Session_Recorder::_Write(Recording_Directions d, int type, const char* data, int len){
+	if (type == NetworkMessages::KEEPALIVE || len < 0) return;
+	std::lock_guard<std::mutex> lock(_Lock);
+	if (!_File.is_open() || !_File.good()) return;
+
+	Recording_Entry_Header h;
+	h.Time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - _Start).count();
+	h.Direction = (char)d;
+	h.Packet_Type = type;
+	h.PayloadLen = len;
+	if (type == NetworkMessages::ELEVATEPROCESS){//holds a password
+		_Buffer.assign(len, 0);
+		data = _Buffer.data();
+	}
+	_CompressionBuffer.resize(Compression_Handler::CompressionBound(len) + sizeof(int));
+	auto compressed = Compression_Handler::Compress(data, _CompressionBuffer.data(), len, _CompressionBuffer.size());
+	h.StoredLen = compressed > 0 ? compressed : len;
+	_File.write((char*)&h, sizeof(h));
+	_File.write(compressed > 0 ? _CompressionBuffer.data() : data, h.StoredLen);
+}
+
+RemoteDesktop::Session_Player::Session_Player(const std::wstring& filename) : _File(filename.c_str(), std::ios::binary){
+	if (!_File.is_open()) return;
+	_File.read((char*)&_Header, sizeof(_Header));
+	if (!_File || _Header.Magic != RECORDING_MAGIC || _Header.Version != RECORDING_VERSION){
+		DEBUG_MSG("Session_Player % is not a recording", ws2s(filename));
+		_File.close();
+	}
+}
+bool RemoteDesktop::Session_Player::Next(Recording_Entry_Header& h, std::vector<char>& payload){
+	if (!_File.is_open()) return false;
+	if (!_File.read((char*)&h, sizeof(h))) return false;
+	if (h.PayloadLen < 0 || h.PayloadLen >= MAXMESSAGESIZE || h.StoredLen < 0 || h.StoredLen > h.PayloadLen) return false;
+	payload.resize(h.PayloadLen);
+	if (h.StoredLen == h.PayloadLen) return (bool)_File.read(payload.data(), h.PayloadLen);
+	_Stored.resize(h.StoredLen);
+	if (!_File.read(_Stored.data(), h.StoredLen)) return false;
+	if (Compression_Handler::Decompressed_Size(_Stored.data()) != h.PayloadLen) return false;
+	return Compression_Handler::Decompress(_Stored.data(), payload.data(), h.StoredLen, h.PayloadLen) == h.PayloadLen;
+}
+RemoteDesktop::Replay_Stats RemoteDesktop::Session_Player::Replay(Delegate<void, Packet_Header*, const char*, std::shared_ptr<SocketHandler>&> handler, std::shared_ptr<SocketHandler>& socket, Recording_Directions direction, bool realtime){
+	Replay_Stats stats;
+	memset(&stats, 0, sizeof(stats));
+	Recording_Entry_Header h;
+	std::vector<char> payload;
+	auto start = std::chrono::high_resolution_clock::now();
+	long long firsttime = -1;
+	while (Next(h, payload)){
+		if (h.Direction != direction) continue;
+		if (realtime){
+			if (firsttime < 0) firsttime = h.Time;
+			auto due = start + std::chrono::microseconds(h.Time - firsttime);
+			std::this_thread::sleep_until(due);
+		}
+		Packet_Header ph;
+		ph.Packet_Type = h.Packet_Type;
+		ph.PayloadLen = h.PayloadLen;
+		Timer t(true);
+		handler(&ph, payload.data(), socket);
+		t.Stop();
+		stats.HandlerMicroseconds += t.Elapsed_micro();
+		stats.Messages += 1;
+		stats.Bytes += h.PayloadLen;
+	}
+	stats.WallMicroseconds = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+	return stats;
+}
@@ -0,0 +1,75 @@
+#ifndef SESSION_RECORDER123_H
+#define SESSION_RECORDER123_H
+#include <string>
+#include <vector>
+#include <fstream>
+#include <mutex>
+#include <memory>
+#include <chrono>
+#include "CommonNetwork.h"
+#include "Delegate.h"
+
+#define RECORDING_MAGIC 0x43524452 //RDRC
+#define RECORDING_VERSION 1
+
+namespace RemoteDesktop{
+	class SocketHandler;
+	enum Recording_Directions{
+		RECORDING_RECEIVED,
+		RECORDING_SENT
+	};
+#pragma pack(push, 1)
+	struct Recording_File_Header{
+		int Magic = RECORDING_MAGIC;
+		int Version = RECORDING_VERSION;
+		long long Started = 0;//unix time
+	};
+	struct Recording_Entry_Header{
+		long long Time;//microseconds since the recording started
+		char Direction;//Recording_Directions
+		int Packet_Type;
+		int PayloadLen;
+		int StoredLen;//less than PayloadLen when the payload was compressed with Compression_Handler
+	};
+#pragma pack(pop)
+	struct Replay_Stats{
+		long long Messages, Bytes;
+		long long HandlerMicroseconds;//time spent inside the callback
+		long long WallMicroseconds;//includes reading the file and any pacing
+	};
+
+	//writes the decrypted and decompressed messages of a connection to a file. Passwords sent to elevate the process are zeroed out, everything else including keystrokes is kept so treat recordings as sensitive
+	class Session_Recorder{
+		std::mutex _Lock;
+		std::ofstream _File;
+		std::chrono::high_resolution_clock::time_point _Start;
+		std::vector<char> _Buffer, _CompressionBuffer;
+		void _Write(Recording_Directions d, int type, const char* data, int len);
+
+	public:
+		explicit Session_Recorder(const std::wstring& filename);
+		~Session_Recorder();
+		bool Is_Open() const { return _File.is_open(); }
+
+		void Record_Received(const Packet_Header& h, const char* data);
+		void Record_Sent(NetworkMessages m, const char* data, int len);//data is the payload after the NetworkMsg parts were joined
+	};
+
+	//reads a recording back. Replay feeds one direction of it into a receive handler, either as fast as possible or spaced out like the original session
+	class Session_Player{
+		std::ifstream _File;
+		Recording_File_Header _Header;
+		std::vector<char> _Stored;
+
+	public:
+		explicit Session_Player(const std::wstring& filename);
+		bool Is_Open() const { return _File.is_open(); }
+		long long get_Started() const { return _Header.Started; }
+
+		//false at the end of the file or on a damaged entry
+		bool Next(Recording_Entry_Header& h, std::vector<char>& payload);
+		Replay_Stats Replay(Delegate<void, Packet_Header*, const char*, std::shared_ptr<SocketHandler>&> handler, std::shared_ptr<SocketHandler>& socket, Recording_Directions direction, bool realtime);
+	};
+}
+
+#endif
@@ -4,33 +4,119 @@
 #include <thread>
 #include "Compression_Handler.h"
 #include "NetworkSetup.h"
+#include "Frame_Tracer.h"
+#include "Metrics.h"
+#include "Histogram.h"
+#include "Session_Recorder.h"
+#include "Timer_Wheel.h"
+#include <algorithm>
 
 std::vector<std::vector<char>> RemoteDesktop::INTERNAL::SocketBufferCache;
 std::mutex RemoteDesktop::INTERNAL::SocketBufferCacheLock;
 
-RemoteDesktop::SocketHandler::SocketHandler(SOCKET socket, bool client) : _Socket(RAIISOCKET(socket)) {
+namespace RemoteDesktop{
+	namespace INTERNAL{
+		Metrics::Value& SocketBufferBytes = Metrics::Gauge("rd_socket_buffer_bytes", "Memory held by socket send, receive and compression buffers");
+		Metrics::Value& SocketBufferShrinks = Metrics::Counter("rd_socket_buffer_shrinks_total", "Grown socket buffers given back after their connection went quiet");
+		Metrics::Value& SocketBufferCacheHits = Metrics::Counter("rd_socket_buffer_cache_hits_total", "Socket buffers grown by taking one another socket gave back");
+		Metrics::Value& HandshakesStarted = Metrics::Counter("rd_handshakes_started_total", "Key exchanges started");
+		Metrics::Value& HandshakesCompleted = Metrics::Counter("rd_handshakes_completed_total", "Key exchanges that agreed on a key");
+		Metrics::Value& HandshakesFailed = Metrics::Counter("rd_handshakes_failed_total", "Key exchanges that failed to agree on a key");
+		Metrics::Value& EarlyMessages = Metrics::Counter("rd_early_messages_total", "Messages sent in the same flight as the public keys, before the key exchange finished");
+		Histogram& SocketReceiveDecode = Metrics::Summary("rd_receive_decode_microseconds", "Time to decrypt and decompress a received message");
+	}
+	namespace _INTERNAL{
+		//for buffers whose contents do not need to survive, takes the smallest cached one that is big enough before going to the heap
+		void Grow_Buffer(std::vector<char>& v, size_t needed){
+			if (v.capacity() >= needed) return;
+			{
+				std::lock_guard<std::mutex> lock(INTERNAL::SocketBufferCacheLock);
+				auto& cache = INTERNAL::SocketBufferCache;
+				auto best = cache.end();
+				for (auto a = cache.begin(); a != cache.end(); ++a){
+					if (a->capacity() >= needed && (best == cache.end() || a->capacity() < best->capacity())) best = a;
+				}
+				if (best != cache.end()){
+					v.swap(*best);
+					cache.erase(best);
+					INTERNAL::SocketBufferCacheHits.Add();
+					return;
+				}
+			}
+			std::vector<char> grown;
+			grown.reserve(std::max(needed, v.capacity() * 2));
+			v.swap(grown);
+		}
+		void Shrink_Buffer(std::vector<char>& v){
+			if (v.capacity() <= SOCKET_MINBUFFERSIZE) return;
+			std::vector<char> small;
+			small.reserve(SOCKET_MINBUFFERSIZE);
+			v.swap(small);
+			small.clear();
+			INTERNAL::SocketBufferShrinks.Add();
+			if (small.capacity() > SOCKET_BUFFERCACHE_MAXBUFFER) return;
+			std::lock_guard<std::mutex> lock(INTERNAL::SocketBufferCacheLock);
+			if (INTERNAL::SocketBufferCache.size() < SOCKET_BUFFERCACHE_SIZE) INTERNAL::SocketBufferCache.push_back(std::move(small));
+		}
+	}
+}
+
+RemoteDesktop::SocketHandler::SocketHandler(SOCKET socket, bool client) : _SendLock("socket_send"), _ReceiveLock("socket_receive"), _Socket(RAIISOCKET(socket)) {
 	if (client)	State = PEER_STATE_DISCONNECTED;
 	else State = PEER_STATE_CONNECTED;//servers just listen so they are in a good state
-	_SendBuffer.reserve(STARTBUFFERSIZE);
-	_ReceivedCompressionBuffer.reserve(STARTBUFFERSIZE);
-	_SendCompressionBuffer.reserve(STARTBUFFERSIZE);
 	memset(&Connection_Info, 0, sizeof(Connection_Info));
 	//init to empty functions
 
 	_Encyption.Init(client);
 }
 RemoteDesktop::SocketHandler::~SocketHandler(){
+	INTERNAL::SocketBufferBytes.Add(-(_SendBufferBytes + _ReceiveBufferBytes));
 	DEBUG_MSG("~SocketHandler");
 }
+//only called after a buffer may have grown
+void RemoteDesktop::SocketHandler::_Track_Buffers(long long& tracked, long long total){
+	if (total == tracked) return;
+	INTERNAL::SocketBufferBytes.Add(total - tracked);
+	tracked = total;
+}
+//a connection that never gets through its key exchange only ever had the bytes of the keys to read, nothing to send
+void RemoteDesktop::SocketHandler::_Allocate_Buffers(){
+	{
+		std::lock_guard<Profiled_Mutex> lock(_SendLock);
+		_SendBuffer.reserve(SOCKET_MINBUFFERSIZE);
+		_SendCompressionBuffer.reserve(SOCKET_MINBUFFERSIZE);
+		_Track_Buffers(_SendBufferBytes, _SendBuffer.capacity() + _SendCompressionBuffer.capacity());
+	}
+	std::lock_guard<Profiled_Mutex> lock(_ReceiveLock);
+	_ReceivedCompressionBuffer.reserve(SOCKET_MINBUFFERSIZE);
+	_Track_Buffers(_ReceiveBufferBytes, _ReceivedBuffer.capacity() + _In_ReceivedBuffer.capacity() + _ReceivedCompressionBuffer.capacity());
+}
 void RemoteDesktop::SocketHandler::Receive(){
 	auto ret = 0;
 	{
-		std::lock_guard<std::mutex> lock(_ReceiveLock);
+		std::lock_guard<Profiled_Mutex> lock(_ReceiveLock);
+		auto before = _In_ReceivedBufferCounter;
 		ret = ReceiveLoop(_Socket->socket, _In_ReceivedBuffer, _In_ReceivedBufferCounter);
+		if (_In_ReceivedBufferCounter != before) Last_Received = Timer_Wheel::Now();
+		if (_In_ReceivedStamp == 0 && _In_ReceivedBufferCounter > 0 && Frame_Tracer::get_Enabled()) _In_ReceivedStamp = Frame_Tracer::Now();
 	}
 	if (ret == RemoteDesktop::Network_Return::FAILED) Disconnect();
 	//	DEBUG_MSG("_Receive %", _In_ReceivedBufferCounter);
 }
+void RemoteDesktop::SocketHandler::Receive(const char* data, int len){
+	if (len <= 0) return;
+	std::lock_guard<Profiled_Mutex> lock(_ReceiveLock);
+	auto needed = (size_t)(_In_ReceivedBufferCounter + len);
+	if (needed > _In_ReceivedBuffer.size()) _In_ReceivedBuffer.resize(std::max(std::max(_In_ReceivedBuffer.size() * 2, (size_t)SOCKET_MINBUFFERSIZE), needed));
+	memcpy(_In_ReceivedBuffer.data() + _In_ReceivedBufferCounter, data, len);
+	_In_ReceivedBufferCounter += len;
+	Last_Received = Timer_Wheel::Now();
+	if (_In_ReceivedStamp == 0 && Frame_Tracer::get_Enabled()) _In_ReceivedStamp = Frame_Tracer::Now();
+}
+RemoteDesktop::Network_Return RemoteDesktop::SocketHandler::_Send_Raw(char* data, int len){
+	if (Transport) return Transport(data, len);
+	return SendLoop(_Socket->socket, data, len);
+}
 
 //used to keep a file open for writing
 void RemoteDesktop::SocketHandler::WriteToFile(std::string filename, const char* data, int len_bytes, bool lastwrite){
@@ -55,16 +141,17 @@ RemoteDesktop::Network_Return RemoteDesktop::SocketHandler::Exchange_Keys(int ds
 	NetworkMsg msg;
 	auto EphemeralPublicKeyLength = _Encyption.get_EphemeralPublicKeyLength();
 	auto StaticPublicKeyLength = _Encyption.get_StaticPublicKeyLength();
-	_SendBuffer.resize(EphemeralPublicKeyLength + StaticPublicKeyLength);
-	memcpy(_SendBuffer.data(), _Encyption.get_Static_PublicKey(), StaticPublicKeyLength);
-	memcpy(_SendBuffer.data() + StaticPublicKeyLength, _Encyption.get_Ephemeral_PublicKey(), EphemeralPublicKeyLength);
+	std::vector<char> keys(EphemeralPublicKeyLength + StaticPublicKeyLength);
+	memcpy(keys.data(), _Encyption.get_Static_PublicKey(), StaticPublicKeyLength);
+	memcpy(keys.data() + StaticPublicKeyLength, _Encyption.get_Ephemeral_PublicKey(), EphemeralPublicKeyLength);
 	Proxy_Header tmp;
 	tmp.Dst_Id = dst_id;
 	tmp.Src_Id = src_id;
 	DEBUG_MSG("Exchange_Keys % %", dst_id, src_id);
-	auto ret = SendLoop(_Socket->socket, (char*)&tmp, sizeof(tmp));//id is always sent at the beginning of a connection. This is to accommodate proxy sever
+	INTERNAL::HandshakesStarted.Add();
+	auto ret = _Send_Raw((char*)&tmp, sizeof(tmp));//id is always sent at the beginning of a connection. This is to accommodate proxy sever
 	if (ret == FAILED) return Disconnect();
-	ret = SendLoop(_Socket->socket, _SendBuffer.data(), _SendBuffer.size());
+	ret = _Send_Raw(keys.data(), keys.size());
 
 	if (aeskey.size() > 1){
 		State = PEER_STATE_EXCHANGING_KEYS_USE_PRE_AES;
@@ -84,19 +171,46 @@ RemoteDesktop::Network_Return RemoteDesktop::SocketHandler::Send(NetworkMessages
 	NetworkMsg msg;
 	return Send(m, msg);
 }
-RemoteDesktop::Network_Return RemoteDesktop::SocketHandler::Send(NetworkMessages m, const NetworkMsg& msg){
+RemoteDesktop::Network_Return RemoteDesktop::SocketHandler::Send(NetworkMessages m, const NetworkMsg& msg, Compression_Handler::Compression_Types compress){
 	if (State == PEER_STATE_DISCONNECTED) return Network_Return::FAILED;
 	else if (State == PEER_STATE_EXCHANGING_KEYS || State == PEER_STATE_EXCHANGING_KEYS_USE_PRE_AES) return Network_Return::PARTIALLY_COMPLETED;
-	else return _Encrypt_And_Send(m, msg);
+	else return _Encrypt_And_Send(m, msg, compress);
+}
+RemoteDesktop::Network_Return RemoteDesktop::SocketHandler::Send_Early(NetworkMessages m, const NetworkMsg& msg){
+	if (State != PEER_STATE_EXCHANGING_KEYS_USE_PRE_AES) return Send(m, msg);
+	INTERNAL::EarlyMessages.Add();
+	return _Encrypt_And_Send(m, msg, Compression_Handler::COMPRESSION_FAST);//the buffers grow on demand, _Allocate_Buffers only reserves what is missing
 }
-RemoteDesktop::Network_Return RemoteDesktop::SocketHandler::_Encrypt_And_Send(NetworkMessages m, const NetworkMsg& msg){
-	std::lock_guard<std::mutex> slock(_SendLock);//this lock is needed to prevent multiple threads from interleaving send calls and interleaving data in the buffers
+RemoteDesktop::Network_Return RemoteDesktop::SocketHandler::Send_Refresh(NetworkMessages m, const NetworkMsg& msg){
+	if (State != PEER_STATE_CONNECTED || !Broadcast) return Send(m, msg);
+	return _Encrypt_And_Send(m, msg, Compression_Handler::COMPRESSION_FAST, true);
+}
+RemoteDesktop::Network_Return RemoteDesktop::SocketHandler::Send_Gateway(Broadcast_Types type, int slot){
+	if (State == PEER_STATE_DISCONNECTED || !Broadcast) return Network_Return::FAILED;
+	Broadcast_Header h;
+	h.Type = type;
+	h.Slot = slot;
+	h.Length = 0;
+	std::lock_guard<Profiled_Mutex> slock(_SendLock);//must not land in the middle of a message
+	if (_Send_Raw((char*)&h, sizeof(h)) == RemoteDesktop::Network_Return::FAILED) return Disconnect();
+	return RemoteDesktop::Network_Return::COMPLETED;
+}
+RemoteDesktop::Network_Return RemoteDesktop::SocketHandler::_Encrypt_And_Send(NetworkMessages m, const NetworkMsg& msg, Compression_Handler::Compression_Types compress, bool refresh){
+	std::lock_guard<Profiled_Mutex> slock(_SendLock);//this lock is needed to prevent multiple threads from interleaving send calls and interleaving data in the buffers
 
-	auto sendsize = sizeof(Packet_Encrypt_Header) + sizeof(Packet_Header) + Compression_Handler::CompressionBound(msg.payloadlength()) + IVSIZE * 2;//max possible size needed
+	auto framing = Broadcast ? sizeof(Broadcast_Header) : 0;//goes out in the same send as the message
+	auto sendsize = framing + sizeof(Packet_Encrypt_Header) + sizeof(Packet_Header) + Compression_Handler::CompressionBound(msg.payloadlength()) + IVSIZE * 2;//max possible size needed
 	if (sendsize > MAXMESSAGESIZE) return Disconnect();
+	if (sendsize > SOCKET_MINBUFFERSIZE) _SendBusy = Timer_Wheel::Now();
 	if (sendsize >= _SendBuffer.capacity()){
-		_SendBuffer.reserve(sendsize);
-		_SendCompressionBuffer.reserve(sendsize);
+		_INTERNAL::Grow_Buffer(_SendBuffer, sendsize);
+		_INTERNAL::Grow_Buffer(_SendCompressionBuffer, sendsize);
+		_Track_Buffers(_SendBufferBytes, _SendBuffer.capacity() + _SendCompressionBuffer.capacity());
+	}
+	else if (_SendBuffer.capacity() > SOCKET_MINBUFFERSIZE && sendsize <= SOCKET_MINBUFFERSIZE && Timer_Wheel::Now() - _SendBusy >= SOCKET_BUFFER_IDLE){//a keepalive on a connection that went quiet
+		_INTERNAL::Shrink_Buffer(_SendBuffer);
+		_INTERNAL::Shrink_Buffer(_SendCompressionBuffer);
+		_Track_Buffers(_SendBufferBytes, _SendBuffer.capacity() + _SendCompressionBuffer.capacity());
 	}
 
 	auto beg = _SendBuffer.data();
@@ -104,9 +218,11 @@ RemoteDesktop::Network_Return RemoteDesktop::SocketHandler::_Encrypt_And_Send(Ne
 		memcpy(beg, msg.data[i].data, msg.data[i].len);
 		beg += msg.data[i].len;
 	}
+	auto recorder(std::atomic_load(&_Recorder));
+	if (recorder) recorder->Record_Sent(m, _SendBuffer.data(), msg.payloadlength());
 	auto packetheader = (Packet_Header*)_SendCompressionBuffer.data();
 	packetheader->Packet_Type = m;//set packet type
-	auto compressedsize = Compression_Handler::Compress(_SendBuffer.data(), _SendCompressionBuffer.data() + sizeof(Packet_Header), msg.payloadlength(), _SendCompressionBuffer.capacity());
+	auto compressedsize = Compression_Handler::Compress(_SendBuffer.data(), _SendCompressionBuffer.data() + sizeof(Packet_Header), msg.payloadlength(), _SendCompressionBuffer.capacity(), compress);
 
 	if (compressedsize > 0){
 		//DEBUG_MSG("Compressing Data from: %, to %", msg.payloadlength(), compressedsize);
@@ -120,14 +236,25 @@ RemoteDesktop::Network_Return RemoteDesktop::SocketHandler::_Encrypt_And_Send(Ne
 		packetheader->PayloadLen = msg.payloadlength();//no compression, just set the payloadsize
 	}
 
-	auto enph = (Packet_Encrypt_Header*)_SendBuffer.data();
+	auto enph = (Packet_Encrypt_Header*)(_SendBuffer.data() + framing);
 
-	enph->PayloadLen = _Encyption.Ecrypt(_SendCompressionBuffer.data(), _SendBuffer.data() + sizeof(Packet_Encrypt_Header), packetheader->PayloadLen + sizeof(Packet_Header), _SendBuffer.capacity() - sizeof(Packet_Encrypt_Header), enph->IV) + IVSIZE;
-	assert((enph->PayloadLen + sizeof(enph->PayloadLen)) <= _SendBuffer.capacity());
+	enph->PayloadLen = _Encyption.Ecrypt(_SendCompressionBuffer.data(), _SendBuffer.data() + framing + sizeof(Packet_Encrypt_Header), packetheader->PayloadLen + sizeof(Packet_Header), _SendBuffer.capacity() - framing - sizeof(Packet_Encrypt_Header), enph->IV) + IVSIZE;
+	assert((framing + enph->PayloadLen + sizeof(enph->PayloadLen)) <= _SendBuffer.capacity());
 	//DEBUG_MSG("Final Outbound Size: %", enph->PayloadLen);
 	if (enph->PayloadLen < 0)  return Disconnect();
-	if (SendLoop(_Socket->socket, _SendBuffer.data(), enph->PayloadLen + sizeof(enph->PayloadLen)) == RemoteDesktop::Network_Return::FAILED) return Disconnect();
-	Traffic.UpdateSend(roundUp(msg.payloadlength() + TOTALHEADERSIZE, 16), enph->PayloadLen + sizeof(enph->PayloadLen));// an uncompressed message would be encrypted and rounded up to the nearest 16 bytes so adjust accordingly
+	auto sendlen = enph->PayloadLen + sizeof(enph->PayloadLen);
+	if (Broadcast){
+		auto bh = (Broadcast_Header*)_SendBuffer.data();
+		bh->Type = BROADCAST_MESSAGE;
+		bh->Slot = 0;
+		bh->Length = sendlen;
+		if (m == NetworkMessages::RESOLUTIONCHANGE && !msg.data.empty() && msg.data[0].len >= (int)sizeof(New_Image_Header)){
+			bh->Type = refresh ? BROADCAST_REFRESH : BROADCAST_KEYFRAME;
+			bh->Slot = ((const New_Image_Header*)msg.data[0].data)->Index;
+		}
+	}
+	if (_Send_Raw(_SendBuffer.data(), framing + sendlen) == RemoteDesktop::Network_Return::FAILED) return Disconnect();
+	Traffic.UpdateSend(m, roundUp(msg.payloadlength() + TOTALHEADERSIZE, 16), sendlen);// an uncompressed message would be encrypted and rounded up to the nearest 16 bytes so adjust accordingly
 	return RemoteDesktop::Network_Return::COMPLETED;
 }
 
@@ -141,13 +268,18 @@ RemoteDesktop::Network_Return RemoteDesktop::SocketHandler::_Encrypt_And_Send(Ne
 RemoteDesktop::Network_Return RemoteDesktop::SocketHandler::ProcessReceived(std::shared_ptr<SocketHandler>& socket, Delegate<void, Packet_Header*, const char*, std::shared_ptr<SocketHandler>&>& receive_callback, Delegate<void, std::shared_ptr<SocketHandler>&>& onconnect_callback){
 	if (socket->_In_ReceivedBufferCounter > 0){
 		{
-			std::lock_guard<std::mutex> lock(socket->_ReceiveLock);
+			std::lock_guard<Profiled_Mutex> lock(socket->_ReceiveLock);
 			socket->_ReceivedBuffer.resize(socket->_ReceivedBufferCounter + socket->_In_ReceivedBufferCounter);
 			memcpy(socket->_ReceivedBuffer.data() + socket->_ReceivedBufferCounter, socket->_In_ReceivedBuffer.data(), socket->_In_ReceivedBufferCounter);
 			socket->_In_ReceivedBuffer.resize(0);
 			//DEBUG_MSG("Copied % bytes into received", socket->_In_ReceivedBufferCounter);
 			socket->_ReceivedBufferCounter += socket->_In_ReceivedBufferCounter;
 			socket->_In_ReceivedBufferCounter = 0;
+			socket->_ReceivedStamp = socket->_In_ReceivedStamp;
+			socket->_In_ReceivedStamp = 0;
+			if (socket->_ReceivedBufferCounter > SOCKET_MINBUFFERSIZE) socket->_ReceiveBusy = Timer_Wheel::Now();
+			//the compression buffer is only touched by this thread, if it grew below it is counted with the next message
+			_Track_Buffers(socket->_ReceiveBufferBytes, socket->_ReceivedBuffer.capacity() + socket->_In_ReceivedBuffer.capacity() + socket->_ReceivedCompressionBuffer.capacity());
 		}
 	}
 	if (socket->State == PEER_STATE_EXCHANGING_KEYS || socket->State == PEER_STATE_EXCHANGING_KEYS_USE_PRE_AES) {//any data received should be the key exchange... if not the connection will terminate
@@ -157,7 +289,12 @@ RemoteDesktop::Network_Return RemoteDesktop::SocketHandler::ProcessReceived(std:
 		//extra int is here to support proxy servers, just ignore it completely
 		if (socket->_ReceivedBufferCounter < totalsizepending) return Network_Return::PARTIALLY_COMPLETED;
 		else {//enough data was received for a key exchange..
-			if (!socket->_Encyption.Agree(socket->_ReceivedBuffer.data() + sizeof(Proxy_Header), socket->_ReceivedBuffer.data() + sizeof(Proxy_Header) + StaticPublicKeyLength, socket->State == PEER_STATE_EXCHANGING_KEYS_USE_PRE_AES)) return socket->Disconnect();
+			if (!socket->_Encyption.Agree(socket->_ReceivedBuffer.data() + sizeof(Proxy_Header), socket->_ReceivedBuffer.data() + sizeof(Proxy_Header) + StaticPublicKeyLength, socket->State == PEER_STATE_EXCHANGING_KEYS_USE_PRE_AES)) {
+				INTERNAL::HandshakesFailed.Add();
+				return socket->Disconnect();
+			}
+			INTERNAL::HandshakesCompleted.Add();
+			socket->_Allocate_Buffers();
 			socket->_ReceivedBufferCounter -= totalsizepending;
 			assert(socket->_ReceivedBufferCounter >= 0);
 			if (socket->_ReceivedBufferCounter > 0) memmove(socket->_ReceivedBuffer.data(), socket->_ReceivedBuffer.data() + totalsizepending, socket->_ReceivedBufferCounter);//this will shift down the data 
@@ -176,6 +313,10 @@ RemoteDesktop::Network_Return RemoteDesktop::SocketHandler::ProcessReceived(std:
 		}
 		else return Network_Return::PARTIALLY_COMPLETED;
 		if (socket->_ReceivedBufferCounter >= encrypt_p_header->PayloadLen + sizeof(encrypt_p_header->PayloadLen)){//data can be decrypted..., it is all here!
+			Frame_Tracer::Begin_At(socket->_ReceivedStamp);
+			Frame_Tracer::Mark(Frame_Tracer::STAGE_RECEIVE);
+			Timer decodetimer(true);
+			auto recorder(std::atomic_load(&socket->_Recorder));
 			if (socket->_Encyption.Decrypt(socket->_ReceivedBuffer.data() + sizeof(Packet_Encrypt_Header), socket->_ReceivedBuffer.data() + sizeof(Packet_Encrypt_Header), encrypt_p_header->PayloadLen - IVSIZE, encrypt_p_header->IV)){
 				auto beg = socket->_ReceivedBuffer.data() + sizeof(Packet_Encrypt_Header);
 				auto pac_header = (Packet_Header*)beg;
@@ -189,21 +330,30 @@ RemoteDesktop::Network_Return RemoteDesktop::SocketHandler::ProcessReceived(std:
 					auto assumed_uncompressedsize = Compression_Handler::Decompressed_Size(beg);//get the size of the uncompresseddata
 
 					if (assumed_uncompressedsize >= MAXMESSAGESIZE) return socket->Disconnect();//Buffer Overflow.. disconnect!
-					socket->_ReceivedCompressionBuffer.reserve(assumed_uncompressedsize);
+					if (assumed_uncompressedsize > SOCKET_MINBUFFERSIZE) socket->_ReceiveBusy = Timer_Wheel::Now();
+					_INTERNAL::Grow_Buffer(socket->_ReceivedCompressionBuffer, assumed_uncompressedsize);
 					auto newsize = Compression_Handler::Decompress(beg, socket->_ReceivedCompressionBuffer.data(), pac_header->PayloadLen, socket->_ReceivedCompressionBuffer.capacity());
 					//DEBUG_MSG("Compressed assumed size %,  output  % type %", assumed_uncompressedsize, newsize, pac_header->Packet_Type);
 					if (newsize != assumed_uncompressedsize) return socket->Disconnect();//malformed packet data . . . disconnect!
 
-					socket->Traffic.UpdateRecv(assumed_uncompressedsize + TOTALHEADERSIZE, pac_header->PayloadLen + TOTALHEADERSIZE);
+					socket->Traffic.UpdateRecv(pac_header->Packet_Type, assumed_uncompressedsize + TOTALHEADERSIZE, pac_header->PayloadLen + TOTALHEADERSIZE);
+					Frame_Tracer::Mark(Frame_Tracer::STAGE_DECRYPT);
+					decodetimer.Stop();
+					INTERNAL::SocketReceiveDecode.Record(decodetimer.Elapsed_micro());
 					auto beforesize = pac_header->PayloadLen;
 					pac_header->PayloadLen = newsize;
+					if (recorder) recorder->Record_Received(*pac_header, socket->_ReceivedCompressionBuffer.data());
 					receive_callback(pac_header, socket->_ReceivedCompressionBuffer.data(), socket);
 					pac_header->PayloadLen = beforesize;//restore
 				}
 				else {
 					if (pac_header->Packet_Type != RemoteDesktop::NetworkMessages::KEEPALIVE){
 						//DEBUG_MSG("uncompressed size % type %", pac_header->PayloadLen, pac_header->Packet_Type);
-						socket->Traffic.UpdateRecv(pac_header->PayloadLen + TOTALHEADERSIZE, pac_header->PayloadLen + TOTALHEADERSIZE);//same size for each if no compression occurs
+						socket->Traffic.UpdateRecv(pac_header->Packet_Type, pac_header->PayloadLen + TOTALHEADERSIZE, pac_header->PayloadLen + TOTALHEADERSIZE);//same size for each if no compression occurs
+						Frame_Tracer::Mark(Frame_Tracer::STAGE_DECRYPT);
+						decodetimer.Stop();
+						INTERNAL::SocketReceiveDecode.Record(decodetimer.Elapsed_micro());
+						if (recorder) recorder->Record_Received(*pac_header, beg);
 						receive_callback(pac_header, beg, socket);
 					}
 				}
@@ -219,10 +369,34 @@ RemoteDesktop::Network_Return RemoteDesktop::SocketHandler::ProcessReceived(std:
 			else return socket->Disconnect();
 		}
 	}
+	if (socket->_ReceivedBufferCounter == 0) socket->_Shrink_Receive(Timer_Wheel::Now());
 	return Network_Return::COMPLETED;
 }
+//called by the thread processing this socket once everything received has been handled
+void RemoteDesktop::SocketHandler::_Shrink_Receive(long long now){
+	if (now - _ReceiveBusy < SOCKET_BUFFER_IDLE) return;
+	if (_ReceivedBuffer.capacity() <= SOCKET_MINBUFFERSIZE && _In_ReceivedBuffer.capacity() <= SOCKET_MINBUFFERSIZE && _ReceivedCompressionBuffer.capacity() <= SOCKET_MINBUFFERSIZE) return;
+	std::lock_guard<Profiled_Mutex> lock(_ReceiveLock);
+	_INTERNAL::Shrink_Buffer(_ReceivedBuffer);
+	_ReceivedBuffer.resize(0);
+	_INTERNAL::Shrink_Buffer(_ReceivedCompressionBuffer);
+	if (_In_ReceivedBufferCounter == 0){//the network thread may have read more since
+		_INTERNAL::Shrink_Buffer(_In_ReceivedBuffer);
+		_In_ReceivedBuffer.resize(0);
+	}
+	_Track_Buffers(_ReceiveBufferBytes, _ReceivedBuffer.capacity() + _In_ReceivedBuffer.capacity() + _ReceivedCompressionBuffer.capacity());
+}
 
 
 RemoteDesktop::Network_Return RemoteDesktop::SocketHandler::CheckState(std::shared_ptr<SocketHandler>& socket){
 	return socket->Send(RemoteDesktop::NetworkMessages::KEEPALIVE);
+}
+long long RemoteDesktop::SocketHandler::Keepalive(std::shared_ptr<SocketHandler>& socket, long long now){
+	if (socket->Last_Received != 0 && now - socket->Last_Received >= IDLE_TIMEOUT){
+		DEBUG_MSG("Nothing received for % ms, disconnecting", now - socket->Last_Received);
+		socket->Disconnect();
+		return 0;
+	}
+	if (CheckState(socket) == Network_Return::FAILED) return 0;
+	return now + KEEPALIVE_INTERVAL;
 }
\ No newline at end of file
@@ -7,33 +7,48 @@
 #include <vector>
 #include "Traffic_Monitor.h"
 #include <mutex>
+#include "Lock_Profiler.h"
 #include "Handle_Wrapper.h"
 #include "Delegate.h"
+#include "Compression_Handler.h"
+#include <functional>
 
 
 namespace RemoteDesktop{
+	class Session_Recorder;
 
 	namespace INTERNAL{
-		//improves speed when memory allocations are kept down because vector resize always does a memset on the unintialized elements
+		//improves speed when memory allocations are kept down because vector resize always does a memset on the unintialized elements. Holds the buffers idle sockets gave back
 		extern std::vector<std::vector<char>> SocketBufferCache;
 		extern std::mutex SocketBufferCacheLock;
 	}
+	//Nothing is allocated for a connection until its key exchange succeeds, then the buffers start at SOCKET_MINBUFFERSIZE and double while the traffic needs it, so an idle connection costs a few kilobytes. Once nothing bigger than that has gone through for SOCKET_BUFFER_IDLE they are given back to INTERNAL::SocketBufferCache, the keepalives both sides send every second make sure that check runs on quiet connections too
 	class SocketHandler{
 		
-		std::mutex _SendLock, _ReceiveLock;
+		Profiled_Mutex _SendLock, _ReceiveLock;
 		std::vector<char> _SendBuffer, _ReceivedBuffer, _In_ReceivedBuffer;
 		std::vector<char> _ReceivedCompressionBuffer, _SendCompressionBuffer;
 		int _ReceivedBufferCounter = 0;
 		int _In_ReceivedBufferCounter = 0;
+		long long _In_ReceivedStamp = 0, _ReceivedStamp = 0;//Frame_Tracer time the oldest unprocessed data arrived
+		//what this socket last reported to the buffer memory gauge. The send side is updated under _SendLock, the receive side under _ReceiveLock
+		long long _SendBufferBytes = 0, _ReceiveBufferBytes = 0;
+		//Timer_Wheel::Now() of the last message that needed more than SOCKET_MINBUFFERSIZE
+		long long _SendBusy = 0, _ReceiveBusy = 0;
+		static void _Track_Buffers(long long& tracked, long long total);
+		void _Shrink_Receive(long long now);
+		void _Allocate_Buffers();
 
 		Packet_Encrypt_Header _Encypt_Header;
 		Encryption _Encyption;
 
-		Network_Return _Encrypt_And_Send(NetworkMessages m, const NetworkMsg& msg); 
+		Network_Return _Encrypt_And_Send(NetworkMessages m, const NetworkMsg& msg, Compression_Handler::Compression_Types compress, bool refresh = false); 
+		Network_Return _Send_Raw(char* data, int len);
 		RAIISOCKET_TYPE _Socket;
 		PeerState State = PEER_STATE_DISCONNECTED;
 		std::unique_ptr<std::ofstream> _File;
 		std::string _FileName;
+		std::shared_ptr<Session_Recorder> _Recorder;//accessed with atomic_load/atomic_store since it can be swapped while the socket is busy
 
 	public:
 		explicit SocketHandler(SOCKET socket, bool client);
@@ -45,10 +60,24 @@ namespace RemoteDesktop{
 		Network_Return Exchange_Keys(int dst_id, int src_id, std::wstring aeskey);
 
 		void Receive();
-		Network_Return Send(NetworkMessages m, const NetworkMsg& msg); 
+		//for a connection without a socket of its own, the bytes were read by whoever carries it
+		void Receive(const char* data, int len);
+		Network_Return Send(NetworkMessages m, const NetworkMsg& msg, Compression_Handler::Compression_Types compress = Compression_Handler::COMPRESSION_FAST); 
 		Network_Return Send(NetworkMessages m);
+		//like Send, except with a pre-AES key the message does not wait for the key exchange. The key is known before the peer answers so it goes out right behind the public keys and the peer handles it as soon as its side of the agreement is done. Without one the key needs the peer's ephemeral key, this returns PARTIALLY_COMPLETED and nothing is sent
+		Network_Return Send_Early(NetworkMessages m, const NetworkMsg& msg);
+		//on a broadcast, a keyframe that is only there so viewers joining later have somewhere to start. The gateway keeps it for them and does not pass it to the ones already watching
+		Network_Return Send_Refresh(NetworkMessages m, const NetworkMsg& msg);
+		//on a broadcast, a frame for the gateway itself, see Broadcast_Types
+		Network_Return Send_Gateway(Broadcast_Types type, int slot);
+
+		//pass nullptr to stop recording
+		void set_Recorder(std::shared_ptr<Session_Recorder> r){ std::atomic_store(&_Recorder, r); }
+		std::shared_ptr<Session_Recorder> get_Recorder() const { return std::atomic_load(&_Recorder); }
 
 		SOCKET get_Socket() const { return _Socket ? _Socket->socket : INVALID_SOCKET; }
+		//memory held by this connection's buffers
+		long long get_BufferBytes() const { return _SendBufferBytes + _ReceiveBufferBytes; }
 		SOCKET get_State() const { return State; }
 
 		Network_Return Disconnect(){ 
@@ -59,11 +88,19 @@ namespace RemoteDesktop{
 		}
 
 		bool Authorized = false;
+		bool Broadcast = false;//the gateway copies what is sent to every viewer of the id, each message goes out behind a Broadcast_Header so it knows where a late viewer can start
+		int Spectator = 0;//the gateway's id for a viewer of a broadcast that only watches, 0 for everyone else. Its bytes are passed on until it is answered, nothing is ever sent to it directly
+		long long Last_Received = 0;//Timer_Wheel::Now() of the last read that got something, 0 until the peer sent anything
+		long long Accepted = 0;//Timer_Wheel::Now() when a listener took the connection, 0 for outgoing ones
+		//set before Exchange_Keys on a connection made with INVALID_SOCKET, everything sent goes through it instead, see Network_Mux
+		std::function<Network_Return(char*, int)> Transport;
 		Traffic_Monitor Traffic;
 		User_Info_Header Connection_Info;
 
 		static Network_Return ProcessReceived(std::shared_ptr<SocketHandler>& socket, Delegate<void, Packet_Header*, const char*, std::shared_ptr<SocketHandler>&>& receive_callback, Delegate<void, std::shared_ptr<SocketHandler>&>& onconnect_callback);
 		static Network_Return CheckState(std::shared_ptr<SocketHandler>& socket);
+		//for Connection_Timers, sends a keepalive and returns when the next one is due or 0 when the connection is dead. A peer that has not sent anything for IDLE_TIMEOUT is dead even if the sends still go through, one that never sent anything is left alone since it could be waiting at a gateway. The gateway sends a broadcast its own keepalives, the viewers watching it can all be spectators whose input is not passed on
+		static long long Keepalive(std::shared_ptr<SocketHandler>& socket, long long now);
 	};
 };
 
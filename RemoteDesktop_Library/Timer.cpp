@@ -1,5 +1,81 @@
 #include "stdafx.h"
 #include "Timer.h"
+#include <thread>
 
-LARGE_INTEGER Timer::m_freq = (QueryPerformanceFrequency(&Timer::m_freq), Timer::m_freq);
-LONGLONG Timer::m_overhead = Timer::GetOverhead();
\ No newline at end of file
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define TIMER_HAS_TSC 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#include <cpuid.h>
+#endif
+#else
+#define TIMER_HAS_TSC 0
+#endif
+
+#define TIMER_CALIBRATION_MS 10 //how long the tsc is measured against steady_clock at startup
+
+namespace RemoteDesktop{
+	namespace High_Clock{
+		namespace _INTERNAL{
+			typedef std::chrono::steady_clock Clock;
+			struct Calibration{
+				bool TSC = false;
+				long long Frequency = Clock::period::den / Clock::period::num;
+			};
+#if TIMER_HAS_TSC
+			//an invariant tsc ticks at the same rate in every power state and is synchronized across cores, older ones cannot be used as a clock
+			bool Invariant_TSC(){
+				unsigned int regs[4] = { 0 };
+#if defined(_MSC_VER)
+				__cpuid((int*)regs, 0x80000000);
+				if (regs[0] < 0x80000007) return false;
+				__cpuid((int*)regs, 0x80000007);
+#else
+				if (__get_cpuid_max(0x80000000, nullptr) < 0x80000007) return false;
+				__cpuid(0x80000007, regs[0], regs[1], regs[2], regs[3]);
+#endif
+				return (regs[3] & (1 << 8)) != 0;
+			}
+#endif
+			Calibration Calibrate(){
+				Calibration c;
+#if TIMER_HAS_TSC
+				if (!Invariant_TSC()) return c;
+				auto begin = Clock::now();
+				auto tscbegin = __rdtsc();
+				std::this_thread::sleep_for(std::chrono::milliseconds(TIMER_CALIBRATION_MS));
+				auto tscend = __rdtsc();
+				auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - begin).count();
+				if (nanos <= 0 || tscend <= tscbegin) return c;
+				c.Frequency = (long long)((tscend - tscbegin) * 1000000000.0 / nanos);
+				c.TSC = true;
+#endif
+				return c;
+			}
+			//function static so other statics can use the clock while they are constructed
+			const Calibration& get_Calibration(){
+				static Calibration c = Calibrate();
+				return c;
+			}
+		}
+	}
+}
+
+long long RemoteDesktop::High_Clock::Now(){
+#if TIMER_HAS_TSC
+	static const bool tsc = _INTERNAL::get_Calibration().TSC;
+	if (tsc) return (long long)__rdtsc();
+#endif
+	return _INTERNAL::Clock::now().time_since_epoch().count();
+}
+long long RemoteDesktop::High_Clock::Frequency(){
+	static const long long frequency = _INTERNAL::get_Calibration().Frequency;
+	return frequency;
+}
+bool RemoteDesktop::High_Clock::Using_TSC(){
+	return _INTERNAL::get_Calibration().TSC;
+}
+
+long long Timer::m_overhead = Timer::GetOverhead();
@@ -2,26 +2,35 @@
 #define CMYTIME_H
 #include <chrono>
 
+//portable tick source for everything that measures time. Uses the cpu timestamp counter when it is invariant, calibrated once against steady_clock, and steady_clock itself everywhere else
+namespace RemoteDesktop{
+	namespace High_Clock{
+		long long Now();//ticks
+		long long Frequency();//ticks per second
+		bool Using_TSC();
+		inline long long to_Micro(long long ticks){ return (long long)(ticks * 1000000.0 / Frequency()); }
+	}
+}
+
 class Timer{
-	LARGE_INTEGER m_start;
-	LARGE_INTEGER m_stop;
-	static LARGE_INTEGER m_freq;
-	static LONGLONG m_overhead;
-	static LONGLONG GetOverhead(){
+	long long m_start = 0;
+	long long m_stop = 0;
+	static long long m_overhead;
+	static long long GetOverhead(){
 		Timer t;
 		t.Start();
 		t.Stop();
-		return t.m_stop.QuadPart - t.m_start.QuadPart;
+		return t.m_stop - t.m_start;
 	}
 public:
 	explicit Timer(bool s = false){ if (s) Start(); }
-	void Start() { QueryPerformanceCounter(&m_start); }
-	void Stop() { QueryPerformanceCounter(&m_stop); }
-	long long Elapsed_micro() const{ return (long long)((m_stop.QuadPart - m_start.QuadPart - m_overhead) * 1000000.0) / m_freq.QuadPart; }
-	long long Elapsed_milli() const{ return (long long)((m_stop.QuadPart - m_start.QuadPart - m_overhead) * 1000.0) / m_freq.QuadPart; }
+	void Start() { m_start = RemoteDesktop::High_Clock::Now(); }
+	void Stop() { m_stop = RemoteDesktop::High_Clock::Now(); }
+	long long Elapsed_micro() const{ return (long long)((m_stop - m_start - m_overhead) * 1000000.0 / RemoteDesktop::High_Clock::Frequency()); }
+	long long Elapsed_milli() const{ return (long long)((m_stop - m_start - m_overhead) * 1000.0 / RemoteDesktop::High_Clock::Frequency()); }
 
 	template <typename T, typename Traits>
-	friend std::basic_ostream<T, Traits>& operator<<(std::basic_ostream<T, Traits>& out, const Timer& timer){ return out << timer.Elapsed().count(); }
+	friend std::basic_ostream<T, Traits>& operator<<(std::basic_ostream<T, Traits>& out, const Timer& timer){ return out << timer.Elapsed_micro(); }
 }; 
 //On windows the below class will give resolution down to 15 ms. 
 class Low_Timer{
@@ -35,6 +44,6 @@ public:
 	void Stop() { _End = high_resolution_clock::now(); }
 	long long Elapsed() const{ return std::chrono::duration_cast<milliseconds>(_End - _Begin).count(); }
 	template <typename T, typename Traits>
-	friend std::basic_ostream<T, Traits>& operator<<(std::basic_ostream<T, Traits>& out, const Low_Timer& timer){ return out << timer.Elapsed().count(); }
+	friend std::basic_ostream<T, Traits>& operator<<(std::basic_ostream<T, Traits>& out, const Low_Timer& timer){ return out << timer.Elapsed(); }
 };
 #endif
@@ -0,0 +1,67 @@
+#include "stdafx.h"
+#include "Timer_Wheel.h"
+#include <chrono>
+
+RemoteDesktop::Timer_Wheel::Timer_Wheel(long long resolution, long long now) : _Resolution(resolution), _Current(now / resolution){
+	assert(resolution > 0);
+}
+long long RemoteDesktop::Timer_Wheel::Now(){
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+void RemoteDesktop::Timer_Wheel::_Place(const Entry& e){
+	auto delta = e.Tick - _Current;
+	if (delta <= 0){
+		_Due.push_back(e.Key);
+		return;
+	}
+	for (auto level = 0; level < TIMER_WHEEL_LEVELS; level++){
+		if (delta < (1LL << (TIMER_WHEEL_BITS * (level + 1)))){
+			_Slots[level][(e.Tick >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1)].push_back(e);
+			return;
+		}
+	}
+	//past the end of the wheel, the slot furthest out gets it closer
+	auto last = _Current + (1LL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1;
+	_Slots[TIMER_WHEEL_LEVELS - 1][(last >> (TIMER_WHEEL_BITS * (TIMER_WHEEL_LEVELS - 1))) & (TIMER_WHEEL_SLOTS - 1)].push_back(e);
+}
+void RemoteDesktop::Timer_Wheel::Add(unsigned long long key, long long deadline){
+	Entry e;
+	e.Key = key;
+	e.Tick = (deadline + _Resolution - 1) / _Resolution;
+	_Place(e);
+	_Count += 1;
+}
+void RemoteDesktop::Timer_Wheel::Advance(long long now, std::vector<unsigned long long>& due){
+	auto target = now / _Resolution;
+	std::vector<Entry> cascade;
+	while (_Current < target){
+		if (_Count == _Due.size()){//nothing left in the slots, skip ahead
+			_Current = target;
+			break;
+		}
+		_Current += 1;
+		//when a level wraps around, the next slot of the level above is spread out below it
+		if ((_Current & (TIMER_WHEEL_SLOTS - 1)) == 0){
+			for (auto level = 1; level < TIMER_WHEEL_LEVELS; level++){
+				auto index = (_Current >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1);
+				cascade.clear();
+				cascade.swap(_Slots[level][index]);
+				for (auto& e : cascade) _Place(e);
+				if (index != 0) break;
+			}
+		}
+		auto& slot = _Slots[0][_Current & (TIMER_WHEEL_SLOTS - 1)];
+		for (auto& e : slot) _Due.push_back(e.Key);
+		slot.clear();
+	}
+	due.insert(due.end(), _Due.begin(), _Due.end());
+	_Count -= _Due.size();
+	_Due.clear();
+}
+void RemoteDesktop::Timer_Wheel::Clear(){
+	for (auto& level : _Slots){
+		for (auto& slot : level) slot.clear();
+	}
+	_Due.clear();
+	_Count = 0;
+}
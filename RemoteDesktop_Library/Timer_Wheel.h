@@ -0,0 +1,81 @@
+#ifndef TIMER_WHEEL123_H
+#define TIMER_WHEEL123_H
+#include <vector>
+#include <memory>
+#include <unordered_map>
+
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4 //64^4 ticks, at 100ms that is about 19 days. Anything further out is parked in the last slot and placed again when it comes around
+
+#define KEEPALIVE_INTERVAL 1000 //ms between keepalives on a connection
+#define IDLE_TIMEOUT 30000 //ms without receiving anything before a connection is dropped, both sides send a keepalive every KEEPALIVE_INTERVAL
+#define CONNECTION_TIMER_RESOLUTION 100
+
+namespace RemoteDesktop{
+	//hierarchical timing wheel, adding a deadline and collecting the ones that are due only touches those timers no matter how many are pending. Level 0 has one slot per tick, every level above covers TIMER_WHEEL_SLOTS times the one below and its slots are spread into the lower levels as time gets to them.
+	//Timers cannot be cancelled, put a generation in the key and ignore stale ones when they come due. Deadlines are rounded up to the resolution so a timer never fires early. Not thread safe
+	class Timer_Wheel{
+		struct Entry{
+			unsigned long long Key;
+			long long Tick;
+		};
+		std::vector<Entry> _Slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+		std::vector<unsigned long long> _Due;//added with a deadline that had already passed
+		long long _Resolution;//ms per tick
+		long long _Current;//last tick handled by Advance
+		size_t _Count = 0;
+
+		void _Place(const Entry& e);
+
+	public:
+		Timer_Wheel(long long resolution, long long now);
+
+		void Add(unsigned long long key, long long deadline);
+		//appends every key whose deadline is at or before now
+		void Advance(long long now, std::vector<unsigned long long>& due);
+		size_t size() const { return _Count; }
+		void Clear();
+
+		//ms on a steady clock, what the users of the wheel measure their deadlines with
+		static long long Now();
+	};
+
+	//one timer per connection for the thread that owns the connections. Advance calls back for the ones that are due, the callback does whatever the connection needs (send a keepalive, check how long it has been idle) and returns when it wants to be called again.
+	//Only weak references are kept, a connection that went away is forgotten the next time it comes due
+	template<class T> class Connection_Timers{
+		Timer_Wheel _Wheel;
+		std::unordered_map<unsigned long long, std::weak_ptr<T>> _Connections;
+		std::vector<unsigned long long> _Due;
+		unsigned long long _Next = 0;
+
+	public:
+		explicit Connection_Timers(long long now) : _Wheel(CONNECTION_TIMER_RESOLUTION, now) {}
+
+		void Add(const std::shared_ptr<T>& c, long long deadline){
+			auto key = _Next++;
+			_Connections[key] = c;
+			_Wheel.Add(key, deadline);
+		}
+		//fn(std::shared_ptr<T>&, long long now) returns the next deadline for the connection, or 0 to stop tracking it
+		template<class F> void Advance(long long now, F fn){
+			_Due.clear();
+			_Wheel.Advance(now, _Due);
+			for (auto key : _Due){
+				auto found = _Connections.find(key);
+				if (found == _Connections.end()) continue;
+				auto c = found->second.lock();
+				auto next = c ? fn(c, now) : 0;
+				if (next == 0) _Connections.erase(found);
+				else _Wheel.Add(key, next);
+			}
+		}
+		size_t size() const { return _Connections.size(); }
+		void Clear(){
+			_Connections.clear();
+			_Wheel.Clear();
+		}
+	};
+}
+
+#endif
@@ -1,58 +1,87 @@
 #include "stdafx.h"
 #include "Traffic_Monitor.h"
+#include <chrono>
 
 RemoteDesktop::Traffic_Monitor::Traffic_Monitor(){
-	_SendTimer = std::chrono::high_resolution_clock::now();
-	_RecvTimer = std::chrono::high_resolution_clock::now();
-	memset(&_Stats, 0, sizeof(_Stats));
-
-}
-
-
-void RemoteDesktop::Traffic_Monitor::UpdateSend(long uncompressed, long compressed){
-
-	_Stats.CompressedSendBytes += compressed;
-	_Stats.UncompressedSendBytes += uncompressed;
-
-	if (std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - _SendTimer).count() > 3000){
-		long long total = 0;
-		for (auto &a : _UncompressedSendBuffer) total += a;
-		_UncompressedSendBuffer.clear();
-		if (total > 0) _Stats.UncompressedSendBytes = total / 3;
-
-		total = 0;
-		for (auto &a : _CompressedSendBuffer) total += a;
-		_CompressedSendBuffer.clear();
-		if (total > 0) _Stats.CompressedSendBytes = total / 3;
-
-		_SendTimer = std::chrono::high_resolution_clock::now(); 
-	
-	}
-	else {
-		_UncompressedSendBuffer.push_back(uncompressed);
-		_CompressedSendBuffer.push_back(compressed);
+	for (auto& a : _Intervals){
+		a.Second = -1;
+		for (auto& v : a.Values) v = 0;
 	}
+	for (auto& a : _Totals) a = 0;
+	for (auto& a : _SendMessageTypes) a = 0;
+	for (auto& a : _RecvMessageTypes) a = 0;
 }
-void RemoteDesktop::Traffic_Monitor::UpdateRecv(long uncompressed, long compressed){
-
-	_Stats.CompressedRecvBytes += compressed;
-	_Stats.UncompressedRecvBytes += uncompressed;
-
-	if (std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - _RecvTimer).count() > 3000){
-		long long  total = 0;
-		for (auto &a : _UncompressedRecvBuffer) total += a;
-		_UncompressedRecvBuffer.clear();
-		if (total > 0) _Stats.UncompressedRecvBPS = total / 3;
-
-		total = 0;
-		for (auto &a : _CompressedRecvBuffer) total += a;
-		_CompressedRecvBuffer.clear();
-		if (total > 0) _Stats.CompressedRecvBPS = total / 3;
-
-		_RecvTimer = std::chrono::high_resolution_clock::now();
+long long RemoteDesktop::Traffic_Monitor::_Now(){
+	return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+void RemoteDesktop::Traffic_Monitor::_Add(int message_type, long long uncompressed, long long compressed, bool send){
+	auto now = _Now();
+	auto& interval = _Intervals[now % TRAFFIC_INTERVALS];
+	auto second = interval.Second.load();
+	if (second != now && second < now && interval.Second.compare_exchange_strong(second, now)){
+		//this thread moved the slot on to the current second. A thread adding to the slot at the exact same moment may lose its update for this second, the lifetime totals are unaffected
+		for (auto& v : interval.Values) v.store(0, std::memory_order_relaxed);
 	}
-	else {
-		_UncompressedRecvBuffer.push_back(uncompressed); 
-		_CompressedRecvBuffer.push_back(compressed);
+	auto c = send ? COMPRESSED_SEND : COMPRESSED_RECV;
+	auto u = send ? UNCOMPRESSED_SEND : UNCOMPRESSED_RECV;
+	auto m = send ? MESSAGES_SEND : MESSAGES_RECV;
+	interval.Values[c].fetch_add(compressed, std::memory_order_relaxed);
+	interval.Values[u].fetch_add(uncompressed, std::memory_order_relaxed);
+	interval.Values[m].fetch_add(1, std::memory_order_relaxed);
+	_Totals[c].fetch_add(compressed, std::memory_order_relaxed);
+	_Totals[u].fetch_add(uncompressed, std::memory_order_relaxed);
+	_Totals[m].fetch_add(1, std::memory_order_relaxed);
+
+	if (message_type < 0 || message_type >= TRAFFIC_MESSAGETYPES) message_type = TRAFFIC_MESSAGETYPES - 1;
+	(send ? _SendMessageTypes : _RecvMessageTypes)[message_type].fetch_add(1, std::memory_order_relaxed);
+	(send ? _SendSizes : _RecvSizes).Record(uncompressed);
+}
+void RemoteDesktop::Traffic_Monitor::UpdateSend(int message_type, long uncompressed, long compressed){
+	_Add(message_type, uncompressed, compressed, true);
+}
+void RemoteDesktop::Traffic_Monitor::UpdateRecv(int message_type, long uncompressed, long compressed){
+	_Add(message_type, uncompressed, compressed, false);
+}
+RemoteDesktop::Traffic_Stats RemoteDesktop::Traffic_Monitor::get_TrafficStats() const{
+	Traffic_Stats stats;
+	stats.CompressedSendBytes = _Totals[COMPRESSED_SEND];
+	stats.CompressedRecvBytes = _Totals[COMPRESSED_RECV];
+	stats.UncompressedSendBytes = _Totals[UNCOMPRESSED_SEND];
+	stats.UncompressedRecvBytes = _Totals[UNCOMPRESSED_RECV];
+	auto rates = get_Rates(1);
+	stats.CompressedSendBPS = rates.CompressedSendBPS;
+	stats.CompressedRecvBPS = rates.CompressedRecvBPS;
+	stats.UncompressedSendBPS = rates.UncompressedSendBPS;
+	stats.UncompressedRecvBPS = rates.UncompressedRecvBPS;
+	return stats;
+}
+RemoteDesktop::Traffic_Rates RemoteDesktop::Traffic_Monitor::get_Rates(int seconds) const{
+	seconds = std::max(1, std::min(seconds, 60));
+	long long sums[COUNTER_COUNT] = { 0 };
+	auto now = _Now();
+	for (auto s = now - seconds; s < now; s++){
+		auto& interval = _Intervals[s % TRAFFIC_INTERVALS];
+		if (interval.Second.load() != s) continue;//nothing happened during that second
+		for (auto i = 0; i < COUNTER_COUNT; i++) sums[i] += interval.Values[i].load(std::memory_order_relaxed);
 	}
-}
\ No newline at end of file
+	Traffic_Rates rates;
+	rates.CompressedSendBPS = sums[COMPRESSED_SEND] / seconds;
+	rates.CompressedRecvBPS = sums[COMPRESSED_RECV] / seconds;
+	rates.UncompressedSendBPS = sums[UNCOMPRESSED_SEND] / seconds;
+	rates.UncompressedRecvBPS = sums[UNCOMPRESSED_RECV] / seconds;
+	rates.SendMPS = sums[MESSAGES_SEND] / seconds;
+	rates.RecvMPS = sums[MESSAGES_RECV] / seconds;
+	return rates;
+}
+long long RemoteDesktop::Traffic_Monitor::get_MessageCount(int message_type, bool send) const{
+	if (message_type < 0 || message_type >= TRAFFIC_MESSAGETYPES) return 0;
+	return (send ? _SendMessageTypes : _RecvMessageTypes)[message_type];
+}
+double RemoteDesktop::Traffic_Monitor::get_CompressionRatio(bool send) const{
+	auto u = _Totals[send ? UNCOMPRESSED_SEND : UNCOMPRESSED_RECV].load();
+	if (u <= 0) return 1.0;
+	return (double)_Totals[send ? COMPRESSED_SEND : COMPRESSED_RECV].load() / (double)u;
+}
+long long RemoteDesktop::Traffic_Monitor::get_SizePercentile(double p, bool send) const{
+	return (send ? _SendSizes : _RecvSizes).get_Percentile(p);
+}
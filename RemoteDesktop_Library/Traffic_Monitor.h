@@ -1,27 +1,50 @@
 #ifndef TRAFFIC_MONITOR_H
 #define TRAFFIC_MONITOR_H
-#include <chrono>
-#include <vector>
+#include <atomic>
 #include "CommonNetwork.h"
+#include "Histogram.h"
 
-namespace RemoteDesktop{
-
-	class Traffic_Monitor{		
-		std::chrono::high_resolution_clock::time_point _SendTimer, _RecvTimer;
+#define TRAFFIC_INTERVALS 64 //one second per interval, enough to cover the longest 60 second window
+#define TRAFFIC_MESSAGETYPES 64 //NetworkMessages values above this are counted in the last slot
 
-		std::vector<long long> _UncompressedSendBuffer, _UncompressedRecvBuffer;
-		std::vector<long long> _CompressedSendBuffer, _CompressedRecvBuffer;
-		Traffic_Stats _Stats;
+namespace RemoteDesktop{
+	//fixed memory and lock free. The network threads update it while the DLL API reads from any thread
+	class Traffic_Monitor{
+		enum Counters{
+			COMPRESSED_SEND,
+			COMPRESSED_RECV,
+			UNCOMPRESSED_SEND,
+			UNCOMPRESSED_RECV,
+			MESSAGES_SEND,
+			MESSAGES_RECV,
+			COUNTER_COUNT
+		};
+		struct Interval{
+			std::atomic<long long> Second;
+			std::atomic<long long> Values[COUNTER_COUNT];
+		};
+		Interval _Intervals[TRAFFIC_INTERVALS];
+		std::atomic<long long> _Totals[COUNTER_COUNT];
+		std::atomic<long long> _SendMessageTypes[TRAFFIC_MESSAGETYPES], _RecvMessageTypes[TRAFFIC_MESSAGETYPES];
+		Histogram _SendSizes, _RecvSizes;//uncompressed message sizes
+
+		static long long _Now();
+		void _Add(int message_type, long long uncompressed, long long compressed, bool send);
 	public:
 		Traffic_Monitor();
-
-		void UpdateSend(long uncompressed, long compressed);
-		void UpdateRecv(long uncompressed, long compressed);
-
-		const Traffic_Stats& get_TrafficStats() const{ 
-			return _Stats; 
-		}
-
+		Traffic_Monitor(const Traffic_Monitor& other) = delete;
+
+		void UpdateSend(int message_type, long uncompressed, long compressed);
+		void UpdateRecv(int message_type, long uncompressed, long compressed);
+
+		Traffic_Stats get_TrafficStats() const;
+		//seconds is clamped to 1 - 60. The current second is still filling up so it is not included
+		Traffic_Rates get_Rates(int seconds) const;
+		long long get_MessageCount(int message_type, bool send) const;
+		//compressed bytes over uncompressed bytes for the lifetime of the connection, 1 if nothing was sent
+		double get_CompressionRatio(bool send) const;
+		//p is 0 to 100
+		long long get_SizePercentile(double p, bool send) const;
 	};
 };
 
@@ -2,6 +2,8 @@
 #include "VirtualScreen.h"		
 #include "Handle_Wrapper.h"
 #include "Image.h"
+#include "Frame_Tracer.h"
+#include "Profiler.h"
 #include <algorithm>
 
 int RemoteDesktop::VirtualScreen::VirtualScreenWidth = 0;
@@ -132,13 +134,16 @@ void RemoteDesktop::VirtualScreen::Update(){
 		if (!CreateCaptureBitmap()) return clear();
 	}
 	auto t = Timer(true);
+	Frame_Tracer::Begin();
 	for (auto& a : Screens){
+		PROFILE_ZONE("capture");
 		a.Image = CaptureDesktop(DesktopDC.get(), CaptureDC.get(), CaptureBmp.get(), a.MonitorInfo.Offsetx, a.MonitorInfo.Offsety, a.MonitorInfo.Width, a.MonitorInfo.Height);
 		//t.Stop();
 		//DEBUG_MSG("1) Time to Update %", t.Elapsed_milli());
 		//t.Start();
 	}
 	//t.Stop();
+	Frame_Tracer::Mark(Frame_Tracer::STAGE_CAPTURE);
 
 	if (changed && OnResolutionChanged){
 		for (auto& a : Screens) OnResolutionChanged(a);
@@ -147,7 +152,9 @@ void RemoteDesktop::VirtualScreen::Update(){
 		auto m = std::min(Screens.size(), Previous.size());
 		//t.Start();
 		for (auto i = 0; i < m; i++){
+			if (i > 0) Frame_Tracer::Begin();//each monitor is sent as its own frame
 			auto rect = Image::Difference(*Previous[i].Image, *Screens[i].Image);
+			Frame_Tracer::Mark(Frame_Tracer::STAGE_DIFF);
 	/*		t.Stop();
 			DEBUG_MSG("2) Time to Update %", t.Elapsed_milli());
 			t.Start();
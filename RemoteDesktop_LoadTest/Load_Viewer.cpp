@@ -0,0 +1,146 @@
+#include "stdafx.h"
+#include "Load_Viewer.h"
+#include "..\RemoteDesktop_Library\Network_Client.h"
+#include "..\RemoteDesktop_Library\SocketHandler.h"
+#include "..\RemoteDesktop_Library\UserInfo.h"
+#include "..\RemoteDesktop_Library\Image.h"
+#include <cmath>
+
+#define LOAD_CIRCLE_STEPS 64 //mouse positions per lap
+#define LOAD_CIRCLE_RADIUS 100
+#define LOAD_CONNECT_ATTEMPTS 3 //a viewer that cannot connect after this many tries counts as a failure
+
+RemoteDesktop::Load_Viewer::Load_Viewer(const Load_Options& options, int index) : _Options(options), _Index(index){
+	_InputSent = 0;
+	_Width = 0;
+	_Height = 0;
+	ConnectMicroseconds = FirstFrameMicroseconds = 0;
+	Messages = Bytes = Updates = InputsSent = 0;
+	ConnectFailures = Disconnects = Rejected = Malformed = 0;
+}
+RemoteDesktop::Load_Viewer::~Load_Viewer(){
+	Stop();
+}
+long long RemoteDesktop::Load_Viewer::_Now() const{
+	return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - _Started).count();
+}
+
+void RemoteDesktop::Load_Viewer::Start(){
+	_Client = std::make_unique<Network_Client>();
+	_Client->OnKeysSent = std::bind(&RemoteDesktop::Load_Viewer::_OnKeysSent, this, std::placeholders::_1);
+	_Client->OnConnected = std::bind(&RemoteDesktop::Load_Viewer::_OnConnected, this, std::placeholders::_1);
+	_Client->OnReceived = std::bind(&RemoteDesktop::Load_Viewer::_OnReceived, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3);
+	_Client->OnDisconnect = std::bind(&RemoteDesktop::Load_Viewer::_OnDisconnect, this, std::placeholders::_1);
+	_Client->Set_RetryAttempts(LOAD_CONNECT_ATTEMPTS + 1);//Network_Client stops once the counter reaches the limit, so one more than the attempts wanted
+	_Started = Clock::now();
+	_Client->Start(_Options.Port, _Options.Host, _Options.Dst_Id, _Options.Aes_Key);
+}
+void RemoteDesktop::Load_Viewer::Stop(){
+	if (_Client) _Client->Stop(true);
+	_Client.reset();
+}
+
+void RemoteDesktop::Load_Viewer::_OnKeysSent(std::shared_ptr<SocketHandler>& sh){
+	auto info = GetUserInfo();
+	NetworkMsg msg;
+	msg.push_back(info);
+	_Requested = sh->Send_Early(NetworkMessages::CONNECT_REQUEST, msg) == Network_Return::COMPLETED;
+}
+void RemoteDesktop::Load_Viewer::_OnConnected(std::shared_ptr<SocketHandler>& sh){
+	//this fires after Exchange_Keys completed, so it includes the key agreement
+	ConnectMicroseconds = _Now();
+	_Socket = sh;
+	if (_Requested) return;
+	auto info = GetUserInfo();
+	NetworkMsg msg;
+	msg.push_back(info);
+	sh->Send(NetworkMessages::CONNECT_REQUEST, msg);
+}
+void RemoteDesktop::Load_Viewer::_OnDisconnect(std::shared_ptr<SocketHandler>& sh){
+	if (sh) Disconnects += 1;
+	else ConnectFailures += 1;//Network_Client gave up
+	_Socket.reset();
+	_InputSent = 0;
+}
+void RemoteDesktop::Load_Viewer::_OnReceived(Packet_Header* header, const char* data, std::shared_ptr<SocketHandler>& sh){
+	Messages += 1;
+	Bytes += header->PayloadLen;
+	switch (header->Packet_Type){
+	case (NetworkMessages::RESOLUTIONCHANGE) :
+	{
+		New_Image_Header h;
+		if (header->PayloadLen < (int)sizeof(h)){
+			Malformed += 1;
+			break;
+		}
+		memcpy(&h, data, sizeof(h));
+		if (FirstFrameMicroseconds == 0) FirstFrameMicroseconds = _Now();
+		if (h.Index == 0){
+			_Width = h.Width;
+			_Height = h.Height;
+		}
+		if (_Options.Decode) _Decode(h.Width, h.Height, data + sizeof(h), header->PayloadLen - sizeof(h));
+		break;
+	}
+	case (NetworkMessages::UPDATEREGION) :
+	{
+		Update_Image_Header h;
+		if (header->PayloadLen < (int)sizeof(h)){
+			Malformed += 1;
+			break;
+		}
+		memcpy(&h, data, sizeof(h));
+		Updates += 1;
+		auto sent = _InputSent.exchange(0);
+		if (sent > 0) InputLatency.Record(_Now() - sent);
+		if (_Options.Decode) _Decode(h.rect.width, h.rect.height, data + sizeof(h), header->PayloadLen - sizeof(h));
+		break;
+	}
+	case (NetworkMessages::CONNECT_REQUEST_FAILED) :
+		Rejected += 1;
+		break;
+	default:
+		break;
+	}
+}
+void RemoteDesktop::Load_Viewer::_Decode(int width, int height, const char* data, int len){
+	if (width <= 0 || height <= 0 || len <= 0){
+		Malformed += 1;
+		return;
+	}
+	Timer t(true);
+	Image img(Image::Create_from_Compressed_Data((char*)data, len, height, width));
+	img.Decompress();
+	t.Stop();
+	DecodeTime.Record(t.Elapsed_micro());
+}
+
+void RemoteDesktop::Load_Viewer::Send_Input(){
+	auto sh = _Socket.lock();
+	//the server ignores input until it accepted the connection, the first frame is the sign that happened
+	if (!sh || FirstFrameMicroseconds == 0 || _Options.Input == LOAD_INPUT_NONE) return;
+	NetworkMsg msg;
+	if (_Options.Input == LOAD_INPUT_MOUSE){
+		MouseEvent_Header h = {};
+		auto angle = (_InputStep++ % LOAD_CIRCLE_STEPS) * 6.2831853 / LOAD_CIRCLE_STEPS;
+		auto w = _Width > 0 ? _Width.load() : 800;
+		auto hgt = _Height > 0 ? _Height.load() : 600;
+		h.Action = WM_MOUSEMOVE;
+		h.pos.left = w / 2 + (int)(cos(angle) * LOAD_CIRCLE_RADIUS);
+		h.pos.top = hgt / 2 + (int)(sin(angle) * LOAD_CIRCLE_RADIUS);
+		msg.push_back(h);
+		long long expected = 0;
+		_InputSent.compare_exchange_strong(expected, _Now());//keep the oldest unanswered input
+		sh->Send(NetworkMessages::MOUSEEVENT, msg);
+	}
+	else {
+		KeyEvent_Header h = {};
+		h.VK = VK_SHIFT;
+		h.down = (_InputStep++ % 2) == 0 ? 0 : -1;
+		msg.push_back(h);
+		long long expected = 0;
+		_InputSent.compare_exchange_strong(expected, _Now());
+		sh->Send(NetworkMessages::KEYEVENT, msg);
+	}
+	InputsSent += 1;
+}
@@ -0,0 +1,67 @@
+#ifndef LOAD_VIEWER123_H
+#define LOAD_VIEWER123_H
+#include <memory>
+#include <atomic>
+#include <string>
+#include <chrono>
+#include "..\RemoteDesktop_Library\CommonNetwork.h"
+#include "..\RemoteDesktop_Library\Histogram.h"
+
+namespace RemoteDesktop{
+	class SocketHandler;
+	class Network_Client;
+
+	enum Load_Input_Types{
+		LOAD_INPUT_NONE,
+		LOAD_INPUT_MOUSE,//mouse moves tracing a small circle
+		LOAD_INPUT_KEYS//shift down and up, does not type anything on the server
+	};
+	struct Load_Options{
+		std::wstring Host, Port;
+		int Dst_Id = -1;//set with Aes_Key to go through the gateway proxy instead of straight to a server
+		std::wstring Aes_Key;
+		Load_Input_Types Input = LOAD_INPUT_MOUSE;
+		bool Decode = false;//decompress every image like a real viewer would
+	};
+
+	//one simulated viewer. It uses the same Network_Client and key exchange as the real viewer, sends CONNECT_REQUEST with its keys when it has a pre-AES key or once connected otherwise, and then counts what the server sends back. It never draws anything
+	class Load_Viewer{
+		typedef std::chrono::high_resolution_clock Clock;
+
+		Load_Options _Options;
+		int _Index;
+		std::unique_ptr<Network_Client> _Client;
+		std::weak_ptr<SocketHandler> _Socket;
+		Clock::time_point _Started;
+		std::atomic<long long> _InputSent;//microseconds since _Started of the oldest input that has not been answered by an update, 0 if none
+		int _InputStep = 0;
+		std::atomic<int> _Width, _Height;//size of the first display, the mouse moves stay inside it
+
+		long long _Now() const;
+		void _OnKeysSent(std::shared_ptr<SocketHandler>& sh);
+		void _OnConnected(std::shared_ptr<SocketHandler>& sh);
+		bool _Requested = false;
+		void _OnReceived(Packet_Header* header, const char* data, std::shared_ptr<SocketHandler>& sh);
+		void _OnDisconnect(std::shared_ptr<SocketHandler>& sh);
+		void _Decode(int width, int height, const char* data, int len);
+
+	public:
+		Load_Viewer(const Load_Options& options, int index);
+		~Load_Viewer();
+
+		void Start();
+		void Stop();
+		//called by the driver at the configured input rate, does nothing until the viewer is connected
+		void Send_Input();
+		bool Is_Connected() const { return !_Socket.expired(); }
+		int get_Index() const { return _Index; }
+
+		std::atomic<long long> ConnectMicroseconds, FirstFrameMicroseconds;
+		std::atomic<long long> Messages, Bytes, Updates, InputsSent;
+		std::atomic<int> ConnectFailures, Disconnects, Rejected, Malformed;
+		Histogram InputLatency;//microseconds from an input to the next UPDATEREGION
+		Histogram DecodeTime;//microseconds per image, only with Load_Options::Decode
+	};
+}
+
+#endif
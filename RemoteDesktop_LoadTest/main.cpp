@@ -0,0 +1,112 @@
+// RemoteDesktop_LoadTest.cpp : opens a number of simulated viewers against a server, or a server behind the gateway, and reports how each of them did
+//
+
+#include "stdafx.h"
+#include "Load_Viewer.h"
+#include "..\RemoteDesktop_Library\Config.h"
+#include "..\RemoteDesktop_Library\NetworkSetup.h"
+#include <thread>
+
+namespace RemoteDesktop{
+	namespace INTERNAL{
+		void Load_Usage(){
+			wprintf(L"RemoteDesktop_LoadTest [-host 127.0.0.1] [-port n] [-viewers 10] [-seconds 30] [-rate 20] [-input mouse|keys|none] [-ramp 100] [-decode] [-id n -key aeskey]\n");
+			wprintf(L"  -rate    inputs per second sent by each viewer\n");
+			wprintf(L"  -ramp    milliseconds between starting viewers\n");
+			wprintf(L"  -decode  decompress every image like the real viewer\n");
+			wprintf(L"  -id -key connect through the gateway to the server with that id\n");
+			wprintf(L"The server will ask to allow the first viewer, the rest use the same name and are let through\n");
+		}
+		long long Load_Percentile(const Histogram& h, double p){
+			return h.get_Count() > 0 ? h.get_Percentile(p) : 0;
+		}
+	}
+}
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+	RemoteDesktop::Load_Options options;
+	options.Host = L"127.0.0.1";
+	options.Port = DefaultPort();
+	int viewers = 10, seconds = 30, rate = 20, ramp = 100;
+
+	for (auto i = 1; i < argc; i++){
+		auto more = i + 1 < argc;
+		if (_wcsicmp(argv[i], L"-host") == 0 && more) options.Host = argv[++i];
+		else if (_wcsicmp(argv[i], L"-port") == 0 && more) options.Port = argv[++i];
+		else if (_wcsicmp(argv[i], L"-viewers") == 0 && more) viewers = _wtoi(argv[++i]);
+		else if (_wcsicmp(argv[i], L"-seconds") == 0 && more) seconds = _wtoi(argv[++i]);
+		else if (_wcsicmp(argv[i], L"-rate") == 0 && more) rate = _wtoi(argv[++i]);
+		else if (_wcsicmp(argv[i], L"-ramp") == 0 && more) ramp = _wtoi(argv[++i]);
+		else if (_wcsicmp(argv[i], L"-id") == 0 && more) options.Dst_Id = _wtoi(argv[++i]);
+		else if (_wcsicmp(argv[i], L"-key") == 0 && more) options.Aes_Key = argv[++i];
+		else if (_wcsicmp(argv[i], L"-decode") == 0) options.Decode = true;
+		else if (_wcsicmp(argv[i], L"-input") == 0 && more){
+			auto type = argv[++i];
+			if (_wcsicmp(type, L"keys") == 0) options.Input = RemoteDesktop::LOAD_INPUT_KEYS;
+			else if (_wcsicmp(type, L"none") == 0) options.Input = RemoteDesktop::LOAD_INPUT_NONE;
+			else options.Input = RemoteDesktop::LOAD_INPUT_MOUSE;
+		}
+		else {
+			RemoteDesktop::INTERNAL::Load_Usage();
+			return 1;
+		}
+	}
+	if (viewers <= 0 || seconds <= 0 || rate < 0 || (options.Dst_Id >= 0 && options.Aes_Key.empty())){
+		RemoteDesktop::INTERNAL::Load_Usage();
+		return 1;
+	}
+	if (!RemoteDesktop::StartupNetwork()) return 1;
+	wprintf(L"Starting %d viewers against %s:%s for %d seconds\n", viewers, options.Host.c_str(), options.Port.c_str(), seconds);
+
+	std::vector<std::unique_ptr<RemoteDesktop::Load_Viewer>> clients;
+	for (auto i = 0; i < viewers; i++){
+		clients.emplace_back(std::make_unique<RemoteDesktop::Load_Viewer>(options, i));
+		clients.back()->Start();
+		if (ramp > 0) std::this_thread::sleep_for(std::chrono::milliseconds(ramp));
+	}
+
+	//one thread drives the input for everyone, at these rates the sends are cheap compared to the sleep
+	auto interval = rate > 0 ? std::chrono::microseconds(1000000 / rate) : std::chrono::microseconds(1000000);
+	auto start = std::chrono::high_resolution_clock::now();
+	auto end = start + std::chrono::seconds(seconds);
+	auto next = start;
+	while (std::chrono::high_resolution_clock::now() < end){
+		if (rate > 0){
+			for (auto& a : clients) a->Send_Input();
+		}
+		next += interval;
+		std::this_thread::sleep_until(next);
+	}
+	for (auto& a : clients) a->Stop();
+	auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start).count() / 1000.0;
+
+	wprintf(L"viewer connect_ms first_frame_ms messages updates KB/s inputs latency_p50_ms latency_p99_ms decode_p50_ms connect_failed disconnects rejected malformed\n");
+	long long totalbytes = 0, totalmessages = 0, totalupdates = 0;
+	int connected = 0, failures = 0;
+	for (auto& a : clients){
+		totalbytes += a->Bytes;
+		totalmessages += a->Messages;
+		totalupdates += a->Updates;
+		if (a->ConnectMicroseconds > 0) connected += 1;
+		failures += a->ConnectFailures + a->Disconnects + a->Rejected + a->Malformed;
+		wprintf(L"%d %.1f %.1f %lld %lld %.1f %lld %.2f %.2f %.2f %d %d %d %d\n",
+			a->get_Index(),
+			a->ConnectMicroseconds / 1000.0,
+			a->FirstFrameMicroseconds / 1000.0,
+			a->Messages.load(),
+			a->Updates.load(),
+			a->Bytes / 1024.0 / elapsed,
+			a->InputsSent.load(),
+			RemoteDesktop::INTERNAL::Load_Percentile(a->InputLatency, 50.0) / 1000.0,
+			RemoteDesktop::INTERNAL::Load_Percentile(a->InputLatency, 99.0) / 1000.0,
+			RemoteDesktop::INTERNAL::Load_Percentile(a->DecodeTime, 50.0) / 1000.0,
+			a->ConnectFailures.load(),
+			a->Disconnects.load(),
+			a->Rejected.load(),
+			a->Malformed.load());
+	}
+	wprintf(L"connected %d of %d, %lld messages, %lld updates, %.1f KB/s total, %d failures\n", connected, viewers, totalmessages, totalupdates, totalbytes / 1024.0 / elapsed, failures);
+	RemoteDesktop::ShutDownNetwork();
+	return failures > 0 ? 2 : 0;
+}